@@ -0,0 +1,221 @@
+#!/usr/bin/env python
+#
+# Measure cluster rendering on one machine. This starts N local fyre
+# servers (fyre -r), puts a proxy in front of each one that adds a fixed
+# latency and bandwidth limit to the link, then renders through all of
+# them with a batch-mode fyre master using -c. Each node's totals come
+# from the master's cluster summary, and are printed along with the
+# overall merged iteration rate.
+#
+# Usage:
+#   cluster-benchmark.py [options]
+#
+#   --nodes N           Number of servers to start (default 4)
+#   --latency MS        Round trip time added to each link (default 0)
+#   --bandwidth KB      Bandwidth of each link in kilobytes/sec, in each
+#                       direction (default unlimited)
+#   --quality Q         Quality to render to (default 20)
+#   --seed N            Job seed for the cluster (default 1)
+#   --params FILE       Parameter file for the render (default dense.params)
+#   --port N            First port to use; servers and proxies use N and up
+#   --shared-memory     Let nodes push through shared memory. That skips
+#                       the shaped links, so it's off by default.
+#   --fyre PATH         The fyre binary to test
+#
+# The shaping is deterministic: every chunk of data is held for half the
+# round trip time, plus however long the link takes to carry it at the
+# given bandwidth after everything queued before it.
+#
+
+import os, sys, re, time, socket, threading, getopt, tempfile, shutil, subprocess
+try:
+    import queue
+except ImportError:
+    import Queue as queue
+
+here = os.path.dirname(os.path.abspath(__file__))
+CHUNK_SIZE = 16384
+
+
+class ShapedLink:
+    """One direction of a proxied connection"""
+    def __init__(self, source, dest, latency, bandwidth, filter=None):
+        self.source = source
+        self.dest = dest
+        self.latency = latency
+        self.bandwidth = bandwidth
+        self.filter = filter
+        self.queue = queue.Queue()
+        self.link_free = 0
+        for target in (self.read, self.write):
+            thread = threading.Thread(target=target)
+            thread.setDaemon(True)
+            thread.start()
+
+    def read(self):
+        partial = b""
+        while 1:
+            try:
+                data = self.source.recv(CHUNK_SIZE)
+            except socket.error:
+                data = b""
+            if not data:
+                self.queue.put(None)
+                return
+
+            if self.filter:
+                # Filters work on whole lines
+                lines = (partial + data).split(b"\n")
+                partial = lines.pop()
+                data = b"".join([self.filter(line) + b"\n" for line in lines])
+                if not data:
+                    continue
+
+            now = time.time()
+            if self.bandwidth:
+                self.link_free = max(self.link_free, now) + len(data) / float(self.bandwidth)
+            else:
+                self.link_free = now
+            self.queue.put((self.link_free + self.latency, data))
+
+    def write(self):
+        while 1:
+            item = self.queue.get()
+            if item is None:
+                break
+            deliver, data = item
+            delay = deliver - time.time()
+            if delay > 0:
+                time.sleep(delay)
+            try:
+                self.dest.sendall(data)
+            except socket.error:
+                break
+        try:
+            self.dest.shutdown(socket.SHUT_WR)
+        except socket.error:
+            pass
+
+
+class ShapingProxy:
+    """Accepts connections on listen_port and shapes them on their way to target_port"""
+    def __init__(self, listen_port, target_port, latency, bandwidth, shared_memory):
+        self.target_port = target_port
+        self.latency = latency
+        self.bandwidth = bandwidth
+        self.shared_memory = shared_memory
+        self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.listener.bind(("127.0.0.1", listen_port))
+        self.listener.listen(5)
+        thread = threading.Thread(target=self.accept)
+        thread.setDaemon(True)
+        thread.start()
+
+    def filter_command(self, line):
+        # Loopback clients ask for shared memory, which would bypass us
+        if not self.shared_memory and line.strip() == b"share_memory 1":
+            return b"share_memory 0"
+        return line
+
+    def accept(self):
+        while 1:
+            client, address = self.listener.accept()
+            server = socket.create_connection(("127.0.0.1", self.target_port))
+            for sock in (client, server):
+                sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            ShapedLink(client, server, self.latency / 2, self.bandwidth, self.filter_command)
+            ShapedLink(server, client, self.latency / 2, self.bandwidth)
+
+
+def wait_for_port(port, timeout=10.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port)).close()
+            return
+        except socket.error:
+            time.sleep(0.1)
+    raise RuntimeError("Server on port %d didn't start" % port)
+
+
+def main():
+    opts, args = getopt.getopt(sys.argv[1:], "", [
+        "nodes=", "latency=", "bandwidth=", "quality=", "seed=",
+        "params=", "port=", "shared-memory", "fyre="])
+    opts = dict(opts)
+
+    nodes = int(opts.get("--nodes", 4))
+    latency = float(opts.get("--latency", 0)) / 1000.0
+    bandwidth = float(opts.get("--bandwidth", 0)) * 1024
+    quality = opts.get("--quality", "20")
+    seed = opts.get("--seed", "1")
+    params = opts.get("--params", os.path.join(here, "dense.params"))
+    base_port = int(opts.get("--port", 7940))
+    fyre = opts.get("--fyre")
+    if not fyre:
+        fyre = os.path.join(here, "..", "..", "src", "fyre")
+        if not os.path.exists(fyre):
+            fyre = "fyre"
+
+    workdir = tempfile.mkdtemp(prefix="fyre-cluster-")
+    servers = []
+    hosts = []
+    try:
+        for i in range(nodes):
+            server_port = base_port + i
+            proxy_port = base_port + nodes + i
+            # Stay in the foreground so we can stop them, and keep them
+            # out of discovery so nothing else finds them
+            servers.append(subprocess.Popen([fyre, "-r", "-v", "--hidden", "-P", str(server_port)],
+                                            stdout=open(os.devnull, "w"),
+                                            stderr=subprocess.STDOUT))
+            wait_for_port(server_port)
+            ShapingProxy(proxy_port, server_port, latency, bandwidth, "--shared-memory" in opts)
+            hosts.append("127.0.0.1:%d" % proxy_port)
+
+        master = subprocess.Popen([fyre, "-c", ",".join(hosts), "--seed", seed, "-q", quality,
+                                   "-p", open(params).read(),
+                                   "-o", os.path.join(workdir, "cluster.png")],
+                                  stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        log = master.communicate()[0].decode("latin-1")
+        if master.returncode != 0:
+            raise RuntimeError("Master failed with status %d:\n%s" % (master.returncode, log))
+    finally:
+        for server in servers:
+            server.terminate()
+            server.wait()
+        shutil.rmtree(workdir)
+
+    finished = re.search(r"Finished with quality ([0-9.]+) after ([0-9.e+]+) iterations in ([0-9.]+) seconds", log)
+    if not finished:
+        raise RuntimeError("No summary from the master:\n%s" % log)
+    total_iterations = float(finished.group(2))
+    seconds = float(finished.group(3))
+
+    print("# node\titerations\tbytes\tbytes_per_iteration\tmerge_seconds\tstale_drops\trtt_ms")
+    totals = {"iterations": 0.0, "bytes": 0.0, "merge_seconds": 0.0, "stale_drops": 0}
+    for match in re.finditer(r"^node (\S+) iterations=(\S+) bytes=(\S+) merge_seconds=(\S+) "
+                             r"stale_drops=(\S+) rtt=(\S+)$", log, re.M):
+        host, iterations, bytes, merge_seconds, stale_drops, rtt = match.groups()
+        iterations, bytes = float(iterations), float(bytes)
+        totals["iterations"] += iterations
+        totals["bytes"] += bytes
+        totals["merge_seconds"] += float(merge_seconds)
+        totals["stale_drops"] += int(stale_drops)
+        print("%s\t%.0f\t%.0f\t%.4f\t%s\t%s\t%.1f" % (
+            host, iterations, bytes, bytes / max(iterations, 1),
+            merge_seconds, stale_drops, float(rtt) * 1000))
+
+    print("# nodes\tlatency_ms\tbandwidth_kb\tseconds\tmerged_iters_per_sec\tbytes_per_iteration"
+          "\tmerge_seconds\tstale_drops\tlocal_iterations")
+    print("%d\t%.1f\t%.0f\t%.2f\t%.6e\t%.4f\t%.6f\t%d\t%.0f" % (
+        nodes, latency * 1000, bandwidth / 1024, seconds,
+        totals["iterations"] / max(seconds, 1e-6),
+        totals["bytes"] / max(totals["iterations"], 1),
+        totals["merge_seconds"], totals["stale_drops"],
+        total_iterations - totals["iterations"]))
+
+
+if __name__ == "__main__":
+    main()
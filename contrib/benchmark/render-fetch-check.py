@@ -0,0 +1,142 @@
+#!/usr/bin/env python
+#
+# Check that whole renders submitted to a fyre server come back intact.
+# This starts a local fyre server (fyre -r), submits a histogram render
+# with render_submit that is big enough to span several export chunks,
+# fetches the result with render_fetch, and loads it back with
+# fyre --merge. The merge has to succeed and report the same number of
+# iterations the server rendered.
+#
+# Usage:
+#   render-fetch-check.py [options]
+#
+#   --size WxH          Size of the render (default 2048x2048)
+#   --oversample N      Oversampling for the render (default 2)
+#   --quality Q         Quality to render to (default 1)
+#   --params FILE       Parameter file for the render (default dense.params)
+#   --port N            Port for the server (default 7950)
+#   --fyre PATH         The fyre binary to test
+#
+# The fetched histogram must be larger than one megabyte, so it can't
+# have been exported in a single piece. If it isn't, raise the size.
+#
+
+import os, sys, re, time, socket, getopt, tempfile, shutil, subprocess
+
+here = os.path.dirname(os.path.abspath(__file__))
+MIN_RESULT_SIZE = 1024 * 1024
+
+
+def wait_for_port(port, timeout=10.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port)).close()
+            return
+        except socket.error:
+            time.sleep(0.1)
+    raise RuntimeError("Server on port %d didn't start" % port)
+
+
+class Connection:
+    """Just enough of the remote control protocol for render_submit"""
+    def __init__(self, port):
+        self.socket = socket.create_connection(("127.0.0.1", port))
+        self.file = self.socket.makefile("rwb")
+        code, message = self.read_response()
+        if code != 220:
+            raise RuntimeError("Unexpected greeting: %d %s" % (code, message))
+
+    def read_response(self):
+        line = self.file.readline().decode("latin-1").strip()
+        code, message = line.split(" ", 1)
+        return int(code), message
+
+    def query(self, command):
+        self.file.write(command.encode("latin-1") + b"\n")
+        self.file.flush()
+        code, message = self.read_response()
+        if code == 380:
+            # The length is the first token, the data follows the response
+            return code, message, self.file.read(int(message.split()[0]))
+        if code < 200 or code >= 300:
+            raise RuntimeError("%d %s (in response to %r)" % (code, message, command))
+        return code, message, None
+
+
+def escape(line):
+    return line.replace("\\", "\\\\").replace("\t", "\\t")
+
+
+def main():
+    opts, args = getopt.getopt(sys.argv[1:], "", [
+        "size=", "oversample=", "quality=", "params=", "port=", "fyre="])
+    opts = dict(opts)
+
+    width, height = opts.get("--size", "2048x2048").split("x")
+    oversample = opts.get("--oversample", "2")
+    quality = opts.get("--quality", "1")
+    params = opts.get("--params", os.path.join(here, "dense.params"))
+    port = int(opts.get("--port", 7950))
+    fyre = opts.get("--fyre")
+    if not fyre:
+        fyre = os.path.join(here, "..", "..", "src", "fyre")
+        if not os.path.exists(fyre):
+            fyre = "fyre"
+
+    pairs = [line.strip() for line in open(params) if line.strip()]
+    pairs = [p for p in pairs if not re.match(r"(width|height|oversample)\s*=", p)]
+    pairs += ["width = %s" % width, "height = %s" % height, "oversample = %s" % oversample]
+
+    workdir = tempfile.mkdtemp(prefix="fyre-render-")
+    server = subprocess.Popen([fyre, "-r", "-v", "--hidden", "-P", str(port)],
+                              stdout=open(os.devnull, "w"),
+                              stderr=subprocess.STDOUT)
+    try:
+        wait_for_port(port)
+        conn = Connection(port)
+
+        message = conn.query("render_submit %s histogram %s" % (
+            quality, "\t".join(map(escape, pairs))))[1]
+        render = re.search(r"render=(\d+)", message).group(1)
+
+        while 1:
+            message = conn.query("render_status %s" % render)[1]
+            state = re.search(r"state=(\S+)", message).group(1)
+            if state == "failed":
+                raise RuntimeError("Render failed: %s" % message)
+            if state == "done":
+                break
+            time.sleep(0.5)
+        iterations = float(re.search(r"iterations=(\S+)", message).group(1))
+
+        code, message, data = conn.query("render_fetch %s" % render)
+        if code != 380:
+            raise RuntimeError("render_fetch failed: %d %s" % (code, message))
+        if len(data) <= MIN_RESULT_SIZE:
+            raise RuntimeError("Result is only %d bytes, use a larger --size" % len(data))
+
+        dump = os.path.join(workdir, "render.histogram")
+        open(dump, "wb").write(data)
+        merge = subprocess.Popen([fyre, "--merge", dump, "-o", os.path.join(workdir, "render.png")],
+                                 stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        log = merge.communicate()[0].decode("latin-1")
+        if merge.returncode != 0:
+            raise RuntimeError("Merge failed with status %d:\n%s" % (merge.returncode, log))
+
+        merged = re.search(r"Merged 1 histograms, ([0-9.e+]+) iterations", log)
+        if not merged:
+            raise RuntimeError("No summary from the merge:\n%s" % log)
+        if abs(float(merged.group(1)) - iterations) > iterations * 1e-3:
+            raise RuntimeError("Server rendered %.3e iterations, but the merge found %s" % (
+                iterations, merged.group(1)))
+    finally:
+        server.terminate()
+        server.wait()
+        shutil.rmtree(workdir)
+
+    print("ok: %d byte histogram, %.3e iterations" % (len(data), iterations))
+
+
+if __name__ == "__main__":
+    main()
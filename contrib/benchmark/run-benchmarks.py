@@ -0,0 +1,158 @@
+#!/usr/bin/env python
+#
+# Render the benchmark corpus listed in corpus.txt, and report how long
+# each case took, how many iterations it needed to reach its target
+# quality, the peak memory use of the fyre process, and a checksum of
+# a fixed-iteration render. Results are printed as tab-separated lines,
+# so the output of one run can be saved and given to --compare on a
+# later one to catch changes in the rendered images.
+#
+# Usage:
+#   run-benchmarks.py [--fyre PATH] [--keep DIR] [--compare FILE] [case ...]
+#
+# Peak memory comes from wait4(), so this only runs on POSIX systems.
+#
+
+import os, sys, re, time, getopt, tempfile, shutil
+try:
+    from hashlib import md5
+except ImportError:
+    from md5 import md5
+
+here = os.path.dirname(os.path.abspath(__file__))
+columns = ("name", "seconds", "iterations", "quality", "peak_rss_kb", "md5")
+
+
+def read_corpus(path):
+    """Returns a list of (name, input, seed, quality, iterations) tuples.
+       Iterations is None for cases that aren't checksummed.
+       """
+    cases = []
+    for line in open(path):
+        line = line.split("#")[0].split()
+        if not line:
+            continue
+        name, input, seed, quality, iterations = line
+        if iterations == "-":
+            iterations = None
+        cases.append((name, os.path.join(here, input), seed, quality, iterations))
+    return cases
+
+
+def run_fyre(args):
+    """Run fyre to completion, returning its output and peak RSS in kilobytes"""
+    r, w = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        os.close(r)
+        os.dup2(w, 1)
+        os.dup2(w, 2)
+        try:
+            os.execvp(args[0], args)
+        finally:
+            os._exit(127)
+    os.close(w)
+
+    output = []
+    while 1:
+        data = os.read(r, 65536)
+        if not data:
+            break
+        output.append(data.decode("latin-1"))
+    os.close(r)
+
+    pid, status, rusage = os.wait4(pid, 0)
+    output = "".join(output)
+    if status != 0:
+        raise RuntimeError("%r failed with status %d:\n%s" % (args, status, output))
+    return output, rusage.ru_maxrss
+
+
+def input_args(input):
+    if input.endswith(".fa"):
+        return ["-n", input]
+    return ["-p", open(input).read()]
+
+
+def run_case(fyre, workdir, case):
+    name, input, seed, quality, iterations = case
+    animated = input.endswith(".fa")
+    output = os.path.join(workdir, name + (animated and ".avi" or ".png"))
+
+    # The timed render, to the target quality
+    start = time.time()
+    log, rss = run_fyre([fyre, "--seed", seed, "-q", quality, "-o", output] + input_args(input))
+    seconds = time.time() - start
+
+    finished = re.search(r"Finished with quality ([0-9.]+) after ([0-9.e+]+) iterations", log)
+    if finished:
+        reached, count = finished.group(1), "%.0f" % float(finished.group(2))
+    else:
+        reached, count = "-", "-"
+
+    # The reproducible render, for the checksum
+    checksum = "-"
+    if iterations:
+        check = os.path.join(workdir, name + (animated and "-check.avi" or "-check.png"))
+        run_fyre([fyre, "--seed", seed, "--iterations", iterations, "-o", check] + input_args(input))
+        checksum = md5(open(check, "rb").read()).hexdigest()
+
+    return (name, "%.2f" % seconds, count, reached, str(rss), checksum)
+
+
+def read_results(path):
+    results = {}
+    for line in open(path):
+        if line.startswith("#"):
+            continue
+        fields = line.rstrip("\n").split("\t")
+        results[fields[0]] = dict(zip(columns, fields))
+    return results
+
+
+def main():
+    opts, names = getopt.getopt(sys.argv[1:], "", ["fyre=", "keep=", "compare="])
+    opts = dict(opts)
+
+    fyre = opts.get("--fyre")
+    if not fyre:
+        fyre = os.path.join(here, "..", "..", "src", "fyre")
+        if not os.path.exists(fyre):
+            fyre = "fyre"
+
+    reference = None
+    if "--compare" in opts:
+        reference = read_results(opts["--compare"])
+
+    workdir = opts.get("--keep") or tempfile.mkdtemp(prefix="fyre-benchmark-")
+    if not os.path.isdir(workdir):
+        os.makedirs(workdir)
+
+    cases = read_corpus(os.path.join(here, "corpus.txt"))
+    if names:
+        cases = [case for case in cases if case[0] in names]
+
+    print("# " + "\t".join(columns))
+    sys.stdout.flush()
+    mismatches = 0
+    try:
+        for case in cases:
+            result = run_case(fyre, workdir, case)
+            print("\t".join(result))
+            sys.stdout.flush()
+
+            if reference and case[0] in reference:
+                expected = reference[case[0]]["md5"]
+                if result[-1] != "-" and expected != "-" and result[-1] != expected:
+                    sys.stderr.write("%s: checksum changed from %s\n" % (case[0], expected))
+                    mismatches += 1
+    finally:
+        if "--keep" not in opts:
+            shutil.rmtree(workdir)
+
+    if mismatches:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,336 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * animation-batch-render.c - Deadline-driven animation rendering with no GUI
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include "animation-batch-render.h"
+#include "avi-writer.h"
+#include "de-jong.h"
+
+/* The scheduler works on a simple model: for a fixed frame, our quality
+ * metric grows roughly linearly with the number of iterations, and hence
+ * with calculation time. Each frame starts with a short probe that measures
+ * its convergence rate, in quality units per second. Frames are written to
+ * the AVI stream in order so we can never go back and improve one, but we
+ * can choose how far to take the current frame.
+ *
+ * With no deadline, every frame is simply rendered to the target quality.
+ * With a deadline, we try to give every frame the same quality, since that
+ * spends the remaining time where it helps the most. Future frames are
+ * assumed to converge at the smoothed rate of the frames seen so far, so the
+ * quality we can afford for all remaining frames is:
+ *
+ *    q = remaining_time / (1/current_rate + (frames_left-1) / average_rate)
+ *
+ * This is recomputed after every calculation step, so frames that turn out
+ * to be faster or slower than predicted are corrected for as we go.
+ */
+
+#define FRAME_RATE          24
+#define STEP_TIME           0.5   /* Seconds between quality updates within a frame */
+#define MIN_STEP_TIME       0.01
+#define PROBE_TIME          0.1   /* Seconds spent measuring a new frame's convergence rate */
+#define RATE_SMOOTHING      0.3   /* Weight of the newest frame in the average rate */
+#define ITERATION_BLOCK     1000000 /* Iterations per step with a fixed count per frame */
+
+typedef struct {
+    IterativeMap*  map;
+    double         quality;
+    double         iterations;
+    double         time_budget;
+    double         frame_budget;
+
+    guint          frame_count;
+    guint          total_frames;
+
+    GTimer*        total_timer;
+    GTimer*        frame_timer;
+
+    /* Smoothed estimates from previously completed frames */
+    double         average_rate;
+    double         average_overhead;
+    double         quality_sum;
+    double         quality_min;
+} AnimationBatchRender;
+
+static double     schedule_target_quality     (AnimationBatchRender*  self,
+					       double                 remaining_time,
+					       double                 rate);
+static double     estimate_remaining_time     (AnimationBatchRender*  self,
+					       double                 current_quality,
+					       double                 target_quality,
+					       double                 rate);
+static void       render_frame                (AnimationBatchRender*  self,
+					       ParameterHolderPair*   frame);
+static void       render_frame_iterations     (AnimationBatchRender*  self,
+					       ParameterHolderPair*   frame);
+static void       print_duration              (double                 seconds);
+
+
+void animation_batch_render(IterativeMap*  map,
+			    Animation*     animation,
+			    const char*    filename,
+			    double         quality,
+			    double         iterations,
+			    double         time_budget,
+			    double         frame_budget)
+{
+    AnimationBatchRender self;
+    AnimationIter iter;
+    ParameterHolderPair frame;
+    GTimer *overhead_timer;
+    double elapsed;
+
+    AviWriter *avi = avi_writer_new(fopen(filename, "wb"),
+				    HISTOGRAM_IMAGER(map)->width,
+				    HISTOGRAM_IMAGER(map)->height,
+				    FRAME_RATE);
+
+    self.map = map;
+    self.quality = quality;
+    self.iterations = iterations;
+    self.time_budget = time_budget;
+    self.frame_budget = frame_budget;
+    self.frame_count = 0;
+    self.total_frames = MAX(1, (guint) (animation_get_length(animation) * FRAME_RATE));
+    self.average_rate = 0;
+    self.average_overhead = 0;
+    self.quality_sum = 0;
+    self.quality_min = G_MAXDOUBLE;
+    self.total_timer = g_timer_new();
+    self.frame_timer = g_timer_new();
+    overhead_timer = g_timer_new();
+
+    animation_iter_get_first(animation, &iter);
+    frame.a = PARAMETER_HOLDER(de_jong_new());
+    frame.b = PARAMETER_HOLDER(de_jong_new());
+
+    g_timer_start(self.total_timer);
+    while (animation_iter_read_frame(animation, &iter, &frame, FRAME_RATE)) {
+
+	if (self.iterations > 0)
+	    render_frame_iterations(&self, &frame);
+	else
+	    render_frame(&self, &frame);
+
+	/* Image generation and encoding aren't part of the calculation
+	 * time, but they still count against the deadline. Track them
+	 * separately so the scheduler can reserve time for them.
+	 */
+	g_timer_start(overhead_timer);
+	histogram_imager_update_image(HISTOGRAM_IMAGER(map));
+	avi_writer_append_frame(avi, HISTOGRAM_IMAGER(map)->image);
+	elapsed = g_timer_elapsed(overhead_timer, NULL);
+
+	if (self.frame_count == 0)
+	    self.average_overhead = elapsed;
+	else
+	    self.average_overhead += RATE_SMOOTHING * (elapsed - self.average_overhead);
+
+	/* Move to the next line for each frame.
+	 * Updates within a frame overwrite that line.
+	 */
+	printf("\n");
+
+	self.frame_count++;
+    }
+
+    avi_writer_close(avi);
+
+    if (self.frame_count > 0) {
+	printf("%d frames in ", self.frame_count);
+	print_duration(g_timer_elapsed(self.total_timer, NULL));
+	printf(", average quality %.04f, minimum %.04f\n",
+	       self.quality_sum / self.frame_count, self.quality_min);
+    }
+
+    g_object_unref(frame.a);
+    g_object_unref(frame.b);
+    g_timer_destroy(self.total_timer);
+    g_timer_destroy(self.frame_timer);
+    g_timer_destroy(overhead_timer);
+}
+
+static void       render_frame                (AnimationBatchRender*  self,
+					       ParameterHolderPair*   frame)
+{
+    guint frames_left = MAX(1, self->total_frames - MIN(self->frame_count, self->total_frames));
+    double remaining_time = 0;
+    double frame_elapsed, step, rate;
+    double current_quality = 0;
+    double target_quality = self->quality;
+    gboolean continuation = FALSE;
+
+    /* Time left for calculation, after reserving enough for the image
+     * generation that still needs to happen on every remaining frame.
+     */
+    if (self->time_budget > 0)
+	remaining_time = self->time_budget - g_timer_elapsed(self->total_timer, NULL)
+	    - self->average_overhead * frames_left;
+
+    /* The probe is kept short compared to this frame's share of the
+     * remaining time, so even tight deadlines leave room to schedule.
+     */
+    step = PROBE_TIME;
+    if (self->time_budget > 0)
+	step = MIN(step, remaining_time / frames_left / 4);
+    if (self->frame_budget > 0)
+	step = MIN(step, self->frame_budget / 4);
+    step = MAX(step, MIN_STEP_TIME);
+
+    g_timer_start(self->frame_timer);
+    while (1) {
+	iterative_map_calculate_motion_timed(self->map, step, continuation,
+					     PARAMETER_INTERPOLATOR(parameter_holder_interpolate_linear),
+					     frame);
+	continuation = TRUE;
+
+	current_quality = histogram_imager_compute_quality(HISTOGRAM_IMAGER(self->map));
+	frame_elapsed = g_timer_elapsed(self->frame_timer, NULL);
+	rate = current_quality / MAX(frame_elapsed, 1e-6);
+
+	if (self->time_budget > 0)
+	    target_quality = MIN(self->quality, schedule_target_quality(self, remaining_time, rate));
+
+	printf("\rFrame %d/%d, %e iterations, %.04f / %.04f quality, ",
+	       self->frame_count + 1, self->total_frames,
+	       self->map->iterations, current_quality, target_quality);
+	print_duration(estimate_remaining_time(self, current_quality, target_quality, rate));
+	printf(" remaining  ");
+	fflush(stdout);
+
+	if (current_quality >= target_quality)
+	    break;
+	if (self->frame_budget > 0 && frame_elapsed >= self->frame_budget)
+	    break;
+
+	/* Take the next step no further than our estimate of where
+	 * this frame will reach its target.
+	 */
+	step = STEP_TIME;
+	if (rate > 0)
+	    step = MIN(step, (target_quality - current_quality) / rate);
+	if (self->frame_budget > 0)
+	    step = MIN(step, self->frame_budget - frame_elapsed);
+	step = MAX(step, MIN_STEP_TIME);
+    }
+
+    /* Fold this frame's final convergence rate into the running average */
+    if (self->frame_count == 0 || self->average_rate <= 0)
+	self->average_rate = rate;
+    else
+	self->average_rate += RATE_SMOOTHING * (rate - self->average_rate);
+
+    self->quality_sum += current_quality;
+    self->quality_min = MIN(self->quality_min, current_quality);
+}
+
+static void       render_frame_iterations     (AnimationBatchRender*  self,
+					       ParameterHolderPair*   frame)
+{
+    /* Calculate a fixed number of iterations for this frame, in steps
+     * whose size never depends on how fast the machine is. Each step is
+     * split ten ways for motion blur, so anything smaller is left out.
+     */
+    double remaining = self->iterations;
+    gboolean continuation = FALSE;
+    double current_quality;
+    guint block;
+
+    while (remaining >= 10) {
+	block = (guint) MIN(remaining, ITERATION_BLOCK);
+	iterative_map_calculate_motion(self->map, block, continuation,
+				       PARAMETER_INTERPOLATOR(parameter_holder_interpolate_linear),
+				       frame);
+	continuation = TRUE;
+	remaining -= block;
+    }
+
+    current_quality = histogram_imager_compute_quality(HISTOGRAM_IMAGER(self->map));
+    printf("\rFrame %d/%d, %e iterations, %.04f quality  ",
+	   self->frame_count + 1, self->total_frames,
+	   self->map->iterations, current_quality);
+    fflush(stdout);
+
+    self->quality_sum += current_quality;
+    self->quality_min = MIN(self->quality_min, current_quality);
+}
+
+static double     schedule_target_quality     (AnimationBatchRender*  self,
+					       double                 remaining_time,
+					       double                 rate)
+{
+    /* The uniform quality we can afford for this frame and all following
+     * ones, given the time remaining when this frame started.
+     */
+    guint frames_left = MAX(1, self->total_frames - MIN(self->frame_count, self->total_frames));
+    double future_rate = self->average_rate > 0 ? self->average_rate : rate;
+    double cost_per_quality;
+
+    if (remaining_time <= 0 || rate <= 0)
+	return 0;
+
+    cost_per_quality = 1/rate + (frames_left - 1) / future_rate;
+    return remaining_time / cost_per_quality;
+}
+
+static double     estimate_remaining_time     (AnimationBatchRender*  self,
+					       double                 current_quality,
+					       double                 target_quality,
+					       double                 rate)
+{
+    /* Estimate total time until the animation is finished, including
+     * image generation. Later frames are predicted to reach the same
+     * quality as this one, at the average rate seen so far.
+     */
+    guint frames_after = self->total_frames - MIN(self->frame_count + 1, self->total_frames);
+    double future_rate = self->average_rate > 0 ? self->average_rate : rate;
+    double current_frame = 0, future_frames = 0;
+    double estimate;
+
+    if (rate > 0 && target_quality > current_quality)
+	current_frame = (target_quality - current_quality) / rate;
+    if (future_rate > 0)
+	future_frames = frames_after * target_quality / future_rate;
+
+    if (self->frame_budget > 0) {
+	current_frame = MIN(current_frame,
+			    MAX(0, self->frame_budget - g_timer_elapsed(self->frame_timer, NULL)));
+	future_frames = MIN(future_frames, frames_after * self->frame_budget);
+    }
+
+    estimate = current_frame + future_frames + self->average_overhead * (frames_after + 1);
+
+    if (self->time_budget > 0)
+	estimate = MIN(estimate, MAX(0, self->time_budget - g_timer_elapsed(self->total_timer, NULL)));
+
+    return estimate;
+}
+
+static void       print_duration              (double                 seconds)
+{
+    int s = (int) seconds;
+    printf("%02d:%02d:%02d", s / (60*60), (s / 60) % 60, s % 60);
+}
+
+/* The End */
@@ -0,0 +1,50 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * animation-batch-render.h - Deadline-driven animation rendering with no GUI
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "iterative-map.h"
+#include "animation.h"
+
+#ifndef __ANIMATION_BATCH_RENDER_H__
+#define __ANIMATION_BATCH_RENDER_H__
+
+/* Render an animation to an AVI file. Each frame is rendered until it
+ * reaches 'quality'. If time_budget is nonzero, it gives a total wall-clock
+ * deadline in seconds for the whole animation, and the quality target is
+ * lowered as necessary to meet it. If frame_budget is nonzero, no single
+ * frame is given more than that many seconds of calculation time.
+ *
+ * If iterations is nonzero, every frame gets that many iterations instead,
+ * regardless of quality or budgets, so a seeded render comes out the same
+ * every time.
+ */
+void animation_batch_render(IterativeMap*  map,
+			    Animation*     animation,
+			    const char*    output_filename,
+			    double         quality,
+			    double         iterations,
+			    double         time_budget,
+			    double         frame_budget);
+
+#endif /* __ANIMATION_BATCH_RENDER_H__ */
+
+/* The End */
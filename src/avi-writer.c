@@ -23,6 +23,7 @@
  */
 
 #include "avi-writer.h"
+#include "trace.h"
 #include <string.h>
 
 static void avi_writer_class_init           (AviWriterClass *klass);
@@ -156,6 +157,7 @@ void avi_writer_append_frame (AviWriter *self, const GdkPixbuf *frame) {
 
     g_assert(width == self->width);
     g_assert(height == self->height);
+    trace_begin("avi_frame");
 
     /* Start an uncompressed video frame */
     avi_writer_push_chunk(self, "00db");
@@ -187,6 +189,7 @@ void avi_writer_append_frame (AviWriter *self, const GdkPixbuf *frame) {
 
     avi_writer_pop_chunk_with_index(self, AVIIF_KEYFRAME);
     self->frame_count++;
+    trace_end("avi_frame");
 }
 
 void avi_writer_close (AviWriter *self) {
@@ -30,6 +30,8 @@
 #include "cluster-model.h"
 #endif
 
+#define ITERATION_BLOCK  1000000
+
 typedef struct {
     double      quality;
     GMainLoop*  main_loop;
@@ -38,12 +40,38 @@ typedef struct {
 
 static void       on_calc_finished            (IterativeMap*      map,
 					       BatchImageRender*  self);
+static void       print_summary               (IterativeMap*      map);
+static double     compute_quality             (IterativeMap*      map);
+
+#ifdef HAVE_GNET
+static gboolean   poll_cluster                (gpointer           user_data);
+#endif
 
 void batch_image_render(IterativeMap*  map,
 			const char*    filename,
 			double         quality)
+{
+#ifdef HAVE_GNET
+    {
+	/* If the image is partitioned, nodes can keep their bands
+	 * until we save it. Nothing else here needs the histogram.
+	 */
+	ClusterModel *cluster = cluster_model_get(map, FALSE);
+	if (cluster) {
+	    cluster_model_set_keep_bands(cluster, TRUE);
+	    g_object_unref(cluster);
+	}
+    }
+#endif
+    batch_image_calculate(map, quality);
+    batch_image_save(map, filename);
+}
+
+void batch_image_calculate(IterativeMap*  map,
+			   double         quality)
 {
     BatchImageRender self;
+    gboolean keep_bands = FALSE;
 
 #ifdef HAVE_GNET
     {
@@ -51,6 +79,7 @@ void batch_image_render(IterativeMap*  map,
 	if (cluster) {
 	    /* Stream in new results very infrequently, since this is batch rendering */
 	    cluster_model_set_min_stream_interval(cluster, 10.0);
+	    keep_bands = cluster_model_get_keep_bands(cluster);
 	    g_object_unref(cluster);
 	}
     }
@@ -67,12 +96,81 @@ void batch_image_render(IterativeMap*  map,
      * get cranky, but high enough that it still gets most of our CPU time
      */
     map->render_time = 0.1;
-    iterative_map_start_calculation(map);
-    g_main_loop_run(self.main_loop);
-    iterative_map_stop_calculation(map);
+#ifdef HAVE_GNET
+    if (keep_bands) {
+	/* The master has no histogram to calculate into, only the nodes
+	 * work. Polling them stands in for our own calculation steps.
+	 */
+	guint timer = g_timeout_add((guint) (map->render_time * 1000), poll_cluster, map);
+	g_signal_emit_by_name(map, "calculation-start");
+	g_main_loop_run(self.main_loop);
+	g_signal_emit_by_name(map, "calculation-stop");
+	g_source_remove(timer);
+    }
+    else
+#endif
+    {
+	iterative_map_start_calculation(map);
+	g_main_loop_run(self.main_loop);
+	iterative_map_stop_calculation(map);
+    }
 
     g_timer_destroy(self.status_timer);
+    g_signal_handlers_disconnect_by_func(map, G_CALLBACK(on_calc_finished), &self);
+    print_summary(map);
 
+#ifdef HAVE_GNET
+    {
+	ClusterModel *cluster = cluster_model_get(map, FALSE);
+	if (cluster) {
+	    cluster_model_show_totals(cluster);
+	    g_object_unref(cluster);
+	}
+    }
+#endif
+}
+
+void batch_image_calculate_iterations(IterativeMap*  map,
+				      double         iterations)
+{
+    while (iterations > 0) {
+	guint block = (guint) MIN(iterations, ITERATION_BLOCK);
+	iterative_map_calculate(map, block);
+	iterations -= block;
+    }
+    print_summary(map);
+}
+
+void batch_image_save(IterativeMap*  map,
+		      const char*    filename)
+{
+#ifdef HAVE_GNET
+    ClusterModel *cluster = cluster_model_get(map, FALSE);
+    if (cluster) {
+	gboolean keep_bands = cluster_model_get_keep_bands(cluster);
+	GdkPixbuf *image = NULL;
+
+	/* Kept bands are only ever assembled as an image */
+	if (keep_bands && strlen(filename) > 4 && strcmp(".exr", filename + strlen(filename) - 4)==0)
+	    g_print ("Error: OpenEXR output needs the whole histogram, which partitioned renders never hold\n");
+	else if (keep_bands)
+	    image = cluster_model_collect_bands(cluster);
+	g_object_unref(cluster);
+
+	if (image) {
+	    GError *error = NULL;
+	    printf("Creating PNG image one band at a time...\n");
+	    histogram_imager_save_image_pixbuf(HISTOGRAM_IMAGER(map), image, filename, &error);
+	    if (error) {
+		g_print ("Error: %s\n", error->message);
+		g_error_free (error);
+	    }
+	    gdk_pixbuf_unref(image);
+	}
+	if (keep_bands)
+	    return;
+    }
+#endif
 #ifdef HAVE_EXR
     /* Save as an OpenEXR file if it has a .exr extension, otherwise use PNG */
     if (strlen(filename) > 4 && strcmp(".exr", filename + strlen(filename) - 4)==0) {
@@ -98,11 +196,43 @@ void batch_image_render(IterativeMap*  map,
 }
 
 
+static double     compute_quality             (IterativeMap*       map)
+{
+#ifdef HAVE_GNET
+    /* When nodes keep their bands, we never see the histogram */
+    ClusterModel *cluster = cluster_model_get(map, FALSE);
+    if (cluster) {
+	gboolean keep_bands = cluster_model_get_keep_bands(cluster);
+	double quality = cluster_model_get_band_quality(cluster);
+	g_object_unref(cluster);
+	if (keep_bands)
+	    return quality;
+    }
+#endif
+    return histogram_imager_compute_quality(HISTOGRAM_IMAGER(map));
+}
+
+#ifdef HAVE_GNET
+static gboolean   poll_cluster                (gpointer            user_data)
+{
+    g_signal_emit_by_name(user_data, "calculation-finished");
+    return TRUE;
+}
+#endif
+
+static void       print_summary               (IterativeMap*       map)
+{
+    /* One line for scripts that want to know what the render took */
+    printf("Finished with quality %.04f after %.6e iterations in %.02f seconds\n",
+	   compute_quality(map), map->iterations,
+	   histogram_imager_get_elapsed_time(HISTOGRAM_IMAGER(map)));
+}
+
 static void       on_calc_finished            (IterativeMap*       map,
 					       BatchImageRender*   self)
 {
     double elapsed, remaining;
-    double current_quality = histogram_imager_compute_quality(HISTOGRAM_IMAGER(map));
+    double current_quality = compute_quality(map);
 
     if (current_quality >= self->quality)
 	g_main_loop_quit(self->main_loop);
@@ -30,6 +30,23 @@ void batch_image_render(IterativeMap*  map,
 			const char*    output_filename,
 			double         quality);
 
+/* The two halves of batch_image_render(): calculate until the map reaches
+ * 'quality', and save its image as OpenEXR if the name ends in .exr,
+ * otherwise as PNG.
+ */
+void batch_image_calculate(IterativeMap*  map,
+			   double         quality);
+void batch_image_save(IterativeMap*  map,
+		      const char*    output_filename);
+
+/* Calculate exactly 'iterations' more iterations, in blocks of a fixed
+ * size. The blur and oversampling tables are drawn from the random
+ * stream once per block, so unlike calculating to a quality, this gives
+ * the same histogram every time for the same seed.
+ */
+void batch_image_calculate_iterations(IterativeMap*  map,
+				      double         iterations);
+
 #endif /* __BATCH_IMAGE_RENDER_H__ */
 
 /* The End */
@@ -0,0 +1,381 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * benchmark.c - Timed, seeded microbenchmarks of the rendering hot paths
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include "benchmark.h"
+#include "de-jong.h"
+#include "histogram-stream.h"
+#include "avi-writer.h"
+#include "math-util.h"
+
+/* Each benchmark is timed with an operation count that doubles, or
+ * grows by our best guess, until one run takes at least MIN_TIME. Only
+ * that last run is reported, so the first calls that warm up caches and
+ * allocate buffers don't count.
+ */
+#define MIN_TIME            1.0
+#define MAX_GROWTH          16.0
+
+/* Histograms are filled with this many iterations before we time
+ * anything that works on a whole histogram.
+ */
+#define FILL_ITERATIONS     2000000
+#define STREAM_BUFFER_SIZE  (1024 * 1024)
+
+typedef void (BenchmarkFunc) (gpointer data, guint ops);
+
+typedef struct {
+    HistogramImager*       source;
+    HistogramImager*       dest;
+    HistogramStreamFormat  format;
+    guchar*                buffer;
+} StreamBenchmark;
+
+typedef struct {
+    HistogramImager*  imager;
+    const gchar*      extension;
+} SaveBenchmark;
+
+typedef struct {
+    AviWriter*        avi;
+    const GdkPixbuf*  frame;
+} AviBenchmark;
+
+/* Installed on our thread while benchmarks run, so each one can
+ * restart it from the seed no matter what has drawn from it before.
+ */
+static GRand*     benchmark_random = NULL;
+
+static void       benchmark_measure           (const gchar*     name,
+					       BenchmarkFunc*   func,
+					       gpointer         data,
+					       guint            initial_ops);
+static IterativeMap* benchmark_new_map        (guint32          seed);
+
+static void       benchmark_kernel            (guint32          seed);
+static void       benchmark_imager            (guint32          seed);
+static void       benchmark_streams           (guint32          seed);
+static void       benchmark_output            (guint32          seed);
+
+static void       run_calculate               (gpointer         data,
+					       guint            ops);
+static void       run_update_image            (gpointer         data,
+					       guint            ops);
+static void       run_compute_quality         (gpointer         data,
+					       guint            ops);
+static void       run_stream_roundtrip        (gpointer         data,
+					       guint            ops);
+static void       run_save_image              (gpointer         data,
+					       guint            ops);
+static void       run_avi_append              (gpointer         data,
+					       guint            ops);
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+void benchmark_run(guint32 seed)
+{
+    GRand* previous_random;
+
+    printf("# fyre %s benchmark, seed %u\n", VERSION, seed);
+    printf("# name\tops\tseconds\tops_per_sec\tns_per_op\n");
+    fflush(stdout);
+
+    benchmark_random = g_rand_new_with_seed(seed);
+    previous_random = math_set_thread_random(benchmark_random);
+
+    benchmark_kernel(seed);
+    benchmark_imager(seed);
+    benchmark_streams(seed);
+    benchmark_output(seed);
+
+    math_set_thread_random(previous_random);
+    g_rand_free(benchmark_random);
+    benchmark_random = NULL;
+}
+
+
+/************************************************************************************/
+/********************************************************************** Benchmarks **/
+/************************************************************************************/
+
+static void       benchmark_kernel            (guint32          seed)
+{
+    /* Every combination of the options that take different paths
+     * through de_jong_calculate(), on the default map.
+     */
+    int variant;
+
+    for (variant=0; variant<16; variant++) {
+	gboolean tileable = (variant & 1) != 0;
+	gboolean transform = (variant & 2) != 0;
+	gboolean blur = (variant & 4) != 0;
+	gboolean transient = (variant & 8) != 0;
+	IterativeMap* map = benchmark_new_map(seed);
+	gchar* name;
+
+	g_object_set(map,
+		     "tileable", tileable,
+		     "zoom", transform ? 2.5 : 1.0,
+		     "rotation", transform ? 0.7 : 0.0,
+		     "blur_radius", blur ? 0.02 : 0.0,
+		     "emphasize_transient", transient,
+		     NULL);
+
+	name = g_strdup_printf("calculate%s%s%s%s",
+			       tileable ? "-tileable" : "",
+			       transform ? "-transform" : "",
+			       blur ? "-blur" : "",
+			       transient ? "-transient" : "");
+	benchmark_measure(name, run_calculate, map, 100000);
+	g_free(name);
+	g_object_unref(map);
+    }
+}
+
+static void       benchmark_imager            (guint32          seed)
+{
+    guint oversample;
+
+    for (oversample=1; oversample<=4; oversample++) {
+	IterativeMap* map = benchmark_new_map(seed);
+	gchar* name;
+
+	g_object_set(map, "oversample", oversample, NULL);
+	iterative_map_calculate(map, FILL_ITERATIONS);
+
+	name = g_strdup_printf("update_image-oversample%u", oversample);
+	benchmark_measure(name, run_update_image, map, 1);
+	g_free(name);
+
+	name = g_strdup_printf("compute_quality-oversample%u", oversample);
+	benchmark_measure(name, run_compute_quality, map, 1);
+	g_free(name);
+
+	g_object_unref(map);
+    }
+}
+
+static void       benchmark_streams           (guint32          seed)
+{
+    /* Histograms are bounced between two imagers, exporting all of
+     * one and merging it into the other each time.
+     */
+    static const HistogramStreamFormat formats[] = {
+	HISTOGRAM_STREAM_RLE,
+	HISTOGRAM_STREAM_DELTA_ZLIB,
+    };
+    int i;
+
+    for (i=0; i<G_N_ELEMENTS(formats); i++) {
+	StreamBenchmark bench;
+	IterativeMap* map;
+	gchar* name;
+
+	if (!histogram_stream_format_supported(formats[i]))
+	    continue;
+
+	map = benchmark_new_map(seed);
+	iterative_map_calculate(map, FILL_ITERATIONS);
+
+	bench.source = HISTOGRAM_IMAGER(map);
+	bench.dest = HISTOGRAM_IMAGER(benchmark_new_map(seed));
+	bench.format = formats[i];
+	bench.buffer = g_malloc(STREAM_BUFFER_SIZE);
+
+	name = g_strdup_printf("stream-%s-roundtrip", histogram_stream_format_name(formats[i]));
+	benchmark_measure(name, run_stream_roundtrip, &bench, 1);
+	g_free(name);
+
+	g_free(bench.buffer);
+	g_object_unref(bench.source);
+	g_object_unref(bench.dest);
+    }
+}
+
+static void       benchmark_output            (guint32          seed)
+{
+    IterativeMap* map = benchmark_new_map(seed);
+    SaveBenchmark save;
+    AviBenchmark avi;
+    FILE* avi_file;
+    gchar* name;
+    gchar* path;
+
+    iterative_map_calculate(map, FILL_ITERATIONS);
+    histogram_imager_update_image(HISTOGRAM_IMAGER(map));
+    save.imager = HISTOGRAM_IMAGER(map);
+
+    save.extension = "png";
+    benchmark_measure("save-png", run_save_image, &save, 1);
+
+#ifdef HAVE_EXR
+    save.extension = "exr";
+    benchmark_measure("save-exr", run_save_image, &save, 1);
+#endif
+
+    /* One AVI file collects every frame we append while timing */
+    name = g_strdup_printf("fyre-benchmark-%08x.avi", g_random_int());
+    path = g_build_filename(g_get_tmp_dir(), name, NULL);
+    avi_file = fopen(path, "wb");
+    if (avi_file) {
+	avi.avi = avi_writer_new(avi_file, save.imager->width, save.imager->height, 24);
+	avi.frame = save.imager->image;
+	benchmark_measure("avi-append", run_avi_append, &avi, 1);
+	avi_writer_close(avi.avi);
+	g_object_unref(avi.avi);
+	remove(path);
+    }
+    else {
+	printf("# Error: Can't open %s\n", path);
+    }
+    g_free(path);
+    g_free(name);
+
+    g_object_unref(map);
+}
+
+
+/************************************************************************************/
+/************************************************************************* Helpers **/
+/************************************************************************************/
+
+static void       benchmark_measure           (const gchar*     name,
+					       BenchmarkFunc*   func,
+					       gpointer         data,
+					       guint            initial_ops)
+{
+    GTimer* timer = g_timer_new();
+    double ops = initial_ops;
+    double elapsed;
+
+    while (1) {
+	g_timer_start(timer);
+	func(data, (guint) ops);
+	elapsed = g_timer_elapsed(timer, NULL);
+
+	if (elapsed >= MIN_TIME || ops * 2 > G_MAXUINT)
+	    break;
+
+	/* Aim a little past MIN_TIME, so we usually need just one more run */
+	if (elapsed > 0)
+	    ops *= CLAMP(MIN_TIME * 1.2 / elapsed, 2.0, MAX_GROWTH);
+	else
+	    ops *= MAX_GROWTH;
+	ops = MIN(ops, G_MAXUINT);
+    }
+
+    printf("%s\t%u\t%.6f\t%.6e\t%.3f\n", name, (guint) ops, elapsed,
+	   ops / elapsed, elapsed * 1e9 / ops);
+    fflush(stdout);
+    g_timer_destroy(timer);
+}
+
+static IterativeMap* benchmark_new_map        (guint32          seed)
+{
+    /* Every benchmark starts from the default parameters and
+     * the same random stream, so runs are comparable. Reseeding the
+     * global generator alone wouldn't restart our thread's stream.
+     */
+    math_seed(seed);
+    g_rand_set_seed(benchmark_random, seed);
+    return ITERATIVE_MAP(de_jong_new());
+}
+
+static void       run_calculate               (gpointer         data,
+					       guint            ops)
+{
+    iterative_map_calculate(ITERATIVE_MAP(data), ops);
+}
+
+static void       run_update_image            (gpointer         data,
+					       guint            ops)
+{
+    while (ops--)
+	histogram_imager_update_image(HISTOGRAM_IMAGER(data));
+}
+
+static void       run_compute_quality         (gpointer         data,
+					       guint            ops)
+{
+    while (ops--)
+	histogram_imager_compute_quality(HISTOGRAM_IMAGER(data));
+}
+
+static void       run_stream_roundtrip        (gpointer         data,
+					       guint            ops)
+{
+    StreamBenchmark* self = (StreamBenchmark*) data;
+    HistogramImager* swap;
+    gsize size;
+
+    while (ops--) {
+	while ((size = histogram_stream_export(self->source, self->format,
+					       self->buffer, STREAM_BUFFER_SIZE)))
+	    histogram_stream_merge(self->dest, self->format, self->buffer, size);
+
+	swap = self->source;
+	self->source = self->dest;
+	self->dest = swap;
+    }
+}
+
+static void       run_save_image              (gpointer         data,
+					       guint            ops)
+{
+    SaveBenchmark* self = (SaveBenchmark*) data;
+    gchar* name = g_strdup_printf("fyre-benchmark-%08x.%s", g_random_int(), self->extension);
+    gchar* path = g_build_filename(g_get_tmp_dir(), name, NULL);
+    GError* error = NULL;
+
+    while (ops-- && !error) {
+#ifdef HAVE_EXR
+	if (!strcmp(self->extension, "exr"))
+	    exr_save_image_file(self->imager, path, &error);
+	else
+#endif
+	    histogram_imager_save_image_file(self->imager, path, &error);
+    }
+
+    if (error) {
+	printf("# Error: %s\n", error->message);
+	g_error_free(error);
+    }
+    remove(path);
+    g_free(path);
+    g_free(name);
+}
+
+static void       run_avi_append              (gpointer         data,
+					       guint            ops)
+{
+    AviBenchmark* self = (AviBenchmark*) data;
+    while (ops--)
+	avi_writer_append_frame(self->avi, self->frame);
+}
+
+/* The End */
@@ -0,0 +1,40 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * benchmark.h - Timed, seeded microbenchmarks of the rendering hot paths
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include <glib.h>
+
+/* Run each benchmark with the given random seed, and print one line of
+ * results per benchmark to stdout. Lines are tab-separated: the name,
+ * the number of operations, total seconds, operations per second, and
+ * nanoseconds per operation. For the calculation kernel an operation is
+ * one iteration; everywhere else it's one whole image or histogram.
+ * Comment lines start with '#'.
+ */
+void benchmark_run(guint32 seed);
+
+#endif /* __BENCHMARK_H__ */
+
+/* The End */
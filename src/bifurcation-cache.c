@@ -0,0 +1,234 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * bifurcation-cache.c - On-disk cache of converged bifurcation diagrams
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include "platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#endif
+#include "bifurcation-cache.h"
+
+/* Cache files hold a small header followed by the histogram, in the
+ * format produced by histogram_imager_export_stream(). The stream is
+ * stored as a list of length-prefixed chunks, since each chunk starts
+ * over at the beginning of the histogram and must be merged separately.
+ * All integers are little-endian.
+ *
+ *   "FyBc"  version  hist_width  hist_height  { length  data[length] }*
+ */
+#define CACHE_MAGIC         "FyBc"
+#define CACHE_VERSION       1
+#define CACHE_CHUNK_SIZE    (64 * 1024)
+
+static gchar*    bifurcation_cache_dir      (gboolean create);
+static gboolean  write_uint32               (FILE *f, guint32 value);
+static gboolean  read_uint32                (FILE *f, guint32 *value);
+
+
+/************************************************************************************/
+/***************************************************************************** Keys */
+/************************************************************************************/
+
+static void hash_bytes(guint32 *h1, guint32 *h2, const void *data, gsize length) {
+    /* Two independent 32-bit FNV-1a hashes, giving a 64-bit key */
+    const guchar *p = data;
+    while (length--) {
+	*h1 = (*h1 ^ *p) * 16777619;
+	*h2 = (*h2 ^ *p) * 16777619 + 0x9E3779B9;
+	p++;
+    }
+}
+
+gchar* bifurcation_cache_key (const DeJongParams *a,
+			      const DeJongParams *b,
+			      int                 width,
+			      int                 height)
+{
+    guint32 h1 = 2166136261U, h2 = 0x811C9DC5 ^ 0x5BD1E995;
+    guint32 size[2];
+
+    hash_bytes(&h1, &h2, a, sizeof(*a));
+    hash_bytes(&h1, &h2, b, sizeof(*b));
+    size[0] = width;
+    size[1] = height;
+    hash_bytes(&h1, &h2, size, sizeof(size));
+
+    return g_strdup_printf("%08x%08x-%dx%d", h1, h2, width, height);
+}
+
+
+/************************************************************************************/
+/*************************************************************************** Files */
+/************************************************************************************/
+
+static gchar* bifurcation_cache_dir (gboolean create) {
+    gchar *fyre_dir = g_build_filename(g_get_home_dir(), ".fyre", NULL);
+    gchar *cache_dir = g_build_filename(fyre_dir, "bifurcation-cache", NULL);
+
+    if (create) {
+#ifdef WIN32
+	mkdir(fyre_dir);
+	mkdir(cache_dir);
+#else
+	mkdir(fyre_dir, 0755);
+	mkdir(cache_dir, 0755);
+#endif
+    }
+
+    g_free(fyre_dir);
+    return cache_dir;
+}
+
+static gboolean write_uint32 (FILE *f, guint32 value) {
+    value = GUINT32_TO_LE(value);
+    return fwrite(&value, sizeof(value), 1, f) == 1;
+}
+
+static gboolean read_uint32 (FILE *f, guint32 *value) {
+    if (fread(value, sizeof(*value), 1, f) != 1)
+	return FALSE;
+    *value = GUINT32_FROM_LE(*value);
+    return TRUE;
+}
+
+gboolean bifurcation_cache_load (HistogramImager *imager,
+				 const gchar     *key)
+{
+    gchar *dir = bifurcation_cache_dir(FALSE);
+    gchar *filename = g_build_filename(dir, key, NULL);
+    FILE *f = fopen(filename, "rb");
+    char magic[4];
+    guint32 version, width, height, length;
+    int hist_width, hist_height;
+    GSList *chunks = NULL, *i;
+    gboolean success = FALSE;
+
+    g_free(dir);
+    g_free(filename);
+    if (!f)
+	return FALSE;
+
+    histogram_imager_get_hist_size(imager, &hist_width, &hist_height);
+
+    if (fread(magic, sizeof(magic), 1, f) == 1 &&
+	!memcmp(magic, CACHE_MAGIC, sizeof(magic)) &&
+	read_uint32(f, &version) && version == CACHE_VERSION &&
+	read_uint32(f, &width) && width == hist_width &&
+	read_uint32(f, &height) && height == hist_height) {
+
+	/* Read every chunk before merging any of them, so a
+	 * truncated file never leaves a partial histogram behind.
+	 */
+	success = TRUE;
+	while (read_uint32(f, &length)) {
+	    GByteArray *chunk = g_byte_array_new();
+	    g_byte_array_set_size(chunk, length);
+	    chunks = g_slist_prepend(chunks, chunk);
+
+	    if (length > CACHE_CHUNK_SIZE || fread(chunk->data, 1, length, f) != length) {
+		success = FALSE;
+		break;
+	    }
+	}
+	chunks = g_slist_reverse(chunks);
+    }
+    fclose(f);
+
+    for (i=chunks; i; i=i->next) {
+	GByteArray *chunk = (GByteArray*) i->data;
+	if (success)
+	    histogram_imager_merge_stream(imager, chunk->data, chunk->len);
+	g_byte_array_free(chunk, TRUE);
+    }
+    g_slist_free(chunks);
+
+    return success;
+}
+
+void bifurcation_cache_save (HistogramImager *imager,
+			     const gchar     *key)
+{
+    /* Exporting the histogram empties it, so we hold on to every chunk
+     * we write and merge them all back afterwards. Merging counts every
+     * point again, so the original totals are restored at the end.
+     */
+    gchar *dir = bifurcation_cache_dir(TRUE);
+    gchar *filename = g_build_filename(dir, key, NULL);
+    gchar *temp_filename = g_strconcat(filename, ".tmp", NULL);
+    FILE *f = fopen(temp_filename, "wb");
+    guchar *buffer = g_malloc(CACHE_CHUNK_SIZE);
+    GSList *chunks = NULL, *i;
+    gboolean success = f != NULL;
+    gdouble total_points_plotted = imager->total_points_plotted;
+    int hist_width, hist_height;
+    gsize size;
+
+    histogram_imager_get_hist_size(imager, &hist_width, &hist_height);
+
+    if (f) {
+	success = fwrite(CACHE_MAGIC, 4, 1, f) == 1 &&
+	    write_uint32(f, CACHE_VERSION) &&
+	    write_uint32(f, hist_width) &&
+	    write_uint32(f, hist_height);
+    }
+
+    while ((size = histogram_imager_export_stream(imager, buffer, CACHE_CHUNK_SIZE))) {
+	GByteArray *chunk = g_byte_array_new();
+	g_byte_array_append(chunk, buffer, size);
+	chunks = g_slist_prepend(chunks, chunk);
+
+	if (success)
+	    success = write_uint32(f, size) && fwrite(buffer, 1, size, f) == size;
+    }
+
+    for (i=chunks = g_slist_reverse(chunks); i; i=i->next) {
+	GByteArray *chunk = (GByteArray*) i->data;
+	histogram_imager_merge_stream(imager, chunk->data, chunk->len);
+	g_byte_array_free(chunk, TRUE);
+    }
+    g_slist_free(chunks);
+    imager->total_points_plotted = total_points_plotted;
+
+    if (f) {
+	if (fclose(f) != 0)
+	    success = FALSE;
+	if (success) {
+	    /* Windows won't rename over an existing file */
+	    remove(filename);
+	    success = rename(temp_filename, filename) == 0;
+	}
+	if (!success)
+	    remove(temp_filename);
+    }
+
+    g_free(buffer);
+    g_free(dir);
+    g_free(filename);
+    g_free(temp_filename);
+}
+
+/* The End */
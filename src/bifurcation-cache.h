@@ -0,0 +1,56 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * bifurcation-cache.h - On-disk cache of converged bifurcation diagrams
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __BIFURCATION_CACHE_H__
+#define __BIFURCATION_CACHE_H__
+
+#include "histogram-imager.h"
+#include "de-jong.h"
+
+G_BEGIN_DECLS
+
+/* Diagrams are cached as compressed histograms, so they can be recolored
+ * freely after loading. The key is a hash of the two keyframes' map
+ * parameters and the histogram size; anything else that changes the
+ * calculation must be folded into the key too.
+ */
+gchar*    bifurcation_cache_key   (const DeJongParams *a,
+				   const DeJongParams *b,
+				   int                 width,
+				   int                 height);
+
+/* Merge a cached histogram into 'imager'. Returns FALSE if there is no
+ * valid cache entry for this key and histogram size.
+ */
+gboolean  bifurcation_cache_load  (HistogramImager    *imager,
+				   const gchar        *key);
+
+/* Store the imager's current histogram. The histogram is left intact. */
+void      bifurcation_cache_save  (HistogramImager    *imager,
+				   const gchar        *key);
+
+G_END_DECLS
+
+#endif /* __BIFURCATION_CACHE_H__ */
+
+/* The End */
@@ -28,16 +28,40 @@
 #include <math.h>
 #include "bifurcation-diagram.h"
 #include "math-util.h"
+#include "thread-util.h"
+
+/* Columns are calculated in groups of this many at once, with the
+ * parameters and points for each group stored as separate arrays.
+ * Written this way, the inner loop has no dependencies between lanes,
+ * so the compiler is free to vectorize it.
+ */
+#define BIFURCATION_LANES        4
+
+/* Calculations smaller than this aren't worth starting threads for.
+ * The cell renderer's incremental updates stay well below it.
+ */
+#define PARALLEL_THRESHOLD       1000000
+#define MAX_THREADS              64
+
+typedef struct {
+    BifurcationDiagram *self;
+    HistogramPlot       plot;
+    int                 thread_index, num_threads;
+    int                 first_column, num_visits;
+    guint               iterations_total, iterations_per_column;
+} BifurcationWorker;
 
 static void               bifurcation_diagram_class_init        (BifurcationDiagramClass *klass);
 static void               bifurcation_diagram_init              (BifurcationDiagram      *self);
 static void               bifurcation_diagram_dispose           (GObject                 *gobject);
 
 static void               bifurcation_diagram_init_columns      (BifurcationDiagram      *self);
-static BifurcationColumn* bifurcation_diagram_next_column       (BifurcationDiagram      *self);
+static BifurcationColumn* bifurcation_diagram_get_column         (BifurcationDiagram      *self,
+								 int                      index);
 static void               bifurcation_diagram_get_column_params (BifurcationDiagram      *self,
 								 BifurcationColumn       *column,
 								 DeJongParams            *param);
+static gpointer           bifurcation_diagram_worker            (BifurcationWorker       *worker);
 
 static gpointer parent_class = NULL;
 
@@ -202,11 +226,16 @@ static void bifurcation_diagram_init_columns (BifurcationDiagram *self) {
     }
 }
 
-static BifurcationColumn* bifurcation_diagram_next_column (BifurcationDiagram *self) {
-    /* Get the next column, wrapping around when we hit the end */
-    BifurcationColumn *column = &self->columns[self->current_column];
-    if (++self->current_column >= self->num_columns)
-	self->current_column = 0;
+void bifurcation_diagram_reset (BifurcationDiagram *self) {
+    histogram_imager_clear(HISTOGRAM_IMAGER(self));
+    self->calc_dirty_flag = TRUE;
+    bifurcation_diagram_init_columns(self);
+}
+
+static BifurcationColumn* bifurcation_diagram_get_column (BifurcationDiagram *self,
+							  int                 index) {
+    /* Get a column by index, wrapping around when we hit the end */
+    BifurcationColumn *column = &self->columns[index % self->num_columns];
 
     /* Initialize this column's point if it isn't yet */
     if (!column->point.valid) {
@@ -226,16 +255,33 @@ static void bifurcation_diagram_get_column_params (BifurcationDiagram *self,
 				  sizeof(self->columns[0].interpolated[0]));
 
     if (!column->interpolated[interpIndex].valid) {
+	/* Pick a random place within the column to perform the interpolation */
+	double alpha = (column->ix + uniform_variate()) / (self->num_columns - 1);
 
-	/* Create an interpolant if we don't have one yet */
-	if (!self->interpolant)
-	    self->interpolant = de_jong_new();
+	if (self->interp == PARAMETER_INTERPOLATOR(parameter_holder_interpolate_linear)) {
+	    /* Linear interpolation is the common case, and only the four map
+	     * parameters matter here. Interpolate them directly rather than
+	     * going through GObject properties. This is also safe to do from
+	     * several threads at once, which the interpolant isn't.
+	     */
+	    ParameterHolderPair *pair = (ParameterHolderPair*) self->interp_data;
+	    const DeJongParams *a = &DE_JONG(pair->a)->param;
+	    const DeJongParams *b = &DE_JONG(pair->b)->param;
+	    DeJongParams *p = &column->interpolated[interpIndex].param;
+
+	    p->a = a->a * (1-alpha) + b->a * alpha;
+	    p->b = a->b * (1-alpha) + b->b * alpha;
+	    p->c = a->c * (1-alpha) + b->c * alpha;
+	    p->d = a->d * (1-alpha) + b->d * alpha;
+	}
+	else {
+	    /* Create an interpolant if we don't have one yet */
+	    if (!self->interpolant)
+		self->interpolant = de_jong_new();
 
-	/* Pick a random place within the column to perform the interpolation */
-	self->interp(PARAMETER_HOLDER(self->interpolant),
-		     (column->ix + uniform_variate()) / (self->num_columns - 1),
-		     self->interp_data);
-	column->interpolated[interpIndex].param = self->interpolant->param;
+	    self->interp(PARAMETER_HOLDER(self->interpolant), alpha, self->interp_data);
+	    column->interpolated[interpIndex].param = self->interpolant->param;
+	}
 
 	column->interpolated[interpIndex].valid = TRUE;
     }
@@ -251,49 +297,161 @@ static void bifurcation_diagram_get_column_params (BifurcationDiagram *self,
 void bifurcation_diagram_calculate (BifurcationDiagram *self,
 				    guint               iterations_total,
 				    guint               iterations_per_column) {
-    DeJongParams param;
-    BifurcationColumn *column;
+    /* Run the given number of iterations, visiting columns in shuffled order
+     * with up to iterations_per_column at each visit.
+     *
+     * Every column plots only into its own histogram column, so the work
+     * can be split across threads by column without any locking. Thread t
+     * owns the columns whose index is congruent to t modulo the number of
+     * threads, and each thread keeps its own HistogramPlot totals.
+     */
+    BifurcationWorker workers[MAX_THREADS];
+    GThread *threads[MAX_THREADS];
     HistogramPlot plot;
-    int hist_width, hist_height;
-    double x, y, point_x, point_y;
-    int i, col_i, ix, iy;
+    int num_threads, num_visits, t;
 
-    const float y_min = -3;
-    const float y_max = 3;
+    if (!iterations_total || !iterations_per_column)
+	return;
 
     bifurcation_diagram_init_columns(self);
     histogram_imager_prepare_plots(HISTOGRAM_IMAGER(self), &plot);
+
+    num_visits = (iterations_total + iterations_per_column - 1) / iterations_per_column;
+
+    num_threads = 1;
+    if (iterations_total >= PARALLEL_THRESHOLD && g_thread_supported() &&
+	(self->interp == PARAMETER_INTERPOLATOR(parameter_holder_interpolate_linear)))
+	num_threads = CLAMP(thread_util_num_processors(), 1, MIN(MAX_THREADS, self->num_columns));
+
+    for (t=0; t<num_threads; t++) {
+	workers[t].self = self;
+	workers[t].plot = plot;
+	workers[t].thread_index = t;
+	workers[t].num_threads = num_threads;
+	workers[t].first_column = self->current_column;
+	workers[t].num_visits = num_visits;
+	workers[t].iterations_total = iterations_total;
+	workers[t].iterations_per_column = iterations_per_column;
+    }
+
+    /* The calling thread does the first share itself */
+    for (t=1; t<num_threads; t++)
+	threads[t] = g_thread_create((GThreadFunc) bifurcation_diagram_worker, &workers[t], TRUE, NULL);
+    bifurcation_diagram_worker(&workers[0]);
+    for (t=1; t<num_threads; t++)
+	g_thread_join(threads[t]);
+
+    for (t=0; t<num_threads; t++)
+	histogram_imager_finish_plots(HISTOGRAM_IMAGER(self), &workers[t].plot);
+
+    self->current_column = (self->current_column + num_visits) % self->num_columns;
+}
+
+static gpointer bifurcation_diagram_worker (BifurcationWorker *worker) {
+    BifurcationDiagram *self = worker->self;
+    HistogramPlot plot = worker->plot;
+    int hist_width, hist_height;
+    int visit, lane, n_lanes, i, count, iy;
+    guint remaining;
+
+    /* Per-lane state, one column per lane */
+    BifurcationColumn *column[BIFURCATION_LANES];
+    DeJongParams param;
+    double pa[BIFURCATION_LANES], pb[BIFURCATION_LANES];
+    double pc[BIFURCATION_LANES], pd[BIFURCATION_LANES];
+    double px[BIFURCATION_LANES], py[BIFURCATION_LANES];
+    double x[BIFURCATION_LANES], y[BIFURCATION_LANES];
+    guint lane_iterations[BIFURCATION_LANES];
+
+    const double y_min = -3;
+    const double y_max = 3;
+
     histogram_imager_get_hist_size(HISTOGRAM_IMAGER(self), &hist_width, &hist_height);
 
-    for (i=iterations_total; i;) {
+    visit = 0;
+    while (visit < worker->num_visits) {
+
+	/* Gather up to BIFURCATION_LANES visits to columns this thread owns */
+	n_lanes = 0;
+	while (n_lanes < BIFURCATION_LANES && visit < worker->num_visits) {
+	    int index = (worker->first_column + visit) % self->num_columns;
+
+	    if (index % worker->num_threads == worker->thread_index) {
+		/* A column can't occupy two lanes at once. This only
+		 * happens when we wrap around a very narrow diagram.
+		 */
+		for (lane=0; lane<n_lanes; lane++)
+		    if (column[lane] == &self->columns[index])
+			break;
+		if (lane < n_lanes)
+		    break;
+
+		/* Only the final visit can have less than a full column's worth */
+		remaining = worker->iterations_total - visit * worker->iterations_per_column;
+
+		column[n_lanes] = bifurcation_diagram_get_column(self, index);
+		bifurcation_diagram_get_column_params(self, column[n_lanes], &param);
+		pa[n_lanes] = param.a;
+		pb[n_lanes] = param.b;
+		pc[n_lanes] = param.c;
+		pd[n_lanes] = param.d;
+		px[n_lanes] = column[n_lanes]->point.x;
+		py[n_lanes] = column[n_lanes]->point.y;
+		lane_iterations[n_lanes] = MIN(remaining, worker->iterations_per_column);
+		n_lanes++;
+	    }
+	    visit++;
+	}
+	if (!n_lanes)
+	    break;
+
+	/* Idle lanes repeat the first column's work, but never plot */
+	for (lane=n_lanes; lane<BIFURCATION_LANES; lane++) {
+	    pa[lane] = pa[0];
+	    pb[lane] = pb[0];
+	    pc[lane] = pc[0];
+	    pd[lane] = pd[0];
+	    px[lane] = px[0];
+	    py[lane] = py[0];
+	    lane_iterations[lane] = 0;
+	}
 
-	column = bifurcation_diagram_next_column(self);
-	bifurcation_diagram_get_column_params(self, column, &param);
-	ix = column->ix;
-	point_x = column->point.x;
-	point_y = column->point.y;
+	count = 0;
+	for (lane=0; lane<n_lanes; lane++)
+	    count = MAX(count, lane_iterations[lane]);
 
-	for(col_i=iterations_per_column; i && col_i; --i, --col_i) {
-	    /* These are the actual Peter de Jong map equations. The new point value
-	     * gets stored into 'point', then we go on and mess with x and y before plotting.
+	for (i=0; i<count; i++) {
+	    /* These are the actual Peter de Jong map equations, evaluated
+	     * for every lane at once. The new point value gets stored into
+	     * 'point', then we go on and mess with x and y before plotting.
 	     */
-	    x = sin(param.a * point_y) - cos(param.b * point_x);
-	    y = sin(param.c * point_x) - cos(param.d * point_y);
-	    point_x = x;
-	    point_y = y;
-
-	    if (y >= y_min && y < y_max) {
-		iy = (int)( (y - y_min) / (y_max - y_min) * hist_height );
+	    for (lane=0; lane<BIFURCATION_LANES; lane++) {
+		x[lane] = sin(pa[lane] * py[lane]) - cos(pb[lane] * px[lane]);
+		y[lane] = sin(pc[lane] * px[lane]) - cos(pd[lane] * py[lane]);
+		px[lane] = x[lane];
+		py[lane] = y[lane];
+	    }
 
-		HISTOGRAM_IMAGER_PLOT(plot, ix, iy);
+	    for (lane=0; lane<n_lanes; lane++) {
+		if (i < lane_iterations[lane] && y[lane] >= y_min && y[lane] < y_max) {
+		    iy = (int)( (y[lane] - y_min) / (y_max - y_min) * hist_height );
+		    if (((unsigned int)(iy - plot.first_row)) < plot.num_rows)
+			HISTOGRAM_IMAGER_PLOT(plot, column[lane]->ix, iy);
+		}
 	    }
 	}
 
-	column->point.x = point_x;
-	column->point.y = point_y;
+	/* Lanes with fewer iterations kept going without plotting,
+	 * which still leaves them with a perfectly good point to save.
+	 */
+	for (lane=0; lane<n_lanes; lane++) {
+	    column[lane]->point.x = px[lane];
+	    column[lane]->point.y = py[lane];
+	}
     }
 
-    histogram_imager_finish_plots(HISTOGRAM_IMAGER(self), &plot);
+    worker->plot = plot;
+    return NULL;
 }
 
 /* The End */
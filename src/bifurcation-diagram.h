@@ -103,6 +103,12 @@ void                 bifurcation_diagram_calculate            (BifurcationDiagra
 							       guint                  iterations_total,
 							       guint                  iterations_per_column);
 
+/* Clear the histogram and all column state, applying any pending changes
+ * to size or interpolation. Results merged into the histogram after this
+ * are kept by the next bifurcation_diagram_calculate().
+ */
+void                 bifurcation_diagram_reset                (BifurcationDiagram    *self);
+
 /* The most flexible way to set the interpolation, by
  * providing a new function and opaque interpolation data.
  * A free function for the data can also optionally be
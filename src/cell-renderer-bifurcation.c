@@ -24,7 +24,47 @@
 
 #include "cell-renderer-bifurcation.h"
 #include "bifurcation-diagram.h"
+#include "bifurcation-cache.h"
 #include <gtk/gtk.h>
+#include <string.h>
+
+#define TILE_DATA_KEY        "cell-renderer-bifurcation-tile"
+#define SCHEDULER_INTERVAL   30      /* Milliseconds between checks for finished work */
+#define CONVERGED_DENSITY    5       /* Points per cell pixel that count as good enough */
+#define MIN_JOB_ITERATIONS   10000
+
+/* Per-diagram state, attached to each BifurcationDiagram in the animation
+ * model. Settings from the latest render are recorded here, and only
+ * applied to the diagram itself while no worker is using it.
+ */
+typedef struct {
+    CellRendererBifurcation *owner;
+    BifurcationDiagram *bd;
+
+    /* The latest finished image, drawn as-is by the renderer */
+    GdkPixbuf *image;
+    gboolean busy, converged, cache_checked;
+    gchar *cache_key;
+
+    /* Requested settings, and whether they've changed since being applied */
+    DeJong *a, *b;
+    gint width, height;
+    GdkColor fgcolor, bgcolor;
+    gboolean dirty;
+
+    /* Where this row was last drawn, and when */
+    GdkRectangle area;
+    guint last_visible;
+} BifurcationTile;
+
+typedef struct {
+    BifurcationTile *tile;
+    gchar *cache_key;
+    gboolean load_cache;
+    gboolean converged;
+    guint iterations;
+    GdkPixbuf *image;
+} BifurcationJob;
 
 static void cell_renderer_bifurcation_class_init    (CellRendererBifurcationClass *klass);
 static void cell_renderer_bifurcation_init          (CellRendererBifurcation  *self);
@@ -54,7 +94,26 @@ static void cell_renderer_bifurcation_render        (GtkCellRenderer          *c
 						     GdkRectangle             *expose_area,
 						     GtkCellRendererState      flags);
 
-static BifurcationDiagram* get_bifurcation_diagram  (CellRendererBifurcation  *self);
+static BifurcationDiagram* get_bifurcation_diagram  (CellRendererBifurcation  *self,
+						     DeJong                  **a,
+						     DeJong                  **b);
+static BifurcationTile*    get_tile                 (CellRendererBifurcation  *self,
+						     BifurcationDiagram       *bd);
+static void                tile_free                (BifurcationTile          *tile);
+static void                tile_request             (BifurcationTile          *tile,
+						     DeJong                   *a,
+						     DeJong                   *b,
+						     gint                      width,
+						     gint                      height,
+						     GdkColor                 *fgcolor,
+						     GdkColor                 *bgcolor);
+
+static void                scheduler_start          (CellRendererBifurcation  *self);
+static gboolean            scheduler_tick           (CellRendererBifurcation  *self);
+static void                scheduler_collect        (CellRendererBifurcation  *self);
+static gboolean            scheduler_dispatch       (CellRendererBifurcation  *self);
+static void                bifurcation_worker       (BifurcationJob           *job,
+						     CellRendererBifurcation  *self);
 
 enum {
     PROP_0,
@@ -62,11 +121,6 @@ enum {
     PROP_ANIMATION,
 };
 
-typedef struct {
-    GtkTreeView *view;
-    GdkRectangle rect;
-} RedrawInfo;
-
 
 /************************************************************************************/
 /**************************************************** Initialization / Finalization */
@@ -125,6 +179,11 @@ static void cell_renderer_bifurcation_class_init(CellRendererBifurcationClass *k
 }
 
 static void cell_renderer_bifurcation_init(CellRendererBifurcation *self) {
+    /* One background thread is plenty for a handful of small diagrams,
+     * and leaves the rest of the machine for the main rendering.
+     */
+    self->results = g_async_queue_new();
+    self->workers = g_thread_pool_new((GFunc) bifurcation_worker, self, 1, FALSE, NULL);
 }
 
 GtkCellRenderer* cell_renderer_bifurcation_new() {
@@ -133,6 +192,27 @@ GtkCellRenderer* cell_renderer_bifurcation_new() {
 
 static void cell_renderer_bifurcation_finalize(GObject *object) {
     CellRendererBifurcation *self = CELL_RENDERER_BIFURCATION(object);
+    GList *i;
+
+    if (self->scheduler) {
+	g_source_remove(self->scheduler);
+	self->scheduler = 0;
+    }
+
+    /* Wait for the worker, then disown any tiles still in the model.
+     * Another renderer will adopt them if it draws those rows.
+     */
+    if (self->workers) {
+	g_thread_pool_free(self->workers, FALSE, TRUE);
+	self->workers = NULL;
+	scheduler_collect(self);
+	g_async_queue_unref(self->results);
+	self->results = NULL;
+    }
+    for (i=self->tiles; i; i=i->next)
+	((BifurcationTile*) i->data)->owner = NULL;
+    g_list_free(self->tiles);
+    self->tiles = NULL;
 
     if (self->animation) {
 	g_object_unref(self->animation);
@@ -191,14 +271,17 @@ static void cell_renderer_bifurcation_set_property(GObject       *object,
     }
 }
 
-static BifurcationDiagram* get_bifurcation_diagram  (CellRendererBifurcation  *self) {
+static BifurcationDiagram* get_bifurcation_diagram  (CellRendererBifurcation  *self,
+						     DeJong                  **a,
+						     DeJong                  **b) {
     /* Using the current iterator and animation, find the corresponding
-     * bifurcation diagram object, creating and/or updating it if necessary.
+     * bifurcation diagram object, creating it if necessary. The parameters
+     * of both keyframes are returned in new DeJong objects, but not applied
+     * to the diagram, since it may be in use by a worker thread.
      */
     GObject *obj;
     BifurcationDiagram *bd;
     GtkTreeIter keyframe, next_keyframe;
-    DeJong *a, *b;
 
     /* Look up the first keyframe from a row ID */
     if (!animation_keyframe_find_by_id(self->animation, self->row_id, &keyframe))
@@ -228,20 +311,234 @@ static BifurcationDiagram* get_bifurcation_diagram  (CellRendererBifurcation  *s
     }
 
     /* Load parameters from both keyframes */
-    a = de_jong_new();
-    b = de_jong_new();
-    animation_keyframe_load(self->animation, &keyframe, PARAMETER_HOLDER(a));
-    animation_keyframe_load(self->animation, &next_keyframe,  PARAMETER_HOLDER(b));
+    *a = de_jong_new();
+    *b = de_jong_new();
+    animation_keyframe_load(self->animation, &keyframe, PARAMETER_HOLDER(*a));
+    animation_keyframe_load(self->animation, &next_keyframe,  PARAMETER_HOLDER(*b));
 
-    /* Set up this bifurcation diagram for linear interpolation between the two */
-    bifurcation_diagram_set_linear_endpoints(bd, a, b);
-
-    g_object_unref(a);
-    g_object_unref(b);
     return bd;
 }
 
 
+/************************************************************************************/
+/************************************************************************** Tiles */
+/************************************************************************************/
+
+static BifurcationTile* get_tile (CellRendererBifurcation *self,
+				  BifurcationDiagram      *bd) {
+    BifurcationTile *tile = g_object_get_data(G_OBJECT(bd), TILE_DATA_KEY);
+
+    if (!tile) {
+	tile = g_new0(BifurcationTile, 1);
+	tile->bd = bd;
+	g_object_set_data_full(G_OBJECT(bd), TILE_DATA_KEY, tile, (GDestroyNotify) tile_free);
+    }
+
+    if (tile->owner != self) {
+	if (tile->owner)
+	    tile->owner->tiles = g_list_remove(tile->owner->tiles, tile);
+	tile->owner = self;
+	self->tiles = g_list_prepend(self->tiles, tile);
+    }
+    return tile;
+}
+
+static void tile_free (BifurcationTile *tile) {
+    /* Called when the diagram is destroyed. Workers hold a reference
+     * to the diagram, so this never happens while a tile is busy.
+     */
+    if (tile->owner)
+	tile->owner->tiles = g_list_remove(tile->owner->tiles, tile);
+    if (tile->image)
+	gdk_pixbuf_unref(tile->image);
+    if (tile->a)
+	g_object_unref(tile->a);
+    if (tile->b)
+	g_object_unref(tile->b);
+    g_free(tile->cache_key);
+    g_free(tile);
+}
+
+static void tile_request (BifurcationTile *tile,
+			  DeJong          *a,
+			  DeJong          *b,
+			  gint             width,
+			  gint             height,
+			  GdkColor        *fgcolor,
+			  GdkColor        *bgcolor) {
+    /* Record the settings for this tile's next job. Takes ownership of a and b. */
+    if (!tile->a || !tile->b ||
+	memcmp(&tile->a->param, &a->param, sizeof(a->param)) ||
+	memcmp(&tile->b->param, &b->param, sizeof(b->param)) ||
+	tile->width != width || tile->height != height) {
+
+	if (tile->a)
+	    g_object_unref(tile->a);
+	if (tile->b)
+	    g_object_unref(tile->b);
+	tile->a = a;
+	tile->b = b;
+	tile->width = width;
+	tile->height = height;
+	tile->dirty = TRUE;
+    }
+    else {
+	g_object_unref(a);
+	g_object_unref(b);
+    }
+
+    if (!gdk_color_equal(&tile->fgcolor, fgcolor) || !gdk_color_equal(&tile->bgcolor, bgcolor)) {
+	tile->fgcolor = *fgcolor;
+	tile->bgcolor = *bgcolor;
+	tile->dirty = TRUE;
+    }
+}
+
+
+/************************************************************************************/
+/************************************************************************ Scheduler */
+/************************************************************************************/
+
+static void scheduler_start (CellRendererBifurcation *self) {
+    if (!self->job_in_flight)
+	scheduler_dispatch(self);
+    if (!self->scheduler)
+	self->scheduler = g_timeout_add(SCHEDULER_INTERVAL, (GSourceFunc) scheduler_tick, self);
+}
+
+static gboolean scheduler_tick (CellRendererBifurcation *self) {
+    scheduler_collect(self);
+    if (!self->job_in_flight && !scheduler_dispatch(self)) {
+	/* Nothing left to do until the next render */
+	self->scheduler = 0;
+	return FALSE;
+    }
+    return TRUE;
+}
+
+static void scheduler_collect (CellRendererBifurcation *self) {
+    /* Post finished images back to their tiles, and redraw those cells */
+    BifurcationJob *job;
+    BifurcationTile *tile;
+
+    while ((job = g_async_queue_try_pop(self->results))) {
+	tile = job->tile;
+	tile->busy = FALSE;
+	tile->converged = job->converged;
+	self->job_in_flight = FALSE;
+
+	if (job->image) {
+	    if (tile->image)
+		gdk_pixbuf_unref(tile->image);
+	    tile->image = job->image;
+
+	    if (self->tree)
+		gtk_widget_queue_draw_area(GTK_WIDGET(self->tree),
+					   tile->area.x, tile->area.y,
+					   tile->area.width, tile->area.height);
+	}
+
+	g_free(job->cache_key);
+	g_object_unref(tile->bd);
+	g_free(job);
+    }
+}
+
+static gboolean scheduler_dispatch (CellRendererBifurcation *self) {
+    /* Start a job on the most recently drawn tile that has work to do.
+     * Rows only get drawn while visible, so this favours what the user
+     * can actually see. Returns FALSE if there was nothing to do.
+     */
+    BifurcationTile *tile = NULL;
+    BifurcationJob *job;
+    gchar *key;
+    GList *i;
+
+    for (i=self->tiles; i; i=i->next) {
+	BifurcationTile *t = (BifurcationTile*) i->data;
+	if (!t->busy && (t->dirty || !t->converged || !t->image) &&
+	    (!tile || t->last_visible > tile->last_visible))
+	    tile = t;
+    }
+    if (!tile)
+	return FALSE;
+
+    if (tile->dirty) {
+	/* Safe to touch the diagram now. It figures out for itself what,
+	 * if anything, it has to reset.
+	 */
+	g_object_set(tile->bd,
+		     "width",  tile->width,
+		     "height", tile->height,
+		     "fgcolor-gdk", &tile->fgcolor,
+		     "bgcolor-gdk", &tile->bgcolor,
+		     NULL);
+	bifurcation_diagram_set_linear_endpoints(tile->bd, tile->a, tile->b);
+
+	key = bifurcation_cache_key(&tile->a->param, &tile->b->param, tile->width, tile->height);
+	if (!tile->cache_key || strcmp(key, tile->cache_key)) {
+	    g_free(tile->cache_key);
+	    tile->cache_key = key;
+	    tile->converged = FALSE;
+	    tile->cache_checked = FALSE;
+	}
+	else {
+	    g_free(key);
+	}
+	tile->dirty = FALSE;
+    }
+
+    job = g_new0(BifurcationJob, 1);
+    job->tile = tile;
+    job->cache_key = g_strdup(tile->cache_key);
+    job->load_cache = !tile->cache_checked;
+    job->converged = tile->converged;
+    if (!tile->converged)
+	job->iterations = MAX(MIN_JOB_ITERATIONS, tile->width * tile->height);
+
+    tile->cache_checked = TRUE;
+    tile->busy = TRUE;
+    g_object_ref(tile->bd);
+    self->job_in_flight = TRUE;
+    g_thread_pool_push(self->workers, job, NULL);
+    return TRUE;
+}
+
+static void bifurcation_worker (BifurcationJob          *job,
+				CellRendererBifurcation *self) {
+    /* Runs on the worker thread. The tile is busy, so the main
+     * thread leaves its diagram alone until we post the result.
+     */
+    BifurcationDiagram *bd = job->tile->bd;
+    HistogramImager *hi = HISTOGRAM_IMAGER(bd);
+    gdouble converged_points = CONVERGED_DENSITY * (gdouble) hi->width * hi->height;
+
+    if (job->load_cache) {
+	/* Start from scratch, with a converged diagram from disk if there is one */
+	bifurcation_diagram_reset(bd);
+	if (bifurcation_cache_load(hi, job->cache_key) &&
+	    hi->total_points_plotted > converged_points) {
+	    job->converged = TRUE;
+	    job->iterations = 0;
+	}
+    }
+
+    if (job->iterations) {
+	bifurcation_diagram_calculate(bd, job->iterations, 100);
+
+	if (hi->total_points_plotted > converged_points) {
+	    job->converged = TRUE;
+	    bifurcation_cache_save(hi, job->cache_key);
+	}
+    }
+
+    histogram_imager_update_image(hi);
+    job->image = gdk_pixbuf_copy(hi->image);
+
+    g_async_queue_push(self->results, job);
+}
+
+
 /************************************************************************************/
 /********************************************************** GtkCellRenderer Methods */
 /************************************************************************************/
@@ -256,13 +553,6 @@ static void cell_renderer_bifurcation_get_size(GtkCellRenderer  *cell,
     /* We don't bother suggesting a size yet, just use whatever's available */
 }
 
-static gboolean cell_queue_redraw (RedrawInfo *info) {
-    gtk_widget_queue_draw_area (GTK_WIDGET (info->view),
-		                info->rect.x, info->rect.y,
-				info->rect.width, info->rect.height);
-    return FALSE;
-}
-
 static void cell_renderer_bifurcation_render(GtkCellRenderer      *cell,
 					     GdkWindow            *window,
 					     GtkWidget            *widget,
@@ -271,10 +561,12 @@ static void cell_renderer_bifurcation_render(GtkCellRenderer      *cell,
 					     GdkRectangle         *expose_area,
 					     GtkCellRendererState  flags) {
     CellRendererBifurcation *self = CELL_RENDERER_BIFURCATION(cell);
-    BifurcationDiagram *bd = get_bifurcation_diagram(self);
+    BifurcationDiagram *bd;
+    BifurcationTile *tile;
     GtkStateType state;
-    RedrawInfo *nr;
+    DeJong *a, *b;
 
+    bd = get_bifurcation_diagram(self, &a, &b);
     if (!bd)
 	return;
 
@@ -295,45 +587,29 @@ static void cell_renderer_bifurcation_render(GtkCellRenderer      *cell,
 	    state = GTK_STATE_NORMAL;
     }
 
-    /* Set the bifurcation diagram renderer's parameters appropriately for this
-     * cell renderer. It will automatically figure out what if anything it has
-     * to change internally. We size it to fit this cell exactly, and set
-     * the colors appropriately for our state and theme.
+    /* Ask for the diagram to be sized to fit this cell exactly, with
+     * colors appropriate for our state and theme. The worker picks
+     * this up the next time it gets to this row.
      */
-    g_object_set(bd,
-		 "width",  cell_area->width,
-		 "height", cell_area->height,
-		 "fgcolor-gdk", &GTK_WIDGET(widget)->style->fg[state],
-		 "bgcolor-gdk", &GTK_WIDGET(widget)->style->base[state],
-		 NULL);
-
-    /* Assume that 5*(cell area) is good enough) */
-    if(HISTOGRAM_IMAGER(bd)->total_points_plotted > 5 * cell_area->width * cell_area->height) {
-        gdk_draw_pixbuf(window, GTK_WIDGET(widget)->style->fg_gc[state],
-		        HISTOGRAM_IMAGER(bd)->image,
-		        0, 0, cell_area->x, cell_area->y, cell_area->width, cell_area->height,
-		        GDK_RGB_DITHER_NONE, 0, 0);
-
-        return;
-    }
-
-    /* Render it a bit and update the image */
-    bifurcation_diagram_calculate(bd, 10000, 100);
-    histogram_imager_update_image(HISTOGRAM_IMAGER(bd));
-
-    gdk_draw_pixbuf(window, GTK_WIDGET(widget)->style->fg_gc[state],
-		    HISTOGRAM_IMAGER(bd)->image,
-		    0, 0, cell_area->x, cell_area->y, cell_area->width, cell_area->height,
-		    GDK_RGB_DITHER_NONE, 0, 0);
-
-    nr = g_new (RedrawInfo, 1);
-    nr->view = self->tree;
-    nr->rect.x = cell_area->x;
-    nr->rect.y = cell_area->y;
-    nr->rect.width = cell_area->width;
-    nr->rect.height = cell_area->height;
-
-    g_timeout_add (20, (GSourceFunc) cell_queue_redraw, nr);
+    tile = get_tile(self, bd);
+    tile_request(tile, a, b, cell_area->width, cell_area->height,
+		 &GTK_WIDGET(widget)->style->fg[state],
+		 &GTK_WIDGET(widget)->style->base[state]);
+    tile->area = *cell_area;
+    tile->last_visible = ++self->tick;
+
+    /* Draw whatever we have so far. It may be a different size while
+     * a resize is in progress, so stay within both rectangles.
+     */
+    if (tile->image)
+	gdk_draw_pixbuf(window, GTK_WIDGET(widget)->style->fg_gc[state],
+			tile->image,
+			0, 0, cell_area->x, cell_area->y,
+			MIN(cell_area->width, gdk_pixbuf_get_width(tile->image)),
+			MIN(cell_area->height, gdk_pixbuf_get_height(tile->image)),
+			GDK_RGB_DITHER_NONE, 0, 0);
+
+    scheduler_start(self);
 }
 
 /* The End */
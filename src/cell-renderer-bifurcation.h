@@ -50,6 +50,17 @@ struct _CellRendererBifurcation {
 
     /* Our parent - yes, I know this makes baby jesus cry. */
     GtkTreeView *tree;
+
+    /* Diagrams are refined on a background thread. The render method only
+     * draws the most recent finished image for each row, and records which
+     * rows are visible so the scheduler can work on those first.
+     */
+    GThreadPool *workers;
+    GAsyncQueue *results;
+    GList *tiles;
+    guint scheduler;
+    guint tick;
+    gboolean job_in_flight;
 };
 
 struct _CellRendererBifurcationClass {
@@ -27,6 +27,59 @@
 #include "cluster-model.h"
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+
+/* Every few seconds we look at each node's speed, round trip time and
+ * bandwidth, and adjust how it streams results to us. Intervals never drop
+ * below the user's min_stream_interval, are stretched to cover several
+ * round trips, and stretch further for everyone when merging results starts
+ * taking too much of the master's time. Each push is sized to carry a
+ * full interval of data. Nodes that stay far slower than the fastest one
+ * are demoted to rare, large batches so they don't cost more than they
+ * contribute.
+ *
+ * Our round trip time is measured from commands to their responses, so it
+ * includes the node's processing time and any pushes queued ahead of the
+ * response. That makes it an upper bound on the link's latency, which is
+ * fine for stretching intervals. Since every interval covers several of
+ * these round trips, a fixed PUSH_CREDITS is always enough to keep a push
+ * in flight while we merge the last one.
+ */
+#define BALANCE_INTERVAL        2.0    /* Seconds between balancing passes */
+#define DEFAULT_STREAM_INTERVAL 1.0
+#define MERGE_BUDGET            0.25   /* Fraction of the master's time to spend merging */
+#define MAX_BACKPRESSURE        16.0
+#define RTT_INTERVALS           4.0    /* Stream intervals are at least this many round trips */
+#define MIN_PUSH_BYTES          (64 * 1024)
+#define MAX_PUSH_BYTES          (16 * 1024 * 1024)
+#define PUSH_CREDITS            2
+#define SLOW_NODE_FRACTION      0.1    /* Nodes this much slower than the fastest... */
+#define SLOW_NODE_PASSES        5      /* ...for this many passes are demoted */
+#define DEMOTED_INTERVAL_SCALE  4.0
+
+/* In partitioned mode, every band needs the same number of iterations
+ * behind it or the image's density would vary from band to band. Nodes
+ * that get more than this fraction ahead of the slowest band are paused
+ * until it catches up.
+ */
+#define PARTITION_SLACK         0.05
+
+typedef struct {
+    guint first_row;
+    guint num_rows;
+    guint num_bands;
+    guint index;
+    GArray* layout;
+} ClusterBands;
+
+/* One band of the master map's rows, and the iterations its node has
+ * added to it since the bands were laid out.
+ */
+typedef struct {
+    guint first_row;
+    guint num_rows;
+    gdouble iterations;
+} ClusterBand;
 
 typedef void      (*ClusterForeachCallback)   (ClusterModel*         self,
 					       RemoteClient*         client,
@@ -58,7 +111,32 @@ static void       cluster_foreach_node        (ClusterModel*  self,
 					       ClusterForeachCallback callback,
 					       gpointer       user_data,
 					       gboolean       only_ready_nodes);
-static void       cluster_node_update_param   (ClusterModel  *self,
+static void       cluster_node_update_params  (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data);
+static void       cluster_node_set_generation (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data);
+static gboolean   cluster_model_flush_params  (gpointer       user_data);
+static gboolean   cluster_model_balance       (gpointer       user_data);
+static void       cluster_model_partition     (ClusterModel  *self);
+static void       cluster_model_renormalize   (ClusterModel  *self);
+static void       cluster_model_sync_bands    (ClusterModel  *self);
+static void       cluster_model_reset_bands   (ClusterModel  *self);
+static ClusterBand* cluster_model_find_band   (ClusterModel  *self,
+					       RemoteClient  *client);
+static gdouble    cluster_node_band_progress  (ClusterModel  *self,
+					       RemoteClient  *client);
+static void       cluster_node_hold           (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gboolean       paused);
+static void       cluster_node_collect_progress (ClusterModel  *self,
+						 RemoteClient  *client,
+						 gpointer       user_data);
+static void       cluster_node_hold_band      (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data);
+static void       cluster_node_set_seed       (ClusterModel  *self,
 					       RemoteClient  *client,
 					       gpointer       user_data);
 static void       cluster_node_start          (ClusterModel  *self,
@@ -73,6 +151,9 @@ static void       cluster_node_merge_results  (ClusterModel  *self,
 static void       cluster_node_set_min_stream_interval (ClusterModel  *self,
 							RemoteClient  *client,
 							gpointer       user_data);
+static void       cluster_node_detach_merger  (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data);
 static void       cluster_model_discovery_callback     (DiscoveryClient* self,
 							const gchar*     host,
 							int              port,
@@ -120,6 +201,34 @@ static void cluster_model_dispose(GObject *gobject)
 
     cluster_model_disable_discovery(self);
 
+    if (self->param_flush_idle) {
+	g_source_remove(self->param_flush_idle);
+	self->param_flush_idle = 0;
+    }
+    if (self->pending_params) {
+	g_hash_table_destroy(self->pending_params);
+	self->pending_params = NULL;
+    }
+    if (self->balance_timer) {
+	g_source_remove(self->balance_timer);
+	self->balance_timer = 0;
+    }
+    if (self->balance_clock) {
+	g_timer_destroy(self->balance_clock);
+	self->balance_clock = NULL;
+    }
+
+    if (self->bands) {
+	g_array_free(self->bands, TRUE);
+	self->bands = NULL;
+    }
+
+    if (self->merger) {
+	cluster_foreach_node(self, cluster_node_detach_merger, NULL, FALSE);
+	histogram_merger_free(self->merger);
+	self->merger = NULL;
+    }
+
     if (self->master_map) {
 	g_object_set_data(G_OBJECT(self->master_map), "ClusterModel", NULL);
 
@@ -134,6 +243,13 @@ static void cluster_model_dispose(GObject *gobject)
 
 static void cluster_model_init(ClusterModel *self)
 {
+    self->pending_params = g_hash_table_new(g_str_hash, g_str_equal);
+    self->backpressure = 1.0;
+    self->job_seed = g_random_int();
+    self->balance_clock = g_timer_new();
+    self->bands = g_array_new(FALSE, TRUE, sizeof(ClusterBand));
+    self->balance_timer = g_timeout_add((guint) (BALANCE_INTERVAL * 1000),
+					cluster_model_balance, self);
 }
 
 ClusterModel*  cluster_model_new              (IterativeMap*         master_map)
@@ -152,6 +268,7 @@ ClusterModel*  cluster_model_new              (IterativeMap*         master_map)
     gtk_list_store_set_column_types(GTK_LIST_STORE(self), 7, types);
 
     self->master_map = g_object_ref(master_map);
+    self->merger = histogram_merger_new(HISTOGRAM_IMAGER(master_map));
 
     g_signal_connect(self->master_map, "notify",               G_CALLBACK(on_param_notify),  self);
     g_signal_connect(self->master_map, "calculation-finished", G_CALLBACK(on_calc_finished), self);
@@ -304,17 +421,24 @@ RemoteClient*  cluster_model_enable_node      (ClusterModel*         self,
 		       -1);
 
     client = remote_client_new(host, port);
+    client->merger = self->merger;
     remote_client_set_status_cb(client, client_status_callback, self);
     remote_client_set_speed_cb(client, client_speed_callback, self);
 
     if (self->set_min_stream_interval)
 	client->min_stream_interval = self->min_stream_interval;
 
+    /* Stream IDs start at 1, leaving 0 for whoever owns the master map */
+    remote_client_set_seed(client, self->job_seed, ++self->next_stream_id);
+
     gtk_list_store_set(GTK_LIST_STORE(self), iter,
 		       CLUSTER_MODEL_CLIENT, client,
 		       CLUSTER_MODEL_ENABLED, TRUE,
 		       -1);
 
+    if (self->partitioned)
+	cluster_model_partition(self);
+
     /* The liststore will keep a reference, ditch ours.
      * When the client is removed from the liststore, it
      * should be disposed of.
@@ -331,6 +455,10 @@ RemoteClient*  cluster_model_enable_node      (ClusterModel*         self,
 void           cluster_model_disable_node     (ClusterModel*         self,
 					       GtkTreeIter*          iter)
 {
+    /* Whatever this node added to its band stays in the master map */
+    if (self->partitioned)
+	cluster_model_sync_bands(self);
+
     gtk_list_store_set(GTK_LIST_STORE(self), iter,
 		       CLUSTER_MODEL_CLIENT, NULL,
 		       CLUSTER_MODEL_ENABLED, FALSE,
@@ -338,6 +466,9 @@ void           cluster_model_disable_node     (ClusterModel*         self,
 		       CLUSTER_MODEL_SPEED, "",
 		       CLUSTER_MODEL_BANDWIDTH, "",
 		       -1);
+
+    if (self->partitioned)
+	cluster_model_partition(self);
 }
 
 void           cluster_model_show_status      (ClusterModel*         self)
@@ -382,6 +513,32 @@ void           cluster_model_show_status      (ClusterModel*         self)
     }
 }
 
+void           cluster_model_show_totals      (ClusterModel*         self)
+{
+    GtkTreeIter iter;
+    RemoteClient* client;
+    gchar* host;
+    int port;
+
+    if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(self), &iter)) {
+	do {
+	    gtk_tree_model_get(GTK_TREE_MODEL(self), &iter,
+			       CLUSTER_MODEL_HOSTNAME, &host,
+			       CLUSTER_MODEL_PORT, &port,
+			       CLUSTER_MODEL_CLIENT, &client,
+			       -1);
+	    if (client) {
+		printf("node %s:%d iterations=%.0f bytes=%.0f merge_seconds=%.6f "
+		       "stale_drops=%u rtt=%.6f\n",
+		       host, port, client->total_iterations, client->total_bytes,
+		       client->total_merge_seconds, client->stale_drops, client->rtt);
+		g_object_unref(client);
+	    }
+	    g_free(host);
+	} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(self), &iter));
+    }
+}
+
 void           cluster_model_set_min_stream_interval (ClusterModel*  self,
 						      gdouble        seconds)
 {
@@ -390,6 +547,37 @@ void           cluster_model_set_min_stream_interval (ClusterModel*  self,
     cluster_foreach_node(self, cluster_node_set_min_stream_interval, NULL, FALSE);
 }
 
+void           cluster_model_set_job_seed     (ClusterModel*         self,
+					       guint32               job_seed)
+{
+    self->job_seed = job_seed;
+    cluster_foreach_node(self, cluster_node_set_seed, NULL, FALSE);
+}
+
+void           cluster_model_set_partitioned  (ClusterModel*         self,
+					       gboolean              partitioned)
+{
+    /* This is also how a server tells us its own region changed, which
+     * cleared its histogram, so the band counts start over either way.
+     */
+    self->partitioned = partitioned;
+    cluster_model_partition(self);
+    cluster_model_reset_bands(self);
+}
+
+void           cluster_model_set_keep_bands   (ClusterModel*         self,
+					       gboolean              keep_bands)
+{
+    self->keep_bands = keep_bands;
+    if (self->partitioned)
+	cluster_model_partition(self);
+}
+
+gboolean       cluster_model_get_keep_bands   (ClusterModel*         self)
+{
+    return self->partitioned && self->keep_bands;
+}
+
 void           cluster_model_enable_discovery (ClusterModel* self)
 {
     /* Currently, our scanning interval is hardcoded at 5 minutes */
@@ -423,7 +611,8 @@ static void      client_status_callback          (RemoteClient*  client,
      * be running, make sure this node is running too.
      */
     if (self->is_running && remote_client_is_ready(client)) {
-	remote_client_send_all_params(client, PARAMETER_HOLDER(self->master_map));
+	remote_client_send_all_params(client, PARAMETER_HOLDER(self->master_map),
+				      self->param_generation);
 	cluster_node_start(self, client, NULL);
     }
 
@@ -446,8 +635,10 @@ static void      client_speed_callback           (RemoteClient*  client,
 
     cluster_model_find_client(self, client, &iter);
 
-    speed_str = g_strdup_printf("%.3e iter/s", iters_per_sec);
-    bandwidth_str = g_strdup_printf("%.2f KB/s", bytes_per_sec / 1000);
+    speed_str = g_strdup_printf("%.3e iter/s%s", iters_per_sec,
+				client->is_demoted ? " (slow)" : "");
+    bandwidth_str = g_strdup_printf("%.2f KB/s, %d ms", bytes_per_sec / 1000,
+				    (int) (client->rtt * 1000 + 0.5));
 
     gtk_list_store_set(GTK_LIST_STORE(self), &iter,
 		       CLUSTER_MODEL_SPEED, speed_str,
@@ -461,12 +652,61 @@ static void       on_param_notify             (ParameterHolder* holder,
 					       GParamSpec*      spec,
 					       ClusterModel*    self)
 {
-    cluster_foreach_node(self, cluster_node_update_param, spec, TRUE);
+    /* Parameters often change several at a time, for example when loading
+     * a file or dragging in the explorer. Collect everything that changes
+     * before we get back to the main loop, so each node sees one atomic update.
+     */
+    if (!(spec->flags & PARAM_SERIALIZED))
+	return;
+
+    g_hash_table_insert(self->pending_params, (gpointer) spec->name, (gpointer) spec->name);
+
+    /* Only changes that affect calculation invalidate the nodes' results */
+    if (!(spec->flags & PARAM_COSMETIC) && !self->pending_params_relevant) {
+	self->pending_params_relevant = TRUE;
+	self->param_generation++;
+	cluster_foreach_node(self, cluster_node_set_generation, NULL, TRUE);
+	histogram_merger_reset(self->merger);
+	cluster_model_reset_bands(self);
+    }
+
+    if (!self->param_flush_idle)
+	self->param_flush_idle = g_idle_add(cluster_model_flush_params, self);
+}
+
+static void       collect_param_name          (gpointer       key,
+					       gpointer       value,
+					       gpointer       user_data)
+{
+    GPtrArray* names = (GPtrArray*) user_data;
+    g_ptr_array_add(names, key);
+}
+
+static gboolean   cluster_model_flush_params  (gpointer       user_data)
+{
+    ClusterModel* self = CLUSTER_MODEL(user_data);
+    GPtrArray* names = g_ptr_array_new();
+
+    g_hash_table_foreach(self->pending_params, collect_param_name, names);
+    g_ptr_array_add(names, NULL);
+
+    /* Bands follow the image size */
+    if (self->partitioned)
+	cluster_model_partition(self);
+    cluster_foreach_node(self, cluster_node_update_params, names->pdata, TRUE);
+
+    g_ptr_array_free(names, TRUE);
+    g_hash_table_destroy(self->pending_params);
+    self->pending_params = g_hash_table_new(g_str_hash, g_str_equal);
+    self->pending_params_relevant = FALSE;
+    self->param_flush_idle = 0;
+    return FALSE;
 }
 
 static void       on_calc_finished            (IterativeMap*  map,
 					       ClusterModel*  self)
 {
+    histogram_merger_flush(self->merger);
     cluster_foreach_node(self, cluster_node_merge_results, NULL, TRUE);
 }
 
@@ -534,19 +774,31 @@ static void      cluster_foreach_node            (ClusterModel*  self,
     }
 }
 
-static void      cluster_node_update_param       (ClusterModel  *self,
+static void      cluster_node_update_params      (ClusterModel  *self,
+						  RemoteClient  *client,
+						  gpointer       user_data)
+{
+    gchar** names = (gchar**) user_data;
+    remote_client_send_params(client, PARAMETER_HOLDER(self->master_map),
+			      names, self->param_generation);
+}
+
+static void      cluster_node_set_generation     (ClusterModel  *self,
 						  RemoteClient  *client,
 						  gpointer       user_data)
 {
-    GParamSpec* spec = (GParamSpec*) user_data;
-    remote_client_send_param(client, PARAMETER_HOLDER(self->master_map), spec->name);
+    /* Anything this node sends us from now until it receives
+     * the new parameters is stale.
+     */
+    client->param_generation = self->param_generation;
 }
 
 static void      cluster_node_start              (ClusterModel  *self,
 						  RemoteClient  *client,
 						  gpointer       user_data)
 {
-    remote_client_command(client, NULL, NULL, "calc_start");
+    if (!client->is_paused)
+	remote_client_command(client, NULL, NULL, "calc_start");
 }
 
 static void      cluster_node_stop               (ClusterModel  *self,
@@ -560,6 +812,15 @@ static void      cluster_node_merge_results      (ClusterModel  *self,
 						  RemoteClient  *client,
 						  gpointer       user_data)
 {
+    /* Nodes keeping their bands only report progress. Nodes rendering
+     * the whole image have nowhere to send results then, so they're
+     * left paused.
+     */
+    if (cluster_model_get_keep_bands(self)) {
+	if (client->has_region && !client->region_refused)
+	    remote_client_poll_status(client, self->master_map);
+	return;
+    }
     remote_client_merge_results(client, self->master_map);
 }
 
@@ -570,4 +831,489 @@ static void       cluster_node_set_min_stream_interval (ClusterModel  *self,
     client->min_stream_interval = self->min_stream_interval;
 }
 
+static void       cluster_node_detach_merger  (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data)
+{
+    client->merger = NULL;
+}
+
+static void       cluster_node_set_seed       (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data)
+{
+    remote_client_set_seed(client, self->job_seed, client->stream_id);
+}
+
+
+/************************************************************************************/
+/******************************************************************** Load Balancing */
+/************************************************************************************/
+
+static void       cluster_node_collect_load   (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data)
+{
+    gdouble* totals = (gdouble*) user_data;
+
+    /* totals[0] is merge time, totals[1] the fastest node's speed */
+    totals[0] += client->merge_seconds;
+    client->merge_seconds = 0;
+    totals[1] = MAX(totals[1], client->iters_per_sec);
+}
+
+static void       cluster_node_balance        (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data)
+{
+    gdouble fastest = *(gdouble*) user_data;
+    gdouble interval;
+    gsize bytes;
+
+    /* Nodes that haven't reported a speed yet aren't judged */
+    if (fastest > 0 && client->iters_per_sec > 0 &&
+	client->iters_per_sec < fastest * SLOW_NODE_FRACTION)
+	client->slow_passes++;
+    else
+	client->slow_passes = 0;
+    client->is_demoted = client->slow_passes >= SLOW_NODE_PASSES;
+
+    interval = self->set_min_stream_interval ? self->min_stream_interval : DEFAULT_STREAM_INTERVAL;
+    interval *= self->backpressure;
+    interval = MAX(interval, client->rtt * RTT_INTERVALS);
+    if (client->is_demoted)
+	interval *= DEMOTED_INTERVAL_SCALE;
+
+    /* Room for twice the data we've been seeing per interval,
+     * so the size can grow if pushes are what's limiting us.
+     */
+    bytes = CLAMP(client->bytes_per_sec * interval * 2, MIN_PUSH_BYTES, MAX_PUSH_BYTES);
+
+    /* Small changes aren't worth a new subscription */
+    if (fabs(interval - client->min_stream_interval) > client->min_stream_interval * 0.1)
+	client->min_stream_interval = interval;
+    if (bytes > client->push_bytes * 1.25 || bytes < client->push_bytes * 0.75)
+	client->push_bytes = bytes;
+    client->push_credits = PUSH_CREDITS;
+}
+
+static gboolean   cluster_model_balance       (gpointer       user_data)
+{
+    ClusterModel* self = CLUSTER_MODEL(user_data);
+    gdouble totals[2] = { 0, 0 };
+    gdouble elapsed, merge_load;
+
+    elapsed = g_timer_elapsed(self->balance_clock, NULL);
+    g_timer_start(self->balance_clock);
+    cluster_foreach_node(self, cluster_node_collect_load, totals, TRUE);
+
+    /* If merging is taking more than its share of our time, back everyone
+     * off proportionally. Otherwise, gradually return to normal.
+     */
+    merge_load = totals[0] / MAX(elapsed, 0.001);
+    if (merge_load > MERGE_BUDGET)
+	self->backpressure = MIN(self->backpressure * merge_load / MERGE_BUDGET, MAX_BACKPRESSURE);
+    else
+	self->backpressure = MAX(self->backpressure * 0.8, 1.0);
+
+    cluster_foreach_node(self, cluster_node_balance, &totals[1], TRUE);
+
+    if (self->partitioned) {
+	gdouble slowest = G_MAXDOUBLE;
+
+	cluster_model_partition(self);
+	cluster_foreach_node(self, cluster_node_collect_progress, &slowest, TRUE);
+	if (slowest < G_MAXDOUBLE)
+	    cluster_foreach_node(self, cluster_node_hold_band, &slowest, TRUE);
+    }
+    return TRUE;
+}
+
+
+/************************************************************************************/
+/********************************************************************* Partitioning */
+/************************************************************************************/
+
+/* Nodes that can't partition render the whole image. Their samples are
+ * spread evenly across every band, so they mix in without upsetting the
+ * density; they're simply left out of the band assignment.
+ */
+
+static void       cluster_node_count_band     (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data)
+{
+    ClusterBands* bands = (ClusterBands*) user_data;
+    if (!client->region_refused)
+	bands->num_bands++;
+}
+
+static void       cluster_node_assign_band    (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data)
+{
+    ClusterBands* bands = (ClusterBands*) user_data;
+    ClusterBand band;
+    guint first, end;
+
+    if (client->region_refused) {
+	cluster_node_hold(self, client, cluster_model_get_keep_bands(self));
+	return;
+    }
+
+    if (!bands->num_bands) {
+	/* Back to rendering the whole image */
+	if (client->has_region)
+	    remote_client_set_region(client, 0, 0);
+	client->iteration_share = 1.0;
+	cluster_node_hold(self, client, FALSE);
+	return;
+    }
+
+    first = bands->first_row + (guint) (((guint64) bands->num_rows) * bands->index / bands->num_bands);
+    end = bands->first_row + (guint) (((guint64) bands->num_rows) * (bands->index + 1) / bands->num_bands);
+    bands->index++;
+
+    remote_client_set_region(client, first, MAX(end - first, 1));
+    client->iteration_share = 1.0 / bands->num_bands;
+
+    memset(&band, 0, sizeof(band));
+    band.first_row = client->region_first_row;
+    band.num_rows = client->region_rows;
+    g_array_append_val(bands->layout, band);
+}
+
+static void       cluster_model_partition     (ClusterModel  *self)
+{
+    /* Give each node an equal band of the master map's rows. The master
+     * may itself only cover a band, if it's a server in a larger cluster.
+     * When we're keeping bands the master has no histogram, and its region
+     * is only borrowed while collecting them, so the bands cover the image.
+     * Nodes keep their band as long as the set of nodes stays the same,
+     * since moving one throws away that node's unsent results.
+     */
+    ClusterBands bands;
+    gboolean changed;
+    guint i;
+
+    /* Bands can't move while they're being collected */
+    if (self->collecting)
+	return;
+
+    memset(&bands, 0, sizeof(bands));
+    bands.layout = g_array_new(FALSE, TRUE, sizeof(ClusterBand));
+
+    if (self->partitioned) {
+	if (self->keep_bands) {
+	    bands.num_rows = HISTOGRAM_IMAGER(self->master_map)->height;
+	}
+	else {
+	    histogram_imager_get_region(HISTOGRAM_IMAGER(self->master_map),
+					&bands.first_row, &bands.num_rows);
+	}
+	cluster_foreach_node(self, cluster_node_count_band, &bands, FALSE);
+    }
+
+    /* Count what was merged under the old layout before anyone moves */
+    cluster_model_sync_bands(self);
+    cluster_foreach_node(self, cluster_node_assign_band, &bands, FALSE);
+
+    changed = bands.layout->len != self->bands->len;
+    for (i=0; i<bands.layout->len && !changed; i++)
+	changed = (g_array_index(bands.layout, ClusterBand, i).first_row !=
+		   g_array_index(self->bands, ClusterBand, i).first_row ||
+		   g_array_index(bands.layout, ClusterBand, i).num_rows !=
+		   g_array_index(self->bands, ClusterBand, i).num_rows);
+
+    if (changed) {
+	cluster_model_renormalize(self);
+	g_array_free(self->bands, TRUE);
+	self->bands = bands.layout;
+    }
+    else {
+	g_array_free(bands.layout, TRUE);
+    }
+}
+
+static void       cluster_model_renormalize   (ClusterModel  *self)
+{
+    /* The bands are about to move, and each old band's rows have a
+     * different number of iterations behind them. Scale every band down
+     * to match the slowest, so whoever renders those rows next starts
+     * from an even image. Everything but the bands themselves, like
+     * the master's own calculation, covered every row equally.
+     */
+    IterativeMap* map = self->master_map;
+    ClusterBand* band;
+    gdouble total = 0, slowest = G_MAXDOUBLE, common;
+    guint i;
+
+    if (self->keep_bands || self->bands->len < 2)
+	return;
+
+    for (i=0; i<self->bands->len; i++) {
+	band = &g_array_index(self->bands, ClusterBand, i);
+	total += band->iterations;
+	slowest = MIN(slowest, band->iterations);
+    }
+    common = map->iterations - total / self->bands->len;
+
+    /* If the master was cleared behind our backs, these counts are stale */
+    if (common < 0)
+	return;
+
+    histogram_merger_flush(self->merger);
+    for (i=0; i<self->bands->len; i++) {
+	band = &g_array_index(self->bands, ClusterBand, i);
+	if (band->iterations > slowest)
+	    histogram_imager_scale_rows(HISTOGRAM_IMAGER(map), band->first_row, band->num_rows,
+					(common + slowest) / (common + band->iterations));
+    }
+    map->iterations = common + slowest;
+}
+
+static void       cluster_node_sync_band      (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data)
+{
+    ClusterBand* band = cluster_model_find_band(self, client);
+    if (band)
+	band->iterations += client->band_iterations;
+    client->band_iterations = 0;
+}
+
+static void       cluster_model_sync_bands    (ClusterModel  *self)
+{
+    /* Move each node's merged iterations into its band's count */
+    cluster_foreach_node(self, cluster_node_sync_band, NULL, FALSE);
+}
+
+static void       cluster_model_reset_bands   (ClusterModel  *self)
+{
+    /* The master's histogram has been cleared, nothing is left in any band */
+    guint i;
+
+    cluster_model_sync_bands(self);
+    for (i=0; i<self->bands->len; i++)
+	g_array_index(self->bands, ClusterBand, i).iterations = 0;
+}
+
+static ClusterBand* cluster_model_find_band   (ClusterModel  *self,
+					       RemoteClient  *client)
+{
+    ClusterBand* band;
+    guint i;
+
+    if (!client->has_region || client->region_refused)
+	return NULL;
+
+    for (i=0; i<self->bands->len; i++) {
+	band = &g_array_index(self->bands, ClusterBand, i);
+	if (band->first_row == client->region_first_row && band->num_rows == client->region_rows)
+	    return band;
+    }
+    return NULL;
+}
+
+static gdouble    cluster_node_band_progress  (ClusterModel  *self,
+					       RemoteClient  *client)
+{
+    /* What matters is how much is behind each band's rows. Normally
+     * that's what we've merged, which a reconnect doesn't take away.
+     * When nodes keep their bands it's what the node holds, and there
+     * a reconnect does start it over.
+     */
+    ClusterBand* band;
+
+    if (self->keep_bands)
+	return client->prev_iterations;
+
+    band = cluster_model_find_band(self, client);
+    return band ? band->iterations : 0;
+}
+
+static void       cluster_node_hold           (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gboolean       paused)
+{
+    if (self->collecting || client->is_paused == paused)
+	return;
+    client->is_paused = paused;
+
+    if (self->is_running && remote_client_is_ready(client))
+	remote_client_command(client, NULL, NULL, paused ? "calc_stop" : "calc_start");
+}
+
+static void       cluster_node_collect_progress (ClusterModel  *self,
+						 RemoteClient  *client,
+						 gpointer       user_data)
+{
+    gdouble* slowest = (gdouble*) user_data;
+    if (client->has_region && !client->region_refused)
+	*slowest = MIN(*slowest, cluster_node_band_progress(self, client));
+}
+
+static void       cluster_node_hold_band      (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data)
+{
+    /* Pause nodes that are too far ahead of the slowest band, with a
+     * pass worth of leeway before pausing so we don't flap.
+     */
+    gdouble limit = *(gdouble*) user_data * (1 + PARTITION_SLACK);
+    gdouble progress;
+
+    if (!client->has_region || client->region_refused)
+	return;
+    progress = cluster_node_band_progress(self, client);
+
+    if (client->is_paused)
+	cluster_node_hold(self, client, progress > limit);
+    else
+	cluster_node_hold(self, client, progress >
+			  limit + client->iters_per_sec * BALANCE_INTERVAL);
+}
+
+
+/************************************************************************************/
+/************************************************************ Collecting Kept Bands */
+/************************************************************************************/
+
+typedef struct {
+    gdouble quality;
+    guint num_bands;
+} ClusterQuality;
+
+static void       cluster_node_band_quality   (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data)
+{
+    ClusterQuality* total = (ClusterQuality*) user_data;
+
+    if (client->has_region && !client->region_refused) {
+	total->quality = MIN(total->quality, client->quality);
+	total->num_bands++;
+    }
+}
+
+gdouble        cluster_model_get_band_quality (ClusterModel*         self)
+{
+    /* Every band has to be good enough, including any whose node is
+     * reconnecting. Nodes that haven't reported yet count as zero.
+     */
+    ClusterQuality total;
+
+    total.quality = G_MAXDOUBLE;
+    total.num_bands = 0;
+    cluster_foreach_node(self, cluster_node_band_quality, &total, FALSE);
+    return total.num_bands ? total.quality : 0;
+}
+
+static void       cluster_node_list_band      (ClusterModel  *self,
+					       RemoteClient  *client,
+					       gpointer       user_data)
+{
+    if (client->has_region && !client->region_refused)
+	g_ptr_array_add((GPtrArray*) user_data, g_object_ref(client));
+}
+
+static void       cluster_model_wait          (RemoteClient  *client,
+					       int           *pending)
+{
+    /* Run the main loop until a request is answered, or the node drops */
+    while (*pending && remote_client_is_ready(client))
+	g_main_context_iteration(NULL, TRUE);
+}
+
+GdkPixbuf*     cluster_model_collect_bands    (ClusterModel*         self)
+{
+    /* Each band is exposed by the density of the whole image, in points
+     * per bucket per iteration, times its own iterations. That evens out
+     * the small differences partitioning allows between bands. Only one
+     * band's histogram is ever allocated here, borrowing the master's.
+     */
+    HistogramImager* imager = HISTOGRAM_IMAGER(self->master_map);
+    GPtrArray* nodes;
+    GdkPixbuf* image;
+    RemoteClient* client;
+    guint region_first_row = imager->region_first_row;
+    guint region_rows = imager->region_rows;
+    gdouble points = 0, weighted_buckets = 0, density = 0;
+    gsize row_buckets;
+    guint i;
+
+    if (!cluster_model_get_keep_bands(self) || self->collecting)
+	return NULL;
+
+    /* We run the main loop while the master's region is borrowed, so
+     * balancing is suspended and nothing may move or hold a band until
+     * we're done.
+     */
+    g_object_ref(self);
+    self->collecting = TRUE;
+    if (self->balance_timer) {
+	g_source_remove(self->balance_timer);
+	self->balance_timer = 0;
+    }
+
+    nodes = g_ptr_array_new();
+    cluster_foreach_node(self, cluster_node_list_band, nodes, FALSE);
+
+    /* Get final totals from every node, now that they've stopped */
+    for (i=0; i<nodes->len; i++) {
+	client = REMOTE_CLIENT(g_ptr_array_index(nodes, i));
+	cluster_model_wait(client, &client->pending_status_requests);
+	remote_client_poll_status(client, self->master_map);
+	cluster_model_wait(client, &client->pending_status_requests);
+    }
+
+    row_buckets = ((gsize) imager->width) * imager->oversample * imager->oversample;
+    for (i=0; i<nodes->len; i++) {
+	client = REMOTE_CLIENT(g_ptr_array_index(nodes, i));
+	if (remote_client_is_ready(client)) {
+	    points += client->points_plotted;
+	    weighted_buckets += ((gdouble) row_buckets) * client->region_rows * client->prev_iterations;
+	}
+    }
+    if (weighted_buckets > 0)
+	density = points / weighted_buckets;
+
+    /* Anything we can't fetch is left as background */
+    image = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, imager->width, imager->height);
+    gdk_pixbuf_fill(image, ((imager->bgcolor.red >> 8) << 24) |
+		    ((imager->bgcolor.green >> 8) << 16) |
+		    ((imager->bgcolor.blue >> 8) << 8) |
+		    (imager->bgalpha >> 8));
+
+    for (i=0; i<nodes->len; i++) {
+	client = REMOTE_CLIENT(g_ptr_array_index(nodes, i));
+	histogram_imager_set_region(imager, client->region_first_row, client->region_rows);
+
+	if (remote_client_is_ready(client)) {
+	    remote_client_fetch_histogram(client, imager);
+	    cluster_model_wait(client, &client->is_fetching);
+	}
+	if (client->is_fetching || !remote_client_is_ready(client))
+	    g_warning("Lost the band at rows %u to %u", client->region_first_row,
+		      client->region_first_row + client->region_rows - 1);
+	else
+	    histogram_imager_colorize_region(imager, image, density * client->prev_iterations);
+	g_object_unref(client);
+    }
+    g_ptr_array_free(nodes, TRUE);
+
+    /* Give the last band's memory back */
+    histogram_imager_set_region(imager, region_first_row, region_rows);
+
+    /* Unless we were disposed of in the meantime, start balancing again */
+    self->collecting = FALSE;
+    if (self->master_map) {
+	g_timer_start(self->balance_clock);
+	self->balance_timer = g_timeout_add((guint) (BALANCE_INTERVAL * 1000),
+					    cluster_model_balance, self);
+    }
+    g_object_unref(self);
+    return image;
+}
+
 /* The End */
@@ -30,6 +30,7 @@
 #include "remote-client.h"
 #include "discovery-client.h"
 #include "iterative-map.h"
+#include "histogram-merger.h"
 
 G_BEGIN_DECLS
 
@@ -52,6 +53,39 @@ struct _ClusterModel {
     gboolean      set_min_stream_interval;
 
     DiscoveryClient* discovery;
+
+    /* Parameter changes are collected and sent to each node as one batch.
+     * The generation advances whenever a batch affects calculation.
+     */
+    guint         param_generation;
+    GHashTable*   pending_params;
+    gboolean      pending_params_relevant;
+    guint         param_flush_idle;
+
+    /* Every node gets a distinct random stream under this job seed */
+    guint32       job_seed;
+    guint32       next_stream_id;
+
+    /* Adaptive load balancing, see cluster_model_balance() */
+    guint         balance_timer;
+    GTimer*       balance_clock;
+    gdouble       backpressure;
+
+    /* In partitioned mode each node renders one band of the master
+     * map's rows, see cluster_model_partition(). 'bands' is the current
+     * layout, with the iterations merged into each band. With keep_bands,
+     * nodes hold on to their bands until cluster_model_collect_bands(),
+     * which sets 'collecting' while it runs.
+     */
+    gboolean      partitioned;
+    gboolean      keep_bands;
+    gboolean      collecting;
+    GArray*       bands;
+
+    /* Nodes' histogram data is merged on this thread, and folded into
+     * the master map whenever it finishes a calculation step.
+     */
+    HistogramMerger* merger;
 };
 
 struct _ClusterModelClass {
@@ -89,9 +123,42 @@ RemoteClient*  cluster_model_add_node         (ClusterModel*         self,
 void           cluster_model_set_min_stream_interval (ClusterModel*  self,
 						      gdouble        seconds);
 
+/* Nodes are seeded from this job seed and a stream ID we assign, so
+ * rendering again with the same seed and nodes reproduces the result.
+ * By default the job seed is chosen at random.
+ */
+void           cluster_model_set_job_seed     (ClusterModel*         self,
+					       guint32               job_seed);
+
+/* Split the histogram into bands of rows, one per node, so the cluster's
+ * memory adds up instead of every node holding the whole image. Points
+ * outside a node's band are discarded, so fast nodes are held back to
+ * keep the density of every band the same.
+ */
+void           cluster_model_set_partitioned  (ClusterModel*         self,
+					       gboolean              partitioned);
+
+/* For batch renders of a partitioned image, leave each band on its node
+ * instead of merging it as we go, so the master never needs the whole
+ * histogram. Nodes that can't partition sit idle. The cluster's quality
+ * is then that of its worst band, and once the nodes have stopped,
+ * cluster_model_collect_bands() fetches and colorizes one band at a time.
+ * It returns a new image, or NULL if we aren't keeping bands.
+ */
+void           cluster_model_set_keep_bands   (ClusterModel*         self,
+					       gboolean              keep_bands);
+gboolean       cluster_model_get_keep_bands   (ClusterModel*         self);
+gdouble        cluster_model_get_band_quality (ClusterModel*         self);
+GdkPixbuf*     cluster_model_collect_bands    (ClusterModel*         self);
+
 /* Show the cluster status on stdout. Good for debugging, and batch-mode rendering */
 void           cluster_model_show_status      (ClusterModel*         self);
 
+/* Show each node's totals on stdout, one line per node in a format
+ * that's easy for benchmark scripts to pick apart.
+ */
+void           cluster_model_show_totals      (ClusterModel*         self);
+
 /* Add a comma-separated list of host[:port] specifiers */
 void           cluster_model_add_nodes        (ClusterModel*         self,
 					       const gchar*          hosts);
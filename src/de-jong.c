@@ -25,14 +25,18 @@
 #include "de-jong.h"
 #include "math-util.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 static void de_jong_class_init(DeJongClass *klass);
 static void de_jong_init(DeJong *self);
+static void de_jong_dispose(GObject *gobject);
 static void de_jong_init_calc_params(GObjectClass *object_class);
 static void de_jong_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec);
 static void de_jong_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec);
 static void de_jong_reset_calc(DeJong *self);
+static void de_jong_load_initial_image(DeJong *self, const gchar *filename);
+static void de_jong_initial_image_batch(DeJong *self, gdouble *x, gdouble *y, gsize count);
 static void de_jong_calculate(IterativeMap *self, guint iterations);
 static void de_jong_calculate_motion(IterativeMap *self, guint iterations, gboolean continuation, ParameterInterpolator *interp, gpointer interp_data);
 static ToolInfoPH *de_jong_get_tools();
@@ -62,15 +66,20 @@ enum {
     PROP_INITIAL_YSCALE,
     PROP_INITIAL_XOFFSET,
     PROP_INITIAL_YOFFSET,
+    PROP_INITIAL_IMAGE,
 };
 
-typedef void (*initial_conditions_t)(gdouble *x, gdouble *y);
+typedef void (*initial_conditions_t)(DeJong *self, gdouble *x, gdouble *y);
 
-void initial_func_square_uniform    (gdouble *x, gdouble *y);
-void initial_func_gaussian          (gdouble *x, gdouble *y);
-void initial_func_circular_uniform  (gdouble *x, gdouble *y);
-void initial_func_radial            (gdouble *x, gdouble *y);
-void initial_func_sphere            (gdouble *x, gdouble *y);
+void initial_func_square_uniform    (DeJong *self, gdouble *x, gdouble *y);
+void initial_func_gaussian          (DeJong *self, gdouble *x, gdouble *y);
+void initial_func_circular_uniform  (DeJong *self, gdouble *x, gdouble *y);
+void initial_func_radial            (DeJong *self, gdouble *x, gdouble *y);
+void initial_func_sphere            (DeJong *self, gdouble *x, gdouble *y);
+void initial_func_image             (DeJong *self, gdouble *x, gdouble *y);
+
+/* Image initial conditions are drawn this many at a time while calculating */
+#define INITIAL_BATCH_SIZE 256
 
 static const
 GEnumValue initial_conditions_enum[] =
@@ -80,6 +89,7 @@ GEnumValue initial_conditions_enum[] =
 	{ 2, "gaussian",          "Gaussian"          },
 	{ 3, "radial",            "Radial"            },
 	{ 4, "sphere",            "Sphere"            },
+	{ 5, "image",             "Image"             },
 	{ 0 },
     };
 
@@ -91,10 +101,13 @@ initial_conditions_t initial_conditions_table[] =
 	initial_func_gaussian,
 	initial_func_radial,
 	initial_func_sphere,
+	initial_func_image,
     };
 
 static GType initial_conditions_enum_get_type(void);
 
+static gpointer parent_class = NULL;
+
 static void tool_grab(ParameterHolder *self, ToolInput *i);
 static void tool_blur(ParameterHolder *self, ToolInput *i);
 static void tool_zoom(ParameterHolder *self, ToolInput *i);
@@ -172,8 +185,11 @@ static void de_jong_class_init(DeJongClass *klass) {
     im_class = (IterativeMapClass*) klass;
     ph_class = (ParameterHolderClass*) klass;
 
+    parent_class = g_type_class_peek_parent(klass);
+
     object_class->set_property = de_jong_set_property;
     object_class->get_property = de_jong_get_property;
+    object_class->dispose = de_jong_dispose;
 
     im_class->calculate = de_jong_calculate;
     im_class->calculate_motion = de_jong_calculate_motion;
@@ -342,6 +358,8 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
 				      PARAM_INTERPOLATE | PARAM_IN_GUI);
     param_spec_set_group             (spec, current_group);
     param_spec_set_dependency        (spec, "emphasize-transient");
+    /* 'Image' stays out of the GUI, since initial_image can't be set there yet */
+    param_spec_set_gui_values        (spec, 5);
     g_object_class_install_property  (object_class, PROP_INITIAL_CONDITIONS, spec);
 
     spec = g_param_spec_double       ("initial_xscale",
@@ -387,12 +405,34 @@ static void de_jong_init_calc_params(GObjectClass *object_class) {
     param_spec_set_increments        (spec, 0.001, 0.01, 3);
     param_spec_set_dependency        (spec, "emphasize-transient");
     g_object_class_install_property  (object_class, PROP_INITIAL_YOFFSET, spec);
+
+    spec = g_param_spec_string       ("initial_image",
+				      "Initial image",
+				      "Image file whose brightness gives the distribution of initial conditions, when 'Initial conditions' is 'Image'",
+				      NULL,
+				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED);
+    g_object_class_install_property  (object_class, PROP_INITIAL_IMAGE, spec);
 }
 
 static void de_jong_init(DeJong *self) {
     /* Nothing to do here yet, everything's set up by our G_PARAM_CONSTRUCT properties */
 }
 
+static void de_jong_dispose(GObject *gobject) {
+    DeJong *self = DE_JONG(gobject);
+
+    if (self->initial_map) {
+	g_object_unref(self->initial_map);
+	self->initial_map = NULL;
+    }
+    if (self->initial_image) {
+	g_free(self->initial_image);
+	self->initial_image = NULL;
+    }
+
+    G_OBJECT_CLASS(parent_class)->dispose(gobject);
+}
+
 DeJong* de_jong_new() {
     return DE_JONG(g_object_new(de_jong_get_type(), NULL));
 }
@@ -512,6 +552,10 @@ static void de_jong_set_property (GObject *object, guint prop_id, const GValue *
 	update_double_if_necessary(g_value_get_double(value), &self->calc_dirty_flag, &self->initial_yscale, 0.0009);
 	break;
 
+    case PROP_INITIAL_IMAGE:
+	de_jong_load_initial_image(self, g_value_get_string(value));
+	break;
+
     default:
 	G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 	break;
@@ -599,6 +643,10 @@ static void de_jong_get_property (GObject *object, guint prop_id, GValue *value,
 	g_value_set_double(value, self->initial_yscale);
 	break;
 
+    case PROP_INITIAL_IMAGE:
+	g_value_set_string(value, self->initial_image);
+	break;
+
     default:
 	G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 	break;
@@ -652,6 +700,12 @@ void de_jong_calculate(IterativeMap *map, guint iterations) {
     guint remaining_transient_iterations;
     initial_conditions_t initial_func;
 
+    /* Batched image initial conditions */
+    const gboolean batch_initial = emphasize_transient && self->initial_map &&
+	initial_conditions_table[self->initial_conditions] == initial_func_image;
+    gdouble initial_x[INITIAL_BATCH_SIZE], initial_y[INITIAL_BATCH_SIZE];
+    int initial_index = INITIAL_BATCH_SIZE;
+
     /* Reset calculation if we need to */
     if (self->calc_dirty_flag || HISTOGRAM_IMAGER(self)->histogram_clear_flag)
 	de_jong_reset_calc(self);
@@ -739,7 +793,18 @@ void de_jong_calculate(IterativeMap *map, guint iterations) {
 	    }
 	    else {
 		remaining_transient_iterations = self->transient_iterations-1;
-		initial_func(&point_x, &point_y);
+		if (batch_initial) {
+		    if (initial_index == INITIAL_BATCH_SIZE) {
+			de_jong_initial_image_batch(self, initial_x, initial_y, INITIAL_BATCH_SIZE);
+			initial_index = 0;
+		    }
+		    point_x = initial_x[initial_index];
+		    point_y = initial_y[initial_index];
+		    initial_index++;
+		}
+		else {
+		    initial_func(self, &point_x, &point_y);
+		}
 		point_x = self->initial_xscale * point_x + self->initial_xoffset;
 		point_y = self->initial_yscale * point_y + self->initial_yoffset;
 	    }
@@ -818,14 +883,17 @@ void de_jong_calculate(IterativeMap *map, guint iterations) {
 	    iy %= hist_height;
 	    if (ix < 0) ix += hist_width;
 	    if (iy < 0) iy += hist_height;
+	    if (((unsigned int)(iy - plot.first_row)) >= plot.num_rows)
+		continue;
 	}
 	else {
-	    /* Otherwise, clip off the edges.
-	     * Cast ix and iy to unsigned so our comparison against
-	     * the width/height also implicitly compares against zero.
+	    /* Otherwise, clip off the edges, and any rows outside
+	     * the region our histogram covers. Cast ix and iy to
+	     * unsigned so our comparisons also implicitly compare
+	     * against zero.
 	     */
 	    if (((unsigned int)ix) >= hist_width  ||
-		((unsigned int)iy) >= hist_height)
+		((unsigned int)(iy - plot.first_row)) >= plot.num_rows)
 		continue;
 	}
 
@@ -886,7 +954,7 @@ static void de_jong_reset_calc(DeJong *self) {
 /*************************************************************** Initial Conditions */
 /************************************************************************************/
 
-void initial_func_square_uniform (gdouble *x, gdouble *y) {
+void initial_func_square_uniform (DeJong *self, gdouble *x, gdouble *y) {
     /* From -1 to +1. The default used to be 0 to 1, which produced
      * some neat effects, but made a silly default. This, by default,
      * looks a lot like circular_uniform but with corners.
@@ -895,12 +963,12 @@ void initial_func_square_uniform (gdouble *x, gdouble *y) {
     *y = uniform_variate()*2 - 1;
 }
 
-void initial_func_gaussian (gdouble *x, gdouble *y) {
+void initial_func_gaussian (DeJong *self, gdouble *x, gdouble *y) {
     /* Just a unit normal in each axis */
     normal_variate_pair(x, y);
 }
 
-void initial_func_circular_uniform (gdouble *x, gdouble *y) {
+void initial_func_circular_uniform (DeJong *self, gdouble *x, gdouble *y) {
     /* A uniform distribution in each axis, but discarding
      * all values that fall outside the unit circle. This
      * gives a similar look to square_uniform, but with smooth
@@ -915,7 +983,7 @@ void initial_func_circular_uniform (gdouble *x, gdouble *y) {
     *y = j;
 }
 
-void initial_func_radial (gdouble *x, gdouble *y) {
+void initial_func_radial (DeJong *self, gdouble *x, gdouble *y) {
     /* Pick a radius and angle uniformly, then convert to cartesian
      * coordinates. This also produces a unit circle, but it isn't
      * uniform- it has a strong dense spot in the center that fades
@@ -928,7 +996,7 @@ void initial_func_radial (gdouble *x, gdouble *y) {
     *y = sin(theta) * radius;
 }
 
-void initial_func_sphere (gdouble *x, gdouble *y) {
+void initial_func_sphere (DeJong *self, gdouble *x, gdouble *y) {
     /* The opposite of radial's effect- a circle that's dense at
      * the edges and light in the center. This creates a distribution
      * uniform along the surface of a sphere, then flattens it.
@@ -946,6 +1014,86 @@ void initial_func_sphere (gdouble *x, gdouble *y) {
     *y = vy / mag;
 }
 
+void initial_func_image (DeJong *self, gdouble *x, gdouble *y) {
+    /* Points distributed according to the brightness of an image,
+     * with its longest side spanning -1 to +1 like square_uniform.
+     * Each point lands uniformly within the pixel it picked, so the
+     * image's center maps to the origin. The probability map's alias
+     * table makes each draw constant time, no matter how large the
+     * image is.
+     */
+    ProbabilityMap *map = self->initial_map;
+    guint xi, yi;
+    gdouble scale;
+
+    if (!map) {
+	initial_func_square_uniform(self, x, y);
+	return;
+    }
+
+    probability_map_ints(map, &xi, &yi);
+    scale = 2.0 / MAX(map->width, map->height);
+    *x = (xi + uniform_variate() - map->width * 0.5) * scale;
+    *y = (yi + uniform_variate() - map->height * 0.5) * scale;
+}
+
+static void de_jong_initial_image_batch(DeJong *self, gdouble *x, gdouble *y, gsize count) {
+    /* The same distribution as initial_func_image(), for many points at
+     * once. The alias table lookups are done as one batch, which is much
+     * cheaper than drawing each point separately. Requires an initial_map.
+     */
+    ProbabilityMap *map = self->initial_map;
+    guint xi[INITIAL_BATCH_SIZE], yi[INITIAL_BATCH_SIZE];
+    gdouble scale = 2.0 / MAX(map->width, map->height);
+    gsize block, i;
+
+    while (count) {
+	block = MIN(count, INITIAL_BATCH_SIZE);
+	probability_map_ints_batch(map, xi, yi, block);
+
+	for (i=0; i<block; i++) {
+	    x[i] = (xi[i] + uniform_variate() - map->width * 0.5) * scale;
+	    y[i] = (yi[i] + uniform_variate() - map->height * 0.5) * scale;
+	}
+
+	x += block;
+	y += block;
+	count -= block;
+    }
+}
+
+static void de_jong_load_initial_image(DeJong *self, const gchar *filename) {
+    GdkPixbuf *pixbuf;
+    GError *error = NULL;
+
+    /* An empty filename is stored as NULL, our default */
+    if (filename && !*filename)
+	filename = NULL;
+    if (filename == self->initial_image ||
+	(filename && self->initial_image && !strcmp(self->initial_image, filename)))
+	return;
+
+    g_free(self->initial_image);
+    self->initial_image = g_strdup(filename);
+    if (self->initial_map) {
+	g_object_unref(self->initial_map);
+	self->initial_map = NULL;
+    }
+    self->calc_dirty_flag = TRUE;
+
+    if (!filename)
+	return;
+
+    pixbuf = gdk_pixbuf_new_from_file(filename, &error);
+    if (!pixbuf) {
+	g_warning("Can't load initial conditions image: %s", error->message);
+	g_error_free(error);
+	return;
+    }
+    self->initial_map = probability_map_new_pixbuf(pixbuf);
+    gdk_pixbuf_unref(pixbuf);
+}
+
 
 /************************************************************************************/
 /**************************************************************************** Tools */
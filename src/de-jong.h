@@ -27,6 +27,7 @@
 
 #include <gtk/gtk.h>
 #include "iterative-map.h"
+#include "probability-map.h"
 
 G_BEGIN_DECLS
 
@@ -57,6 +58,8 @@ struct _DeJong {
     gint initial_conditions;
     gdouble initial_xscale, initial_yscale;
     gdouble initial_xoffset, initial_yoffset;
+    gchar* initial_image;
+    ProbabilityMap* initial_map;    /* Loaded from initial_image, or NULL */
 
     gboolean calc_dirty_flag;
 
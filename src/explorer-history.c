@@ -28,16 +28,32 @@
 #include <config.h>
 #include "explorer.h"
 #include "histogram-imager.h"
+#include "trace.h"
+
+typedef struct _HistoryNode HistoryNode;
+
+/* Thumbnails are colorized on a worker thread. The job owns the reduced
+ * histogram and the finished pixbuf until it's collected back on the main
+ * thread. 'node' is only touched from the main thread, and is cleared if the
+ * node is freed before its thumbnail arrives.
+ */
+typedef struct {
+    HistogramThumbnail* reduced;
+    GdkPixbuf*          thumbnail;
+    HistoryNode*        node;
+} ThumbnailJob;
 
 /* These are stored in the history_queue. The parameter string and
  * thumbnail are both owned by the history node.
  */
-typedef struct {
-    GTimeVal   timestamp;   /* The time at which this node was created */
-    GdkPixbuf* thumbnail;   /* Scaled-down version of the current histogram */
-    gchar*     params;      /* Serialized image parameters */
-    Explorer*  explorer;    /* For convenience in callbacks */
-} HistoryNode;
+struct _HistoryNode {
+    GTimeVal      timestamp;   /* The time at which this node was created */
+    GdkPixbuf*    thumbnail;   /* Scaled-down version of the current histogram */
+    gchar*        params;      /* Serialized image parameters */
+    Explorer*     explorer;    /* For convenience in callbacks */
+    ThumbnailJob* job;         /* Pending thumbnail, if it isn't ready yet */
+    GtkWidget*    menu_image;  /* Weak reference to a menu image waiting on our thumbnail */
+};
 
 struct delete_after_data {
     GtkWidget *menu;
@@ -47,10 +63,13 @@ struct delete_after_data {
 
 static void         delete_after       (GtkWidget *item, gpointer user_data);
 
-static HistoryNode* history_node_new   (HistogramImager* map);
+static HistoryNode* history_node_new   (Explorer* explorer, HistogramImager* map);
 static void         history_node_apply (HistoryNode* self, HistogramImager* map);
 static void         history_node_free  (HistoryNode* self);
 
+static void         thumbnail_worker   (gpointer data, gpointer user_data);
+static gboolean     thumbnail_collect  (gpointer user_data);
+
 static void         on_go_back         (GtkWidget *widget, Explorer *self);
 static void         on_go_forward      (GtkWidget *widget, Explorer *self);
 static void         on_go_menu_show    (GtkWidget *menu, Explorer *self);
@@ -78,6 +97,7 @@ void explorer_init_history(Explorer *self)
     GtkWidget *menu = glade_xml_get_widget(self->xml, "go_menu_menu");
 
     self->history_queue = g_queue_new();
+    self->history_thumbnailer = g_thread_pool_new(thumbnail_worker, NULL, 1, FALSE, NULL);
 
     /* Connect signal handlers
      */
@@ -100,6 +120,14 @@ void explorer_dispose_history(Explorer *self)
 	g_queue_free(self->history_queue);
 	self->history_queue = NULL;
     }
+
+    /* Finish any thumbnails in progress. Their results are still
+     * collected later, but they'll find their nodes gone.
+     */
+    if (self->history_thumbnailer) {
+	g_thread_pool_free(self->history_thumbnailer, FALSE, TRUE);
+	self->history_thumbnailer = NULL;
+    }
 }
 
 
@@ -107,7 +135,7 @@ void explorer_dispose_history(Explorer *self)
 /****************************************************************** History Nodes ***/
 /************************************************************************************/
 
-static HistoryNode* history_node_new   (HistogramImager* map)
+static HistoryNode* history_node_new   (Explorer* explorer, HistogramImager* map)
 {
     HistoryNode* self = g_new0(HistoryNode, 1);
     gint width, height;
@@ -115,11 +143,20 @@ static HistoryNode* history_node_new   (HistogramImager* map)
     g_get_current_time(&self->timestamp);
     self->params = parameter_holder_save_string(PARAMETER_HOLDER(map));
 
-    /* Use the normal icon size plus a little extra */
+    /* Use the normal icon size plus a little extra. The histogram is
+     * reduced to that size here, since it belongs to the main thread,
+     * but colorizing it happens in the background.
+     */
     gtk_icon_size_lookup(GTK_ICON_SIZE_MENU, &width, &height);
     width *= 1.75;
     height *= 1.75;
-    self->thumbnail = histogram_imager_make_thumbnail(map, width, height);
+
+    self->job = g_new0(ThumbnailJob, 1);
+    self->job->node = self;
+    trace_begin("thumbnail_reduce");
+    self->job->reduced = histogram_imager_reduce_thumbnail(map, width, height);
+    trace_end("thumbnail_reduce");
+    g_thread_pool_push(explorer->history_thumbnailer, self->job, NULL);
 
     return self;
 }
@@ -131,6 +168,14 @@ static void         history_node_apply (HistoryNode* self, HistogramImager* map)
 
 static void         history_node_free  (HistoryNode* self)
 {
+    if (self->job) {
+	self->job->node = NULL;
+	self->job = NULL;
+    }
+    if (self->menu_image) {
+	g_object_remove_weak_pointer(G_OBJECT(self->menu_image), (gpointer*) &self->menu_image);
+	self->menu_image = NULL;
+    }
     if (self->thumbnail) {
 	gdk_pixbuf_unref(self->thumbnail);
 	self->thumbnail = NULL;
@@ -143,6 +188,44 @@ static void         history_node_free  (HistoryNode* self)
 }
 
 
+static void         thumbnail_worker   (gpointer data, gpointer user_data)
+{
+    ThumbnailJob* job = data;
+
+    trace_begin("thumbnail_render");
+    job->thumbnail = histogram_thumbnail_render(job->reduced);
+    trace_end("thumbnail_render");
+    g_idle_add(thumbnail_collect, job);
+}
+
+static gboolean     thumbnail_collect  (gpointer user_data)
+{
+    /* Back on the main thread, hand a finished thumbnail to its node
+     * if it still exists, and to any menu item already waiting on it.
+     */
+    ThumbnailJob* job = user_data;
+    HistoryNode* node = job->node;
+
+    if (node) {
+	node->job = NULL;
+	node->thumbnail = job->thumbnail;
+	job->thumbnail = NULL;
+
+	if (node->menu_image) {
+	    gtk_image_set_from_pixbuf(GTK_IMAGE(node->menu_image), node->thumbnail);
+	    g_object_remove_weak_pointer(G_OBJECT(node->menu_image), (gpointer*) &node->menu_image);
+	    node->menu_image = NULL;
+	}
+    }
+
+    if (job->thumbnail)
+	gdk_pixbuf_unref(job->thumbnail);
+    histogram_thumbnail_free(job->reduced);
+    g_free(job);
+    return FALSE;
+}
+
+
 /************************************************************************************/
 /******************************************************************** History Queue */
 /************************************************************************************/
@@ -233,9 +316,15 @@ static void         explorer_add_go_item      (Explorer *self, GList *node_link)
     item = gtk_image_menu_item_new_with_label(label);
     g_free(label);
 
-    /* Add the thumbnail */
+    /* Add the thumbnail. If it's still being rendered, the image
+     * is filled in as soon as it arrives.
+     */
     image = gtk_image_new_from_pixbuf(node->thumbnail);
     gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item), image);
+    if (!node->thumbnail && !node->menu_image) {
+	node->menu_image = image;
+	g_object_add_weak_pointer(G_OBJECT(image), (gpointer*) &node->menu_image);
+    }
 
     /* Set up a callback to activate this node.
      * Note that its data is our node_link, not the Explorer.
@@ -315,7 +404,7 @@ static void         on_go_menu_show    (GtkWidget *menu, Explorer *self)
      * reliable than using a timer.
      */
     if (self->history_queue->length < 1)
-	explorer_append_history(self, history_node_new(HISTOGRAM_IMAGER(self->map)));
+	explorer_append_history(self, history_node_new(self, HISTOGRAM_IMAGER(self->map)));
 
     /* The first few items are straight from the most recent list */
     current = g_queue_peek_tail_link(self->history_queue);
@@ -401,7 +490,7 @@ static gboolean     on_record_change   (gpointer user_data)
 {
     Explorer* self = EXPLORER(user_data);
 
-    explorer_append_history(self, history_node_new(HISTOGRAM_IMAGER(self->map)));
+    explorer_append_history(self, history_node_new(self, HISTOGRAM_IMAGER(self->map)));
     self->history_timer = 0;
     return FALSE;
 }
@@ -0,0 +1,91 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * explorer-stats.c - The performance statistics window, for seeing where
+ *                    the time goes while exploring
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include "explorer.h"
+#include "render-stats.h"
+#include <gtk/gtk.h>
+
+#define STATS_UPDATE_INTERVAL  1000   /* Milliseconds */
+
+static gboolean  explorer_update_stats           (gpointer user_data);
+static gboolean  on_stats_window_delete          (GtkWidget *widget, GdkEvent *event,
+						  gpointer user_data);
+
+
+/************************************************************************************/
+/**************************************************** Initialization / Finalization */
+/************************************************************************************/
+
+void explorer_init_stats(Explorer *self)
+{
+    glade_xml_signal_connect_data(self->xml, "on_stats_window_delete", G_CALLBACK(on_stats_window_delete), self);
+    self->stats_timer = g_timeout_add(STATS_UPDATE_INTERVAL, explorer_update_stats, self);
+}
+
+void explorer_dispose_stats(Explorer *self)
+{
+    if (self->stats_timer) {
+	g_source_remove(self->stats_timer);
+	self->stats_timer = 0;
+    }
+}
+
+
+/************************************************************************************/
+/******************************************************************** GUI Callbacks */
+/************************************************************************************/
+
+static gboolean explorer_update_stats(gpointer user_data)
+{
+    Explorer *self = EXPLORER(user_data);
+    GtkWidget *window = glade_xml_get_widget(self->xml, "stats_window");
+    RenderStats stats;
+    gchar *text, *escaped, *markup;
+
+    /* Collecting is cheap, but there's no point while nobody's looking */
+    if (!GTK_WIDGET_VISIBLE(window))
+	return TRUE;
+
+    render_stats_collect(&stats, self->map);
+    text = render_stats_to_text(&stats);
+    escaped = g_markup_escape_text(text, -1);
+    markup = g_strdup_printf("<tt>%s</tt>", escaped);
+
+    gtk_label_set_markup(GTK_LABEL(glade_xml_get_widget(self->xml, "stats_label")), markup);
+
+    g_free(markup);
+    g_free(escaped);
+    g_free(text);
+    return TRUE;
+}
+
+static gboolean on_stats_window_delete(GtkWidget *widget, GdkEvent *event, gpointer user_data) {
+    /* Just hide the window when the user tries to close it */
+    Explorer *self = EXPLORER(user_data);
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(glade_xml_get_widget(self->xml, "toggle_stats_window")), FALSE);
+    return TRUE;
+}
+
+/* The End */
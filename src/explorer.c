@@ -165,6 +165,7 @@ static void explorer_dispose(GObject *gobject) {
     explorer_dispose_animation(self);
     explorer_dispose_cluster(self);
     explorer_dispose_history(self);
+    explorer_dispose_stats(self);
 
     if (self->speed_timer) {
 	g_timer_destroy(self->speed_timer);
@@ -213,6 +214,7 @@ Explorer* explorer_new(IterativeMap *map, Animation *animation) {
     explorer_init_tools(self);
     explorer_init_cluster(self);
     explorer_init_about(self);
+    explorer_init_stats(self);
 
     /* Start the iterative map rendering in the background, and get a callback every time a block
      * of calculations finish so we can update the GUI.
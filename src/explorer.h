@@ -96,6 +96,9 @@ struct _Explorer {
     guint                history_timer;
     GList*               history_current_link;
     gboolean             history_freeze;
+    GThreadPool*         history_thumbnailer;
+
+    guint                stats_timer;
 
 #ifdef HAVE_GNET
     ClusterModel*        cluster_model;
@@ -131,6 +134,9 @@ void      explorer_dispose_cluster       (Explorer *self);
 
 void      explorer_init_about            (Explorer *self);
 
+void      explorer_init_stats            (Explorer *self);
+void      explorer_dispose_stats         (Explorer *self);
+
 void      explorer_init_history          (Explorer *self);
 void      explorer_dispose_history       (Explorer *self);
 
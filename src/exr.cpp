@@ -24,6 +24,7 @@
 
 extern "C" {
 #include "histogram-imager.h"
+#include "trace.h"
 #include "config.h"
 }
 
@@ -39,12 +40,14 @@ enum {
 
 extern "C" void exr_save_image_file(HistogramImager *hi, const gchar* filename, GError **error)
 {
+    trace_begin ("save_exr");
     try {
 	exr_save_real (hi, filename);
     } catch (const std::exception &exc) {
 	GError *nerror = g_error_new (fyre_exr_error_quark(), FYRE_EXR_SAVE_FAILURE, exc.what());
 	*error = nerror;
     }
+    trace_end ("save_exr");
 }
 
 void
@@ -0,0 +1,190 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * histogram-dump.c - Saving and merging raw histograms for offline sharded renders
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "histogram-dump.h"
+#include "chunked-file.h"
+#include "de-jong.h"
+
+/* The file is a chunked file with the parameters first, then the iteration
+ * count as text so dumps can move between machines, then any number of
+ * histogram chunks. Each histogram chunk is one export, and since exporting
+ * clears what it sends, every chunk is merged from the start of the histogram.
+ */
+#define FILE_SIGNATURE        "Fyre Histogram\n\r\xFF\n"
+#define CHUNK_FYRE_PARAMS     CHUNK_TYPE('f','y','P','R')   /* Fyre parameters, as a string */
+#define CHUNK_ITERATIONS      CHUNK_TYPE('i','t','e','R')   /* Iteration count, as a string */
+#define CHUNK_HISTOGRAM       CHUNK_TYPE('h','s','R','L')   /* Run-length histogram stream */
+
+#define HISTOGRAM_CHUNK_SIZE  (16 * 1024 * 1024)
+
+static gboolean   histogram_dump_check_size   (IterativeMap*  map,
+					       const gchar*   params,
+					       const gchar*   filename,
+					       GError**       error);
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+gboolean         histogram_dump_save              (IterativeMap*   map,
+						   const gchar*    filename,
+						   GError**        error)
+{
+    FILE* f = fopen(filename, "wb");
+    gchar* params;
+    gchar* iterations;
+    guchar* buffer;
+    gsize size;
+
+    if (!f) {
+	g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+		    "Can't open '%s' for writing: %s", filename, g_strerror(errno));
+	return FALSE;
+    }
+
+    chunked_file_write_signature(f, FILE_SIGNATURE);
+
+    params = parameter_holder_save_string(PARAMETER_HOLDER(map));
+    chunked_file_write_chunk(f, CHUNK_FYRE_PARAMS, strlen(params), (const guchar*) params);
+    g_free(params);
+
+    iterations = g_strdup_printf("%.20e", map->iterations);
+    chunked_file_write_chunk(f, CHUNK_ITERATIONS, strlen(iterations), (const guchar*) iterations);
+    g_free(iterations);
+
+    buffer = g_malloc(HISTOGRAM_CHUNK_SIZE);
+    while ((size = histogram_imager_export_stream(HISTOGRAM_IMAGER(map), buffer, HISTOGRAM_CHUNK_SIZE)))
+	chunked_file_write_chunk(f, CHUNK_HISTOGRAM, size, buffer);
+    g_free(buffer);
+
+    if (fclose(f) != 0) {
+	g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+		    "Error writing '%s': %s", filename, g_strerror(errno));
+	return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean         histogram_dump_merge             (IterativeMap*   map,
+						   const gchar*    filename,
+						   gboolean        load_params,
+						   GError**        error)
+{
+    FILE* f = fopen(filename, "rb");
+    gboolean success = TRUE;
+    ChunkType type;
+    gsize length;
+    guchar* data;
+    gchar* text;
+
+    if (!f) {
+	g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+		    "Can't open '%s': %s", filename, g_strerror(errno));
+	return FALSE;
+    }
+    if (!chunked_file_read_signature(f, FILE_SIGNATURE)) {
+	g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+		    "'%s' is not a Fyre histogram dump", filename);
+	fclose(f);
+	return FALSE;
+    }
+
+    while (success && chunked_file_read_chunk(f, &type, &length, &data)) {
+	switch (type) {
+
+	case CHUNK_FYRE_PARAMS:
+	    text = g_strndup((const gchar*) data, length);
+	    if (load_params) {
+		parameter_holder_load_string(PARAMETER_HOLDER(map), text);
+		histogram_imager_clear(HISTOGRAM_IMAGER(map));
+		map->iterations = 0;
+	    }
+	    else {
+		success = histogram_dump_check_size(map, text, filename, error);
+	    }
+	    g_free(text);
+	    break;
+
+	case CHUNK_ITERATIONS:
+	    text = g_strndup((const gchar*) data, length);
+	    map->iterations += g_ascii_strtod(text, NULL);
+	    g_free(text);
+	    break;
+
+	case CHUNK_HISTOGRAM:
+	    histogram_imager_merge_stream(HISTOGRAM_IMAGER(map), data, length);
+	    break;
+
+	default:
+	    chunked_file_warn_unknown_type(type);
+	}
+	g_free(data);
+    }
+
+    fclose(f);
+    return success;
+}
+
+
+/************************************************************************************/
+/************************************************************************** Private */
+/************************************************************************************/
+
+static gboolean   histogram_dump_check_size   (IterativeMap*  map,
+					       const gchar*   params,
+					       const gchar*   filename,
+					       GError**       error)
+{
+    /* Histograms can only be added if they have the same shape. Any
+     * other difference is probably a mistake, but not a fatal one.
+     */
+    HistogramImager* dest = HISTOGRAM_IMAGER(map);
+    HistogramImager* dump = HISTOGRAM_IMAGER(de_jong_new());
+    gchar* dest_params = parameter_holder_save_string(PARAMETER_HOLDER(map));
+    gboolean success = TRUE;
+
+    parameter_holder_load_string(PARAMETER_HOLDER(dump), params);
+
+    if (dump->width != dest->width || dump->height != dest->height ||
+	dump->oversample != dest->oversample) {
+	g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+		    "'%s' is %dx%d with oversampling %d, but earlier dumps are %dx%d with oversampling %d",
+		    filename, dump->width, dump->height, dump->oversample,
+		    dest->width, dest->height, dest->oversample);
+	success = FALSE;
+    }
+    else if (strcmp(params, dest_params)) {
+	g_warning("'%s' has different parameters from earlier dumps", filename);
+    }
+
+    g_free(dest_params);
+    g_object_unref(dump);
+    return success;
+}
+
+/* The End */
@@ -0,0 +1,60 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * histogram-dump.h - Saving and merging raw histograms for offline sharded renders
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __HISTOGRAM_DUMP_H__
+#define __HISTOGRAM_DUMP_H__
+
+#include <glib.h>
+#include "iterative-map.h"
+
+G_BEGIN_DECLS
+
+/* A histogram dump holds a map's parameters, its iteration count, and its
+ * raw histogram in the run-length format of histogram_imager_export_stream().
+ * Renders can be split into independent shards that each dump their
+ * histogram, then summed into one image later without any network.
+ */
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+/* Write the map's histogram to a dump file. This empties the histogram. */
+gboolean         histogram_dump_save              (IterativeMap*   map,
+						   const gchar*    filename,
+						   GError**        error);
+
+/* Add a dump file's histogram and iterations to the map. If load_params is
+ * set, the map first takes on the dump's parameters and is cleared. Otherwise
+ * the dump must have the same image size and oversampling as the map.
+ */
+gboolean         histogram_dump_merge             (IterativeMap*   map,
+						   const gchar*    filename,
+						   gboolean        load_params,
+						   GError**        error);
+
+G_END_DECLS
+
+#endif /* __HISTOGRAM_DUMP_H__ */
+
+/* The End */
@@ -26,6 +26,8 @@
 #include "histogram-imager.h"
 #include "var-int.h"
 #include "image-fu.h"
+#include "render-stats.h"
+#include "trace.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -45,6 +47,7 @@ static void histogram_imager_check_dirty_flags (HistogramImager *self);
 static void histogram_imager_require_histogram (HistogramImager *self);
 static void histogram_imager_require_image (HistogramImager *self);
 static void histogram_imager_require_oversample_tables (HistogramImager *self);
+static void histogram_imager_colorize_rows (HistogramImager *self, guint32 *pixel_p);
 static gulong histogram_imager_get_max_usable_density (HistogramImager *self);
 
 static gboolean update_double_if_necessary (gdouble new_value, gboolean *dirty_flag, gdouble *param, gdouble epsilon);
@@ -53,6 +56,12 @@ static gboolean update_boolean_if_necessary (gboolean new_value, gboolean *dirty
 static gboolean update_color_if_necessary (const GdkColor* new_value, gboolean *dirty_flag, GdkColor *param);
 static gchar* describe_color (GdkColor *c);
 
+typedef struct {
+    int r, g, b, a;
+} ColorComponents;
+
+static void interpolate_color (float luma, const GdkColor *fgcolor, const GdkColor *bgcolor, guint fgalpha, guint bgalpha, ColorComponents *color);
+
 enum {
     PROP_0,
     PROP_WIDTH,
@@ -184,7 +193,7 @@ histogram_imager_init_render_params (GObjectClass *object_class)
 				      "The relative strength, darkness, or brightness of the image",
 				      0, 100, 0.05,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_COSMETIC);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.001, 0.01, 3);
     g_object_class_install_property  (object_class, PROP_EXPOSURE, spec);
@@ -194,7 +203,7 @@ histogram_imager_init_render_params (GObjectClass *object_class)
 				      "A gamma correction applied while rendering the image",
 				      0, 10, 1,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_COSMETIC);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.01, 0.1, 3);
     g_object_class_install_property  (object_class, PROP_GAMMA, spec);
@@ -204,7 +213,7 @@ histogram_imager_init_render_params (GObjectClass *object_class)
 				      "Gamma correction used when downconverting oversampled histograms",
 				      0, 10, 1.66,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_LAX_VALIDATION | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_COSMETIC);
     param_spec_set_group             (spec, current_group);
     param_spec_set_increments        (spec, 0.01, 0.1, 3);
     param_spec_set_dependency        (spec, "oversample-enabled");
@@ -214,21 +223,21 @@ histogram_imager_init_render_params (GObjectClass *object_class)
 				      "Foreground",
 				      "The foreground color, as a color name or #RRGGBB hex triple",
 				      "#000000",
-				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED);
+				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED | PARAM_COSMETIC);
     g_object_class_install_property  (object_class, PROP_FGCOLOR, spec);
 
     spec = g_param_spec_string       ("bgcolor",
 				      "Background",
 				      "The background color, as a color name or #RRGGBB hex triple",
 				      "#FFFFFF",
-				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED);
+				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED | PARAM_COSMETIC);
     g_object_class_install_property  (object_class, PROP_BGCOLOR, spec);
 
     spec = g_param_spec_boxed        ("fgcolor_gdk",
 				      "Foreground",
 				      "The foreground color, as a GdkColor",
 				      GDK_TYPE_COLOR,
-				      G_PARAM_READWRITE | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_READWRITE | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_COSMETIC);
     param_spec_set_group             (spec, current_group);
     g_param_spec_set_qdata           (spec, g_quark_from_static_string("opacity-property"), "fgalpha");
     g_object_class_install_property  (object_class, PROP_FGCOLOR_GDK, spec);
@@ -237,7 +246,7 @@ histogram_imager_init_render_params (GObjectClass *object_class)
 				      "Background",
 				      "The background color, as a GdkColor",
 				      GDK_TYPE_COLOR,
-				      G_PARAM_READWRITE | PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      G_PARAM_READWRITE | PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_COSMETIC);
     param_spec_set_group             (spec, current_group);
     g_param_spec_set_qdata           (spec, g_quark_from_static_string("opacity-property"), "bgalpha");
     g_object_class_install_property  (object_class, PROP_BGCOLOR_GDK, spec);
@@ -247,7 +256,7 @@ histogram_imager_init_render_params (GObjectClass *object_class)
 				      "The foreground color's opacity",
 				      0, 65535, 65535,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      PARAM_INTERPOLATE);
+				      PARAM_INTERPOLATE | PARAM_COSMETIC);
     g_object_class_install_property  (object_class, PROP_FGALPHA, spec);
 
     spec = g_param_spec_uint         ("bgalpha",
@@ -255,7 +264,7 @@ histogram_imager_init_render_params (GObjectClass *object_class)
 				      "The background color's opacity",
 				      0, 65535, 65535,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      PARAM_INTERPOLATE);
+				      PARAM_INTERPOLATE | PARAM_COSMETIC);
     g_object_class_install_property  (object_class, PROP_BGALPHA, spec);
 
     spec = g_param_spec_boolean      ("clamped",
@@ -263,7 +272,7 @@ histogram_imager_init_render_params (GObjectClass *object_class)
 				      "When set, luminances are clamped to [0,1] before linear interpolation",
 				      FALSE,
 				      G_PARAM_READWRITE | G_PARAM_CONSTRUCT | PARAM_SERIALIZED |
-				      PARAM_INTERPOLATE | PARAM_IN_GUI);
+				      PARAM_INTERPOLATE | PARAM_IN_GUI | PARAM_COSMETIC);
     param_spec_set_group             (spec, current_group);
     g_object_class_install_property  (object_class, PROP_CLAMPED, spec);
 }
@@ -567,54 +576,239 @@ void
 histogram_imager_save_image_file (HistogramImager *self, const gchar *filename, GError **error)
 {
     /* Save our current image to a .PNG file */
+    histogram_imager_update_image (self);
+    histogram_imager_save_image_pixbuf (self, self->image, filename, error);
+}
+
+void
+histogram_imager_save_image_pixbuf (HistogramImager *self, GdkPixbuf *image,
+				    const gchar *filename, GError **error)
+{
     gchar *params;
 
-    histogram_imager_update_image (self);
+    trace_begin ("save_png");
 
     /* Save our current parameters in a tEXt chunk, using a format that
      * is both human-readable and easy to load parameters from automatically.
      */
     params = parameter_holder_save_string (PARAMETER_HOLDER(self));
-    gdk_pixbuf_save (self->image, filename, "png", error, "tEXt::fyre_params", params, NULL);
+    gdk_pixbuf_save (image, filename, "png", error, "tEXt::fyre_params", params, NULL);
     g_free (params);
+    trace_end ("save_png");
 }
 
-GdkPixbuf*
-histogram_imager_make_thumbnail (HistogramImager *self, guint max_width, guint max_height)
+/************************************************************************************/
+/*********************************************************************** Thumbnails */
+/************************************************************************************/
+
+/* A reduced histogram, ready to be colorized into a thumbnail. This holds
+ * a snapshot of everything needed to colorize it, so it can be rendered on
+ * any thread without touching the HistogramImager again.
+ */
+struct _HistogramThumbnail {
+    guint width, height;
+    float *counts;          /* Average histogram count for each thumbnail pixel */
+    float *lumas;           /* Average luminance of those buckets, after gamma and clamping */
+
+    float pixel_scale;
+    GdkColor fgcolor, bgcolor;
+    guint fgalpha, bgalpha;
+};
+
+/* Each thumbnail pixel averages at most this many histogram buckets along
+ * each axis, spread evenly over the area it covers. This keeps the cost of a
+ * thumbnail proportional to its own size rather than the histogram's, so it
+ * stays cheap on the main thread no matter how large the render is.
+ */
+#define THUMBNAIL_SAMPLES 4
+
+static guint*
+thumbnail_sample_positions (guint hist_size, guint thumb_size, guint *samples)
+{
+    /* Choose 'samples' histogram positions within the span covered by each
+     * thumbnail pixel, returning them as one flat array.
+     */
+    guint *positions, *p;
+    guint i, j, start, span, pos;
+
+    *samples = CLAMP(hist_size / thumb_size, 1, THUMBNAIL_SAMPLES);
+    p = positions = g_new(guint, thumb_size * (*samples));
+
+    for (i=0; i<thumb_size; i++) {
+	start = (guint) (((guint64) i) * hist_size / thumb_size);
+	span = (guint) (((guint64) i+1) * hist_size / thumb_size) - start;
+
+	for (j=0; j<*samples; j++) {
+	    pos = start + ((2*j + 1) * span) / (2 * (*samples));
+	    *(p++) = MIN(pos, hist_size - 1);
+	}
+    }
+    return positions;
+}
+
+HistogramThumbnail*
+histogram_imager_reduce_thumbnail (HistogramImager *self, guint max_width, guint max_height)
 {
     float aspect = ((float)self->width) / ((float)self->height);
-    guint width, height;
-    GdkPixbuf *thumb;
+    HistogramThumbnail *thumb = g_new0(HistogramThumbnail, 1);
+    guint *x_positions, *y_positions, *row;
+    guint x_samples, y_samples;
+    guint x, y, sx, sy, hy, count, luma_clamp;
+    guint region_first, region_rows;
+    int hist_width, hist_height;
+    float *count_p, *luma_p;
+    float luma, scale, count_sum, luma_sum;
+    double one_over_gamma = 1/self->gamma;
 
-    /* Make sure the histogram is up to date */
-    histogram_imager_update_image (self);
+    histogram_imager_check_dirty_flags (self);
+    histogram_imager_require_histogram (self);
 
     /* Scale it down aspect-correctly */
     if (aspect > 1) {
-	width = max_width;
-	height = width / aspect;
+	thumb->width = max_width;
+	thumb->height = thumb->width / aspect;
     }
     else {
-	height = max_height;
-	width = height * aspect;
+	thumb->height = max_height;
+	thumb->width = thumb->height * aspect;
+    }
+    thumb->width = MAX(thumb->width, 5);
+    thumb->height = MAX(thumb->height, 5);
+
+    /* Snapshot the rendering parameters */
+    thumb->pixel_scale = histogram_imager_get_pixel_scale (self);
+    thumb->fgcolor = self->fgcolor;
+    thumb->bgcolor = self->bgcolor;
+    thumb->fgalpha = self->fgalpha;
+    thumb->bgalpha = self->bgalpha;
+
+    /* Counts are limited the same way as the color table, so counts past
+     * the saturation point look the same as in the full image.
+     */
+    luma_clamp = MIN(histogram_imager_get_max_usable_density (self), self->peak_density);
+
+    /* Average a fixed grid of buckets under each thumbnail pixel. Each
+     * sample's luminance is taken before averaging, rather than taking the
+     * luminance of the average count, matching the way update_image()
+     * colorizes oversampled buckets before combining them. Rows outside
+     * our region are empty buckets, so their samples add nothing.
+     */
+    histogram_imager_get_hist_size (self, &hist_width, &hist_height);
+    histogram_imager_get_region (self, &region_first, &region_rows);
+    region_first *= self->oversample;
+    region_rows *= self->oversample;
+    x_positions = thumbnail_sample_positions (hist_width, thumb->width, &x_samples);
+    y_positions = thumbnail_sample_positions (hist_height, thumb->height, &y_samples);
+    scale = 1.0 / (x_samples * y_samples);
+
+    count_p = thumb->counts = g_new(float, thumb->width * thumb->height);
+    luma_p = thumb->lumas = g_new(float, thumb->width * thumb->height);
+
+    for (y=0; y<thumb->height; y++) {
+	for (x=0; x<thumb->width; x++) {
+	    count_sum = luma_sum = 0;
+
+	    for (sy=0; sy<y_samples; sy++) {
+		hy = y_positions[y * y_samples + sy];
+		if (hy < region_first || hy >= region_first + region_rows)
+		    continue;
+		row = self->histogram + (hy - region_first) * hist_width;
+
+		for (sx=0; sx<x_samples; sx++) {
+		    count = row[x_positions[x * x_samples + sx]];
+		    if (!count)
+			continue;
+		    count_sum += count;
+
+		    luma = pow(MIN(count, luma_clamp) * thumb->pixel_scale, one_over_gamma);
+		    if (self->clamped && luma > 1)
+			luma = 1;
+		    luma_sum += luma;
+		}
+	    }
+	    *(count_p++) = count_sum * scale;
+	    *(luma_p++) = luma_sum * scale;
+	}
     }
-    width = MAX(width, 5);
-    height = MAX(height, 5);
-    thumb = gdk_pixbuf_scale_simple (self->image, width, height, GDK_INTERP_BILINEAR);
+
+    g_free (x_positions);
+    g_free (y_positions);
+    return thumb;
+}
+
+GdkPixbuf*
+histogram_thumbnail_colorize (HistogramThumbnail *thumb)
+{
+    /* Colorize the reduced luminances using the same mapping as the color
+     * table. Since we're only working at thumbnail size, we can afford to
+     * evaluate it directly for each pixel rather than building a table.
+     */
+    GdkPixbuf *image = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, thumb->width, thumb->height);
+    guint32 *pixel_p;
+    float *luma_p = thumb->lumas;
+    ColorComponents color;
+    guint x, y;
+
+    for (y=0; y<thumb->height; y++) {
+	pixel_p = (guint32*) (gdk_pixbuf_get_pixels (image) + y * gdk_pixbuf_get_rowstride (image));
+	for (x=0; x<thumb->width; x++) {
+	    interpolate_color (*(luma_p++), &thumb->fgcolor, &thumb->bgcolor,
+			       thumb->fgalpha, thumb->bgalpha, &color);
+	    *(pixel_p++) = IMAGEFU_COLOR(color.a, color.r, color.g, color.b);
+	}
+    }
+    return image;
+}
+
+GdkPixbuf*
+histogram_thumbnail_render (HistogramThumbnail *thumb)
+{
+    GdkPixbuf *image = histogram_thumbnail_colorize (thumb);
 
     /* Do an in-place composite of a checkerboard behind this image, to make alpha visible */
-    image_add_checkerboard(thumb);
+    image_add_checkerboard(image);
 
     /* If the image is particularly small, enhance its visibility */
-    if (width < 128 || height < 128)
-	image_adjust_levels(thumb);
+    if (thumb->width < 128 || thumb->height < 128)
+	image_adjust_levels(image);
 
     /* Put a standard frame around it */
-    image_add_thumbnail_frame(thumb);
+    image_add_thumbnail_frame(image);
 
-    return thumb;
+    return image;
+}
+
+const float*
+histogram_thumbnail_get_counts (HistogramThumbnail *thumb,
+				guint              *width,
+				guint              *height,
+				float              *pixel_scale)
+{
+    if (width)
+	*width = thumb->width;
+    if (height)
+	*height = thumb->height;
+    if (pixel_scale)
+	*pixel_scale = thumb->pixel_scale;
+    return thumb->counts;
+}
+
+void
+histogram_thumbnail_free (HistogramThumbnail *thumb)
+{
+    g_free (thumb->counts);
+    g_free (thumb->lumas);
+    g_free (thumb);
 }
 
+GdkPixbuf*
+histogram_imager_make_thumbnail (HistogramImager *self, guint max_width, guint max_height)
+{
+    HistogramThumbnail *thumb = histogram_imager_reduce_thumbnail (self, max_width, max_height);
+    GdkPixbuf *image = histogram_thumbnail_render (thumb);
+    histogram_thumbnail_free (thumb);
+    return image;
+}
 
 /************************************************************************************/
 /************************************************************************* Plotting */
@@ -637,8 +831,11 @@ histogram_imager_prepare_plots (HistogramImager *self,
 {
     histogram_imager_check_dirty_flags(self);
     histogram_imager_require_histogram(self);
+    histogram_imager_get_region(self, &plot->first_row, &plot->num_rows);
     plot->histogram = self->histogram;
     plot->hist_width = self->width * self->oversample;
+    plot->first_row *= self->oversample;
+    plot->num_rows *= self->oversample;
     plot->density = 0;
     plot->plot_count = 0;
 }
@@ -663,6 +860,9 @@ histogram_imager_update_image (HistogramImager *self)
     /* Convert our histogram counts to an 8-bit ARGB image data using our color lookup table,
      * downsampling by combining all count buckets that represent each of our output pixels.
      */
+    double start = render_stats_clock ();
+
+    trace_begin ("update_image");
     histogram_imager_check_dirty_flags (self);
     histogram_imager_require_histogram (self);
     histogram_imager_require_image (self);
@@ -670,98 +870,150 @@ histogram_imager_update_image (HistogramImager *self)
 
     {
 	guint32 *pixel_p;
-	guint32* const color_table = self->color_table.table;
-	guint *hist_p, *sample_p;
-	guint count, hist_clamp;
-	const guint oversample = self->oversample;
-	int x, y;
+	guint32 background = self->color_table.table[0];
+	guint region_first, region_rows;
+	int x;
 
 	pixel_p = (guint32*) gdk_pixbuf_get_pixels (self->image);
-	hist_p = self->histogram;
+	histogram_imager_get_region (self, &region_first, &region_rows);
+
+	/* Rows outside our region get the empty bucket's color */
+	for (x = region_first * self->width; x; x--)
+	    *(pixel_p++) = background;
+
+	histogram_imager_colorize_rows (self, pixel_p);
+	pixel_p += region_rows * self->width;
 
-	/* Clamp count values to the size of our color table.
-	 * Assuming the color table generator did it's job
-	 * correctly, any count values higher than the maximum
-	 * one in the table would generate the same color as
-	 * the highest one.
+	for (x = (self->height - region_first - region_rows) * self->width; x; x--)
+	    *(pixel_p++) = background;
+    }
+
+    self->colorize_seconds += render_stats_clock () - start;
+    self->colorize_count++;
+    trace_end ("update_image");
+}
+
+void
+histogram_imager_colorize_region (HistogramImager *self,
+				  GdkPixbuf       *image,
+				  gdouble          density)
+{
+    /* Colorize only our region, into the matching rows of an image the
+     * size of the whole output. Exposure follows the density we're given
+     * instead of our own, so bands colorized one at a time match.
+     */
+    gdouble total_points = self->total_points_plotted;
+    guint region_first;
+
+    histogram_imager_check_dirty_flags (self);
+    histogram_imager_require_histogram (self);
+    histogram_imager_get_region (self, &region_first, NULL);
+
+    self->total_points_plotted = density * histogram_imager_get_region_buckets (self);
+    histogram_imager_generate_color_table (self, TRUE);
+    histogram_imager_colorize_rows (self, ((guint32*) gdk_pixbuf_get_pixels (image)) +
+				    region_first * self->width);
+
+    self->total_points_plotted = total_points;
+    histogram_imager_generate_color_table (self, TRUE);
+}
+
+static void
+histogram_imager_colorize_rows (HistogramImager *self, guint32 *pixel_p)
+{
+    /* Convert every row of our region, starting at pixel_p, using the current color table */
+    guint32* const color_table = self->color_table.table;
+    guint *hist_p, *sample_p;
+    guint count, hist_clamp;
+    const guint oversample = self->oversample;
+    guint region_rows;
+    int x, y;
+
+    hist_p = self->histogram;
+    histogram_imager_get_region (self, NULL, &region_rows);
+
+    /* Clamp count values to the size of our color table.
+     * Assuming the color table generator did it's job
+     * correctly, any count values higher than the maximum
+     * one in the table would generate the same color as
+     * the highest one.
+     */
+    hist_clamp = self->color_table.filled_size - 1;
+
+    if (oversample > 1) {
+	/* Nice ugly loop that downsamples multiple (oversample^2)
+	 * histogram buckets to each pixel
 	 */
-	hist_clamp = self->color_table.filled_size - 1;
 
-	if (oversample > 1) {
-	    /* Nice ugly loop that downsamples multiple (oversample^2)
-	     * histogram buckets to each pixel
-	     */
+	const int sample_stride = (self->width * oversample) - oversample;
+	const int sample_y_stride = (self->width * oversample) * (oversample - 1);
+	guint* linearize_table;
+	guint8* nonlinearize_table;
+	int sample_x, sample_y;
+	int ch0, ch1, ch2, ch3;
+	union {
+	    guint32 word;
+	    struct {
+		guchar ch0, ch1, ch2, ch3;
+	    } channels;
+	} sample_pixel;
+
+	histogram_imager_require_oversample_tables (self);
+	linearize_table = self->oversample_tables.linearize;
+	nonlinearize_table = self->oversample_tables.nonlinearize;
+
+	for (y=region_rows; y; y--) {
+	    for (x=self->width; x; x--) {
+
+		/* Convert each oversampled input point to a color separately, then
+		 * average the resulting colors using the ch0 through ch3 channel
+		 * accumulators. Note that which channel is which depends on the
+		 * machine's endianness, so we can't name them red, green, blue,
+		 * and alpha here. This can be though of as dividing each pixel into
+		 * and oversample-by-oversample grid of squares and plotting one
+		 * histogram bucket in each, with antialiasing.
+		 */
 
-	    const int sample_stride = (self->width * oversample) - oversample;
-	    const int sample_y_stride = (self->width * oversample) * (oversample - 1);
-	    guint* linearize_table;
-	    guint8* nonlinearize_table;
-	    int sample_x, sample_y;
-	    int ch0, ch1, ch2, ch3;
-	    union {
-		guint32 word;
-		struct {
-		    guchar ch0, ch1, ch2, ch3;
-		} channels;
-	    } sample_pixel;
-
-	    histogram_imager_require_oversample_tables (self);
-	    linearize_table = self->oversample_tables.linearize;
-	    nonlinearize_table = self->oversample_tables.nonlinearize;
-
-	    for (y=self->height; y; y--) {
-		for (x=self->width; x; x--) {
-
-		    /* Convert each oversampled input point to a color separately, then
-		     * average the resulting colors using the ch0 through ch3 channel
-		     * accumulators. Note that which channel is which depends on the
-		     * machine's endianness, so we can't name them red, green, blue,
-		     * and alpha here. This can be though of as dividing each pixel into
-		     * and oversample-by-oversample grid of squares and plotting one
-		     * histogram bucket in each, with antialiasing.
-		     */
-
-		    ch0 = ch1 = ch2 = ch3 = 0;
-		    sample_p = hist_p;
-
-		    for (sample_y=oversample; sample_y; sample_y--) {
-			for (sample_x=oversample; sample_x; sample_x--) {
-
-			    count = *(sample_p++);
-			    if (count > hist_clamp)
-				sample_pixel.word = color_table[hist_clamp];
-			    else
-				sample_pixel.word = color_table[count];
-
-			    ch0 += linearize_table[sample_pixel.channels.ch0];
-			    ch1 += linearize_table[sample_pixel.channels.ch1];
-			    ch2 += linearize_table[sample_pixel.channels.ch2];
-			    ch3 += linearize_table[sample_pixel.channels.ch3];
-			}
-			sample_p += sample_stride;
-		    }
-		    hist_p += oversample;
+		ch0 = ch1 = ch2 = ch3 = 0;
+		sample_p = hist_p;
 
-		    sample_pixel.channels.ch0 = nonlinearize_table[ch0];
-		    sample_pixel.channels.ch1 = nonlinearize_table[ch1];
-		    sample_pixel.channels.ch2 = nonlinearize_table[ch2];
-		    sample_pixel.channels.ch3 = nonlinearize_table[ch3];
-		    *(pixel_p++) = sample_pixel.word;
+		for (sample_y=oversample; sample_y; sample_y--) {
+		    for (sample_x=oversample; sample_x; sample_x--) {
+
+			count = *(sample_p++);
+			if (count > hist_clamp)
+			    sample_pixel.word = color_table[hist_clamp];
+			else
+			    sample_pixel.word = color_table[count];
+
+			ch0 += linearize_table[sample_pixel.channels.ch0];
+			ch1 += linearize_table[sample_pixel.channels.ch1];
+			ch2 += linearize_table[sample_pixel.channels.ch2];
+			ch3 += linearize_table[sample_pixel.channels.ch3];
+		    }
+		    sample_p += sample_stride;
 		}
-		hist_p += sample_y_stride;
+		hist_p += oversample;
+
+		sample_pixel.channels.ch0 = nonlinearize_table[ch0];
+		sample_pixel.channels.ch1 = nonlinearize_table[ch1];
+		sample_pixel.channels.ch2 = nonlinearize_table[ch2];
+		sample_pixel.channels.ch3 = nonlinearize_table[ch3];
+		*(pixel_p++) = sample_pixel.word;
 	    }
+	    hist_p += sample_y_stride;
 	}
-	else {
-	    /* A much simpler and faster loop to use when oversampling is disabled */
-
-	    for (y=self->height; y; y--) {
-		for (x=self->width; x; x--) {
-		    count = *(hist_p++);
-		    if (count > hist_clamp)
-			*(pixel_p++) = color_table[hist_clamp];
-		    else
-			*(pixel_p++) = color_table[count];
-		}
+    }
+    else {
+	/* A much simpler and faster loop to use when oversampling is disabled */
+
+	for (y=region_rows; y; y--) {
+	    for (x=self->width; x; x--) {
+		count = *(hist_p++);
+		if (count > hist_clamp)
+		    *(pixel_p++) = color_table[hist_clamp];
+		else
+		    *(pixel_p++) = color_table[count];
 	    }
 	}
     }
@@ -815,8 +1067,10 @@ histogram_imager_get_pixel_scale (HistogramImager *self)
     if (!self->total_points_plotted)
 	return 0;
 
-    /* Calculate the average histogram density */
-    density = self->total_points_plotted / (self->width * self->height * self->oversample * self->oversample);
+    /* Calculate the average histogram density. Only points landing in our
+     * region were counted, so this is measured over the region's area.
+     */
+    density = self->total_points_plotted / histogram_imager_get_region_buckets (self);
 
     /* fscale is a floating point number that, when multiplied by a raw
      * counts[] value, gives values between 0 and 1 corresponding to full
@@ -834,6 +1088,25 @@ histogram_imager_get_pixel_scale (HistogramImager *self)
     return fscale;
 }
 
+static void
+interpolate_color (float luma, const GdkColor *fgcolor, const GdkColor *bgcolor,
+		   guint fgalpha, guint bgalpha, ColorComponents *color)
+{
+    /* Linearly interpolate between fgcolor and bgcolor, producing 8-bit
+     * components. Luma values outside [0,1] extrapolate, but the resulting
+     * components are always clamped.
+     */
+    color->r = ((int)(bgcolor->red   * (1-luma) + fgcolor->red   * luma)) >> 8;
+    color->g = ((int)(bgcolor->green * (1-luma) + fgcolor->green * luma)) >> 8;
+    color->b = ((int)(bgcolor->blue  * (1-luma) + fgcolor->blue  * luma)) >> 8;
+    color->a = ((int)(bgalpha        * (1-luma) + fgalpha        * luma)) >> 8;
+
+    color->r = CLAMP(color->r, 0, 255);
+    color->g = CLAMP(color->g, 0, 255);
+    color->b = CLAMP(color->b, 0, 255);
+    color->a = CLAMP(color->a, 0, 255);
+}
+
 static void
 histogram_imager_generate_color_table (HistogramImager *self, gboolean force)
 {
@@ -847,9 +1120,7 @@ histogram_imager_generate_color_table (HistogramImager *self, gboolean force)
     double one_over_gamma = 1/self->gamma;
     float distance = 0;
     gulong color_table_size;
-    struct {
-	int r, g, b, a;
-    } current, previous;
+    ColorComponents current, previous;
 
     /* Our actual color table size should be either the maximum
      * usable density, or our histogram's current peak density,
@@ -882,16 +1153,8 @@ histogram_imager_generate_color_table (HistogramImager *self, gboolean force)
 	    luma = 1;
 
 	/* Linearly interpolate between fgcolor and bgcolor */
-	current.r = ((int)(self->bgcolor.red   * (1-luma) + self->fgcolor.red   * luma)) >> 8;
-	current.g = ((int)(self->bgcolor.green * (1-luma) + self->fgcolor.green * luma)) >> 8;
-	current.b = ((int)(self->bgcolor.blue  * (1-luma) + self->fgcolor.blue  * luma)) >> 8;
-	current.a = ((int)(self->bgalpha       * (1-luma) + self->fgalpha       * luma)) >> 8;
-
-	/* Always clamp color components */
-	if (current.r<0) current.r = 0;  if (current.r>255) current.r = 255;
-	if (current.g<0) current.g = 0;  if (current.g>255) current.g = 255;
-	if (current.b<0) current.b = 0;  if (current.b>255) current.b = 255;
-	if (current.a<0) current.a = 0;  if (current.a>255) current.a = 255;
+	interpolate_color (luma, &self->fgcolor, &self->bgcolor,
+			   self->fgalpha, self->bgalpha, &current);
 
 	/* Colors are always ARGB order in little endian */
 	self->color_table.table[count] = IMAGEFU_COLOR(current.a, current.r, current.g, current.b);
@@ -1024,9 +1287,9 @@ histogram_imager_compute_quality (HistogramImager *self)
 	guint count;
 	guint hist_clamp = self->color_table.filled_size - 1;
 	int width = self->width * self->oversample;
-	int height = self->height * self->oversample;
+	int height;
 	int x, y, x_scale, y_scale;
-	guint stride;
+	guint stride, region_rows;
 
 	gulong denominator = 0;
 	gulong num_saturated = 0;
@@ -1035,6 +1298,9 @@ histogram_imager_compute_quality (HistogramImager *self)
 	if (self->color_table.filled_size < 1)
 	    return G_MAXDOUBLE;
 
+	histogram_imager_get_region (self, NULL, &region_rows);
+	height = region_rows * self->oversample;
+
 	/* Sample the histogram at a reduced resolution, calculated
 	 * such that we get about a 256x256 grid.
 	 */
@@ -1110,13 +1376,14 @@ histogram_imager_export_stream (HistogramImager *self,
     guint skipped = 0;
     int bucket;
     int i;
+    double start = render_stats_clock ();
 
+    trace_begin ("export");
     histogram_imager_check_dirty_flags(self);
     histogram_imager_require_histogram(self);
 
     hist_p = self->histogram;
-    hist_remaining = self->width * self->height *
-	self->oversample * self->oversample;
+    hist_remaining = histogram_imager_get_region_buckets (self);
 
     output_p = buffer;
     output_remaining = buffer_size - VAR_INT_MAX_SIZE;
@@ -1152,6 +1419,8 @@ histogram_imager_export_stream (HistogramImager *self,
 	hist_remaining--;
     }
 
+    self->export_seconds += render_stats_clock () - start;
+    trace_end ("export");
     return output_p - buffer;
 }
 
@@ -1160,6 +1429,19 @@ histogram_imager_merge_stream (HistogramImager *self,
 			       const guchar    *buffer,
 			       gsize            buffer_size)
 {
+    guint first_row;
+
+    histogram_imager_get_region (self, &first_row, NULL);
+    histogram_imager_merge_stream_rows (self, first_row * self->oversample,
+					buffer, buffer_size);
+}
+
+void
+histogram_imager_merge_stream_rows (HistogramImager *self,
+				    guint            first_row,
+				    const guchar    *buffer,
+				    gsize            buffer_size)
+{
 
     /* The inverse of histogram_imager_export_stream(). This follows
      * the skip/plot instructions in the given buffer, merging the
@@ -1173,17 +1455,44 @@ histogram_imager_merge_stream (HistogramImager *self,
     guint token, bucket;
     HistogramPlot plot;
     int i;
+    double start = render_stats_clock ();
 
+    trace_begin ("merge");
     histogram_imager_prepare_plots (self, &plot);
 
-    hist_p = self->histogram;
-    hist_remaining = self->width * self->height *
-	self->oversample * self->oversample;
+    if (first_row < plot.first_row || first_row >= plot.first_row + plot.num_rows) {
+	g_warning ("Histogram stream starts outside this imager's region");
+	histogram_imager_finish_plots (self, &plot);
+	trace_end ("merge");
+	return;
+    }
+
+    hist_p = self->histogram + plot.hist_width * (first_row - plot.first_row);
+    hist_remaining = plot.hist_width * (plot.first_row + plot.num_rows - first_row);
 
     input_p = buffer;
     input_remaining = buffer_size;
 
     while (hist_remaining > 0 && input_remaining > 0) {
+	if (hist_remaining >= 8 && input_remaining >= 8 && var_int_short8 (input_p, 1)) {
+	    /* Eight single-byte plots in a row, common in dense areas.
+	     * Decode them together without checking each token.
+	     */
+	    for (i=0; i<8; i++) {
+		token = (input_p[i] & 0x7F) >> 1;
+		plot.plot_count += token;
+		bucket = hist_p[i] + token;
+		hist_p[i] = bucket;
+		if (bucket > plot.density)
+		    plot.density = bucket;
+	    }
+	    input_p += 8;
+	    input_remaining -= 8;
+	    hist_p += 8;
+	    hist_remaining -= 8;
+	    continue;
+	}
+
 	i = var_int_read (input_p, &token);
 	input_p += i;
 	input_remaining -= i;
@@ -1199,16 +1508,169 @@ histogram_imager_merge_stream (HistogramImager *self,
 	    if (bucket > plot.density)
 		plot.density = bucket;
 	    hist_p++;
+	    hist_remaining--;
 	}
 	else {
 	    /* Skip buckets */
 
 	    token >>= 1;
+	    if (token > hist_remaining)
+		break;
 	    hist_p += token;
+	    hist_remaining -= token;
 	}
     }
 
     histogram_imager_finish_plots (self, &plot);
+    self->merge_seconds += render_stats_clock () - start;
+    trace_end ("merge");
+}
+
+void
+histogram_imager_export_buckets (HistogramImager *self,
+				 guint           *buckets)
+{
+    gsize size;
+    double start = render_stats_clock ();
+
+    trace_begin ("export");
+    histogram_imager_check_dirty_flags (self);
+    histogram_imager_require_histogram (self);
+
+    size = sizeof (self->histogram[0]) * histogram_imager_get_region_buckets (self);
+    memcpy (buckets, self->histogram, size);
+    memset (self->histogram, 0, size);
+    self->export_seconds += render_stats_clock () - start;
+    trace_end ("export");
+}
+
+void
+histogram_imager_merge_buckets (HistogramImager *self,
+				guint            first_row,
+				const guint     *buckets,
+				gsize            num_buckets)
+{
+    guint *hist_p;
+    gsize available;
+    guint bucket;
+    HistogramPlot plot;
+    double start = render_stats_clock ();
+
+    trace_begin ("merge");
+    histogram_imager_prepare_plots (self, &plot);
+
+    if (first_row < plot.first_row || first_row >= plot.first_row + plot.num_rows) {
+	g_warning ("Histogram buckets start outside this imager's region");
+	histogram_imager_finish_plots (self, &plot);
+	trace_end ("merge");
+	return;
+    }
+
+    hist_p = self->histogram + plot.hist_width * (first_row - plot.first_row);
+    available = plot.hist_width * (plot.first_row + plot.num_rows - first_row);
+    num_buckets = MIN(num_buckets, available);
+
+    while (num_buckets--) {
+	plot.plot_count += *buckets;
+	bucket = *hist_p + *(buckets++);
+	*(hist_p++) = bucket;
+	if (bucket > plot.density)
+	    plot.density = bucket;
+    }
+
+    histogram_imager_finish_plots (self, &plot);
+    self->merge_seconds += render_stats_clock () - start;
+    trace_end ("merge");
+}
+
+void
+histogram_imager_merge_histogram (HistogramImager *self,
+				  HistogramImager *source)
+{
+    /* Add every bucket of another imager's histogram to ours, emptying
+     * the source as we go. This is a single pass over both buffers, and
+     * unlike histogram_imager_clear() it leaves the source's calculation
+     * state alone so it can carry on where it left off.
+     */
+    guint *src_p, *dest_p;
+    gsize remaining;
+    guint bucket;
+    HistogramPlot plot;
+    double start = render_stats_clock ();
+
+    histogram_imager_check_dirty_flags (source);
+    if (!source->histogram)
+	return;
+    g_return_if_fail (self->width == source->width &&
+		      self->height == source->height &&
+		      self->oversample == source->oversample &&
+		      self->region_first_row == source->region_first_row &&
+		      self->region_rows == source->region_rows);
+
+    trace_begin ("merge");
+    histogram_imager_prepare_plots (self, &plot);
+
+    src_p = source->histogram;
+    dest_p = self->histogram;
+    remaining = histogram_imager_get_region_buckets (self);
+
+    while (remaining--) {
+	bucket = *dest_p + *src_p;
+	*src_p++ = 0;
+	*dest_p++ = bucket;
+	if (bucket > plot.density)
+	    plot.density = bucket;
+    }
+
+    histogram_imager_finish_plots (self, &plot);
+    self->total_points_plotted += source->total_points_plotted;
+    source->total_points_plotted = 0;
+    source->peak_density = 0;
+    self->merge_seconds += render_stats_clock () - start;
+    trace_end ("merge");
+}
+
+void
+histogram_imager_scale_rows (HistogramImager *self,
+			     guint            first_row,
+			     guint            num_rows,
+			     gdouble          factor)
+{
+    /* Multiply a band of image rows by 'factor', carrying each bucket's
+     * rounding error into the next so the band's total comes out right.
+     * The peak density is found again, since it may have been in the band.
+     */
+    guint region_first, region_rows, bucket;
+    gsize row_buckets, remaining;
+    guint *hist_p;
+    gdouble carry = 0, removed = 0;
+
+    histogram_imager_check_dirty_flags (self);
+    if (!self->histogram)
+	return;
+    histogram_imager_get_region (self, &region_first, &region_rows);
+    if (first_row < region_first)
+	first_row = region_first;
+    if (first_row + num_rows > region_first + region_rows)
+	num_rows = region_first + region_rows - MIN(first_row, region_first + region_rows);
+
+    row_buckets = ((gsize) self->width) * self->oversample * self->oversample;
+    hist_p = self->histogram + row_buckets * (first_row - region_first);
+    for (remaining = row_buckets * num_rows; remaining; remaining--, hist_p++) {
+	carry += *hist_p * factor;
+	bucket = (guint) carry;
+	carry -= bucket;
+	removed += (gdouble) *hist_p - bucket;
+	*hist_p = bucket;
+    }
+    self->total_points_plotted = MAX(self->total_points_plotted - removed, 0);
+
+    self->peak_density = 0;
+    hist_p = self->histogram;
+    for (remaining = histogram_imager_get_region_buckets (self); remaining; remaining--, hist_p++)
+	if (*hist_p > self->peak_density)
+	    self->peak_density = *hist_p;
+    self->render_dirty_flag = TRUE;
 }
 
 
@@ -1246,8 +1708,7 @@ histogram_imager_require_histogram (HistogramImager *self)
     /* Allocate a histogram if we don't have one already */
     if (!self->histogram) {
 	self->histogram = g_malloc (sizeof (self->histogram[0]) *
-				    self->width * self->height *
-				    self->oversample * self->oversample);
+				    histogram_imager_get_region_buckets (self));
 	histogram_imager_clear (self);
     }
 }
@@ -1258,16 +1719,64 @@ histogram_imager_clear (HistogramImager *self)
     histogram_imager_check_dirty_flags (self);
     if (self->histogram) {
 	memset (self->histogram, 0, sizeof (self->histogram[0]) *
-	        self->width * self->height *
-	        self->oversample * self->oversample);
+		histogram_imager_get_region_buckets (self));
     }
     self->histogram_clear_flag = TRUE;
     self->render_dirty_flag = TRUE;
     self->total_points_plotted = 0;
     self->peak_density = 0;
+    self->calc_seconds = 0;
+    self->colorize_seconds = 0;
+    self->colorize_count = 0;
+    self->merge_seconds = 0;
+    self->export_seconds = 0;
     g_get_current_time (&self->render_start_time);
 }
 
+void
+histogram_imager_set_region (HistogramImager *self,
+			     guint            first_row,
+			     guint            num_rows)
+{
+    if (!num_rows)
+	first_row = 0;
+    if (first_row == self->region_first_row && num_rows == self->region_rows)
+	return;
+
+    /* The histogram is reallocated at its new size just like a resize */
+    self->region_first_row = first_row;
+    self->region_rows = num_rows;
+    self->size_dirty_flag = TRUE;
+    histogram_imager_clear (self);
+}
+
+void
+histogram_imager_get_region (HistogramImager *self,
+			     guint           *first_row,
+			     guint           *num_rows)
+{
+    /* The region is clamped to the current image size, always leaving
+     * at least one row so the histogram never has zero size.
+     */
+    guint first = MIN(self->region_first_row, self->height ? self->height - 1 : 0);
+    guint rows = self->height - first;
+
+    if (self->region_rows)
+	rows = MIN(rows, self->region_rows);
+    if (first_row)
+	*first_row = first;
+    if (num_rows)
+	*num_rows = rows;
+}
+
+gsize
+histogram_imager_get_region_buckets (HistogramImager *self)
+{
+    guint num_rows;
+    histogram_imager_get_region (self, NULL, &num_rows);
+    return ((gsize) self->width) * num_rows * self->oversample * self->oversample;
+}
+
 gdouble
 histogram_imager_get_elapsed_time (HistogramImager *self)
 {
@@ -39,6 +39,7 @@ G_BEGIN_DECLS
 
 typedef struct _HistogramImager          HistogramImager;
 typedef struct _HistogramImagerClass     HistogramImagerClass;
+typedef struct _HistogramThumbnail       HistogramThumbnail;
 
 
 struct _HistogramImager {
@@ -50,6 +51,11 @@ struct _HistogramImager {
     guint oversample;
     gboolean size_dirty_flag;
 
+    /* Band of image rows this imager's histogram covers, for renders
+     * split across cluster nodes. Zero rows means the whole image.
+     */
+    guint region_first_row, region_rows;
+
     /* Rendering Parameters
      *
      * Changing these parameters will not affect the
@@ -73,6 +79,15 @@ struct _HistogramImager {
 
     GdkPixbuf *image;
 
+    /* Performance counters since the histogram was last cleared,
+     * in seconds. See render_stats_collect().
+     */
+    gdouble calc_seconds;
+    gdouble colorize_seconds;
+    guint colorize_count;
+    gdouble merge_seconds;
+    gdouble export_seconds;
+
     /* Color table, converts from histogram samples to RGB colors */
     struct {
 	guint allocated_size;
@@ -102,6 +117,7 @@ struct _HistogramImagerClass {
 typedef struct {
     guint *histogram;
     guint hist_width;
+    guint first_row, num_rows;
     guint density;
     gulong plot_count;
 } HistogramPlot;
@@ -115,16 +131,60 @@ GType            histogram_imager_get_type        ();
 HistogramImager* histogram_imager_new             ();
 
 void             histogram_imager_update_image    (HistogramImager *self);
+
+/* Colorize just our region into the matching rows of an image the size of
+ * the whole output, leaving its other rows alone. Exposure is based on the
+ * given density, in points per bucket, instead of our own. Colorizing the
+ * bands of a partitioned render one at a time this way, with one density
+ * for all of them, builds the image without ever holding every band.
+ */
+void             histogram_imager_colorize_region (HistogramImager *self,
+						   GdkPixbuf       *image,
+						   gdouble          density);
 GdkPixbuf*       histogram_imager_make_thumbnail  (HistogramImager *self,
 						   guint            max_width,
 						   guint            max_height);
 
+/* Thumbnails can also be made in two steps. histogram_imager_reduce_thumbnail()
+ * reduces the histogram straight down to thumbnail size, averaging a fixed
+ * grid of buckets under each pixel so its cost depends only on the
+ * thumbnail's size, and snapshots the current rendering parameters.
+ * histogram_thumbnail_render() then colorizes the result, touching nothing but
+ * the HistogramThumbnail, so it may run on any thread.
+ */
+HistogramThumbnail* histogram_imager_reduce_thumbnail (HistogramImager    *self,
+						      guint               max_width,
+						      guint               max_height);
+GdkPixbuf*       histogram_thumbnail_render       (HistogramThumbnail *thumb);
+void             histogram_thumbnail_free         (HistogramThumbnail *thumb);
+
+/* The plain colorized image, without the checkerboard, level adjustment,
+ * and frame that histogram_thumbnail_render() adds for display in lists.
+ */
+GdkPixbuf*       histogram_thumbnail_colorize     (HistogramThumbnail *thumb);
+
+/* The reduced histogram itself: average counts per pixel, row by row.
+ * A count times pixel_scale gives that pixel's luminance before gamma.
+ */
+const float*     histogram_thumbnail_get_counts   (HistogramThumbnail *thumb,
+						   guint              *width,
+						   guint              *height,
+						   float              *pixel_scale);
+
 void	         histogram_imager_load_image_file (HistogramImager *self,
 						   const gchar     *filename,
 						   GError          **error);
 void             histogram_imager_save_image_file (HistogramImager *self,
 						   const gchar     *filename,
 						   GError          **error);
+
+/* Save some other image made from this imager, such as one assembled
+ * band by band, along with our parameters.
+ */
+void             histogram_imager_save_image_pixbuf (HistogramImager *self,
+						     GdkPixbuf       *image,
+						     const gchar     *filename,
+						     GError          **error);
 void             exr_save_image_file              (HistogramImager *hi,
 						   const gchar     *filename,
 						   GError          **error);
@@ -133,6 +193,19 @@ void             histogram_imager_get_hist_size   (HistogramImager *self,
 						   int             *hist_width,
 						   int             *hist_height);
 
+/* Restrict the histogram to a band of image rows. Only those rows are
+ * allocated, plotted, and streamed; the rest of the image stays empty.
+ * This lets a large render be split across cluster nodes so that their
+ * memory adds up. A num_rows of zero selects the whole image again.
+ * Changing the region clears the histogram.
+ */
+void             histogram_imager_set_region      (HistogramImager *self,
+						   guint            first_row,
+						   guint            num_rows);
+void             histogram_imager_get_region      (HistogramImager *self,
+						   guint           *first_row,
+						   guint           *num_rows);
+
 void             histogram_imager_clear           (HistogramImager *self);
 gdouble          histogram_imager_get_elapsed_time (HistogramImager *self);
 
@@ -172,6 +245,44 @@ void             histogram_imager_merge_stream    (HistogramImager *self,
 						   const guchar    *buffer,
 						   gsize            buffer_size);
 
+/* Merge a stream exported by an imager whose region starts at a different
+ * row, given in histogram rows. This is how a full-size histogram collects
+ * the bands rendered by each node of a partitioned cluster.
+ */
+void             histogram_imager_merge_stream_rows (HistogramImager *self,
+						     guint            first_row,
+						     const guchar    *buffer,
+						     gsize            buffer_size);
+
+/* Raw bucket access, for passing histograms through shared memory
+ * between processes on the same machine. histogram_imager_export_buckets()
+ * copies the region's buckets to the given buffer, which must hold
+ * histogram_imager_get_region_buckets() of them, and empties them.
+ * histogram_imager_merge_buckets() adds buckets from an imager whose
+ * region starts at first_row, in histogram rows.
+ */
+gsize            histogram_imager_get_region_buckets (HistogramImager *self);
+void             histogram_imager_export_buckets  (HistogramImager *self,
+						   guint           *buckets);
+void             histogram_imager_merge_buckets   (HistogramImager *self,
+						   guint            first_row,
+						   const guint     *buckets,
+						   gsize            num_buckets);
+
+/* Add another imager's histogram to this one, leaving the other's
+ * histogram empty. Both must have the same size and oversampling.
+ */
+void             histogram_imager_merge_histogram (HistogramImager *self,
+						   HistogramImager *source);
+
+/* Scale the counts in a band of image rows, so a band rendered with more
+ * iterations behind it can be brought down to match its neighbours.
+ */
+void             histogram_imager_scale_rows      (HistogramImager *self,
+						   guint            first_row,
+						   guint            num_rows,
+						   gdouble          factor);
+
 /* These must be called before and after making plots,
  * to initialize and save the HistogramPlot structure.
  */
@@ -185,13 +296,14 @@ void             histogram_imager_finish_plots    (HistogramImager *self,
  * Must be called between histogram_imager_prepare_plots
  * and histogram_imager_finish_plots. 'plot' is a
  * HistogramPlot, *not* a pointer to a HistogramPlot.
- * The provided X and Y must be less than the dimensions
- * returned by histogram_imager_get_hist_size.
+ * The provided X must be less than the width returned by
+ * histogram_imager_get_hist_size, and Y must fall within
+ * the plot's first_row and num_rows.
  */
 #define HISTOGRAM_IMAGER_PLOT(plot, x, y) do { \
     guint bucket; \
     (plot).plot_count++; \
-    bucket = ++(plot).histogram[(x) + (plot).hist_width * (y)]; \
+    bucket = ++(plot).histogram[(x) + (plot).hist_width * ((y) - (plot).first_row)]; \
     if (bucket > (plot).density) { \
       (plot).density = bucket; \
     } \
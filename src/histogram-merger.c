@@ -0,0 +1,328 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * histogram-merger.c - Merges incoming histogram data on a background thread
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include "histogram-merger.h"
+
+/* There are two staging histograms, both with the same size, oversampling
+ * and region as the destination. The worker merges each item into the
+ * 'filling' one, holding the lock only to pick it and to mark it staged
+ * afterwards, never while decoding. A flush swaps the two under the lock
+ * and folds the 'draining' one into the destination without it. If the
+ * worker is still merging into the buffer that was just swapped out, the
+ * fold waits for the next flush instead of for the worker.
+ *
+ * Each queued item carries the serial number that was current when it
+ * was pushed, and the worker discards items whose serial has changed
+ * since, so a reset also throws away the backlog. A buffer the worker
+ * is using when a reset comes along is cleared by the worker once its
+ * item is done.
+ */
+
+typedef struct {
+    HistogramStreamFormat    format;
+    guint                    first_row;
+    guchar*                  data;
+    gsize                    length;
+    gboolean                 is_buckets;    /* Raw guint buckets rather than a stream */
+    guint                    serial;
+    gboolean                 quit;
+
+    double                   merge_seconds;
+    HistogramMergerCallback  callback;
+    gpointer                 user_data;
+} HistogramMergerItem;
+
+typedef struct {
+    HistogramImager*  imager;
+    gboolean          staged;        /* Has data the destination doesn't */
+} HistogramMergerBuffer;
+
+struct _HistogramMerger {
+    HistogramImager*  dest;
+    HistogramMergerBuffer  buffers[2];
+    HistogramMergerBuffer* filling;
+    HistogramMergerBuffer* draining;
+    HistogramMergerBuffer* in_use;   /* The worker's buffer, while it merges an item */
+    guint             serial;
+
+    GMutex*           lock;
+    GCond*            worker_idle;   /* Signalled whenever in_use goes back to NULL */
+    GAsyncQueue*      queue;
+    GThread*          thread;
+};
+
+static void       histogram_merger_sync       (HistogramMerger*      self);
+static void       histogram_merger_clear_buffer (HistogramMergerBuffer* buffer);
+static void       histogram_merger_push       (HistogramMerger*      self,
+					       HistogramMergerItem*  item);
+static gpointer   histogram_merger_worker     (gpointer              user_data);
+static gboolean   histogram_merger_item_done  (gpointer              user_data);
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+HistogramMerger*      histogram_merger_new              (HistogramImager*         dest)
+{
+    HistogramMerger* self = g_new0(HistogramMerger, 1);
+
+    self->dest = g_object_ref(dest);
+    self->buffers[0].imager = histogram_imager_new();
+    self->buffers[1].imager = histogram_imager_new();
+    self->filling = &self->buffers[0];
+    self->draining = &self->buffers[1];
+    self->lock = g_mutex_new();
+    self->worker_idle = g_cond_new();
+    self->queue = g_async_queue_new();
+    self->thread = g_thread_create(histogram_merger_worker, self, TRUE, NULL);
+
+    histogram_merger_sync(self);
+    return self;
+}
+
+void                  histogram_merger_free             (HistogramMerger*         self)
+{
+    /* Anything still queued is stale by now. Its callbacks still
+     * run, from the main loop, after we're gone.
+     */
+    HistogramMergerItem* quit = g_new0(HistogramMergerItem, 1);
+
+    histogram_merger_reset(self);
+    quit->quit = TRUE;
+    g_async_queue_push(self->queue, quit);
+    g_thread_join(self->thread);
+
+    g_async_queue_unref(self->queue);
+    g_mutex_free(self->lock);
+    g_cond_free(self->worker_idle);
+    g_object_unref(self->buffers[0].imager);
+    g_object_unref(self->buffers[1].imager);
+    g_object_unref(self->dest);
+    g_free(self);
+}
+
+void                  histogram_merger_push_stream      (HistogramMerger*         self,
+							 HistogramStreamFormat    format,
+							 guint                    first_row,
+							 guchar*                  data,
+							 gsize                    length,
+							 HistogramMergerCallback  callback,
+							 gpointer                 user_data)
+{
+    HistogramMergerItem* item = g_new0(HistogramMergerItem, 1);
+
+    item->format = format;
+    item->first_row = first_row;
+    item->data = data;
+    item->length = length;
+    item->callback = callback;
+    item->user_data = user_data;
+    histogram_merger_push(self, item);
+}
+
+void                  histogram_merger_push_buckets     (HistogramMerger*         self,
+							 guint                    first_row,
+							 guint*                   buckets,
+							 gsize                    num_buckets,
+							 HistogramMergerCallback  callback,
+							 gpointer                 user_data)
+{
+    HistogramMergerItem* item = g_new0(HistogramMergerItem, 1);
+
+    item->first_row = first_row;
+    item->data = (guchar*) buckets;
+    item->length = num_buckets;
+    item->is_buckets = TRUE;
+    item->callback = callback;
+    item->user_data = user_data;
+    histogram_merger_push(self, item);
+}
+
+void                  histogram_merger_flush            (HistogramMerger*         self)
+{
+    /* Swap in an empty buffer for the worker, then fold the full one
+     * without holding the lock. The worker only ever takes the filling
+     * buffer, so once we've swapped it out it's ours as soon as the
+     * worker is done with its current item.
+     */
+    HistogramMergerBuffer* draining;
+    gboolean fold;
+
+    histogram_merger_sync(self);
+
+    g_mutex_lock(self->lock);
+    if (!self->draining->staged && self->filling->staged) {
+	draining = self->filling;
+	self->filling = self->draining;
+	self->draining = draining;
+    }
+    draining = self->draining;
+    fold = draining->staged && self->in_use != draining;
+    g_mutex_unlock(self->lock);
+
+    if (fold) {
+	histogram_imager_merge_histogram(self->dest, draining->imager);
+	g_mutex_lock(self->lock);
+	draining->staged = FALSE;
+	g_mutex_unlock(self->lock);
+    }
+}
+
+void                  histogram_merger_reset            (HistogramMerger*         self)
+{
+    int i;
+
+    g_mutex_lock(self->lock);
+    self->serial++;
+    for (i=0; i<2; i++)
+	if (&self->buffers[i] != self->in_use)
+	    histogram_merger_clear_buffer(&self->buffers[i]);
+    g_mutex_unlock(self->lock);
+}
+
+
+/************************************************************************************/
+/************************************************************************** Private */
+/************************************************************************************/
+
+static void       histogram_merger_sync       (HistogramMerger*      self)
+{
+    /* Keep the staging histograms' shape matching the destination's.
+     * Any change of shape means the destination was cleared too. That
+     * only happens when the image size changes, so we can afford to wait
+     * for the worker to finish with its buffer before reshaping it.
+     */
+    HistogramImager* dest = self->dest;
+    HistogramImager* staging = self->filling->imager;
+    int i;
+
+    if (staging->width == dest->width &&
+	staging->height == dest->height &&
+	staging->oversample == dest->oversample &&
+	staging->region_first_row == dest->region_first_row &&
+	staging->region_rows == dest->region_rows)
+	return;
+
+    g_mutex_lock(self->lock);
+    while (self->in_use)
+	g_cond_wait(self->worker_idle, self->lock);
+
+    for (i=0; i<2; i++) {
+	staging = self->buffers[i].imager;
+	g_object_set(staging,
+		     "width",      dest->width,
+		     "height",     dest->height,
+		     "oversample", dest->oversample,
+		     NULL);
+	histogram_imager_set_region(staging, dest->region_first_row, dest->region_rows);
+	histogram_merger_clear_buffer(&self->buffers[i]);
+    }
+    self->serial++;
+    g_mutex_unlock(self->lock);
+}
+
+static void       histogram_merger_clear_buffer (HistogramMergerBuffer* buffer)
+{
+    if (buffer->staged)
+	histogram_imager_clear(buffer->imager);
+    buffer->staged = FALSE;
+}
+
+static void       histogram_merger_push       (HistogramMerger*      self,
+					       HistogramMergerItem*  item)
+{
+    histogram_merger_sync(self);
+    item->serial = self->serial;
+    g_async_queue_push(self->queue, item);
+}
+
+static gpointer   histogram_merger_worker     (gpointer              user_data)
+{
+    HistogramMerger* self = (HistogramMerger*) user_data;
+    HistogramMergerItem* item;
+    HistogramMergerBuffer* buffer;
+    gboolean stale;
+    GTimer* timer = g_timer_new();
+
+    while (1) {
+	item = (HistogramMergerItem*) g_async_queue_pop(self->queue);
+	if (item->quit) {
+	    g_free(item);
+	    break;
+	}
+
+	g_timer_start(timer);
+	g_mutex_lock(self->lock);
+	buffer = NULL;
+	if (item->serial == self->serial) {
+	    buffer = self->filling;
+	    self->in_use = buffer;
+	}
+	g_mutex_unlock(self->lock);
+
+	if (buffer) {
+	    if (item->is_buckets)
+		histogram_imager_merge_buckets(buffer->imager, item->first_row,
+					       (const guint*) item->data, item->length);
+	    else
+		histogram_stream_merge_rows(buffer->imager, item->format, item->first_row,
+					    item->data, item->length);
+
+	    /* If a reset came along meanwhile it left this buffer to us.
+	     * It's still ours until in_use changes, so clear it unlocked.
+	     */
+	    g_mutex_lock(self->lock);
+	    stale = item->serial != self->serial;
+	    g_mutex_unlock(self->lock);
+	    if (stale)
+		histogram_imager_clear(buffer->imager);
+
+	    g_mutex_lock(self->lock);
+	    buffer->staged = !stale;
+	    self->in_use = NULL;
+	    g_cond_broadcast(self->worker_idle);
+	    g_mutex_unlock(self->lock);
+	}
+	item->merge_seconds = g_timer_elapsed(timer, NULL);
+
+	g_idle_add(histogram_merger_item_done, item);
+    }
+
+    g_timer_destroy(timer);
+    return NULL;
+}
+
+static gboolean   histogram_merger_item_done  (gpointer              user_data)
+{
+    HistogramMergerItem* item = (HistogramMergerItem*) user_data;
+
+    if (item->callback)
+	item->callback(item->user_data, item->merge_seconds);
+    g_free(item->data);
+    g_free(item);
+    return FALSE;
+}
+
+/* The End */
@@ -0,0 +1,87 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * histogram-merger.h - Merges incoming histogram data on a background thread
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __HISTOGRAM_MERGER_H__
+#define __HISTOGRAM_MERGER_H__
+
+#include <glib.h>
+#include "histogram-imager.h"
+#include "histogram-stream.h"
+
+G_BEGIN_DECLS
+
+/* A HistogramMerger decodes histogram data for one destination imager on
+ * its own thread, accumulating it into a private staging histogram. The
+ * main thread folds the staging histogram into the destination with
+ * histogram_merger_flush() whenever it suits it, in one pass no matter
+ * how many pieces of data arrived in the meantime.
+ *
+ * Everything here except the worker itself runs on the main thread,
+ * including the callbacks, which are called once a piece of data has been
+ * merged into the staging histogram or discarded.
+ */
+typedef struct _HistogramMerger HistogramMerger;
+
+typedef void (*HistogramMergerCallback) (gpointer  user_data,
+					 double    merge_seconds);
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+HistogramMerger*      histogram_merger_new              (HistogramImager*         dest);
+void                  histogram_merger_free             (HistogramMerger*         self);
+
+/* Queue a histogram stream, or raw buckets, starting at first_row in
+ * histogram rows. The merger takes ownership of the data.
+ */
+void                  histogram_merger_push_stream      (HistogramMerger*         self,
+							 HistogramStreamFormat    format,
+							 guint                    first_row,
+							 guchar*                  data,
+							 gsize                    length,
+							 HistogramMergerCallback  callback,
+							 gpointer                 user_data);
+void                  histogram_merger_push_buckets     (HistogramMerger*         self,
+							 guint                    first_row,
+							 guint*                   buckets,
+							 gsize                    num_buckets,
+							 HistogramMergerCallback  callback,
+							 gpointer                 user_data);
+
+/* Add everything merged so far to the destination. This never waits for
+ * the worker; a piece it's still in the middle of is added next time.
+ */
+void                  histogram_merger_flush            (HistogramMerger*         self);
+
+/* Throw away everything staged or queued, because the destination's
+ * calculation parameters have changed.
+ */
+void                  histogram_merger_reset            (HistogramMerger*         self);
+
+G_END_DECLS
+
+#endif /* __HISTOGRAM_MERGER_H__ */
+
+/* The End */
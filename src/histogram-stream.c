@@ -0,0 +1,592 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * histogram-stream.c - Negotiable encodings for transferring histograms
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include <string.h>
+#include "histogram-stream.h"
+#include "render-stats.h"
+#include "trace.h"
+#include "thread-util.h"
+#include "var-int.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* The delta-zlib format divides the histogram into fixed-size blocks that
+ * are encoded and decoded independently, on as many threads as we have
+ * processors. Each block stores the difference between consecutive bucket
+ * counts, zigzag-coded so small negative differences are small var-ints,
+ * then deflated. Dense histograms have smooth neighbourhoods, so most
+ * differences fit in a single byte before compression even starts. Empty
+ * blocks are left out entirely.
+ *
+ * Each block in the stream is:
+ *
+ *    var-int  first bucket, counting from the start of the exporter's region
+ *    var-int  number of buckets, at most BLOCK_BUCKETS
+ *    var-int  length of the var-int data before compression
+ *    var-int  compressed length
+ *    bytes    deflated var-int data
+ *
+ * Like the run-length format, buckets are cleared as they're exported and
+ * anything that doesn't fit in the buffer is left for the next export.
+ * Blocks are compressed in output order, a few at a time, and exporting
+ * stops once the buffer is full. If the next block doesn't fit, as much of
+ * it as will fit is sent on its own, so any buffer with room for a block
+ * header and a little data always makes progress.
+ */
+
+#define BLOCK_BUCKETS      (64 * 1024)
+#define BLOCK_HEADER_SIZE  (4 * VAR_INT_MAX_SIZE)
+
+typedef struct {
+    guint*          buckets;
+    guint           num_buckets;
+    guint           first;
+
+    /* Encoded data, and the var-ints it was compressed from, both
+     * owned by the block. Unused when decoding.
+     */
+    guchar*         data;
+    gsize           length;
+    guchar*         raw;
+
+    /* Compressed input, borrowed from the caller. Unused when encoding. */
+    const guchar*   compressed;
+    gsize           compressed_length;
+    gsize           raw_length;
+
+    /* Decoding results */
+    gulong          plot_count;
+    guint           density;
+
+    GFunc           func;
+    GAsyncQueue*    done;
+} StreamBlock;
+
+static const struct {
+    HistogramStreamFormat  format;
+    const gchar*           name;
+} format_names[] = {
+    { HISTOGRAM_STREAM_RLE,         "rle"        },
+    { HISTOGRAM_STREAM_DELTA_ZLIB,  "delta-zlib" },
+};
+
+#ifdef HAVE_ZLIB
+static void       block_encode                (StreamBlock*          block);
+static gboolean   block_compress_prefix       (StreamBlock*          block,
+					       gsize                 raw_limit,
+					       gsize                 available);
+static gboolean   block_fit                   (StreamBlock*          block,
+					       gsize                 available);
+static void       block_free                  (StreamBlock*          block);
+static void       block_decode                (StreamBlock*          block);
+static void       run_blocks                  (StreamBlock*          blocks,
+					       guint                 num_blocks,
+					       GFunc                 func);
+static void       block_worker                (gpointer              data,
+					       gpointer              user_data);
+static gboolean   read_header_int             (const guchar**        p,
+					       const guchar*         end,
+					       guint*                value);
+
+static GThreadPool* block_workers = NULL;
+G_LOCK_DEFINE_STATIC(block_workers);
+#endif
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+const gchar*     histogram_stream_format_name      (HistogramStreamFormat  format)
+{
+    int i;
+    for (i=0; i<G_N_ELEMENTS(format_names); i++)
+	if (format_names[i].format == format)
+	    return format_names[i].name;
+    return NULL;
+}
+
+gboolean         histogram_stream_format_from_name (const gchar*           name,
+						    HistogramStreamFormat* format)
+{
+    int i;
+    for (i=0; i<G_N_ELEMENTS(format_names); i++)
+	if (!strcmp(format_names[i].name, name) &&
+	    histogram_stream_format_supported(format_names[i].format)) {
+	    *format = format_names[i].format;
+	    return TRUE;
+	}
+    return FALSE;
+}
+
+gboolean         histogram_stream_format_supported (HistogramStreamFormat  format)
+{
+    switch (format) {
+
+    case HISTOGRAM_STREAM_RLE:
+	return TRUE;
+
+    case HISTOGRAM_STREAM_DELTA_ZLIB:
+#ifdef HAVE_ZLIB
+	return TRUE;
+#else
+	return FALSE;
+#endif
+
+    default:
+	return FALSE;
+    }
+}
+
+HistogramStreamFormat histogram_stream_best_format ()
+{
+    if (histogram_stream_format_supported(HISTOGRAM_STREAM_DELTA_ZLIB))
+	return HISTOGRAM_STREAM_DELTA_ZLIB;
+    return HISTOGRAM_STREAM_RLE;
+}
+
+gsize            histogram_stream_export           (HistogramImager*       imager,
+						    HistogramStreamFormat  format,
+						    guchar*                buffer,
+						    gsize                  buffer_size)
+{
+#ifdef HAVE_ZLIB
+    HistogramPlot plot;
+    StreamBlock* blocks;
+    guint num_blocks, total_buckets, batch, next, count, i;
+    guchar* output_p = buffer;
+    gsize output_remaining = buffer_size;
+    gboolean full = FALSE;
+    double start;
+
+    if (format != HISTOGRAM_STREAM_DELTA_ZLIB)
+	return histogram_imager_export_stream(imager, buffer, buffer_size);
+    start = render_stats_clock();
+    trace_begin("export");
+
+    /* This just makes sure the histogram is allocated and current */
+    histogram_imager_prepare_plots(imager, &plot);
+    histogram_imager_finish_plots(imager, &plot);
+
+    total_buckets = plot.hist_width * plot.num_rows;
+    num_blocks = (total_buckets + BLOCK_BUCKETS - 1) / BLOCK_BUCKETS;
+
+    /* Encode one block per processor at a time, so we never compress
+     * much more than will fit.
+     */
+    batch = MAX(thread_util_num_processors(), 1);
+    blocks = g_new(StreamBlock, batch);
+
+    for (next=0; next<num_blocks && !full; next+=count) {
+	count = MIN(batch, num_blocks - next);
+	memset(blocks, 0, count * sizeof(StreamBlock));
+	for (i=0; i<count; i++) {
+	    blocks[i].first = (next + i) * BLOCK_BUCKETS;
+	    blocks[i].buckets = plot.histogram + blocks[i].first;
+	    blocks[i].num_buckets = MIN(BLOCK_BUCKETS, total_buckets - blocks[i].first);
+	}
+	run_blocks(blocks, count, (GFunc) block_encode);
+
+	/* Copy out blocks in order until one doesn't fit, clearing
+	 * the corresponding buckets as we go.
+	 */
+	for (i=0; i<count; i++) {
+	    if (blocks[i].data && !full) {
+		guint num_buckets = blocks[i].num_buckets;
+
+		if (output_remaining < BLOCK_HEADER_SIZE ||
+		    !block_fit(&blocks[i], output_remaining - BLOCK_HEADER_SIZE)) {
+		    full = TRUE;
+		}
+		else {
+		    guchar* header = output_p;
+		    output_p += var_int_write(output_p, blocks[i].first);
+		    output_p += var_int_write(output_p, blocks[i].num_buckets);
+		    output_p += var_int_write(output_p, blocks[i].raw_length);
+		    output_p += var_int_write(output_p, blocks[i].length);
+		    memcpy(output_p, blocks[i].data, blocks[i].length);
+		    output_p += blocks[i].length;
+		    output_remaining -= output_p - header;
+
+		    memset(blocks[i].buckets, 0, blocks[i].num_buckets * sizeof(blocks[i].buckets[0]));
+
+		    /* Only part of it fit, so the buffer is full */
+		    if (blocks[i].num_buckets < num_buckets)
+			full = TRUE;
+		}
+	    }
+	    block_free(&blocks[i]);
+	}
+    }
+
+    g_free(blocks);
+    imager->export_seconds += render_stats_clock() - start;
+    trace_end("export");
+    return output_p - buffer;
+#else
+    return histogram_imager_export_stream(imager, buffer, buffer_size);
+#endif
+}
+
+void             histogram_stream_merge            (HistogramImager*       imager,
+						    HistogramStreamFormat  format,
+						    const guchar*          buffer,
+						    gsize                  buffer_size)
+{
+    guint first_row;
+
+    histogram_imager_get_region(imager, &first_row, NULL);
+    histogram_stream_merge_rows(imager, format, first_row * imager->oversample,
+				buffer, buffer_size);
+}
+
+void             histogram_stream_merge_rows       (HistogramImager*       imager,
+						    HistogramStreamFormat  format,
+						    guint                  first_row,
+						    const guchar*          buffer,
+						    gsize                  buffer_size)
+{
+#ifdef HAVE_ZLIB
+    HistogramPlot plot;
+    StreamBlock* blocks;
+    guint num_blocks = 0, allocated_blocks = 16;
+    guint total_buckets, first, count, raw_length, compressed_length, i;
+    const guchar* input_p = buffer;
+    const guchar* input_end = buffer + buffer_size;
+    guint* base;
+    double start;
+
+    if (format != HISTOGRAM_STREAM_DELTA_ZLIB) {
+	histogram_imager_merge_stream_rows(imager, first_row, buffer, buffer_size);
+	return;
+    }
+    start = render_stats_clock();
+    trace_begin("merge");
+
+    histogram_imager_prepare_plots(imager, &plot);
+    if (first_row < plot.first_row || first_row >= plot.first_row + plot.num_rows) {
+	g_warning("Histogram stream starts outside this imager's region");
+	histogram_imager_finish_plots(imager, &plot);
+	trace_end("merge");
+	return;
+    }
+
+    /* Block positions count from the start of the exporter's region */
+    base = plot.histogram + plot.hist_width * (first_row - plot.first_row);
+    total_buckets = plot.hist_width * (plot.first_row + plot.num_rows - first_row);
+
+    /* Parse the block headers first, validating everything
+     * so the decoders can run without any further checks.
+     */
+    blocks = g_new0(StreamBlock, allocated_blocks);
+    while (input_p < input_end) {
+	if (!(read_header_int(&input_p, input_end, &first) &&
+	      read_header_int(&input_p, input_end, &count) &&
+	      read_header_int(&input_p, input_end, &raw_length) &&
+	      read_header_int(&input_p, input_end, &compressed_length)) ||
+	    count == 0 || count > BLOCK_BUCKETS ||
+	    ((guint64) first) + count > total_buckets ||
+	    raw_length > count * VAR_INT_MAX_SIZE ||
+	    compressed_length > input_end - input_p) {
+	    g_warning("Corrupted histogram stream");
+	    break;
+	}
+
+	if (num_blocks == allocated_blocks) {
+	    allocated_blocks *= 2;
+	    blocks = g_renew(StreamBlock, blocks, allocated_blocks);
+	}
+	memset(&blocks[num_blocks], 0, sizeof(StreamBlock));
+	blocks[num_blocks].first = first;
+	blocks[num_blocks].buckets = base + first;
+	blocks[num_blocks].num_buckets = count;
+	blocks[num_blocks].compressed = input_p;
+	blocks[num_blocks].compressed_length = compressed_length;
+	blocks[num_blocks].raw_length = raw_length;
+	num_blocks++;
+
+	input_p += compressed_length;
+    }
+
+    /* Blocks cover disjoint ranges of the histogram, so they can all be
+     * merged at once. Overlapping blocks would break that, but the
+     * exporter never produces them.
+     */
+    run_blocks(blocks, num_blocks, (GFunc) block_decode);
+
+    for (i=0; i<num_blocks; i++) {
+	plot.plot_count += blocks[i].plot_count;
+	plot.density = MAX(plot.density, blocks[i].density);
+    }
+    histogram_imager_finish_plots(imager, &plot);
+    g_free(blocks);
+    imager->merge_seconds += render_stats_clock() - start;
+    trace_end("merge");
+#else
+    histogram_imager_merge_stream_rows(imager, first_row, buffer, buffer_size);
+#endif
+}
+
+
+/************************************************************************************/
+/************************************************************************ Block Codec */
+/************************************************************************************/
+
+#ifdef HAVE_ZLIB
+
+static void       block_encode                (StreamBlock*          block)
+{
+    guchar *raw, *raw_p;
+    guint prev = 0, current, zigzag, i;
+    gint delta;
+    gboolean empty = TRUE;
+    uLongf length;
+
+    for (i=0; i<block->num_buckets; i++)
+	if (block->buckets[i]) {
+	    empty = FALSE;
+	    break;
+	}
+    if (empty)
+	return;
+
+    raw = raw_p = g_malloc(block->num_buckets * VAR_INT_MAX_SIZE);
+    for (i=0; i<block->num_buckets; i++) {
+	current = block->buckets[i];
+	delta = (gint) (current - prev);
+	zigzag = (((guint) delta) << 1) ^ (guint) (delta >> 31);
+	raw_p += var_int_write(raw_p, zigzag);
+	prev = current;
+    }
+    block->raw = raw;
+    block->raw_length = raw_p - raw;
+
+    length = compressBound(block->raw_length);
+    block->data = g_malloc(length);
+    if (compress2(block->data, &length, raw, block->raw_length, Z_BEST_SPEED) == Z_OK) {
+	block->length = length;
+    }
+    else {
+	g_free(block->data);
+	block->data = NULL;
+    }
+}
+
+static gboolean   block_compress_prefix       (StreamBlock*          block,
+					       gsize                 raw_limit,
+					       gsize                 available)
+{
+    /* Replace an encoded block with just the buckets whose var-ints fit in
+     * raw_limit bytes, if that compresses to at most 'available' bytes.
+     * Each block starts its deltas from zero, so any prefix is a block.
+     */
+    gsize raw_length = 0;
+    guint num_buckets = 0, value;
+    guchar* data;
+    uLongf length;
+    int size;
+
+    while (num_buckets < block->num_buckets) {
+	size = var_int_read(block->raw + raw_length, &value);
+	if (raw_length + size > raw_limit)
+	    break;
+	raw_length += size;
+	num_buckets++;
+    }
+    if (!num_buckets)
+	return FALSE;
+
+    length = compressBound(raw_length);
+    data = g_malloc(length);
+    if (compress2(data, &length, block->raw, raw_length, Z_BEST_SPEED) != Z_OK || length > available) {
+	g_free(data);
+	return FALSE;
+    }
+
+    g_free(block->data);
+    block->data = data;
+    block->length = length;
+    block->raw_length = raw_length;
+    block->num_buckets = num_buckets;
+    return TRUE;
+}
+
+static gboolean   block_fit                   (StreamBlock*          block,
+					       gsize                 available)
+{
+    /* Make an encoded block fit in 'available' bytes, shortening it if
+     * we have to. The first guess assumes a prefix compresses about as
+     * well as the whole block. If it doesn't, fall back on a prefix small
+     * enough to fit even if it doesn't compress at all.
+     */
+    gsize raw_limit;
+
+    if (block->length <= available)
+	return TRUE;
+
+    raw_limit = (gsize) (block->raw_length * 0.9 * available / block->length);
+    if (block_compress_prefix(block, raw_limit, available))
+	return TRUE;
+
+    raw_limit = available;
+    while (raw_limit && compressBound(raw_limit) > available)
+	raw_limit -= MIN(raw_limit, compressBound(raw_limit) - available);
+    return block_compress_prefix(block, raw_limit, available);
+}
+
+static void       block_free                  (StreamBlock*          block)
+{
+    g_free(block->data);
+    g_free(block->raw);
+    block->data = NULL;
+    block->raw = NULL;
+}
+
+static void       block_decode                (StreamBlock*          block)
+{
+    /* The raw buffer is padded so a truncated final var-int
+     * can't read past the end of it.
+     */
+    guchar *raw = g_malloc0(block->raw_length + VAR_INT_MAX_SIZE);
+    const guchar *raw_p = raw, *raw_end;
+    guint prev = 0, zigzag, bucket, i, j, count;
+    gint delta;
+    guint deltas[8];
+    uLongf length = block->raw_length;
+
+    if (uncompress(raw, &length, block->compressed, block->compressed_length) != Z_OK) {
+	g_warning("Corrupted histogram stream block");
+	g_free(raw);
+	return;
+    }
+    raw_end = raw + length;
+
+    for (i=0; i<block->num_buckets && raw_p < raw_end;) {
+	if (i + 8 <= block->num_buckets && raw_p + 8 <= raw_end && var_int_short8(raw_p, 0)) {
+	    /* Most deltas in a dense histogram are single bytes. While
+	     * they are, decode them eight at a time, with no branches
+	     * until the buckets are updated.
+	     */
+	    for (j=0; j<8; j++) {
+		zigzag = raw_p[j] & 0x7F;
+		prev += (gint) ((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+		deltas[j] = prev;
+	    }
+	    raw_p += 8;
+
+	    if (deltas[0] | deltas[1] | deltas[2] | deltas[3] |
+		deltas[4] | deltas[5] | deltas[6] | deltas[7]) {
+		for (j=0; j<8; j++) {
+		    count = deltas[j];
+		    bucket = block->buckets[i+j] + count;
+		    block->buckets[i+j] = bucket;
+		    block->plot_count += count;
+		    if (bucket > block->density)
+			block->density = bucket;
+		}
+	    }
+	    i += 8;
+	    continue;
+	}
+
+	raw_p += var_int_read(raw_p, &zigzag);
+	delta = (gint) ((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+	prev += delta;
+
+	if (prev) {
+	    bucket = block->buckets[i] + prev;
+	    block->buckets[i] = bucket;
+	    block->plot_count += prev;
+	    if (bucket > block->density)
+		block->density = bucket;
+	}
+	i++;
+    }
+    g_free(raw);
+}
+
+static gboolean   read_header_int             (const guchar**        p,
+					       const guchar*         end,
+					       guint*                value)
+{
+    /* Read one var-int without trusting it to stay inside the buffer */
+    guchar padded[VAR_INT_MAX_SIZE];
+    gsize available = end - *p;
+    int size;
+
+    memset(padded, 0, sizeof(padded));
+    memcpy(padded, *p, MIN(available, VAR_INT_MAX_SIZE));
+    size = var_int_read(padded, value);
+    if (size > available)
+	return FALSE;
+
+    *p += size;
+    return TRUE;
+}
+
+static void       block_worker                (gpointer              data,
+					       gpointer              user_data)
+{
+    StreamBlock* block = (StreamBlock*) data;
+
+    /* Our pool is shared, so each job carries its own function */
+    block->func(block, NULL);
+    g_async_queue_push(block->done, block);
+}
+
+static void       run_blocks                  (StreamBlock*          blocks,
+					       guint                 num_blocks,
+					       GFunc                 func)
+{
+    GAsyncQueue* done;
+    guint i;
+
+    if (num_blocks < 2 || thread_util_num_processors() < 2) {
+	for (i=0; i<num_blocks; i++)
+	    func(&blocks[i], NULL);
+	return;
+    }
+
+    G_LOCK(block_workers);
+    if (!block_workers)
+	block_workers = g_thread_pool_new(block_worker, NULL,
+					  thread_util_num_processors(), FALSE, NULL);
+    G_UNLOCK(block_workers);
+
+    done = g_async_queue_new();
+    for (i=0; i<num_blocks; i++) {
+	blocks[i].func = func;
+	blocks[i].done = done;
+	g_thread_pool_push(block_workers, &blocks[i], NULL);
+    }
+    for (i=0; i<num_blocks; i++)
+	g_async_queue_pop(done);
+    g_async_queue_unref(done);
+}
+
+#endif /* HAVE_ZLIB */
+
+/* The End */
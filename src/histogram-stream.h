@@ -0,0 +1,85 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * histogram-stream.h - Negotiable encodings for transferring histograms
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __HISTOGRAM_STREAM_H__
+#define __HISTOGRAM_STREAM_H__
+
+#include <glib.h>
+#include "histogram-imager.h"
+
+G_BEGIN_DECLS
+
+/* Histograms can be transferred in several formats. The run-length
+ * format from histogram_imager_export_stream() is always available and
+ * is what a peer gets unless it negotiates something else. The
+ * delta-zlib format is much smaller for dense histograms, and is
+ * available when we're built with zlib.
+ */
+typedef enum {
+    HISTOGRAM_STREAM_RLE,
+    HISTOGRAM_STREAM_DELTA_ZLIB,
+} HistogramStreamFormat;
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+const gchar*          histogram_stream_format_name      (HistogramStreamFormat  format);
+
+/* Returns FALSE if the name is unknown, or the format isn't supported in this build */
+gboolean              histogram_stream_format_from_name (const gchar*           name,
+							 HistogramStreamFormat* format);
+gboolean              histogram_stream_format_supported (HistogramStreamFormat  format);
+
+/* The most compact format this build supports */
+HistogramStreamFormat histogram_stream_best_format      ();
+
+/* These have the same semantics as histogram_imager_export_stream() and
+ * histogram_imager_merge_stream(), in any supported format. Exported
+ * buckets are cleared, and whatever doesn't fit in the buffer is left
+ * in the histogram for next time.
+ */
+gsize                 histogram_stream_export           (HistogramImager*       imager,
+							 HistogramStreamFormat  format,
+							 guchar*                buffer,
+							 gsize                  buffer_size);
+void                  histogram_stream_merge            (HistogramImager*       imager,
+							 HistogramStreamFormat  format,
+							 const guchar*          buffer,
+							 gsize                  buffer_size);
+
+/* Merge a stream from an imager whose region starts at first_row,
+ * in histogram rows. See histogram_imager_merge_stream_rows().
+ */
+void                  histogram_stream_merge_rows       (HistogramImager*       imager,
+							 HistogramStreamFormat  format,
+							 guint                  first_row,
+							 const guchar*          buffer,
+							 gsize                  buffer_size);
+
+G_END_DECLS
+
+#endif /* __HISTOGRAM_STREAM_H__ */
+
+/* The End */
@@ -23,6 +23,7 @@
 
 #include "histogram-view.h"
 #include "image-fu.h"
+#include "trace.h"
 #include <gtk/gtk.h>
 
 static void histogram_view_class_init(HistogramViewClass *klass);
@@ -88,6 +89,10 @@ static void histogram_view_finalize(GObject *object) {
 	g_object_unref(self->imager);
 	self->imager = NULL;
     }
+    if (self->pixbuf) {
+	gdk_pixbuf_unref(self->pixbuf);
+	self->pixbuf = NULL;
+    }
 }
 
 GtkWidget* histogram_view_new(HistogramImager *imager) {
@@ -163,6 +168,11 @@ static void on_resize_notify(HistogramImager *imager, GParamSpec *spec, Histogra
 void histogram_view_update(HistogramView *self) {
     GdkRegion *update_region;
 
+    trace_begin("view_update");
+    if (self->pixbuf) {
+	gdk_pixbuf_unref(self->pixbuf);
+	self->pixbuf = NULL;
+    }
     histogram_imager_update_image(self->imager);
 
     /* Draw the whole thing */
@@ -171,14 +181,34 @@ void histogram_view_update(HistogramView *self) {
     gdk_region_destroy(update_region);
 
     self->imager->render_dirty_flag = FALSE;
+    trace_end("view_update");
+}
+
+void histogram_view_show_pixbuf(HistogramView *self, GdkPixbuf *pixbuf) {
+    /* Display a previously rendered image instead of the imager's own,
+     * until the next histogram_view_update(). The pixbuf must be the same
+     * size as our imager and have an alpha channel, like the imager's
+     * output. It's drawn as-is, without compositing onto a checkerboard.
+     */
+    GdkRegion *update_region;
+
+    gdk_pixbuf_ref(pixbuf);
+    if (self->pixbuf)
+	gdk_pixbuf_unref(self->pixbuf);
+    self->pixbuf = pixbuf;
+
+    update_region = histogram_view_get_full_image_region(self);
+    histogram_view_draw_image_region(self, update_region);
+    gdk_region_destroy(update_region);
 }
 
 static void histogram_view_draw_image_region(HistogramView *self, GdkRegion *region) {
     GdkRectangle *rects;
     int n_rects, i;
+    GdkPixbuf *image = self->pixbuf ? self->pixbuf : self->imager->image;
     gdk_region_get_rectangles(region, &rects, &n_rects);
 
-    if (self->imager->fgalpha < 0xFFFF || self->imager->bgalpha < 0xFFFF) {
+    if (!self->pixbuf && (self->imager->fgalpha < 0xFFFF || self->imager->bgalpha < 0xFFFF)) {
 	/* If we need to draw with alpha, composite our histogram imager's output
 	 * onto a checkerboard. It's a little messy writing directly to the imager's
 	 * pixbuf, but since we update the image before saving it anyway this shouldn't
@@ -196,7 +226,7 @@ static void histogram_view_draw_image_region(HistogramView *self, GdkRegion *reg
 			      rects[i].x, rects[i].y,
 			      rects[i].width, rects[i].height,
 			      GDK_RGB_DITHER_NORMAL,
-			      gdk_pixbuf_get_pixels(self->imager->image) +
+			      gdk_pixbuf_get_pixels(image) +
 			      rects[i].x * 4 +
 			      rects[i].y * self->imager->width * 4,
 			      self->imager->width * 4);
@@ -222,7 +252,7 @@ static gboolean on_expose(GtkWidget *widget, GdkEventExpose *event) {
     HistogramView *self = HISTOGRAM_VIEW(widget);
     GdkRegion *image_rect_region, *outside_image;
 
-    if (self->imager->image && !self->imager->size_dirty_flag) {
+    if (self->pixbuf || (self->imager->image && !self->imager->size_dirty_flag)) {
 	/* Separate the expose region into a region inside our image and a region outside
 	 * our image. Draw the first with histogram_view_draw_image_region and the second
 	 * with histogram_view_draw_background_region.
@@ -44,6 +44,7 @@ struct _HistogramView {
     GtkDrawingArea parent;
 
     HistogramImager *imager;
+    GdkPixbuf *pixbuf;
     int old_width, old_height;
 };
 
@@ -63,6 +64,8 @@ GtkWidget* histogram_view_new        (HistogramImager *imager);
 void       histogram_view_update     (HistogramView   *self);
 void       histogram_view_set_imager (HistogramView   *self,
 				      HistogramImager *imager);
+void       histogram_view_show_pixbuf(HistogramView   *self,
+				      GdkPixbuf       *pixbuf);
 
 G_END_DECLS
 
@@ -24,6 +24,8 @@
  */
 
 #include "iterative-map.h"
+#include "render-stats.h"
+#include "trace.h"
 #include <stdlib.h>
 
 enum {
@@ -109,7 +111,11 @@ static void iterative_map_init(IterativeMap *self) {
 
 void iterative_map_calculate(IterativeMap *self, guint iterations) {
     IterativeMapClass *class = ITERATIVE_MAP_CLASS(G_OBJECT_GET_CLASS(self));
+    double start = render_stats_clock();
+    trace_begin("calculate");
     class->calculate(self, iterations);
+    HISTOGRAM_IMAGER(self)->calc_seconds += render_stats_clock() - start;
+    trace_end("calculate");
     g_signal_emit(G_OBJECT(self), iterative_map_signals[CALCULATION_FINISHED_SIGNAL], 0);
 }
 
@@ -119,7 +125,11 @@ void iterative_map_calculate_motion(IterativeMap          *self,
                                     ParameterInterpolator *interp,
                                     gpointer               interp_data) {
     IterativeMapClass *class = ITERATIVE_MAP_CLASS(G_OBJECT_GET_CLASS(self));
+    double start = render_stats_clock();
+    trace_begin("calculate");
     class->calculate_motion(self, iterations, continuation, interp, interp_data);
+    HISTOGRAM_IMAGER(self)->calc_seconds += render_stats_clock() - start;
+    trace_end("calculate");
     g_signal_emit(G_OBJECT(self), iterative_map_signals[CALCULATION_FINISHED_SIGNAL], 0);
 }
 
@@ -175,8 +185,13 @@ void iterative_map_calculate_motion_timed(IterativeMap          *self,
 
 static int    iterative_map_idle_handler(gpointer user_data)
 {
+    /* The whole idle step, including the calculation-finished
+     * handlers, so GUI work shows up nested inside it.
+     */
     IterativeMap* self = ITERATIVE_MAP(user_data);
+    trace_begin("idle");
     iterative_map_calculate_timed(self, self->render_time);
+    trace_end("idle");
     return 1;
 }
 
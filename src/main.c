@@ -46,7 +46,14 @@
 #include "screensaver.h"
 #include "remote-server.h"
 #include "batch-image-render.h"
+#include "histogram-dump.h"
+#include "benchmark.h"
+#include "render-stats.h"
+#include "trace.h"
+#include "animation-batch-render.h"
 #include "gui-util.h"
+#include "thread-util.h"
+#include "math-util.h"
 
 #ifdef HAVE_GNET
 #include "cluster-model.h"
@@ -54,11 +61,9 @@
 #endif
 
 static void usage                  (char          **argv);
-static void animation_render_main  (IterativeMap   *map,
-				    Animation      *animation,
-				    const gchar    *filename,
-				    double          quality);
 static void acquire_console        (void);
+static int  write_stats_json       (IterativeMap   *map,
+				    const char     *filename);
 #ifdef HAVE_GNET
 static void daemonize_to_pidfile   (const char* filename);
 #endif
@@ -71,16 +76,28 @@ int main(int argc, char ** argv) {
     gboolean have_gtk;
     gboolean verbose = FALSE;
     gboolean hidden = FALSE;
-    enum {INTERACTIVE, RENDER, SCREENSAVER, REMOTE} mode = INTERACTIVE;
+    enum {INTERACTIVE, RENDER, SCREENSAVER, REMOTE, MERGE, BENCHMARK} mode = INTERACTIVE;
     const gchar *outputFile = NULL;
     const gchar *pidfile = NULL;
     int c, option_index=0;
     double quality = 1.0;
+    double time_budget = 0;
+    double frame_budget = 0;
+    gboolean have_seed = FALSE;
+    guint32 seed = 0;
+    guint shard_index = 0, shard_count = 0;
+    gboolean merge = FALSE;
+    double iterations = 0;
+    const gchar *stats_file = NULL;
+    const gchar *trace_file = NULL;
 #ifdef HAVE_GNET
     int port_number = FYRE_DEFAULT_PORT;
+    gchar *cluster_hosts = NULL;
+    gboolean partitioned = FALSE;
 #endif
     GError *error = NULL;
 
+    thread_util_init();
     math_init();
     g_type_init();
     have_gtk = gtk_init_check(&argc, &argv);
@@ -115,6 +132,16 @@ int main(int argc, char ** argv) {
 	    {"chdir",        1, NULL, 1002},   /* Undocumented, used by win32 file associations */
 	    {"pidfile",      1, NULL, 1003},
 	    {"version",      0, NULL, 1004},
+	    {"time-budget",  1, NULL, 1005},
+	    {"frame-budget", 1, NULL, 1006},
+	    {"seed",         1, NULL, 1007},
+	    {"partition",    0, NULL, 1008},
+	    {"shard",        1, NULL, 1009},
+	    {"merge",        0, NULL, 1010},
+	    {"benchmark",    0, NULL, 1011},
+	    {"iterations",   1, NULL, 1012},
+	    {"stats-json",   1, NULL, 1013},
+	    {"trace",        1, NULL, 1014},
 	    {NULL},
 	};
 	c = getopt_long(argc, argv, "hi:n:o:p:s:S:q:rvP:c:C",
@@ -169,8 +196,12 @@ int main(int argc, char ** argv) {
 #ifdef HAVE_GNET
 	case 'c':
 	    {
-		ClusterModel *cluster = cluster_model_get(map, TRUE);
-		cluster_model_add_nodes(cluster, optarg);
+		/* Nodes are added once we know whether we're a server,
+		 * since servers give each connection its own cluster.
+		 */
+		gchar *hosts = cluster_hosts ? g_strconcat(cluster_hosts, ",", optarg, NULL) : g_strdup(optarg);
+		g_free(cluster_hosts);
+		cluster_hosts = hosts;
 	    }
 	    break;
 	case 'C':
@@ -221,6 +252,53 @@ int main(int argc, char ** argv) {
 	    printf("%s\n", VERSION);
 	    return 0;
 
+	case 1005: /* --time-budget */
+	    time_budget = atof(optarg);
+	    break;
+
+	case 1006: /* --frame-budget */
+	    frame_budget = atof(optarg);
+	    break;
+
+	case 1007: /* --seed */
+	    seed = strtoul(optarg, NULL, 10);
+	    have_seed = TRUE;
+	    break;
+
+	case 1009: /* --shard */
+	    if (sscanf(optarg, "%u/%u", &shard_index, &shard_count) != 2 ||
+		shard_index >= shard_count) {
+		fprintf(stderr, "Shards are given as I/N, with I counting from 0 to N-1\n");
+		return 1;
+	    }
+	    break;
+
+	case 1010: /* --merge */
+	    merge = TRUE;
+	    break;
+
+	case 1011: /* --benchmark */
+	    mode = BENCHMARK;
+	    break;
+
+	case 1012: /* --iterations */
+	    iterations = strtod(optarg, NULL);
+	    break;
+
+	case 1013: /* --stats-json */
+	    stats_file = optarg;
+	    break;
+
+	case 1014: /* --trace */
+	    trace_file = optarg;
+	    break;
+
+#ifdef HAVE_GNET
+	case 1008: /* --partition */
+	    partitioned = TRUE;
+	    break;
+#endif
+
 	case 'h':
 	default:
 	    usage(argv);
@@ -228,12 +306,29 @@ int main(int argc, char ** argv) {
 	}
     }
 
-    if (optind + 1 < argc) {
+    /* Merging takes any number of histogram dumps, and nothing else */
+    if (merge) {
+	if (!outputFile || optind == argc) {
+	    usage(argv);
+	    return 1;
+	}
+	mode = MERGE;
+    }
+    else if (optind + 1 < argc) {
 	usage(argv);
 	return 1;
     }
 
-    if (optind != argc) {
+    if (shard_count && (mode != RENDER || animate)) {
+	fprintf(stderr, "--shard only works when rendering a single image with --output\n");
+	return 1;
+    }
+    if (iterations > 0 && mode != RENDER) {
+	fprintf(stderr, "--iterations only works when rendering with --output\n");
+	return 1;
+    }
+
+    if (optind != argc && !merge) {
 	char *ext = strrchr (argv[optind], '.');
 	if (ext) {
 	    if (g_strcasecmp(ext, ".png") == 0) {
@@ -255,6 +350,58 @@ int main(int argc, char ** argv) {
 	}
     }
 
+#ifdef HAVE_GNET
+    if (cluster_hosts && mode != REMOTE) {
+	ClusterModel *cluster = cluster_model_get(map, TRUE);
+	cluster_model_add_nodes(cluster, cluster_hosts);
+    }
+    if (partitioned && mode != REMOTE) {
+	ClusterModel *cluster = cluster_model_get(map, FALSE);
+	if (cluster) {
+	    cluster_model_set_partitioned(cluster, TRUE);
+	    g_object_unref(cluster);
+	}
+    }
+#endif
+
+    if (shard_count && !have_seed) {
+	/* Unseeded shards start from the time, like everything else, but
+	 * the shard index still has to go in. Shards started together
+	 * would otherwise be able to render the same samples.
+	 */
+	GTimeVal now;
+	g_get_current_time(&now);
+	seed = math_mix_seed(now.tv_sec, now.tv_usec);
+    }
+
+    /* Each shard gets its own stream, just like cluster nodes. Stream 0
+     * stays with the unsharded render, so it matches a render without
+     * --shard.
+     */
+    if (shard_count)
+	math_seed(math_mix_seed(seed, shard_index + 1));
+    else if (have_seed)
+	math_seed(seed);
+
+#ifdef HAVE_GNET
+    if (have_seed) {
+	ClusterModel *cluster = cluster_model_get(map, FALSE);
+	if (cluster) {
+	    cluster_model_set_job_seed(cluster, seed);
+	    g_object_unref(cluster);
+	}
+    }
+#endif
+
+    if (trace_file) {
+	GError *trace_error = NULL;
+	if (!trace_open(trace_file, &trace_error)) {
+	    fprintf(stderr, "Error: %s\n", trace_error->message);
+	    g_error_free(trace_error);
+	    return 1;
+	}
+    }
+
     switch (mode) {
 
     case INTERACTIVE: {
@@ -290,13 +437,58 @@ int main(int argc, char ** argv) {
 	    g_print ("Error: %s\n", error->message);
 	    g_error_free (error);
 	}
-	if (animate)
-	    animation_render_main (map, animation, outputFile, quality);
-	else
+	if (animate) {
+	    animation_batch_render (map, animation, outputFile, quality, iterations,
+				    time_budget, frame_budget);
+	}
+	else if (shard_count) {
+	    /* Quality grows in proportion to the number of samples, so
+	     * this shard's share of the samples gets its share of quality.
+	     */
+	    if (iterations > 0)
+		batch_image_calculate_iterations (map, iterations / shard_count);
+	    else
+		batch_image_calculate (map, quality / shard_count);
+	    printf("Saving histogram for shard %u of %u...\n", shard_index, shard_count);
+	    if (!histogram_dump_save (map, outputFile, &error)) {
+		g_print ("Error: %s\n", error->message);
+		g_error_free (error);
+		return 1;
+	    }
+	}
+	else if (iterations > 0) {
+	    batch_image_calculate_iterations (map, iterations);
+	    batch_image_save (map, outputFile);
+	}
+	else {
 	    batch_image_render (map, outputFile, quality);
+	}
 	break;
     }
 
+    case MERGE: {
+	int i;
+
+	acquire_console();
+	for (i=optind; i<argc; i++) {
+	    if (!histogram_dump_merge (map, argv[i], i == optind, &error)) {
+		g_print ("Error: %s\n", error->message);
+		g_error_free (error);
+		return 1;
+	    }
+	}
+	printf("Merged %d histograms, %.3e iterations, quality %.04f\n", argc - optind,
+	       map->iterations, histogram_imager_compute_quality (HISTOGRAM_IMAGER (map)));
+	batch_image_save (map, outputFile);
+	break;
+    }
+
+    case BENCHMARK:
+	/* Benchmarks are always seeded, so results can be compared between runs */
+	acquire_console();
+	benchmark_run(have_seed ? seed : 1);
+	break;
+
     case REMOTE: {
 #ifdef HAVE_GNET
         if (verbose) {
@@ -307,7 +499,7 @@ int main(int argc, char ** argv) {
 	}
 	if (!hidden)
 	    discovery_server_new(FYRE_DEFAULT_SERVICE, port_number);
-	remote_server_main_loop(port_number, have_gtk, verbose);
+	remote_server_main_loop(port_number, have_gtk, verbose, cluster_hosts);
 #else
 	fprintf(stderr,
 		"This Fyre binary was compiled without gnet support.\n"
@@ -338,6 +530,33 @@ int main(int argc, char ** argv) {
     }
     }
 
+    trace_close();
+    if (stats_file && (mode == RENDER || mode == MERGE))
+	return write_stats_json(map, stats_file);
+    return 0;
+}
+
+static int write_stats_json(IterativeMap *map, const char *filename) {
+    /* Performance counters for the finished render, "-" for stdout */
+    RenderStats stats;
+    gchar *json;
+    FILE *f = stdout;
+
+    if (strcmp(filename, "-")) {
+	f = fopen(filename, "w");
+	if (!f) {
+	    fprintf(stderr, "Can't open stats file '%s'\n", filename);
+	    return 1;
+	}
+    }
+
+    render_stats_collect(&stats, map);
+    json = render_stats_to_json(&stats);
+    fputs(json, f);
+    g_free(json);
+
+    if (f != stdout)
+	fclose(f);
     return 0;
 }
 
@@ -355,6 +574,24 @@ static void usage(char **argv) {
 	    "  -o, --output FILE       Instead of presenting an interactive GUI, render\n"
 	    "                            an image or animation with the provided settings\n"
 	    "                            noninteractively, and store it in FILE.\n"
+	    "  --stats-json FILE       After rendering with --output or --merge, write\n"
+	    "                            performance counters to FILE as JSON, or to\n"
+	    "                            stdout if FILE is '-'.\n"
+	    "  --trace FILE            Record a timeline of calculation, colorizing,\n"
+	    "                            merging and file output on each thread to FILE,\n"
+	    "                            in Chrome's trace event format.\n"
+	    "  --iterations N          With --output, calculate exactly N iterations rather\n"
+	    "                            than calculating to a quality, or N for each frame\n"
+	    "                            of an animation. Along with --seed, this renders\n"
+	    "                            the same output every time.\n"
+	    "  --shard I/N             With --output, render shard I of N for an offline\n"
+	    "                            render: a 1/N share of the quality, from its own\n"
+	    "                            random stream, saved as a raw histogram dump.\n"
+	    "  --merge                 Add up the histogram dumps given as files, and save\n"
+	    "                            the resulting image to the file named by --output.\n"
+	    "  --benchmark             Time the calculation, imaging and output code, and\n"
+	    "                            print tab-separated results. Use --seed to change\n"
+	    "                            the random seed from its default of 1.\n"
 	    "  -h, --help              Display this text.\n"
 	    "  --version               Show the version number and exit.\n"
 	    "\n"
@@ -365,7 +602,15 @@ static void usage(char **argv) {
             "                            as they become available.\n"
 	    "  -r, --remote            Remote control mode. Fyre will listen by default on\n"
 	    "                            port 7931 for commands, and can act as a rendering\n"
-	    "                            server in a cluster.\n"
+	    "                            server in a cluster. With --cluster, the server\n"
+	    "                            also drives those nodes and merges their results,\n"
+	    "                            acting as a single node with their combined speed.\n"
+	    "  --partition             Split the image into bands of rows, one for each\n"
+	    "                            cluster node. Nodes only keep points landing in\n"
+	    "                            their own band, so very large images can be rendered\n"
+	    "                            with the memory of the whole cluster. With --output,\n"
+	    "                            bands stay on the nodes until the image is saved,\n"
+	    "                            one band at a time, as a PNG.\n"
 	    "  -P, --port N            Set the TCP port number used for remote control mode.\n"
 	    "  -v, --verbose           In remote control mode, display status messages on the\n"
 	    "                            console and don't run as a daemon.\n"
@@ -392,65 +637,17 @@ static void usage(char **argv) {
 	    "                            which we stop rendering. Larger numbers give\n"
 	    "                            smoother and more detailed results, but increase\n"
 	    "                            running time. The default of 1.0 gives roughly one\n"
-	    "                            histogram sample for every final image sample.\n",
+	    "                            histogram sample for every final image sample.\n"
+	    "  --time-budget SECONDS   When rendering an animation, finish within this much\n"
+	    "                            wall-clock time. Frames are rendered to a uniform\n"
+	    "                            quality, lowered as necessary to meet the deadline.\n"
+	    "  --frame-budget SECONDS  When rendering an animation, never spend more than\n"
+	    "                            this much time calculating any one frame.\n"
+	    "  --seed N                Seed the random number generators, including those\n"
+	    "                            of every cluster node, so renders can be repeated.\n",
 	    argv[0]);
 }
 
-static void animation_render_main (IterativeMap *map,
-				   Animation    *animation,
-				   const gchar  *filename,
-				   double        quality) {
-    const double frame_rate = 24;
-    AnimationIter iter;
-    ParameterHolderPair frame;
-    guint frame_count = 0;
-    gboolean continuation;
-    double current_quality;
-
-    AviWriter *avi = avi_writer_new(fopen(filename, "wb"),
-				    HISTOGRAM_IMAGER(map)->width,
-				    HISTOGRAM_IMAGER(map)->height,
-				    frame_rate);
-
-    animation_iter_get_first(animation, &iter);
-    frame.a = PARAMETER_HOLDER(de_jong_new());
-    frame.b = PARAMETER_HOLDER(de_jong_new());
-
-    while (animation_iter_read_frame(animation, &iter, &frame, frame_rate)) {
-
-	continuation = FALSE;
-	do {
-	    /* Calculate 0.5 seconds between quality updates. This is lower than the
-	     * batch image rendering default of 2.0 seconds, to better handle
-	     * lower-quality animations where the individual frames go quicker.
-	     */
-	    iterative_map_calculate_motion_timed(map, 0.5, continuation,
-						 PARAMETER_INTERPOLATOR(parameter_holder_interpolate_linear),
-						 &frame);
-	    current_quality = histogram_imager_compute_quality(HISTOGRAM_IMAGER(map));
-
-	    printf("\rFrame %d, %e iterations, %.04f quality", frame_count,
-		   map->iterations, current_quality);
-	    fflush(stdout);
-
-	    continuation = TRUE;
-	} while (current_quality < quality);
-
-	histogram_imager_update_image(HISTOGRAM_IMAGER(map));
-	avi_writer_append_frame(avi, HISTOGRAM_IMAGER(map)->image);
-
-	/* Move to the next line for each frame.
-	 * Updates within a frame overwrite that line.
-	 */
-	printf("\n");
-
-	frame_count++;
-    }
-
-    avi_writer_close(avi);
-}
-
-
 /* Daemonize this process, saving the new PID to a file if a name
  * is specified. No pidfile is written if the filename is NULL.
  */
@@ -25,21 +25,95 @@
 #include <glib.h>
 #include <math.h>
 
-/* It's much faster to use our own global g_rand, rather than
- * relying on the g_random_* family of functions. Those functions
- * are thread-safe, and the locking around that shared g_rand can
- * take a very significant amount of CPU. We don't need thread-safe
- * random variates yet.
+/* It's much faster to use our own g_rand, rather than relying on the
+ * g_random_* family of functions. Those functions are thread-safe, and
+ * the locking around that shared g_rand can take a very significant
+ * amount of CPU. Instead, each thread gets its own private g_rand,
+ * created the first time that thread asks for a random variate.
  */
 static GRand* global_random = NULL;
+static GPrivate* thread_random = NULL;
+static GPrivate* thread_override = NULL;
+static GRand* unthreaded_override = NULL;
+G_LOCK_DEFINE_STATIC(random_seed);
+static guint32 random_seed;
+
+static GRand* get_random() {
+    GRand *random;
+
+    if (!thread_random)
+	return unthreaded_override ? unthreaded_override : global_random;
+
+    random = g_private_get(thread_override);
+    if (random)
+	return random;
+
+    random = g_private_get(thread_random);
+    if (!random) {
+	/* Each new thread's seed is offset from the last one by
+	 * a large odd constant, so no two threads share a sequence.
+	 */
+	G_LOCK(random_seed);
+	random_seed += 0x9E3779B9;
+	random = g_rand_new_with_seed(random_seed);
+	G_UNLOCK(random_seed);
+	g_private_set(thread_random, random);
+    }
+    return random;
+}
 
 void math_init() {
-    global_random = g_rand_new_with_seed(time(NULL));
+    /* Mix in the microseconds too, so that processes
+     * started in the same second still get different sequences.
+     */
+    GTimeVal now;
+    g_get_current_time(&now);
+    random_seed = math_mix_seed(now.tv_sec, now.tv_usec);
+
+    global_random = g_rand_new_with_seed(random_seed);
+    if (g_thread_supported()) {
+	thread_random = g_private_new((GDestroyNotify) g_rand_free);
+	thread_override = g_private_new(NULL);
+    }
+}
+
+void math_seed(guint32 seed) {
+    G_LOCK(random_seed);
+    random_seed = seed;
+    g_rand_set_seed(global_random, seed);
+    G_UNLOCK(random_seed);
+}
+
+guint32 math_mix_seed(guint32 a, guint32 b) {
+    /* Fold b into a, then scramble the result with the
+     * finalization step from MurmurHash3.
+     */
+    guint32 h = a ^ (b * 0x9E3779B9 + 0x7F4A7C15);
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35;
+    h ^= h >> 16;
+    return h;
+}
+
+GRand* math_set_thread_random(GRand* random) {
+    GRand *previous;
+
+    if (!thread_override) {
+	previous = unthreaded_override;
+	unthreaded_override = random;
+	return previous;
+    }
+
+    previous = g_private_get(thread_override);
+    g_private_set(thread_override, random);
+    return previous;
 }
 
 double uniform_variate() {
     /* A uniform random variate between 0 and 1 */
-    return g_rand_double(global_random);
+    return g_rand_double(get_random());
 }
 
 void normal_variate_pair(double *a, double *b) {
@@ -67,7 +141,7 @@ void normal_variate_pair(double *a, double *b) {
 }
 
 int int_variate(int minimum, int maximum) {
-    return g_rand_int_range(global_random, minimum, maximum);
+    return g_rand_int_range(get_random(), minimum, maximum);
 }
 
 int find_upper_pow2(int x) {
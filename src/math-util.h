@@ -24,8 +24,25 @@
 #ifndef __MATH_UTIL_H__
 #define __MATH_UTIL_H__
 
+#include <glib.h>
+
 void math_init();
 
+/* Restart the random number generators from a known seed. Threads
+ * that have already drawn random numbers keep their current sequence.
+ */
+void math_seed(guint32 seed);
+
+/* Combine two seeds, such that similar inputs give unrelated results */
+guint32 math_mix_seed(guint32 a, guint32 b);
+
+/* Calculations that need their own reproducible random sequence can
+ * install a GRand on the current thread while they run. Returns the
+ * previously installed GRand, which should be restored afterwards.
+ * NULL reinstates the thread's default sequence.
+ */
+GRand* math_set_thread_random(GRand* random);
+
 int int_variate(int minimum, int maximum);
 double uniform_variate();
 void normal_variate_pair(double *a, double *b);
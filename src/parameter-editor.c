@@ -384,16 +384,19 @@ static void parameter_editor_add_enum(ParameterEditor *self, GParamSpec *spec) {
     GtkWidget *combo;
     GValue gv;
     GEnumClass *klass;
-    gint i;
+    gint i, n_values;
 #if (GTK_MINOR_VERSION < 4)
     GtkWidget *menu;
 #endif
 
     klass = (GEnumClass*) g_type_class_ref (spec->value_type);
+    n_values = klass->n_values;
+    if (param_spec_get_gui_values (spec))
+	n_values = MIN(n_values, param_spec_get_gui_values (spec));
 
 #if (GTK_MINOR_VERSION >= 4)
     combo = gtk_combo_box_new_text ();
-    for (i = 0; i < klass->n_values; i++)
+    for (i = 0; i < n_values; i++)
 	{
 	    GEnumValue *value;
 
@@ -405,7 +408,7 @@ static void parameter_editor_add_enum(ParameterEditor *self, GParamSpec *spec) {
     combo = gtk_option_menu_new ();
     menu = gtk_menu_new ();
 
-    for (i = 0; i < klass->n_values; i++)
+    for (i = 0; i < n_values; i++)
 	{
 	    GEnumValue *value;
 
@@ -520,6 +523,10 @@ static void on_changed_enum(GtkWidget *widget, ParameterEditor *self) {
     active = gtk_option_menu_get_history (GTK_OPTION_MENU (widget));
 #endif
 
+    /* Nothing is selected while the value is one the GUI doesn't offer */
+    if (active < 0)
+	return;
+
     self->suppress_notify = TRUE;
     g_object_set (self->holder,
 		  spec->name,
@@ -472,4 +472,14 @@ const gchar* param_spec_get_dependency (GParamSpec  *pspec) {
     return g_param_spec_get_qdata(pspec, g_quark_from_static_string("dependency"));
 }
 
+void param_spec_set_gui_values (GParamSpec  *pspec,
+				guint        n_values) {
+    g_param_spec_set_qdata(pspec, g_quark_from_static_string("gui-values"), GUINT_TO_POINTER(n_values));
+}
+
+guint param_spec_get_gui_values (GParamSpec  *pspec) {
+    /* Zero if all values are shown */
+    return GPOINTER_TO_UINT(g_param_spec_get_qdata(pspec, g_quark_from_static_string("gui-values")));
+}
+
 /* The End */
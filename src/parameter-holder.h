@@ -86,6 +86,7 @@ typedef struct {
 #define PARAM_SERIALIZED   (1 << (G_PARAM_USER_SHIFT + 0))    /* Parameters we're interested in serializing */
 #define PARAM_INTERPOLATE  (1 << (G_PARAM_USER_SHIFT + 1))    /* Parameters we're interested in interpolating */
 #define PARAM_IN_GUI       (1 << (G_PARAM_USER_SHIFT + 2))    /* Parameters that should be visible in the GUI */
+#define PARAM_COSMETIC     (1 << (G_PARAM_USER_SHIFT + 3))    /* Parameters that only affect the image, not the calculation */
 
 /* This is attached to the "increments" quark using param_spec_set_increments */
 typedef struct {
@@ -138,12 +139,20 @@ void              param_spec_set_increments (GParamSpec  *pspec,
 void              param_spec_set_dependency (GParamSpec  *pspec,
 					     const gchar *dependency_name);
 
+/* Only the first n_values entries of an enum are offered in the GUI.
+ * The rest can still be set from parameter files.
+ */
+void              param_spec_set_gui_values (GParamSpec  *pspec,
+					     guint        n_values);
+
 const gchar*      param_spec_get_group      (GParamSpec  *pspec);
 
 const ParameterIncrements* param_spec_get_increments (GParamSpec  *pspec);
 
 const gchar*      param_spec_get_dependency (GParamSpec  *pspec);
 
+guint             param_spec_get_gui_values (GParamSpec  *pspec);
+
 
 G_END_DECLS
 
@@ -23,11 +23,18 @@
  */
 
 #include <gtk/gtk.h>
+#include <string.h>
 #include "probability-map.h"
 #include "math-util.h"
 
 static void probability_map_class_init(ProbabilityMapClass *klass);
 static void probability_map_dispose(GObject *gobject);
+static void probability_map_build_alias_table(ProbabilityMap *self, gdouble *weights, gdouble sum);
+
+/* Batches are drawn in blocks of this many samples, small enough
+ * to keep their temporary arrays on the stack.
+ */
+#define BATCH_BLOCK_SIZE 256
 
 
 /************************************************************************************/
@@ -67,9 +74,13 @@ static void probability_map_dispose(GObject *gobject)
 {
     ProbabilityMap *self = PROBABILITY_MAP(gobject);
 
-    if (self->cumulative) {
-	g_free(self->cumulative);
-	self->cumulative = NULL;
+    if (self->alias_probability) {
+	g_free(self->alias_probability);
+	self->alias_probability = NULL;
+    }
+    if (self->alias) {
+	g_free(self->alias);
+	self->alias = NULL;
     }
 }
 
@@ -154,29 +165,30 @@ ProbabilityMap*  probability_map_new_raw          (const guchar*         data,
     const guchar* pixel;
     int x;
     int y = height;
-    gfloat *output;
+    gdouble *weights, *output;
 
     self->width = width;
     self->height = height;
     self->image_scale_x = 1.0 / (width - 1);
     self->image_scale_y = 1.0 / (height - 1);
+    self->length = width * height;
 
-    self->cumulative_length = width * height;
-    self->cumulative = g_new(gfloat, self->cumulative_length);
-    output = self->cumulative;
+    weights = g_new(gdouble, self->length);
+    output = weights;
 
-    /* Caluclate a cumulative distribution. For each pixel, we save the
-     * sum of it and all prior pixels. For speed, these inner loops are
-     * implemented separately for each pixel type using a macro.
+    /* Read every pixel's weight, and their total. Both are kept in double
+     * precision, since a float sum stops resolving individual pixels on
+     * large images. For speed, these inner loops are implemented separately
+     * for each pixel type using a macro.
      */
 
-#define CALCULATE_SUMS(type) do {       \
+#define READ_WEIGHTS(type) do {         \
         while (y) {                     \
 	    x = width;                  \
 	    pixel = row;                \
 	    while (x) {                 \
-		sum += *(type*)pixel;   \
-		*output = sum;          \
+		*output = *(type*)pixel;\
+		sum += *output;         \
 		output++;               \
 		x--;                    \
 		pixel += pixel_stride;  \
@@ -189,115 +201,148 @@ ProbabilityMap*  probability_map_new_raw          (const guchar*         data,
     switch (pixel_type) {
 
     case G_TYPE_UCHAR:
-	CALCULATE_SUMS(guchar);
+	READ_WEIGHTS(guchar);
 	break;
 
     case G_TYPE_UINT:
-	CALCULATE_SUMS(guint);
+	READ_WEIGHTS(guint);
 	break;
 
     case G_TYPE_ULONG:
-	CALCULATE_SUMS(gulong);
+	READ_WEIGHTS(gulong);
 	break;
 
     case G_TYPE_FLOAT:
-	CALCULATE_SUMS(gfloat);
+	READ_WEIGHTS(gfloat);
 	break;
 
     case G_TYPE_DOUBLE:
-	CALCULATE_SUMS(gdouble);
+	READ_WEIGHTS(gdouble);
 	break;
 
     default:
 	g_warning("Unsupported pixel format");
-
+	memset(weights, 0, self->length * sizeof(weights[0]));
     }
 
-#undef CALCULATE_SUMS
+#undef READ_WEIGHTS
+
+    probability_map_build_alias_table(self, weights, sum);
+    g_free(weights);
 
     return self;
 }
 
-
-/************************************************************************************/
-/******************************************************************* Public Methods */
-/************************************************************************************/
-
-void             probability_map_ints             (ProbabilityMap*       self,
-						   guint*                x,
-						   guint*                y)
+static void probability_map_build_alias_table(ProbabilityMap *self, gdouble *weights, gdouble sum)
 {
-#if 1
-    gfloat key;
-    gfloat* cumulative = self->cumulative;
-    gsize length = self->cumulative_length;
-    gsize width = self->width;
-    struct {
-	int index;
-	int ge;
-    } endpoints[2], midpoints[2];
-
-    /* Start with a uniform variate, scaled to cover the range of our CDF */
-    key = uniform_variate() * cumulative[length - 1];
-
-    /* Do a binary search for the first value in 'cumulative' that's greater than
-     * or equal to 'key'. These semantics are necessary to ensure that in a run
-     * of values with the same cumulative value, only the first one is ever chosen
-     * since the other values have zero probability in the original image.
+    /* Build an alias table using Vose's method. Each weight is scaled so
+     * the average is 1, then every entry below 1 is topped up from one
+     * above 1, which becomes its alias. Afterwards, drawing a uniform index
+     * and choosing between it and its alias reproduces the original
+     * distribution exactly, in constant time.
+     *
+     * The worklists share one array: 'small' entries grow up from the
+     * bottom, 'large' entries grow down from the top.
      */
-    endpoints[0].index = 0;
-    endpoints[1].index = length - 1;
-    endpoints[0].ge = cumulative[endpoints[0].index] >= key;
-    endpoints[1].ge = cumulative[endpoints[1].index] >= key;
-
-    while (endpoints[1].index > endpoints[0].index) {
-	midpoints[0].index = (endpoints[0].index + endpoints[1].index) >> 1;
-	midpoints[1].index = midpoints[0].index + 1;
-	midpoints[0].ge = cumulative[midpoints[0].index] >= key;
-	midpoints[1].ge = cumulative[midpoints[1].index] >= key;
-
-	if ((!midpoints[0].ge) && midpoints[1].ge) {
-	    /* We're sitting right on the stopping condition */
-	    break;
-	}
-	else if (!midpoints[1].ge) {
-	    /* The solution is above this */
-	    endpoints[0] = midpoints[1];
+    gsize length = self->length;
+    guint32 *worklist = g_new(guint32, length);
+    gsize num_small = 0, large_start = length;
+    guint32 i, small, large, last_large = 0;
+    gdouble scale;
+
+    self->alias_probability = g_new(gdouble, length);
+    self->alias = g_new(guint32, length);
+
+    /* An image with no weight at all samples uniformly */
+    if (sum <= 0) {
+	for (i=0; i<length; i++) {
+	    self->alias_probability[i] = 1;
+	    self->alias[i] = i;
 	}
-	else if (midpoints[0].ge) {
-	    /* The solution is below this */
-	    endpoints[1] = midpoints[0];
+	g_free(worklist);
+	return;
+    }
+
+    scale = length / sum;
+    for (i=0; i<length; i++) {
+	weights[i] *= scale;
+	if (weights[i] < 1)
+	    worklist[num_small++] = i;
+	else
+	    worklist[--large_start] = i;
+    }
+
+    while (num_small > 0 && large_start < length) {
+	small = worklist[--num_small];
+	large = worklist[large_start++];
+	last_large = large;
+
+	self->alias_probability[small] = weights[small];
+	self->alias[small] = large;
+
+	weights[large] = (weights[large] + weights[small]) - 1;
+	if (weights[large] < 1)
+	    worklist[num_small++] = large;
+	else
+	    worklist[--large_start] = large;
+    }
+
+    /* Whatever is left over is within rounding error of 1. The exception
+     * is a zero-weight pixel, which must never be chosen itself.
+     */
+    while (large_start < length) {
+	large = worklist[large_start++];
+	self->alias_probability[large] = 1;
+	self->alias[large] = large;
+    }
+    while (num_small > 0) {
+	small = worklist[--num_small];
+	if (weights[small] > 0) {
+	    self->alias_probability[small] = 1;
+	    self->alias[small] = small;
 	}
 	else {
-	    /* This should only be possible if our CDF wasn't sorted */
-	    g_assert(0);
+	    self->alias_probability[small] = 0;
+	    self->alias[small] = last_large;
 	}
     }
 
-    /* Convert an index within our cumulative array into (x,y) coords */
-    *x = midpoints[1].index % width;
-    *y = midpoints[1].index / width;
-#else
-    gfloat* cumulative = self->cumulative;
-    gsize length = self->cumulative_length;
-    gdouble energy;
-    gint current = self->current;
-    gsize width = self->width;
-
-    energy = uniform_variate() * 1000;
-
-    while (energy > 0) {
-	energy -= cumulative[current+1] - cumulative[current];
-	current++;
-	if (current == length-2)
-	    current = 0;
-    }
+    g_free(worklist);
+}
 
-    *x = current % width;
-    *y = current / width;
 
-    self->current = current;
-#endif
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+static inline guint32 probability_map_lookup   (ProbabilityMap*       self,
+						   gdouble               u)
+{
+    /* Convert a uniform variate to an index. The integer part of the
+     * scaled variate picks a table entry, and its fractional part decides
+     * between that entry and its alias.
+     */
+    gdouble scaled = u * self->length;
+    guint32 index = (guint32) scaled;
+
+    if (index >= self->length)
+	index = self->length - 1;
+
+    if (scaled - index < self->alias_probability[index])
+	return index;
+    else
+	return self->alias[index];
+}
+
+void             probability_map_ints             (ProbabilityMap*       self,
+						   guint*                x,
+						   guint*                y)
+{
+    guint32 index = probability_map_lookup(self, uniform_variate());
+
+    /* Convert an index within our table into (x,y) coords */
+    *x = index % self->width;
+    *y = index / self->width;
 }
 
 void             probability_map_normalized       (ProbabilityMap*       self,
@@ -333,4 +378,70 @@ void             probability_map_gaussian         (ProbabilityMap*       self,
     *y += b * self->image_scale_y * radius;
 }
 
+void             probability_map_ints_batch       (ProbabilityMap*       self,
+						   guint*                x,
+						   guint*                y,
+						   gsize                 count)
+{
+    /* Each block is split into separate passes, so the arithmetic passes
+     * have no data-dependent branches and can be vectorized by the compiler.
+     * Only the table lookups remain scalar.
+     */
+    gdouble scaled[BATCH_BLOCK_SIZE];
+    guint32 index[BATCH_BLOCK_SIZE];
+    const gdouble length = self->length;
+    const guint32 last = self->length - 1;
+    const guint width = self->width;
+    gsize block, i;
+
+    while (count) {
+	block = MIN(count, BATCH_BLOCK_SIZE);
+
+	for (i=0; i<block; i++)
+	    scaled[i] = uniform_variate() * length;
+
+	for (i=0; i<block; i++) {
+	    index[i] = (guint32) scaled[i];
+	    index[i] = MIN(index[i], last);
+	}
+
+	for (i=0; i<block; i++) {
+	    if (scaled[i] - index[i] >= self->alias_probability[index[i]])
+		index[i] = self->alias[index[i]];
+	}
+
+	for (i=0; i<block; i++) {
+	    x[i] = index[i] % width;
+	    y[i] = index[i] / width;
+	}
+
+	x += block;
+	y += block;
+	count -= block;
+    }
+}
+
+void             probability_map_uniform_batch    (ProbabilityMap*       self,
+						   gdouble*              x,
+						   gdouble*              y,
+						   gsize                 count)
+{
+    guint xi[BATCH_BLOCK_SIZE], yi[BATCH_BLOCK_SIZE];
+    gsize block, i;
+
+    while (count) {
+	block = MIN(count, BATCH_BLOCK_SIZE);
+	probability_map_ints_batch(self, xi, yi, block);
+
+	for (i=0; i<block; i++) {
+	    x[i] = (xi[i] + uniform_variate()) * self->image_scale_x;
+	    y[i] = (yi[i] + uniform_variate()) * self->image_scale_y;
+	}
+
+	x += block;
+	y += block;
+	count -= block;
+    }
+}
+
 /* The End */
@@ -48,14 +48,15 @@ struct _ProbabilityMap {
 
     /* Private */
 
-    gfloat* cumulative;           /* 1D cumulative distribution function */
-    gsize   cumulative_length;
+    /* Walker/Vose alias table, one entry per pixel. Each entry keeps its own
+     * index with probability alias_probability[i], otherwise it takes alias[i].
+     */
+    gdouble* alias_probability;
+    guint32* alias;
+    gsize    length;
 
     gdouble image_scale_x;
     gdouble image_scale_y;
-
-    gdouble energy;
-    int current;
 };
 
 struct _ProbabilityMapClass {
@@ -130,6 +131,19 @@ void             probability_map_gaussian         (ProbabilityMap*       self,
 						   gdouble*              y,
 						   double                radius);
 
+/* Every draw is O(1) regardless of image size. The batch versions fill
+ * 'count' entries in each output array, and are faster than calling the
+ * single-sample versions in a loop.
+ */
+void             probability_map_ints_batch       (ProbabilityMap*       self,
+						   guint*                x,
+						   guint*                y,
+						   gsize                 count);
+void             probability_map_uniform_batch    (ProbabilityMap*       self,
+						   gdouble*              x,
+						   gdouble*              y,
+						   gsize                 count);
+
 G_END_DECLS
 
 #endif /* __PROBABILITY_MAP_H__ */
@@ -53,10 +53,48 @@ static void       remote_client_start_retry   (RemoteClient*         self);
 static void       remote_client_stop_retry    (RemoteClient*         self);
 static gboolean   remote_client_retry_callback(gpointer              user_data);
 static void       remote_client_empty_queue   (RemoteClient*         self);
+static RemoteClosure* remote_client_pop_closure (RemoteClient*       self);
+static void       stream_format_callback      (RemoteClient*         self,
+					       RemoteResponse*       response,
+					       gpointer              user_data);
+static void       remote_client_recv_push     (RemoteClient*         self,
+					       RemoteResponse*       response);
+static gboolean   histogram_merge_response    (RemoteClient*         self,
+					       RemoteResponse*       response,
+					       HistogramImager*      dest,
+					       gboolean              grant);
+static void       histogram_merged            (gpointer              user_data,
+					       double                merge_seconds);
+static void       histogram_merged_grant      (gpointer              user_data,
+					       double                merge_seconds);
+static gpointer   histogram_merged_data       (RemoteClient*         self,
+					       gboolean              grant);
+static void       region_callback             (RemoteClient*         self,
+					       RemoteResponse*       response,
+					       gpointer              user_data);
+static void       remote_client_attach_shared (RemoteClient*         self,
+					       RemoteResponse*       response);
+static void       status_merge_callback       (RemoteClient*         self,
+					       RemoteResponse*       response,
+					       gpointer              user_data);
+
+/* A push queued on our merger, to be granted back once it's merged */
+typedef struct {
+    RemoteClient*  client;
+    guint          connection_serial;
+} RemotePushGrant;
 
 /* Smallest time interval, in seconds, to allow in speed calculations */
 #define MINIMUM_SPEED_WINDOW 1.0
 
+/* Weight of each new sample in our smoothed round trip time */
+#define RTT_SMOOTHING 0.2
+
+/* Seconds between reminders to a server pushing to us that we're still
+ * calculating. It must stay well below the server's idle timeout.
+ */
+#define KEEPALIVE_INTERVAL 60.0
+
 
 /************************************************************************************/
 /**************************************************** Initialization / Finalization */
@@ -122,6 +160,20 @@ static void remote_client_dispose(GObject *gobject)
 	g_timer_destroy(self->stream_request_timer);
 	self->stream_request_timer = NULL;
     }
+    if (self->clock) {
+	g_timer_destroy(self->clock);
+	self->clock = NULL;
+    }
+
+    if (self->push_dest) {
+	g_object_unref(self->push_dest);
+	self->push_dest = NULL;
+    }
+
+    if (self->shared) {
+	shared_memory_free(self->shared);
+	self->shared = NULL;
+    }
 }
 
 static
@@ -139,10 +191,19 @@ static void remote_client_init(RemoteClient *self)
     self->status_speed_timer = g_timer_new();
     self->stream_speed_timer = g_timer_new();
     self->stream_request_timer = g_timer_new();
+    self->clock = g_timer_new();
 
     /* Default stream interval: every second */
     self->min_stream_interval = 1.0;
 
+    /* Pushes of up to a megabyte, with two in flight so the
+     * server never has to wait a full round trip between them.
+     */
+    self->push_bytes = 1024 * 1024;
+    self->push_credits = 2;
+
+    self->iteration_share = 1.0;
+
     /* By default, retry connections every minute */
     self->retry_timeout = 60.0;
     self->is_retry_enabled = TRUE;
@@ -184,6 +245,35 @@ void           remote_client_connect          (RemoteClient*         self)
     }
     remote_client_empty_queue(self);
 
+    /* Until the server agrees otherwise, streams use the original format */
+    self->stream_format = HISTOGRAM_STREAM_RLE;
+
+    /* A new connection starts a new server-side state */
+    self->connection_serial++;
+    self->pending_param_changes = 0;
+    self->pending_stream_requests = 0;
+    self->pending_status_requests = 0;
+    self->is_fetching = FALSE;
+    self->param_generation = 0;
+    self->status_generation = 0;
+    self->prev_iterations = 0;
+    self->legacy_params = FALSE;
+    self->is_subscribed = FALSE;
+    self->subscribe_pending = FALSE;
+    self->legacy_push = FALSE;
+    self->rtt = 0;
+    self->merge_seconds = 0;
+    self->slow_passes = 0;
+    self->is_demoted = FALSE;
+    self->is_paused = FALSE;
+    self->region_refused = FALSE;
+    self->points_plotted = 0;
+    self->quality = 0;
+    if (self->shared) {
+	shared_memory_free(self->shared);
+	self->shared = NULL;
+    }
+
     /* Reset our speed counters and rate limiting timers */
     self->iter_accumulator = 0;
     self->byte_accumulator = 0;
@@ -236,6 +326,16 @@ gboolean       remote_client_is_ready         (RemoteClient*     self)
     return self->is_ready;
 }
 
+gboolean       remote_client_is_local         (RemoteClient*     self)
+{
+    /* Only loopback addresses count. Any other name for this
+     * machine just misses out on shared memory.
+     */
+    return !strcmp(self->host, "localhost") ||
+	!strncmp(self->host, "127.", 4) ||
+	!strcmp(self->host, "::1");
+}
+
 
 /************************************************************************************/
 /************************************************************** Low-level Interface */
@@ -274,6 +374,7 @@ void           remote_client_command          (RemoteClient*     self,
     /* Add the response callback to our queue */
     closure->callback = callback;
     closure->user_data = user_data;
+    closure->sent_time = g_timer_elapsed(self->clock, NULL);
     g_queue_push_head(self->response_queue, closure);
 
     /* Assemble the caller's formatted string */
@@ -288,6 +389,24 @@ void           remote_client_command          (RemoteClient*     self,
     g_free(line);
 }
 
+static RemoteClosure* remote_client_pop_closure (RemoteClient*       self)
+{
+    /* Find the command this response answers, and
+     * update our round trip time while we're at it.
+     */
+    RemoteClosure* closure = g_queue_pop_tail(self->response_queue);
+    double sample;
+
+    if (closure) {
+	sample = g_timer_elapsed(self->clock, NULL) - closure->sent_time;
+	if (self->rtt > 0)
+	    self->rtt += RTT_SMOOTHING * (sample - self->rtt);
+	else
+	    self->rtt = sample;
+    }
+    return closure;
+}
+
 static void       remote_client_callback      (GConn*                gconn,
 					       GConnEvent*           event,
 					       gpointer              user_data)
@@ -332,17 +451,24 @@ static void       remote_client_callback      (GConn*                gconn,
 static void       remote_client_recv_binary   (RemoteClient*         self,
 					       GConnEvent*           event)
 {
-    RemoteClosure* closure = g_queue_pop_tail(self->response_queue);
+    RemoteClosure* closure;
     RemoteResponse* response = self->current_binary_response;
     self->current_binary_response = NULL;
 
-    g_assert(closure != NULL);
-
     response->data = event->buffer;
-    if (closure->callback)
-	closure->callback(self, response, closure->user_data);
 
-    g_free(closure);
+    if (response->code == FYRE_RESPONSE_PUSH_BINARY) {
+	remote_client_recv_push(self, response);
+    }
+    else {
+	closure = remote_client_pop_closure(self);
+	g_assert(closure != NULL);
+
+	if (closure->callback)
+	    closure->callback(self, response, closure->user_data);
+	g_free(closure);
+    }
+
     g_free(response->message);
     g_free(response);
 
@@ -360,7 +486,7 @@ static void       remote_client_recv_line     (RemoteClient*         self,
 	response->message++;
     response->message = g_strdup(response->message);
 
-    if (response->code == FYRE_RESPONSE_BINARY) {
+    if (response->code == FYRE_RESPONSE_BINARY || response->code == FYRE_RESPONSE_PUSH_BINARY) {
 	/* Extract the length of the binary response, then start
 	 * reading the binary data itself. Note that if we
 	 * have a zero-length binary message, skip the next
@@ -376,11 +502,14 @@ static void       remote_client_recv_line     (RemoteClient*         self,
     }
 
     /* We're done, signal the callback and start waiting
-     * for another normal response line.
+     * for another normal response line. Pushed results aren't
+     * answers to anything, so they don't use up a callback.
      */
-    closure = g_queue_pop_tail(self->response_queue);
-
-    if (closure) {
+    if (response->code == FYRE_RESPONSE_PUSH_PROGRESS || response->code == FYRE_RESPONSE_PUSH_BINARY ||
+	response->code == FYRE_RESPONSE_PUSH_SHARED) {
+	remote_client_recv_push(self, response);
+    }
+    else if ((closure = remote_client_pop_closure(self))) {
 	/* This was an answer to some request. Invoke the callback
 	 * if one was specified.
 	 */
@@ -391,6 +520,33 @@ static void       remote_client_recv_line     (RemoteClient*         self,
     else {
 	/* This was unsolicited- should only occur for the server ready message */
 	if (response->code == FYRE_RESPONSE_READY) {
+	    /* Ask for our most compact stream format before anything else.
+	     * Servers that don't understand this will refuse, and we
+	     * stay with the default.
+	     */
+	    if (histogram_stream_best_format() != HISTOGRAM_STREAM_RLE)
+		remote_client_command(self, stream_format_callback,
+				      GINT_TO_POINTER(histogram_stream_best_format()),
+				      "set_stream_format %s",
+				      histogram_stream_format_name(histogram_stream_best_format()));
+
+	    /* Servers that don't know about seeds keep their own */
+	    if (self->has_seed)
+		remote_client_command(self, NULL, NULL, "set_seed %lu %lu",
+				      (unsigned long) self->job_seed,
+				      (unsigned long) self->stream_id);
+
+	    if (self->has_region)
+		remote_client_command(self, region_callback, NULL, "set_region %u %u",
+				      self->region_first_row, self->region_rows);
+
+	    /* Servers on this machine can hand us their histograms
+	     * directly. Anyone else, or any server that doesn't
+	     * support it, keeps pushing encoded streams.
+	     */
+	    if (shared_memory_supported() && remote_client_is_local(self))
+		remote_client_command(self, NULL, NULL, "share_memory 1");
+
 	    self->is_ready = TRUE;
 	    remote_client_update_status(self, "Ready");
 	}
@@ -417,14 +573,14 @@ static void    set_param_callback             (RemoteClient*     self,
     self->pending_param_changes--;
 }
 
-void           remote_client_send_param       (RemoteClient*     self,
-					       ParameterHolder*  ph,
+static gchar*  remote_client_serialize_param  (ParameterHolder*  ph,
 					       const gchar*      name)
 {
-    /* Serialize one parameter value, and send it to the server */
+    /* Serialize one parameter value as a "name = value" line */
 
     GValue val, strval;
     const gchar* string;
+    gchar* line = NULL;
     GParamSpec *spec = g_object_class_find_property(G_OBJECT_GET_CLASS(ph), name);
     g_assert(spec != NULL);
 
@@ -442,64 +598,312 @@ void           remote_client_send_param       (RemoteClient*     self,
      * the corresponding string property. Currently this isn't a problem since
      * render nodes don't deal with colors, but it's something to be aware of.
      */
-    if (string) {
-	self->pending_param_changes++;
-	remote_client_command(self, set_param_callback, NULL, "set_param %s = %s",
-			      name, string);
-    }
+    if (string)
+	line = g_strdup_printf("%s = %s", name, string);
 
     g_value_unset(&strval);
     g_value_unset(&val);
+    return line;
+}
+
+void           remote_client_send_param       (RemoteClient*     self,
+					       ParameterHolder*  ph,
+					       const gchar*      name)
+{
+    /* Serialize one parameter value, and send it to the server */
+    gchar* line = remote_client_serialize_param(ph, name);
+
+    if (line) {
+	self->pending_param_changes++;
+	remote_client_command(self, set_param_callback, NULL, "set_param %s", line);
+	g_free(line);
+    }
+}
+
+static void    set_params_callback            (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    /* If the server doesn't know about set_params, resend this
+     * batch the old way and stop trying to use it.
+     */
+    gchar** lines = (gchar**) user_data;
+    gchar** line;
+
+    self->pending_param_changes--;
+
+    if (response->code == FYRE_RESPONSE_UNRECOGNIZED) {
+	self->legacy_params = TRUE;
+	for (line=lines; *line; line++) {
+	    self->pending_param_changes++;
+	    remote_client_command(self, set_param_callback, NULL, "set_param %s", *line);
+	}
+    }
+
+    g_strfreev(lines);
+}
+
+void           remote_client_send_params      (RemoteClient*     self,
+					       ParameterHolder*  ph,
+					       gchar**           names,
+					       guint             generation)
+{
+    gchar** lines;
+    gchar** escaped;
+    gchar* joined;
+    int i, n_lines = 0;
+
+    for (i=0; names[i]; i++);
+    lines = g_new0(gchar*, i + 1);
+
+    for (i=0; names[i]; i++) {
+	gchar* line = remote_client_serialize_param(ph, names[i]);
+	if (line)
+	    lines[n_lines++] = line;
+    }
+
+    self->param_generation = generation;
+
+    if (self->legacy_params) {
+	for (i=0; i<n_lines; i++) {
+	    self->pending_param_changes++;
+	    remote_client_command(self, set_param_callback, NULL, "set_param %s", lines[i]);
+	}
+	g_strfreev(lines);
+	return;
+    }
+
+    /* Escaping keeps tabs and newlines out of each pair, so tabs can
+     * separate them and the whole batch stays on one line.
+     */
+    escaped = g_new0(gchar*, n_lines + 1);
+    for (i=0; i<n_lines; i++)
+	escaped[i] = g_strescape(lines[i], NULL);
+    joined = g_strjoinv("\t", escaped);
+    g_strfreev(escaped);
+
+    /* The callback owns 'lines', in case it needs to resend them */
+    self->pending_param_changes++;
+    remote_client_command(self, set_params_callback, lines, "set_params %u %s",
+			  generation, joined);
+    g_free(joined);
 }
 
 void           remote_client_send_all_params  (RemoteClient*     self,
-					       ParameterHolder*  ph)
+					       ParameterHolder*  ph,
+					       guint             generation)
 {
     /* Find all serializable parameters, and send them */
 
     guint n_properties;
     GParamSpec** properties;
-    int i;
+    gchar** names;
+    int i, n_names = 0;
 
     properties = g_object_class_list_properties(G_OBJECT_GET_CLASS(ph), &n_properties);
+    names = g_new0(gchar*, n_properties + 1);
 
     for (i=0; i<n_properties; i++)
 	if (properties[i]->flags & PARAM_SERIALIZED)
-	    remote_client_send_param(self, ph, properties[i]->name);
+	    names[n_names++] = (gchar*) properties[i]->name;
 
+    remote_client_send_params(self, ph, names, generation);
+
+    g_free(names);
     g_free(properties);
 }
 
-static void    histogram_merge_callback       (RemoteClient*     self,
+static gboolean response_get_generation       (RemoteResponse*   response,
+					       guint*            generation)
+{
+    /* Find the generation stamp in a response, if the server sent one */
+    const gchar* stamp = strstr(response->message, "generation=");
+    if (!stamp)
+	return FALSE;
+    *generation = strtoul(stamp + strlen("generation="), NULL, 10);
+    return TRUE;
+}
+
+static gulong   response_get_value            (RemoteResponse*   response,
+					       const gchar*      key)
+{
+    /* Find a "key=" value in a response, or zero if it's missing */
+    const gchar* stamp = strstr(response->message, key);
+    if (!stamp)
+	return 0;
+    return strtoul(stamp + strlen(key), NULL, 10);
+}
+
+static gdouble  response_get_double           (RemoteResponse*   response,
+					       const gchar*      key)
+{
+    const gchar* stamp = strstr(response->message, key);
+    if (!stamp)
+	return 0;
+    return g_ascii_strtod(stamp + strlen(key), NULL);
+}
+
+static guint    response_get_first_row        (RemoteResponse*   response)
+{
+    /* Find the histogram row a stream starts at. Servers that
+     * can't partition always send the whole histogram.
+     */
+    return response_get_value(response, "first_row=");
+}
+
+static void    stream_format_callback         (RemoteClient*     self,
 					       RemoteResponse*   response,
 					       gpointer          user_data)
 {
-    HistogramImager *dest = HISTOGRAM_IMAGER(user_data);
-    double elapsed;
+    /* Responses arrive in order, so every stream requested after the
+     * server switched formats will be decoded with the new one.
+     */
+    if (response->code == FYRE_RESPONSE_OK)
+	self->stream_format = GPOINTER_TO_INT(user_data);
+}
 
+static void    histogram_merge_callback       (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
     self->pending_stream_requests--;
+    histogram_merge_response(self, response, HISTOGRAM_IMAGER(user_data), FALSE);
+}
 
-    if (self->pending_param_changes) {
-	/* This data is for an old parameter set, ignore it.
-	 * FIXME: This doesn't distinguish between parameters that
-	 *        actaully affect calculation and those that don't.
+static gboolean histogram_merge_response      (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       HistogramImager*  dest,
+					       gboolean          grant)
+{
+    /* Merge histogram data into dest, or queue it on our merger. In
+     * that case, if 'grant' is set, the merger returns the push credit
+     * once it's done and we return TRUE.
+     */
+    HistogramMergerCallback merged = grant ? histogram_merged_grant : histogram_merged;
+    double elapsed, merge_start;
+    guint generation;
+    gsize length;
+
+    if (response_get_generation(response, &generation)) {
+	/* This data is for an old parameter set, ignore it */
+	if (generation != self->param_generation) {
+	    self->stale_drops++;
+	    return FALSE;
+	}
+    }
+    else if (self->pending_param_changes) {
+	/* Without a generation stamp, we can only assume any data
+	 * that arrives during a parameter change is stale.
 	 */
-	return;
+	self->stale_drops++;
+	return FALSE;
     }
 
-    if (!response->data_length)
-	return;
+    /* Data from a band this node has since been moved off of would land
+     * in rows that now belong to someone else.
+     */
+    if (self->has_region && !self->region_refused &&
+	response_get_first_row(response) != self->region_first_row * dest->oversample) {
+	self->stale_drops++;
+	return FALSE;
+    }
+
+    if (response->code == FYRE_RESPONSE_PUSH_SHARED) {
+	/* Raw buckets, straight out of the server's shared segment */
+	gsize offset = response_get_value(response, "offset=");
+	gsize num_buckets = response_get_value(response, "buckets=");
 
-    histogram_imager_merge_stream(dest, response->data, response->data_length);
+	if (!self->shared || offset > self->shared->size ||
+	    num_buckets > (self->shared->size - offset) / sizeof(guint))
+	    return FALSE;
+	length = num_buckets * sizeof(guint);
+
+	/* The server reuses the segment once we grant it back, so the
+	 * merger gets a copy. That's still far cheaper than decoding.
+	 */
+	merge_start = g_timer_elapsed(self->clock, NULL);
+	if (self->merger)
+	    histogram_merger_push_buckets(self->merger, response_get_first_row(response),
+					  g_memdup(self->shared->data + offset, length), num_buckets,
+					  merged, histogram_merged_data(self, grant));
+	else
+	    histogram_imager_merge_buckets(dest, response_get_first_row(response),
+					   (const guint*) (self->shared->data + offset), num_buckets);
+	elapsed = g_timer_elapsed(self->clock, NULL) - merge_start;
+	self->merge_seconds += elapsed;
+	self->total_merge_seconds += elapsed;
+    }
+    else {
+	if (!response->data_length)
+	    return FALSE;
+	length = response->data_length;
+
+	merge_start = g_timer_elapsed(self->clock, NULL);
+	if (self->merger)
+	    histogram_merger_push_stream(self->merger, self->stream_format, response_get_first_row(response),
+					 g_memdup(response->data, length), length,
+					 merged, histogram_merged_data(self, grant));
+	else
+	    histogram_stream_merge_rows(dest, self->stream_format, response_get_first_row(response),
+					response->data, length);
+	elapsed = g_timer_elapsed(self->clock, NULL) - merge_start;
+	self->merge_seconds += elapsed;
+	self->total_merge_seconds += elapsed;
+    }
 
     /* Update our download speed */
-    self->byte_accumulator += response->data_length;
+    self->byte_accumulator += length;
+    self->total_bytes += length;
     elapsed = g_timer_elapsed(self->stream_speed_timer, NULL);
     if (elapsed > MINIMUM_SPEED_WINDOW) {
 	g_timer_start(self->stream_speed_timer);
 	self->bytes_per_sec = self->byte_accumulator / elapsed;
 	self->byte_accumulator = 0;
     }
+    return self->merger && grant;
+}
+
+static void    histogram_merged               (gpointer          user_data,
+					       double            merge_seconds)
+{
+    /* Our merger finished with some data. Its time still counts as
+     * ours, so load balancing sees what each node costs the master.
+     */
+    RemoteClient* self = REMOTE_CLIENT(user_data);
+    self->merge_seconds += merge_seconds;
+    self->total_merge_seconds += merge_seconds;
+    self->total_worker_merge_seconds += merge_seconds;
+    g_object_unref(self);
+}
+
+static void    histogram_merged_grant         (gpointer          user_data,
+					       double            merge_seconds)
+{
+    /* Flow control covers the merger's queue too, but only for the
+     * connection the push arrived on. A new one starts with fresh credits.
+     */
+    RemotePushGrant* push = (RemotePushGrant*) user_data;
+    RemoteClient* self = push->client;
+
+    if (self->is_ready && push->connection_serial == self->connection_serial)
+	remote_client_command(self, NULL, NULL, "grant 1");
+    histogram_merged(self, merge_seconds);
+    g_free(push);
+}
+
+static gpointer   histogram_merged_data       (RemoteClient*         self,
+					       gboolean              grant)
+{
+    /* User data for the merger's callback, holding a reference to us */
+    RemotePushGrant* push;
+
+    if (!grant)
+	return g_object_ref(self);
+
+    push = g_new0(RemotePushGrant, 1);
+    push->client = g_object_ref(self);
+    push->connection_serial = self->connection_serial;
+    return push;
 }
 
 static void    status_merge_callback          (RemoteClient*     self,
@@ -510,13 +914,21 @@ static void    status_merge_callback          (RemoteClient*     self,
     double iters, iter_delta;
     long density;
     double elapsed;
+    guint generation;
+    gboolean stamped;
 
     sscanf(response->message, "iterations=%lf density=%ld", &iters, &density);
+    stamped = response_get_generation(response, &generation);
 
-    /* FIXME: Since we don't know which parameters affect calculation, we don't
-     *        know when the node's iteration counter gets reset. We currently
-     *        assume that if it's value decreases, it's been reset.
+    /* The node resets its iteration counter whenever the generation
+     * changes. Servers that don't stamp their status give us no way to
+     * know, so there we assume that if the count decreases, it's been reset.
      */
+    if (stamped && generation != self->status_generation) {
+	self->status_generation = generation;
+	self->prev_iterations = 0;
+    }
+
     if (iters >= self->prev_iterations) {
 	iter_delta = iters - self->prev_iterations;
     }
@@ -526,13 +938,20 @@ static void    status_merge_callback          (RemoteClient*     self,
     }
     self->prev_iterations = iters;
 
-    if (self->pending_param_changes)
+    if (stamped ? generation != self->param_generation : self->pending_param_changes)
 	return;
+    self->points_plotted = response_get_double(response, "points=");
+    self->quality = response_get_double(response, "quality=");
     if (!iter_delta)
 	return;
+    if (self->has_region && !self->region_refused)
+	self->band_iterations += iter_delta;
 
-    /* Merge this iteration count in */
-    dest->iterations += iter_delta;
+    /* Merge this iteration count in. A node rendering one band of a
+     * partitioned image only adds its share of whole-image iterations.
+     */
+    dest->iterations += iter_delta * self->iteration_share;
+    self->total_iterations += iter_delta * self->iteration_share;
 
     /* Update our iteration speed */
     self->iter_accumulator += iter_delta;
@@ -547,13 +966,153 @@ static void    status_merge_callback          (RemoteClient*     self,
     }
 }
 
+void           remote_client_set_seed         (RemoteClient*     self,
+					       guint32           job_seed,
+					       guint32           stream_id)
+{
+    self->has_seed = TRUE;
+    self->job_seed = job_seed;
+    self->stream_id = stream_id;
+
+    if (self->is_ready)
+	remote_client_command(self, NULL, NULL, "set_seed %lu %lu",
+			      (unsigned long) job_seed, (unsigned long) stream_id);
+}
+
+void           remote_client_set_region       (RemoteClient*     self,
+					       guint             first_row,
+					       guint             num_rows)
+{
+    if (self->has_region && first_row == self->region_first_row &&
+	num_rows == self->region_rows)
+	return;
+
+    self->has_region = TRUE;
+    self->region_first_row = first_row;
+    self->region_rows = num_rows;
+
+    if (self->is_ready && !self->region_refused)
+	remote_client_command(self, region_callback, NULL, "set_region %u %u",
+			      first_row, num_rows);
+}
+
+static void    region_callback                (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    /* Older servers keep rendering the whole image, which still
+     * mixes correctly with the bands from everyone else.
+     */
+    if (response->code == FYRE_RESPONSE_UNRECOGNIZED) {
+	self->region_refused = TRUE;
+	self->iteration_share = 1.0;
+    }
+}
+
+static void    remote_client_recv_push        (RemoteClient*     self,
+					       RemoteResponse*   response)
+{
+    /* Merge results the server sent on its own. Each histogram push
+     * uses up a credit, which we return once it's been merged.
+     */
+    if (!self->push_dest)
+	return;
+
+    if (response->code == FYRE_RESPONSE_PUSH_PROGRESS) {
+	status_merge_callback(self, response, self->push_dest);
+    }
+    else {
+	if (response->code == FYRE_RESPONSE_PUSH_SHARED)
+	    remote_client_attach_shared(self, response);
+	if (!histogram_merge_response(self, response, HISTOGRAM_IMAGER(self->push_dest), TRUE))
+	    remote_client_command(self, NULL, NULL, "grant 1");
+    }
+}
+
+static void    remote_client_attach_shared    (RemoteClient*     self,
+					       RemoteResponse*   response)
+{
+    /* Make sure we have the segment a push names mapped, even if its data
+     * turns out to be stale; the server unlinks the name once we grant
+     * the push back. If we can't open it, ask for normal pushes instead.
+     * That one push is lost, but losing samples doesn't bias the image.
+     */
+    const gchar* stamp = strstr(response->message, "segment=");
+    gchar* name;
+
+    if (!stamp)
+	return;
+    stamp += strlen("segment=");
+    name = g_strndup(stamp, strcspn(stamp, " "));
+
+    if (!self->shared || strcmp(self->shared->name, name)) {
+	if (self->shared)
+	    shared_memory_free(self->shared);
+	self->shared = shared_memory_open(name);
+	if (!self->shared)
+	    remote_client_command(self, NULL, NULL, "share_memory 0");
+    }
+    g_free(name);
+}
+
+static void    subscribe_callback             (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    self->subscribe_pending = FALSE;
+
+    if (response->code == FYRE_RESPONSE_OK)
+	self->is_subscribed = TRUE;
+    else
+	self->legacy_push = TRUE;
+}
+
 void           remote_client_merge_results    (RemoteClient*     self,
 					       IterativeMap*     dest)
 {
     double elapsed;
 
-    /* Don't let our stream requests get too backed up */
-    if (self->pending_stream_requests >= 4)
+    if (!self->legacy_push) {
+	/* Subscribe, or update our subscription if the stream interval
+	 * changed. After that the server does all the work.
+	 */
+	if (self->subscribe_pending)
+	    return;
+	if (self->is_subscribed && self->push_dest == dest &&
+	    self->subscribed_interval == self->min_stream_interval &&
+	    self->subscribed_bytes == self->push_bytes &&
+	    self->subscribed_credits == self->push_credits) {
+
+	    /* Our grants don't count as activity, so now and then let the
+	     * server know we're still here. Pushes don't use the request
+	     * timer, so it paces these instead.
+	     */
+	    if (g_timer_elapsed(self->stream_request_timer, NULL) > KEEPALIVE_INTERVAL) {
+		g_timer_start(self->stream_request_timer);
+		remote_client_command(self, NULL, NULL, "get_share");
+	    }
+	    return;
+	}
+
+	if (self->push_dest != dest) {
+	    if (self->push_dest)
+		g_object_unref(self->push_dest);
+	    self->push_dest = g_object_ref(dest);
+	}
+	self->subscribed_interval = self->min_stream_interval;
+	self->subscribed_bytes = self->push_bytes;
+	self->subscribed_credits = self->push_credits;
+	self->subscribe_pending = TRUE;
+	remote_client_command(self, subscribe_callback, NULL, "subscribe %f %lu %d",
+			      self->min_stream_interval, (unsigned long) self->push_bytes,
+			      self->push_credits);
+	return;
+    }
+
+    /* Don't let our stream requests get too backed up. Polling
+     * uses the same window as pushed streams.
+     */
+    if (self->pending_stream_requests >= MAX(self->push_credits, 1))
 	return;
 
     /* Always keep the status updated */
@@ -571,4 +1130,45 @@ void           remote_client_merge_results    (RemoteClient*     self,
 			  "get_histogram_stream");
 }
 
+static void    status_poll_callback           (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    self->pending_status_requests--;
+    status_merge_callback(self, response, user_data);
+}
+
+void           remote_client_poll_status      (RemoteClient*     self,
+					       IterativeMap*     dest)
+{
+    if (self->pending_status_requests)
+	return;
+    self->pending_status_requests++;
+    remote_client_command(self, status_poll_callback, dest, "calc_status");
+}
+
+static void    fetch_callback                 (RemoteClient*     self,
+					       RemoteResponse*   response,
+					       gpointer          user_data)
+{
+    HistogramImager* dest = HISTOGRAM_IMAGER(user_data);
+
+    /* Exporting empties what it sends, so an empty stream means we have it all */
+    if (!response->data_length) {
+	self->is_fetching = FALSE;
+	return;
+    }
+    histogram_stream_merge_rows(dest, self->stream_format, response_get_first_row(response),
+				response->data, response->data_length);
+    self->total_bytes += response->data_length;
+    remote_client_command(self, fetch_callback, dest, "get_histogram_stream");
+}
+
+void           remote_client_fetch_histogram  (RemoteClient*     self,
+					       HistogramImager*  dest)
+{
+    self->is_fetching = TRUE;
+    remote_client_command(self, fetch_callback, dest, "get_histogram_stream");
+}
+
 /* The End */
@@ -37,6 +37,9 @@
 #include "animation.h"
 #include "iterative-map.h"
 #include "remote-server.h"
+#include "histogram-stream.h"
+#include "histogram-merger.h"
+#include "shared-memory.h"
 
 G_BEGIN_DECLS
 
@@ -67,12 +70,15 @@ typedef void   (*RemoteSpeedCallback)         (RemoteClient*     self,
 struct _RemoteClosure {
     RemoteCallback callback;
     gpointer       user_data;
+    double         sent_time;
 };
 
 struct _RemoteClient {
     GObject               object;
 
     double                min_stream_interval;
+    gsize                 push_bytes;       /* Largest histogram push the server may send */
+    int                   push_credits;     /* Number of pushes we allow in flight */
     double                retry_timeout;
     gboolean              is_retry_enabled;
 
@@ -93,6 +99,14 @@ struct _RemoteClient {
     int                   pending_param_changes;
     int                   pending_stream_requests;
 
+    /* Results stamped with any other parameter generation are stale.
+     * Servers that predate set_params don't stamp their results, so
+     * for those we fall back on pending_param_changes.
+     */
+    guint                 param_generation;
+    guint                 status_generation;
+    gboolean              legacy_params;
+
     GTimer*               stream_request_timer;
     double                prev_iterations;
     GTimer*               status_speed_timer;
@@ -102,8 +116,89 @@ struct _RemoteClient {
     double                iters_per_sec;
     double                bytes_per_sec;
 
+    /* Smoothed round trip time for commands, and the time we've spent
+     * merging this node's results since someone last reset it.
+     */
+    GTimer*               clock;
+    double                rtt;
+    double                merge_seconds;
+
+    /* Totals for everything this node has sent us, kept across
+     * reconnects. Stale results are counted but not merged.
+     */
+    double                total_iterations;
+    double                total_bytes;
+    double                total_merge_seconds;
+    double                total_worker_merge_seconds;  /* The part spent on the merger's thread */
+    guint                 stale_drops;
+
+    /* Random seeding sent to the server as soon as it's ready */
+    gboolean              has_seed;
+    guint32               job_seed;
+    guint32               stream_id;
+
+    /* Band of image rows this node renders, sent as soon as it's ready.
+     * region_refused is set if the server can't partition, in which case
+     * it renders the whole image. iteration_share scales this node's
+     * iteration counts to whole-image iterations.
+     */
+    gboolean              has_region;
+    guint                 region_first_row;
+    guint                 region_rows;
+    gboolean              region_refused;
+    double                iteration_share;
+
+    /* Iterations merged into this node's band since the ClusterModel last
+     * collected them. Unlike prev_iterations, this carries on across
+     * reconnects, since what's already been merged stays merged.
+     */
+    double                band_iterations;
+
+    /* The node's own totals, from its latest status. These describe
+     * results it still holds, which matters once we stop merging them.
+     */
+    double                points_plotted;
+    double                quality;
+    int                   pending_status_requests;
+    gboolean              is_fetching;
+
+    /* Servers on the same machine push raw buckets through this segment */
+    SharedMemory*         shared;
+
+    /* If set, histogram data is handed to this merger's thread instead
+     * of being merged on the spot. It must be merging into the same
+     * imager we're asked to merge into.
+     */
+    HistogramMerger*      merger;
+
+    /* Load balancing state, managed by the ClusterModel */
+    int                   slow_passes;
+    gboolean              is_demoted;
+    gboolean              is_paused;
+
     GQueue*               response_queue;
     RemoteResponse*       current_binary_response;
+
+    /* Format of histogram streams, as negotiated with the server */
+    HistogramStreamFormat stream_format;
+
+    /* Once the server accepts our subscription, it sends results on its
+     * own schedule and we only need to return credits. Servers that
+     * don't support it are polled instead.
+     */
+    IterativeMap*         push_dest;
+    double                subscribed_interval;
+    gsize                 subscribed_bytes;
+    int                   subscribed_credits;
+    gboolean              is_subscribed;
+    gboolean              subscribe_pending;
+    gboolean              legacy_push;
+
+    /* Counts our connections. Credits for pushes the merger finishes
+     * after a reconnect belong to a server that's gone, so they're
+     * only returned if this hasn't changed since the push arrived.
+     */
+    guint                 connection_serial;
 };
 
 struct _RemoteClientClass {
@@ -135,6 +230,7 @@ void           remote_client_set_speed_cb     (RemoteClient*         self,
 
 void           remote_client_connect          (RemoteClient*         self);
 gboolean       remote_client_is_ready         (RemoteClient*         self);
+gboolean       remote_client_is_local         (RemoteClient*         self);
 
 /* Low-level interface */
 
@@ -149,11 +245,48 @@ void           remote_client_command          (RemoteClient*     self,
 void           remote_client_send_param       (RemoteClient*     self,
 					       ParameterHolder*  ph,
 					       const gchar*      name);
+
+/* Send a NULL-terminated list of parameters in one atomic batch. The
+ * generation should change only when the batch affects calculation.
+ * Results from before that change will be discarded.
+ */
+void           remote_client_send_params      (RemoteClient*     self,
+					       ParameterHolder*  ph,
+					       gchar**           names,
+					       guint             generation);
 void           remote_client_send_all_params  (RemoteClient*     self,
-					       ParameterHolder*  ph);
+					       ParameterHolder*  ph,
+					       guint             generation);
 void           remote_client_merge_results    (RemoteClient*     self,
 					       IterativeMap*     dest);
 
+/* Keep only the iteration count and the node's own totals up to date,
+ * leaving its histogram on the server.
+ */
+void           remote_client_poll_status      (RemoteClient*     self,
+					       IterativeMap*     dest);
+
+/* Empty the node's histogram into dest a request at a time, until it has
+ * nothing left. is_fetching stays set until then, or until the node drops.
+ */
+void           remote_client_fetch_histogram  (RemoteClient*     self,
+					       HistogramImager*  dest);
+
+/* Assign this node its share of the random sequence space. Nodes with the
+ * same job seed and different stream IDs produce independent samples.
+ */
+void           remote_client_set_seed         (RemoteClient*     self,
+					       guint32           job_seed,
+					       guint32           stream_id);
+
+/* Render only a band of image rows, discarding everything else on the
+ * server. Zero rows selects the whole image. Results are merged into the
+ * matching rows of the destination, which must cover the whole band.
+ */
+void           remote_client_set_region       (RemoteClient*     self,
+					       guint             first_row,
+					       guint             num_rows);
+
 G_END_DECLS
 
 #endif /* __REMOTE_CLIENT_H__ */
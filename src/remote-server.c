@@ -38,25 +38,149 @@
 
 #include <gnet.h>
 #include <gtk/gtk.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#endif
 #include "iterative-map.h"
 #include "gui-util.h"
 #include "histogram-view.h"
+#include "histogram-stream.h"
+#include "histogram-dump.h"
 #include "remote-server.h"
+#include "thread-util.h"
 #include "de-jong.h"
+#include "cluster-model.h"
+#include "math-util.h"
+#include "shared-memory.h"
+#include "render-stats.h"
+
+/* Calculation runs on a pool of worker threads shared by every connection,
+ * leaving the main loop free for I/O. Each connection owns one private map
+ * per job it may have in flight, its 'slots', loaded with a copy of its
+ * parameters. Slots keep their results across several jobs, and are merged
+ * into the connection's own map back on the main thread only every
+ * MERGE_SLICES jobs, or once the connection stops. That keeps everything the
+ * protocol touches single-threaded, while the main loop spends most of its
+ * time on I/O rather than on adding up histograms.
+ *
+ * We never queue more jobs than there are workers. Whenever one is free, it
+ * goes to the runnable connection that has used the least calculation time
+ * relative to its weight, its 'virtual time'. Connections share the machine
+ * in proportion to their weights, so interactive sessions stay responsive
+ * while low-weight batch renders soak up whatever is left. A connection
+ * that becomes runnable again starts from the current virtual time rather
+ * than its old one, so time spent idle can't be saved up. Connections also
+ * stop calculating when they use up their CPU quota, or when their client
+ * hasn't said anything for the idle timeout.
+ */
+#define WORKER_SLICE        0.25   /* Seconds of calculation per job */
+#define MERGE_SLICES        4      /* Jobs a slot runs between merges */
+#define DEFAULT_WEIGHT      1.0
+#define RENDER_WEIGHT       0.1    /* Submitted renders are batch work */
+#define DEFAULT_IDLE_TIMEOUT 600.0 /* Seconds without a command before we pause */
+
+/* Slot histograms across every connection may use this fraction of the
+ * machine's memory, or SLOT_MEMORY_DEFAULT bytes if we can't find out how
+ * much it has. Each running connection can always have one slot.
+ */
+#define SLOT_MEMORY_FRACTION 0.25
+#define SLOT_MEMORY_DEFAULT  ((gsize) 1024 * 1024 * 1024)
+
+/* Limits on the size of each histogram push a subscriber may ask for */
+#define MIN_PUSH_BYTES      (4 * 1024)
+#define MAX_PUSH_BYTES      (64 * 1024 * 1024)
+
+/* Clients on the same machine can ask for pushes through shared memory,
+ * copying raw buckets into one of these slots instead of encoding and
+ * sending them. A slot is free again once its push has been granted back.
+ */
+#define SHARED_SLOTS        2
 
 typedef struct _RemoteServer      RemoteServer;
 typedef struct _RemoteServerConn  RemoteServerConn;
 
+/* Whole renders submitted with render_submit run in the background, one at
+ * a time in the order they were submitted, each on a private connection
+ * with no client attached. Finished results are kept until someone removes
+ * them with render_cancel, so a scheduler can submit jobs, disconnect, and
+ * come back for them later.
+ */
+typedef enum {
+    RENDER_QUEUED,
+    RENDER_RUNNING,
+    RENDER_DONE,
+    RENDER_FAILED,
+} RemoteServerRenderState;
+
+typedef struct {
+    guint                id;
+    RemoteServerRenderState state;
+    gchar*               format;         /* "png", "exr", or "histogram" */
+    double               quality;        /* Target quality */
+    gchar*               params;         /* Escaped parameter pairs, as in set_params */
+
+    RemoteServerConn*    conn;           /* Only while running */
+    IterativeMap*        map;            /* Only while a worker encodes it */
+    gboolean             cancelled;      /* Removed while it was being encoded */
+    double               iterations;
+    double               current_quality;
+
+    guchar*              result;
+    gsize                result_size;
+    gchar*               error;
+} RemoteServerRender;
+
 struct _RemoteServer {
     GServer*             gserver;
     GHashTable*          command_hash;
     GHashTable*          gui_hash;
     gboolean             have_gtk;
     gboolean             verbose;
+    const gchar*         sub_nodes;
+
+    GThreadPool*         workers;
+    int                  num_workers;
+    gsize                slot_memory_budget;
+    gsize                slot_memory_used;
+
+    /* Fair-share scheduling between connections */
+    GList*               conns;
+    int                  jobs_in_flight;
+    double               virtual_time;
+    GTimer*              clock;
+
+    GList*               renders;
+    guint                next_render_id;
+
+    /* Private directory for encoding images, which gdk-pixbuf only
+     * writes to files. Nobody else can create anything in it.
+     */
+    gchar*               temp_dir;
 };
 
+typedef struct {
+    IterativeMap*        map;
+    guint                param_serial;   /* Which parameters 'map' was loaded with */
+    gboolean             busy;
+    GRand*               random;         /* Only when the client gave us a seed */
+    gsize                bytes;          /* Histogram memory charged to the server */
+    int                  pending_jobs;   /* Finished jobs not yet merged */
+} RemoteServerSlot;
+
+typedef struct {
+    RemoteServerConn*    conn;
+    RemoteServerSlot*    slot;
+    RemoteServerRender*  render;         /* Set instead for encoding a finished render */
+    RemoteServer*        server;
+    double               elapsed;        /* Seconds the worker spent on it */
+} RemoteServerJob;
+
 struct _RemoteServerConn {
     RemoteServer*        server;
     GConn*               gconn;
@@ -65,12 +189,86 @@ struct _RemoteServerConn {
     IterativeMap*        map;
     ParameterHolderPair  frame;
 
+    /* Parameter generation our current results belong to, set by set_params */
+    guint                generation;
+
+    /* Background calculation. param_serial changes with every parameter
+     * that affects calculation, so stale slots and results can be spotted.
+     */
+    RemoteServerSlot*    slots;
+    int                  num_slots;
+    int                  jobs_in_flight;
+    guint                param_serial;
+    GHashTable*          param_values;   /* Last value of each calculation parameter */
+    gboolean             running;
+    gboolean             disconnected;
+
+    /* Our share of the workers, set with set_share. A quota of zero
+     * means no limit, as does an idle timeout of zero.
+     */
+    double               weight;
+    double               quota;
+    double               idle_timeout;
+    double               cpu_seconds;
+    double               virtual_time;
+    double               last_activity;
+    gboolean             idle;
+
+    /* Random seeding assigned by the client with set_seed. Each slot
+     * gets its own sequence derived from these, so every node and
+     * thread contributes independent samples, reproducibly.
+     */
+    gboolean             has_seed;
+    guint32              job_seed;
+    guint32              stream_id;
+
+    /* Band of image rows assigned by the client with set_region.
+     * Everything outside it is discarded as it's calculated.
+     */
+    guint                region_first_row;
+    guint                region_rows;
+
+    /* Binary data sent to the client, for get_stats */
+    double               bytes_streamed;
+
     /* Temporary buffer for sending back histogram streams */
     guchar*              buffer;
     gsize                buffer_size;
+    HistogramStreamFormat stream_format;
+
+    /* Results pushed without being asked for, enabled with subscribe.
+     * Each histogram push uses up one credit, and the client hands
+     * them back with 'grant' as it finishes merging.
+     */
+    gboolean             subscribed;
+    guint                push_timer;
+    gsize                push_bytes;
+    int                  push_window;
+    int                  push_credits;
+    gboolean             push_backlog;
+    double               pushed_status_iterations;
+    double               pushed_stream_iterations;
+
+    /* Shared memory pushes, enabled with share_memory */
+    gboolean             shared_enabled;
+    SharedMemory*        shared;
+    gsize                shared_slot_size;
+    int                  shared_next_slot;
+    int                  shared_slots_busy;
+
+    /* Every push the client hasn't granted back yet, oldest first, and
+     * whether it went through shared memory. Only those hold a slot.
+     */
+    GQueue*              pushes_in_flight;
+
+    /* When we're an aggregator, the nodes working on our behalf */
+    ClusterModel*        cluster;
 
     /* Optional GUI, enabled with set_gui_style */
     GtkWidget*           gui;
+
+    /* Set on the private connections that run submitted renders */
+    RemoteServerRender*  render;
 };
 
 typedef void      (*RemoteServerCallback)     (RemoteServerConn*     self,
@@ -84,7 +282,10 @@ static void       remote_server_connect       (GServer*              gserver,
 static void       remote_server_callback      (GConn*                gconn,
 					       GConnEvent*           event,
 					       gpointer              user_data);
+static RemoteServerConn* remote_server_conn_new (RemoteServer*       server);
 static void       remote_server_disconnect    (RemoteServerConn*     self);
+static void       remote_server_conn_close    (RemoteServerConn*     self);
+static void       remote_server_conn_free     (RemoteServerConn*     self);
 static void       remote_server_dispatch_line (RemoteServerConn*     self,
 					       char*                 line);
 static void       remote_server_send_response (RemoteServerConn*     self,
@@ -92,8 +293,11 @@ static void       remote_server_send_response (RemoteServerConn*     self,
 					       const char*           response_message,
 					       ...);
 static void       remote_server_send_binary   (RemoteServerConn*     self,
+					       int                   response_code,
 					       unsigned char*        data,
-					       unsigned long         length);
+					       unsigned long         length,
+					       const char*           description,
+					       ...);
 static void       remote_server_add_command   (RemoteServer*         self,
 					       const char*           command,
 					       RemoteServerCallback  callback);
@@ -102,6 +306,54 @@ static void       remote_server_add_gui       (RemoteServer*         self,
 					       RemoteGUIInitializer  initializer);
 static void       remote_server_init_commands (RemoteServer*         self);
 
+static void       remote_server_schedule      (RemoteServerConn*     self);
+static void       remote_server_dispatch      (RemoteServer*         self);
+static gboolean   remote_server_is_runnable   (RemoteServerConn*     self);
+static RemoteServerSlot* remote_server_free_slot (RemoteServerConn*  self);
+static void       remote_server_load_slot     (RemoteServerConn*     self,
+					       RemoteServerSlot*     slot);
+static void       remote_server_account_job   (RemoteServerConn*     self,
+					       double                elapsed);
+static void       remote_server_worker        (gpointer              data,
+					       gpointer              user_data);
+static gboolean   remote_server_collect_job   (gpointer              user_data);
+static void       remote_server_release_slot  (RemoteServerConn*     self,
+					       RemoteServerSlot*     slot);
+static void       remote_server_merge_slot    (RemoteServerConn*     self,
+					       RemoteServerSlot*     slot);
+static void       remote_server_merge_slots   (RemoteServerConn*     self);
+static void       on_map_notify               (IterativeMap*         map,
+					       GParamSpec*           spec,
+					       RemoteServerConn*     self);
+static gboolean   remote_server_param_changed (RemoteServerConn*     self,
+					       GParamSpec*           spec);
+static void       remote_server_value_free    (GValue*               value);
+
+static guint      remote_server_stream_row    (RemoteServerConn*     self);
+static gboolean   remote_server_push_timer    (gpointer              user_data);
+static void       remote_server_push_stream   (RemoteServerConn*     self);
+static gboolean   remote_server_push_shared   (RemoteServerConn*     self);
+
+static void       remote_server_load_params   (IterativeMap*         map,
+					       const gchar*          pairs);
+static void       remote_server_make_temp_dir (RemoteServer*         self);
+static gchar*     remote_server_temp_path     (RemoteServer*         self,
+					       const gchar*          extension);
+static void       remote_server_fit_size      (HistogramImager*      imager,
+					       guint*                width,
+					       guint*                height);
+static gboolean   remote_server_encode_png    (RemoteServer*         self,
+					       GdkPixbuf*            image,
+					       guchar**              data,
+					       gsize*                size,
+					       GError**              error);
+static void       remote_server_start_render  (RemoteServer*         self);
+static gboolean   remote_server_check_render  (RemoteServerConn*     self);
+static void       remote_server_finish_render (RemoteServerRender*   render);
+static void       remote_server_encode_render (RemoteServerJob*      job);
+static gboolean   remote_server_collect_render (gpointer             user_data);
+static void       remote_server_render_free   (RemoteServerRender*   render);
+
 static void       gui_init_none               (RemoteServerConn*     self);
 static void       release_privileges          (RemoteServer*         self);
 
@@ -110,14 +362,16 @@ static void       release_privileges          (RemoteServer*         self);
 /***************************************************************** I/O Layer ********/
 /************************************************************************************/
 
-void              remote_server_main_loop     (int        port_number,
-					       gboolean   have_gtk,
-					       gboolean   verbose)
+void              remote_server_main_loop     (int           port_number,
+					       gboolean      have_gtk,
+					       gboolean      verbose,
+					       const gchar*  sub_nodes)
 {
     RemoteServer self;
 
     self.have_gtk = have_gtk;
     self.verbose = verbose;
+    self.sub_nodes = sub_nodes;
 
     self.gserver = gnet_server_new(NULL, port_number,
 				   remote_server_connect, &self);
@@ -130,14 +384,33 @@ void              remote_server_main_loop     (int        port_number,
     self.gui_hash = g_hash_table_new(g_str_hash, g_str_equal);
     remote_server_init_commands(&self);
 
-    if (self.verbose)
-	printf("Fyre server listening on port %d\n", port_number);
+    self.num_workers = thread_util_num_processors();
+    self.slot_memory_budget = thread_util_physical_memory() * SLOT_MEMORY_FRACTION;
+    if (!self.slot_memory_budget)
+	self.slot_memory_budget = SLOT_MEMORY_DEFAULT;
+    self.slot_memory_used = 0;
+    self.workers = g_thread_pool_new(remote_server_worker, NULL, self.num_workers, FALSE, NULL);
+    self.conns = NULL;
+    self.jobs_in_flight = 0;
+    self.virtual_time = 0;
+    self.clock = g_timer_new();
+    self.renders = NULL;
+    self.next_render_id = 1;
+    self.temp_dir = NULL;
+
+    if (self.verbose) {
+	printf("Fyre server listening on port %d, with %d calculation threads\n",
+	       port_number, self.num_workers);
+	if (sub_nodes)
+	    printf("Aggregating results from %s\n", sub_nodes);
+    }
 
     /* At this point, now that we've bound to the port and such,
      * make sure we aren't running as a privileged user. If so,
      * ditch all privileges permanently.
      */
     release_privileges(&self);
+    remote_server_make_temp_dir(&self);
 
     if (have_gtk)
 	gtk_main();
@@ -148,8 +421,15 @@ void              remote_server_main_loop     (int        port_number,
 	printf("Fyre server shutting down.\n");
 
     gnet_server_delete(self.gserver);
+    g_thread_pool_free(self.workers, TRUE, TRUE);
     g_hash_table_destroy(self.command_hash);
     g_hash_table_destroy(self.gui_hash);
+    g_list_foreach(self.renders, (GFunc) remote_server_render_free, NULL);
+    g_list_free(self.renders);
+    g_list_free(self.conns);
+    g_timer_destroy(self.clock);
+    rmdir(self.temp_dir);
+    g_free(self.temp_dir);
 }
 
 
@@ -179,16 +459,55 @@ static void release_privileges(RemoteServer* self)
 static void release_privileges(RemoteServer* self) {}
 #endif /* HAVE_FORK */
 
+static RemoteServerConn* remote_server_conn_new (RemoteServer*       server)
+{
+    RemoteServerConn* self = g_new0(RemoteServerConn, 1);
+
+    self->server = server;
+    self->map = ITERATIVE_MAP(de_jong_new());
+    self->num_slots = self->server->num_workers;
+    self->slots = g_new0(RemoteServerSlot, self->num_slots);
+
+    self->weight = DEFAULT_WEIGHT;
+    self->idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    self->virtual_time = server->virtual_time;
+    self->last_activity = g_timer_elapsed(server->clock, NULL);
+    self->pushes_in_flight = g_queue_new();
+    server->conns = g_list_prepend(server->conns, self);
+
+    /* Remember the starting parameters, so setting one to the value
+     * it already has doesn't throw away our results.
+     */
+    self->param_values = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+					       (GDestroyNotify) remote_server_value_free);
+    {
+	guint n_properties, i;
+	GParamSpec** properties = g_object_class_list_properties(G_OBJECT_GET_CLASS(self->map),
+								 &n_properties);
+	for (i=0; i<n_properties; i++)
+	    if (!(properties[i]->flags & PARAM_COSMETIC) && (properties[i]->flags & G_PARAM_READABLE))
+		remote_server_param_changed(self, properties[i]);
+	g_free(properties);
+    }
+    g_signal_connect(self->map, "notify", G_CALLBACK(on_map_notify), self);
+
+    /* The cluster follows our map's parameters and calculation signals,
+     * and merges its nodes' results straight into it.
+     */
+    if (self->server->sub_nodes) {
+	self->cluster = cluster_model_get(self->map, TRUE);
+	cluster_model_add_nodes(self->cluster, self->server->sub_nodes);
+    }
+    return self;
+}
+
 static void       remote_server_connect       (GServer*              gserver,
 					       GConn*                gconn,
 					       gpointer              user_data)
 {
-    RemoteServerConn* self = g_new0(RemoteServerConn, 1);
+    RemoteServerConn* self = remote_server_conn_new((RemoteServer*) user_data);
 
-    self->server = (RemoteServer*) user_data;
     self->gconn = gconn;
-    self->map = ITERATIVE_MAP(de_jong_new());
-
     gnet_conn_set_callback(gconn, remote_server_callback, self);
     gnet_conn_set_watch_error(gconn, TRUE);
     gnet_conn_readline(gconn);
@@ -230,12 +549,55 @@ static void       remote_server_disconnect    (RemoteServerConn*     self)
 	printf("[%s:%d] Disconnected\n", self->gconn->hostname, self->gconn->port);
 
     gnet_conn_delete(self->gconn);
-    iterative_map_stop_calculation(self->map);
+    self->gconn = NULL;
+    remote_server_conn_close(self);
+}
+
+static void       remote_server_conn_close    (RemoteServerConn*     self)
+{
+    /* Stop everything this connection was doing. Its memory goes
+     * away once the last of its jobs comes back from the workers.
+     */
+    self->running = FALSE;
+    if (self->push_timer) {
+	g_source_remove(self->push_timer);
+	self->push_timer = 0;
+    }
     gui_init_none(self);
 
+    /* Our cluster and map hold references to each other, break the cycle */
+    if (self->cluster) {
+	g_object_run_dispose(G_OBJECT(self->cluster));
+	g_object_unref(self->cluster);
+	self->cluster = NULL;
+    }
+
+    /* Jobs still running on our slots will finish up the cleanup */
+    self->server->conns = g_list_remove(self->server->conns, self);
+    self->disconnected = TRUE;
+    if (!self->jobs_in_flight)
+	remote_server_conn_free(self);
+}
+
+static void       remote_server_conn_free     (RemoteServerConn*     self)
+{
+    int i;
+
+    for (i=0; i<self->num_slots; i++) {
+	self->slots[i].pending_jobs = 0;
+	remote_server_release_slot(self, &self->slots[i]);
+	if (self->slots[i].random)
+	    g_rand_free(self->slots[i].random);
+    }
+    g_free(self->slots);
+
+    g_hash_table_destroy(self->param_values);
     g_object_unref(self->map);
     if (self->buffer)
 	g_free(self->buffer);
+    if (self->shared)
+	shared_memory_free(self->shared);
+    g_queue_free(self->pushes_in_flight);
     g_free(self);
 }
 
@@ -244,6 +606,7 @@ static void       remote_server_dispatch_line (RemoteServerConn*     self,
 {
     char* args;
     RemoteServerCallback callback;
+    gboolean is_grant;
 
     args = strchr(line, ' ');
     if (args) {
@@ -256,6 +619,23 @@ static void       remote_server_dispatch_line (RemoteServerConn*     self,
     callback = (RemoteServerCallback)
 	g_hash_table_lookup(self->server->command_hash, line);
 
+    /* Anything the client says shows it's still there, except grants.
+     * Clients send those on their own as they merge our pushes, so a
+     * subscriber nobody is watching would otherwise never go idle.
+     */
+    is_grant = !strcmp(line, "grant");
+    if (!is_grant)
+	self->last_activity = g_timer_elapsed(self->server->clock, NULL);
+    if (self->idle && !is_grant) {
+	self->idle = FALSE;
+	if (self->running) {
+	    if (self->server->verbose)
+		printf("[%s:%d] Resuming after idle timeout\n", self->gconn->hostname, self->gconn->port);
+	    remote_server_schedule(self);
+	    g_signal_emit_by_name(self->map, "calculation-start");
+	}
+    }
+
     if (callback)
 	callback(self, line, args);
     else
@@ -285,12 +665,28 @@ static void       remote_server_send_response (RemoteServerConn*  self,
 }
 
 static void       remote_server_send_binary   (RemoteServerConn*  self,
+					       int                response_code,
 					       unsigned char*     data,
-					       unsigned long      length)
+					       unsigned long      length,
+					       const char*        description,
+					       ...)
 {
+    /* The length must be the first token of the response message,
+     * anything after it is a description for the client's benefit.
+     */
     int write_size;
-    remote_server_send_response(self, FYRE_RESPONSE_BINARY,
-				"%d byte binary response", length);
+    gchar* full_description;
+    va_list ap;
+
+    va_start(ap, description);
+    full_description = g_strdup_vprintf(description, ap);
+    va_end(ap);
+
+    remote_server_send_response(self, response_code,
+				"%lu byte %s", length, full_description);
+    g_free(full_description);
+    self->bytes_streamed += length;
+
     while (length > 0) {
 	write_size = MIN(length, 4096);
 	gnet_conn_write(self->gconn, data, write_size);
@@ -314,10 +710,710 @@ static void       remote_server_add_gui       (RemoteServer*         self,
 }
 
 
+/************************************************************************************/
+/*************************************************************** Calculation Workers */
+/************************************************************************************/
+
+static void       remote_server_schedule      (RemoteServerConn*     self)
+{
+    /* This connection may have new work. If it was sitting idle, bring
+     * it up to the current virtual time so it can't claim the time it
+     * didn't use. Then hand out any free workers.
+     */
+    if (remote_server_is_runnable(self))
+	self->virtual_time = MAX(self->virtual_time, self->server->virtual_time);
+    remote_server_dispatch(self->server);
+}
+
+static void       remote_server_dispatch      (RemoteServer*         self)
+{
+    /* Fill free workers, each from the runnable connection furthest behind */
+    RemoteServerConn* conn;
+    RemoteServerConn* best;
+    RemoteServerSlot* slot;
+    RemoteServerJob* job;
+    GList* l;
+
+    while (self->jobs_in_flight < self->num_workers) {
+	best = NULL;
+	for (l=self->conns; l; l=l->next) {
+	    conn = (RemoteServerConn*) l->data;
+	    if (remote_server_is_runnable(conn) &&
+		(!best || conn->virtual_time < best->virtual_time) &&
+		remote_server_free_slot(conn))
+		best = conn;
+	}
+	if (!best)
+	    break;
+
+	slot = remote_server_free_slot(best);
+	remote_server_load_slot(best, slot);
+	self->virtual_time = best->virtual_time;
+
+	job = g_new0(RemoteServerJob, 1);
+	job->conn = best;
+	job->slot = slot;
+	slot->busy = TRUE;
+	best->jobs_in_flight++;
+	self->jobs_in_flight++;
+	g_thread_pool_push(self->workers, job, NULL);
+    }
+}
+
+static gboolean   remote_server_is_runnable   (RemoteServerConn*     self)
+{
+    return self->running && !self->disconnected && !self->idle &&
+	!(self->quota > 0 && self->cpu_seconds >= self->quota);
+}
+
+static RemoteServerSlot* remote_server_free_slot (RemoteServerConn*  self)
+{
+    /* Find a slot that can take a job. Slot histograms come out of a
+     * budget shared by the whole server, so a large render can use every
+     * worker as long as memory allows, and many connections can't add up
+     * to more than the machine has. Slots only hold our region, so that's
+     * all they cost. A connection with nothing in flight can always run.
+     */
+    gsize hist_bytes = histogram_imager_get_region_buckets(HISTOGRAM_IMAGER(self->map)) * sizeof(guint);
+    RemoteServer* server = self->server;
+    RemoteServerSlot* slot;
+    int i;
+
+    for (i=0; i<self->num_slots; i++) {
+	slot = &self->slots[i];
+	if (slot->busy)
+	    continue;
+
+	if (self->jobs_in_flight &&
+	    server->slot_memory_used - slot->bytes + hist_bytes > server->slot_memory_budget) {
+	    /* Don't hold on to memory for slots we can't use */
+	    remote_server_release_slot(self, slot);
+	    continue;
+	}
+	return slot;
+    }
+    return NULL;
+}
+
+static void       remote_server_release_slot  (RemoteServerConn*     self,
+					       RemoteServerSlot*     slot)
+{
+    /* Free a slot's map, merging anything it still holds first */
+    if (!slot->map)
+	return;
+
+    remote_server_merge_slot(self, slot);
+    g_object_unref(slot->map);
+    slot->map = NULL;
+    self->server->slot_memory_used -= slot->bytes;
+    slot->bytes = 0;
+}
+
+static void       remote_server_load_slot     (RemoteServerConn*     self,
+					       RemoteServerSlot*     slot)
+{
+    /* Slots are reloaded whenever our parameters change */
+    gchar* params;
+
+    if (slot->map && slot->param_serial == self->param_serial)
+	return;
+
+    params = parameter_holder_save_string(PARAMETER_HOLDER(self->map));
+    if (!slot->map)
+	slot->map = ITERATIVE_MAP(de_jong_new());
+    parameter_holder_load_string(PARAMETER_HOLDER(slot->map), params);
+    g_free(params);
+
+    histogram_imager_set_region(HISTOGRAM_IMAGER(slot->map),
+				self->region_first_row, self->region_rows);
+    histogram_imager_clear(HISTOGRAM_IMAGER(slot->map));
+    slot->map->iterations = 0;
+    slot->pending_jobs = 0;
+    slot->param_serial = self->param_serial;
+
+    self->server->slot_memory_used -= slot->bytes;
+    slot->bytes = histogram_imager_get_region_buckets(HISTOGRAM_IMAGER(self->map)) * sizeof(guint);
+    self->server->slot_memory_used += slot->bytes;
+
+    /* Restart this slot's sequence, so the same parameters
+     * and seed always produce the same samples.
+     */
+    if (self->has_seed) {
+	guint32 seed = math_mix_seed(math_mix_seed(self->job_seed, self->stream_id),
+				     slot - self->slots);
+	if (slot->random)
+	    g_rand_set_seed(slot->random, seed);
+	else
+	    slot->random = g_rand_new_with_seed(seed);
+    }
+}
+
+static void       remote_server_account_job   (RemoteServerConn*     self,
+					       double                elapsed)
+{
+    /* Charge a finished job to its connection, and stop calculating
+     * if that uses up its quota or its client has gone quiet.
+     */
+    double now = g_timer_elapsed(self->server->clock, NULL);
+    gboolean was_runnable = remote_server_is_runnable(self);
+
+    self->cpu_seconds += elapsed;
+    self->virtual_time += elapsed / self->weight;
+    HISTOGRAM_IMAGER(self->map)->calc_seconds += elapsed;
+
+    if (self->gconn && self->idle_timeout > 0 &&
+	now - self->last_activity > self->idle_timeout)
+	self->idle = TRUE;
+
+    if (was_runnable && !remote_server_is_runnable(self)) {
+	if (self->server->verbose && self->gconn)
+	    printf("[%s:%d] Pausing calculation, %s\n", self->gconn->hostname, self->gconn->port,
+		   self->idle ? "client is idle" : "CPU quota used up");
+	g_signal_emit_by_name(self->map, "calculation-stop");
+    }
+}
+
+static void       remote_server_worker        (gpointer              data,
+					       gpointer              user_data)
+{
+    /* Runs on a worker thread. The slot is marked busy, so nothing
+     * else touches its map until the main thread collects this job.
+     */
+    RemoteServerJob* job = (RemoteServerJob*) data;
+    GRand* previous_random;
+    GTimer* timer;
+
+    if (job->render) {
+	remote_server_encode_render(job);
+	g_idle_add(remote_server_collect_render, job);
+	return;
+    }
+
+    previous_random = math_set_thread_random(job->slot->random);
+    timer = g_timer_new();
+    iterative_map_calculate_timed(job->slot->map, WORKER_SLICE);
+
+    job->elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    math_set_thread_random(previous_random);
+    g_idle_add(remote_server_collect_job, job);
+}
+
+static gboolean   remote_server_collect_job   (gpointer              user_data)
+{
+    /* Back on the main thread. Results stay in the slot for the next job
+     * until it has run MERGE_SLICES of them, or no more jobs are coming.
+     */
+    RemoteServerJob* job = (RemoteServerJob*) user_data;
+    RemoteServerConn* self = job->conn;
+    RemoteServerSlot* slot = job->slot;
+    RemoteServer* server = self->server;
+    double elapsed = job->elapsed;
+
+    g_free(job);
+    slot->busy = FALSE;
+    self->jobs_in_flight--;
+    server->jobs_in_flight--;
+
+    if (self->disconnected) {
+	if (!self->jobs_in_flight)
+	    remote_server_conn_free(self);
+    }
+    else {
+	remote_server_account_job(self, elapsed);
+
+	if (slot->param_serial == self->param_serial) {
+	    slot->pending_jobs++;
+	    if (slot->pending_jobs >= MERGE_SLICES || !remote_server_is_runnable(self))
+		remote_server_merge_slots(self);
+	}
+    }
+
+    remote_server_dispatch(server);
+    return FALSE;
+}
+
+static void       remote_server_merge_slot    (RemoteServerConn*     self,
+					       RemoteServerSlot*     slot)
+{
+    /* Fold an idle slot's pending results into the connection's map.
+     * Results from old parameters are dropped; the slot is cleared when
+     * it's reloaded.
+     */
+    if (slot->busy || !slot->map || !slot->pending_jobs)
+	return;
+    slot->pending_jobs = 0;
+    if (slot->param_serial != self->param_serial)
+	return;
+
+    histogram_imager_merge_histogram(HISTOGRAM_IMAGER(self->map), HISTOGRAM_IMAGER(slot->map));
+    self->map->iterations += slot->map->iterations;
+    slot->map->iterations = 0;
+}
+
+static void       remote_server_merge_slots   (RemoteServerConn*     self)
+{
+    /* Merge every idle slot, and let everyone know there are new
+     * results. Slots that are still busy get merged next time.
+     */
+    int i;
+
+    for (i=0; i<self->num_slots; i++)
+	remote_server_merge_slot(self, &self->slots[i]);
+    g_signal_emit_by_name(self->map, "calculation-finished");
+
+    /* A finished render closes its connection, and may free it */
+    if (self->render)
+	remote_server_check_render(self);
+}
+
+static void       on_map_notify               (IterativeMap*         map,
+					       GParamSpec*           spec,
+					       RemoteServerConn*     self)
+{
+    /* Our map never calculates on its own, so it's up to us to start
+     * over whenever a parameter that affects calculation changes.
+     * GObject notifies on every set, even if the value is the same,
+     * and clients often re-send parameters that didn't change.
+     */
+    if (spec->flags & PARAM_COSMETIC)
+	return;
+    if (!remote_server_param_changed(self, spec))
+	return;
+
+    self->param_serial++;
+    histogram_imager_clear(HISTOGRAM_IMAGER(map));
+    map->iterations = 0;
+}
+
+static gboolean   remote_server_param_changed (RemoteServerConn*     self,
+					       GParamSpec*           spec)
+{
+    /* Compare a parameter with the value we saw last, and remember it */
+    GValue* value = g_new0(GValue, 1);
+    GValue* previous = g_hash_table_lookup(self->param_values, spec->name);
+
+    g_value_init(value, spec->value_type);
+    g_object_get_property(G_OBJECT(self->map), spec->name, value);
+
+    if (previous && !g_param_values_cmp(spec, value, previous)) {
+	remote_server_value_free(value);
+	return FALSE;
+    }
+    g_hash_table_insert(self->param_values, (gpointer) spec->name, value);
+    return TRUE;
+}
+
+static void       remote_server_value_free    (GValue*               value)
+{
+    g_value_unset(value);
+    g_free(value);
+}
+
+static guint      remote_server_stream_row    (RemoteServerConn*     self)
+{
+    /* Our streams start at the first row of our region, in histogram rows */
+    guint first_row;
+    histogram_imager_get_region(HISTOGRAM_IMAGER(self->map), &first_row, NULL);
+    return first_row * HISTOGRAM_IMAGER(self->map)->oversample;
+}
+
+
+/************************************************************************************/
+/******************************************************************** Push Updates */
+/************************************************************************************/
+
+static gboolean   remote_server_push_timer    (gpointer              user_data)
+{
+    /* Once per subscription interval, tell the client about any progress
+     * and send whatever histogram data it has room for.
+     */
+    RemoteServerConn* self = (RemoteServerConn*) user_data;
+
+    if (self->map->iterations != self->pushed_status_iterations) {
+	self->pushed_status_iterations = self->map->iterations;
+	remote_server_send_response(self, FYRE_RESPONSE_PUSH_PROGRESS,
+				    "iterations=%.20e density=%ld generation=%u",
+				    self->map->iterations, HISTOGRAM_IMAGER(self->map)->peak_density,
+				    self->generation);
+    }
+
+    if (self->map->iterations != self->pushed_stream_iterations)
+	self->push_backlog = TRUE;
+    remote_server_push_stream(self);
+    return TRUE;
+}
+
+static void       remote_server_push_stream   (RemoteServerConn*     self)
+{
+    /* Send one push of up to push_bytes, if there's anything new and the
+     * client has a credit to spare. A push that comes close to filling
+     * the limit probably left data behind, so the backlog flag lets the
+     * next one go out as soon as a credit returns, without waiting for
+     * the timer.
+     */
+    gsize size;
+
+    if (!self->push_backlog || self->push_credits <= 0)
+	return;
+
+    if (self->shared_enabled && remote_server_push_shared(self))
+	return;
+
+    if (self->buffer_size < self->push_bytes) {
+	g_free(self->buffer);
+	self->buffer_size = self->push_bytes;
+	self->buffer = g_malloc(self->buffer_size);
+    }
+
+    self->pushed_stream_iterations = self->map->iterations;
+    size = histogram_stream_export(HISTOGRAM_IMAGER(self->map), self->stream_format,
+				   self->buffer, self->push_bytes);
+    self->push_backlog = size > self->push_bytes / 2;
+    if (!size)
+	return;
+
+    self->push_credits--;
+    g_queue_push_tail(self->pushes_in_flight, GINT_TO_POINTER(FALSE));
+    remote_server_send_binary(self, FYRE_RESPONSE_PUSH_BINARY, self->buffer, size,
+			      "histogram stream generation=%u first_row=%u",
+			      self->generation, remote_server_stream_row(self));
+}
+
+
+static gboolean   remote_server_push_shared   (RemoteServerConn*     self)
+{
+    /* Hand the client our whole histogram through shared memory, with no
+     * encoding at all. Returns FALSE if the segment can't be created, in
+     * which case we go back to normal pushes for good.
+     */
+    gsize slot_size = histogram_imager_get_region_buckets(HISTOGRAM_IMAGER(self->map)) * sizeof(guint);
+    gsize offset;
+
+    if (self->shared_slots_busy >= SHARED_SLOTS)
+	return TRUE;
+
+    if (!self->shared || self->shared_slot_size != slot_size) {
+	/* The histogram changed size. Wait for the client to finish
+	 * with the old segment before replacing it.
+	 */
+	if (self->shared_slots_busy)
+	    return TRUE;
+	if (self->shared)
+	    shared_memory_free(self->shared);
+	self->shared = shared_memory_create(slot_size * SHARED_SLOTS);
+	if (!self->shared) {
+	    self->shared_enabled = FALSE;
+	    return FALSE;
+	}
+	self->shared_slot_size = slot_size;
+	self->shared_next_slot = 0;
+    }
+
+    offset = self->shared_next_slot * slot_size;
+    self->shared_next_slot = (self->shared_next_slot + 1) % SHARED_SLOTS;
+    self->shared_slots_busy++;
+    self->push_credits--;
+    g_queue_push_tail(self->pushes_in_flight, GINT_TO_POINTER(TRUE));
+
+    /* Everything goes in one push, so there's never a backlog */
+    self->pushed_stream_iterations = self->map->iterations;
+    self->push_backlog = FALSE;
+    histogram_imager_export_buckets(HISTOGRAM_IMAGER(self->map), (guint*) (self->shared->data + offset));
+    self->bytes_streamed += slot_size;
+
+    remote_server_send_response(self, FYRE_RESPONSE_PUSH_SHARED,
+				"histogram segment=%s offset=%lu buckets=%lu generation=%u first_row=%u",
+				self->shared->name, (unsigned long) offset,
+				(unsigned long) (slot_size / sizeof(guint)),
+				self->generation, remote_server_stream_row(self));
+    return TRUE;
+}
+
+
+/************************************************************************************/
+/****************************************************************** Submitted Renders */
+/************************************************************************************/
+
+static void       remote_server_start_render  (RemoteServer*         self)
+{
+    /* Start the oldest queued render, unless another one is still
+     * calculating. One that's only being encoded doesn't count.
+     */
+    RemoteServerRender* render;
+    GList* l;
+
+    for (l=self->renders; l; l=l->next)
+	if (((RemoteServerRender*) l->data)->conn)
+	    return;
+
+    for (l=self->renders; l; l=l->next) {
+	render = (RemoteServerRender*) l->data;
+	if (render->state != RENDER_QUEUED)
+	    continue;
+
+	if (self->verbose)
+	    printf("Starting render %u\n", render->id);
+
+	render->state = RENDER_RUNNING;
+	render->conn = remote_server_conn_new(self);
+	render->conn->render = render;
+	render->conn->weight = RENDER_WEIGHT;
+	remote_server_load_params(render->conn->map, render->params);
+
+	render->conn->running = TRUE;
+	remote_server_schedule(render->conn);
+	g_signal_emit_by_name(render->conn->map, "calculation-start");
+	return;
+    }
+}
+
+static gboolean   remote_server_check_render  (RemoteServerConn*     self)
+{
+    /* Called after each batch of results is merged. Returns TRUE if
+     * the render reached its target and this connection is gone.
+     */
+    RemoteServerRender* render = self->render;
+    RemoteServer* server = self->server;
+
+    render->iterations = self->map->iterations;
+    render->current_quality = histogram_imager_compute_quality(HISTOGRAM_IMAGER(self->map));
+    if (render->current_quality < render->quality)
+	return FALSE;
+
+    remote_server_finish_render(render);
+    remote_server_start_render(server);
+    return TRUE;
+}
+
+static void       remote_server_finish_render (RemoteServerRender*   render)
+{
+    /* Let the finished render's connection go, and hand its map to a
+     * worker for encoding. Nothing touches the map once its connection
+     * is closed, so the worker can have it to itself. The render stays
+     * running until the result comes back.
+     */
+    RemoteServerConn* conn = render->conn;
+    RemoteServer* server = conn->server;
+    RemoteServerJob* job;
+
+    render->map = g_object_ref(conn->map);
+    conn->render = NULL;
+    render->conn = NULL;
+    remote_server_conn_close(conn);
+
+    /* This counts as one of the workers, so calculation doesn't crowd it out */
+    job = g_new0(RemoteServerJob, 1);
+    job->render = render;
+    job->server = server;
+    server->jobs_in_flight++;
+    g_thread_pool_push(server->workers, job, NULL);
+}
+
+static void       remote_server_encode_render (RemoteServerJob*      job)
+{
+    /* Runs on a worker thread. Results are written through a temporary
+     * file, so images get exactly the same metadata as images saved any
+     * other way, and histograms come back as the same chunked dump files
+     * --merge reads. Errors are left in the render for the main thread.
+     */
+    RemoteServerRender* render = job->render;
+    HistogramImager* imager = HISTOGRAM_IMAGER(render->map);
+    GError* error = NULL;
+    gchar* path = remote_server_temp_path(job->server, render->format);
+
+    if (!strcmp(render->format, "histogram"))
+	histogram_dump_save(render->map, path, &error);
+#ifdef HAVE_EXR
+    else if (!strcmp(render->format, "exr"))
+	exr_save_image_file(imager, path, &error);
+#endif
+    else
+	histogram_imager_save_image_file(imager, path, &error);
+
+    if (!error)
+	g_file_get_contents(path, (gchar**) &render->result, &render->result_size, &error);
+    remove(path);
+    g_free(path);
+
+    if (error) {
+	render->error = g_strdup(error->message);
+	g_error_free(error);
+    }
+}
+
+static gboolean   remote_server_collect_render (gpointer             user_data)
+{
+    /* Back on the main thread with an encoded render */
+    RemoteServerJob* job = (RemoteServerJob*) user_data;
+    RemoteServerRender* render = job->render;
+    RemoteServer* server = job->server;
+
+    g_free(job);
+    server->jobs_in_flight--;
+    g_object_unref(render->map);
+    render->map = NULL;
+
+    if (render->cancelled) {
+	remote_server_render_free(render);
+    }
+    else {
+	render->state = render->error ? RENDER_FAILED : RENDER_DONE;
+	if (server->verbose)
+	    printf("Render %u %s, %.3e iterations\n", render->id,
+		   render->state == RENDER_DONE ? "finished" : "failed", render->iterations);
+    }
+
+    remote_server_dispatch(server);
+    return FALSE;
+}
+
+static void       remote_server_render_free   (RemoteServerRender*   render)
+{
+    /* A worker still encoding this render frees it when it's done */
+    if (render->map) {
+	render->cancelled = TRUE;
+	return;
+    }
+    if (render->conn) {
+	render->conn->render = NULL;
+	remote_server_conn_close(render->conn);
+    }
+    g_free(render->format);
+    g_free(render->params);
+    g_free(render->result);
+    g_free(render->error);
+    g_free(render);
+}
+
+static RemoteServerRender* remote_server_find_render (RemoteServerConn*  self,
+						      const char*        parameters)
+{
+    /* Look up the render named by a command's parameters, sending
+     * an error response and returning NULL if there isn't one.
+     */
+    guint id = strtoul(parameters, NULL, 10);
+    GList* l;
+
+    for (l=self->server->renders; l; l=l->next)
+	if (((RemoteServerRender*) l->data)->id == id)
+	    return (RemoteServerRender*) l->data;
+
+    remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "No such render");
+    return NULL;
+}
+
+static const char* render_state_names[] = { "queued", "running", "done", "failed" };
+
+
 /************************************************************************************/
 /*************************************************** Shared convenience functions ***/
 /************************************************************************************/
 
+static void       remote_server_load_params   (IterativeMap*         map,
+					       const gchar*          pairs)
+{
+    /* Apply tab-separated "name = value" pairs escaped with g_strescape() */
+    gchar** split = g_strsplit(pairs, "\t", 0);
+    gchar** pair;
+    gchar* line;
+
+    for (pair=split; *pair; pair++) {
+	line = g_strcompress(*pair);
+	parameter_holder_set_from_line(PARAMETER_HOLDER(map), line);
+	g_free(line);
+    }
+    g_strfreev(split);
+}
+
+static void       remote_server_make_temp_dir (RemoteServer*         self)
+{
+    /* We're a network daemon, so we can't go writing files under
+     * guessable names in a directory everyone shares. Make our own, with
+     * a name nobody had yet. mkdir() fails rather than following anything
+     * already there, and only we can write to the result.
+     */
+    gchar* name;
+    gchar* path;
+    int status;
+
+    while (1) {
+	name = g_strdup_printf("fyre-server-%08x", g_random_int());
+	path = g_build_filename(g_get_tmp_dir(), name, NULL);
+	g_free(name);
+#ifdef WIN32
+	status = mkdir(path);
+#else
+	status = mkdir(path, 0700);
+#endif
+	if (status == 0 || errno != EEXIST)
+	    break;
+	g_free(path);
+    }
+
+    if (status != 0) {
+	printf("Can't create a temporary directory in %s: %s\n", g_get_tmp_dir(), g_strerror(errno));
+	exit(1);
+    }
+    self->temp_dir = path;
+}
+
+G_LOCK_DEFINE_STATIC(temp_path);
+
+static gchar*     remote_server_temp_path     (RemoteServer*         self,
+					       const gchar*          extension)
+{
+    /* Name a file in our private directory that nobody else is using.
+     * Renders are encoded on worker threads, so the counter is locked.
+     */
+    static guint counter = 0;
+    gchar* name;
+    gchar* path;
+
+    G_LOCK(temp_path);
+    name = g_strdup_printf("%u.%s", counter++, extension);
+    G_UNLOCK(temp_path);
+
+    path = g_build_filename(self->temp_dir, name, NULL);
+    g_free(name);
+    return path;
+}
+
+static void       remote_server_fit_size      (HistogramImager*      imager,
+					       guint*                width,
+					       guint*                height)
+{
+    /* Shrink a requested size to the image's aspect ratio. A zero
+     * in either dimension leaves it free.
+     */
+    guint64 w = *width ? *width : G_MAXUINT;
+    guint64 h = *height ? *height : G_MAXUINT;
+
+    if (w * imager->height > h * imager->width)
+	w = h * imager->width / imager->height;
+    else
+	h = w * imager->height / imager->width;
+
+    *width = MAX(1, w);
+    *height = MAX(1, h);
+}
+
+static gboolean   remote_server_encode_png    (RemoteServer*         self,
+					       GdkPixbuf*            image,
+					       guchar**              data,
+					       gsize*                size,
+					       GError**              error)
+{
+    gchar* path = remote_server_temp_path(self, "png");
+    gboolean success;
+
+    success = gdk_pixbuf_save(image, path, "png", error, NULL) &&
+	g_file_get_contents(path, (gchar**) data, size, error);
+    remove(path);
+    g_free(path);
+    return success;
+}
+
 static void sig_histogram_view_update(IterativeMap *map, HistogramView *view)
 {
     histogram_view_update(view);
@@ -354,6 +1450,96 @@ static void       cmd_set_param        (RemoteServerConn*  self,
     remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
 }
 
+static void       cmd_set_params       (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Set several parameters at once. The first token is a generation
+     * number, followed by tab-separated "name = value" pairs escaped
+     * with g_strescape(). The client only changes the generation when
+     * the parameters affect calculation, so when it does we start over
+     * immediately. Everything we send back is stamped with the
+     * generation it belongs to, letting the client discard stale results.
+     */
+    gchar* rest;
+    guint generation = strtoul(parameters, &rest, 10);
+
+    if (rest == parameters) {
+	remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "Missing generation");
+	return;
+    }
+
+    /* The command line isn't ours to modify, so skip whitespace in place */
+    while (g_ascii_isspace(*rest))
+	rest++;
+    remote_server_load_params(self->map, rest);
+
+    if (generation != self->generation) {
+	histogram_imager_clear(HISTOGRAM_IMAGER(self->map));
+	self->map->iterations = 0;
+	self->generation = generation;
+    }
+
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "generation=%u", self->generation);
+}
+
+static void       cmd_set_seed         (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* The client assigns us a job seed shared by the whole render, and a
+     * stream ID unique to this node. Changing them starts over, since
+     * results from the old sequence wouldn't be reproducible.
+     */
+    unsigned long job_seed, stream_id;
+
+    if (sscanf(parameters, "%lu %lu", &job_seed, &stream_id) != 2) {
+	remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "Expected a job seed and stream ID");
+	return;
+    }
+
+    self->has_seed = TRUE;
+    self->job_seed = job_seed;
+    self->stream_id = stream_id;
+    self->param_serial++;
+    histogram_imager_clear(HISTOGRAM_IMAGER(self->map));
+    self->map->iterations = 0;
+
+    /* Our own nodes get distinct streams under a job seed of their own */
+    if (self->cluster)
+	cluster_model_set_job_seed(self->cluster, math_mix_seed(self->job_seed, self->stream_id));
+
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
+}
+
+static void       cmd_set_region       (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Keep only a band of image rows, so the client can spread one large
+     * histogram across several nodes. Zero rows selects the whole image.
+     */
+    unsigned long first_row, num_rows;
+
+    if (sscanf(parameters, "%lu %lu", &first_row, &num_rows) != 2) {
+	remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "Expected a first row and row count");
+	return;
+    }
+
+    self->region_first_row = first_row;
+    self->region_rows = num_rows;
+    self->param_serial++;
+    histogram_imager_set_region(HISTOGRAM_IMAGER(self->map), first_row, num_rows);
+    histogram_imager_clear(HISTOGRAM_IMAGER(self->map));
+    self->map->iterations = 0;
+
+    /* Our own nodes split this band between themselves */
+    if (self->cluster)
+	cluster_model_set_partitioned(self->cluster, num_rows != 0);
+
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
+}
+
 static void       cmd_set_render_time  (RemoteServerConn*  self,
 					const char*        command,
 					const char*        parameters)
@@ -369,7 +1555,9 @@ static void       cmd_calc_start       (RemoteServerConn*  self,
     if (self->server->verbose)
 	printf("[%s:%d] Starting calculation\n", self->gconn->hostname, self->gconn->port);
 
-    iterative_map_start_calculation(self->map);
+    self->running = TRUE;
+    remote_server_schedule(self);
+    g_signal_emit_by_name(self->map, "calculation-start");
     remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
 }
 
@@ -380,8 +1568,87 @@ static void       cmd_calc_stop        (RemoteServerConn*  self,
     if (self->server->verbose)
 	printf("[%s:%d] Pausing calculation\n", self->gconn->hostname, self->gconn->port);
 
-    iterative_map_stop_calculation(self->map);
+    /* Jobs already running will still be merged when they finish */
+    self->running = FALSE;
+    remote_server_merge_slots(self);
+    g_signal_emit_by_name(self->map, "calculation-stop");
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
+}
+
+static void       cmd_set_share        (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Our weight relative to other connections, then optionally a CPU
+     * quota and an idle timeout, both in seconds. Zero disables them.
+     */
+    double weight, quota = self->quota, idle_timeout = self->idle_timeout;
+    gboolean was_runnable = remote_server_is_runnable(self);
+
+    if (sscanf(parameters, "%lf %lf %lf", &weight, &quota, &idle_timeout) < 1 ||
+	weight <= 0 || quota < 0 || idle_timeout < 0) {
+	remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "Expected weight, quota, and idle timeout");
+	return;
+    }
+
+    self->weight = weight;
+    self->quota = quota;
+    self->idle_timeout = idle_timeout;
     remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
+    remote_server_schedule(self);
+
+    /* A new quota can pause or resume us just like using one up */
+    if (was_runnable && !remote_server_is_runnable(self)) {
+	remote_server_merge_slots(self);
+	g_signal_emit_by_name(self->map, "calculation-stop");
+    }
+    else if (!was_runnable && remote_server_is_runnable(self)) {
+	if (self->server->verbose)
+	    printf("[%s:%d] Resuming after quota change\n", self->gconn->hostname, self->gconn->port);
+	g_signal_emit_by_name(self->map, "calculation-start");
+    }
+}
+
+static void       cmd_get_share        (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    const char* state = "stopped";
+
+    if (remote_server_is_runnable(self))
+	state = "running";
+    else if (self->running && self->idle)
+	state = "idle";
+    else if (self->running)
+	state = "quota";
+
+    remote_server_send_response(self, FYRE_RESPONSE_OK,
+				"weight=%f quota=%f idle_timeout=%f cpu=%f state=%s",
+				self->weight, self->quota, self->idle_timeout,
+				self->cpu_seconds, state);
+}
+
+static void       cmd_get_stats        (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Performance counters for this connection's render. The workers
+     * calculate into slots, so their time and memory are added here.
+     */
+    RenderStats stats;
+    gchar* pairs;
+    int i;
+
+    render_stats_collect(&stats, self->map);
+    stats.bytes_streamed += self->bytes_streamed;
+    for (i=0; i<self->num_slots; i++)
+	if (self->slots[i].map)
+	    render_stats_add_memory(&stats, HISTOGRAM_IMAGER(self->slots[i].map));
+
+    pairs = render_stats_to_pairs(&stats);
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "%s cpu=%f workers=%d",
+				pairs, self->cpu_seconds, self->server->num_workers);
+    g_free(pairs);
 }
 
 static void       cmd_calc_step        (RemoteServerConn*  self,
@@ -406,8 +1673,14 @@ static void       cmd_calc_status      (RemoteServerConn*  self,
 	       self->gconn->hostname, self->gconn->port,
 	       self->map->iterations, HISTOGRAM_IMAGER(self->map)->peak_density);
 
-    remote_server_send_response(self, FYRE_RESPONSE_PROGRESS, "iterations=%.20e density=%ld",
-				self->map->iterations, HISTOGRAM_IMAGER(self->map)->peak_density);
+    /* Points and quality let a client that leaves our band with us
+     * judge it, and expose it to match the others, without fetching it.
+     */
+    remote_server_send_response(self, FYRE_RESPONSE_PROGRESS,
+				"iterations=%.20e density=%ld generation=%u points=%.0f quality=%e",
+				self->map->iterations, HISTOGRAM_IMAGER(self->map)->peak_density,
+				self->generation, HISTOGRAM_IMAGER(self->map)->total_points_plotted,
+				histogram_imager_compute_quality(HISTOGRAM_IMAGER(self->map)));
 }
 
 static void       cmd_get_histogram_stream (RemoteServerConn*  self,
@@ -422,9 +1695,11 @@ static void       cmd_get_histogram_stream (RemoteServerConn*  self,
 	self->buffer = g_malloc(self->buffer_size);
     }
 
-    size = histogram_imager_export_stream(HISTOGRAM_IMAGER(self->map),
-					  self->buffer, self->buffer_size);
-    remote_server_send_binary(self, self->buffer, size);
+    size = histogram_stream_export(HISTOGRAM_IMAGER(self->map), self->stream_format,
+				   self->buffer, self->buffer_size);
+    remote_server_send_binary(self, FYRE_RESPONSE_BINARY, self->buffer, size,
+			      "histogram stream generation=%u first_row=%u",
+			      self->generation, remote_server_stream_row(self));
 
     /* If we used more than half the buffer, double its size.
      * This ensures that if we do run out of room, we'll have plenty
@@ -437,6 +1712,334 @@ static void       cmd_get_histogram_stream (RemoteServerConn*  self,
     }
 }
 
+static void       cmd_get_image        (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Colorize on our side and send a PNG, so a client can watch us
+     * without pulling the whole histogram. Parameters are the largest
+     * width and height wanted, either of which may be zero. The image
+     * keeps its aspect ratio. Smaller images are reduced straight from
+     * a sample of the histogram, so they cost no more than their own size.
+     */
+    HistogramImager* imager = HISTOGRAM_IMAGER(self->map);
+    guint width = 0, height = 0;
+    GdkPixbuf* image;
+    GError* error = NULL;
+    guchar* data;
+    gsize size;
+
+    sscanf(parameters, "%u %u", &width, &height);
+    if (width == 0 && height == 0) {
+	width = imager->width;
+	height = imager->height;
+    }
+    remote_server_fit_size(imager, &width, &height);
+
+    if (width >= imager->width && height >= imager->height) {
+	histogram_imager_update_image(imager);
+	image = gdk_pixbuf_ref(imager->image);
+    }
+    else {
+	HistogramThumbnail* thumb = histogram_imager_reduce_thumbnail(imager, width, height);
+	image = histogram_thumbnail_colorize(thumb);
+	histogram_thumbnail_free(thumb);
+    }
+
+    if (!remote_server_encode_png(self->server, image, &data, &size, &error)) {
+	remote_server_send_response(self, FYRE_RESPONSE_FALSE, "%s", error->message);
+	g_error_free(error);
+    }
+    else {
+	remote_server_send_binary(self, FYRE_RESPONSE_BINARY, data, size,
+				  "image/png width=%d height=%d iterations=%.20e generation=%u",
+				  gdk_pixbuf_get_width(image), gdk_pixbuf_get_height(image),
+				  self->map->iterations, self->generation);
+	g_free(data);
+    }
+    gdk_pixbuf_unref(image);
+}
+
+static void       cmd_get_preview      (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* A low resolution histogram, for clients that want to colorize
+     * it themselves. Parameters are the largest width and height, as
+     * for get_image. The data is one 32-bit little-endian IEEE float
+     * per pixel, row by row, giving the average histogram count over
+     * that pixel. Multiplying by pixel_scale gives linear luminance.
+     */
+    HistogramThumbnail* thumb;
+    const float* counts;
+    guint32* data;
+    guint width = 0, height = 0, i;
+    float pixel_scale;
+    union {
+	float f;
+	guint32 i;
+    } count;
+
+    if (sscanf(parameters, "%u %u", &width, &height) != 2 || (width == 0 && height == 0)) {
+	remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "Expected width and height");
+	return;
+    }
+
+    remote_server_fit_size(HISTOGRAM_IMAGER(self->map), &width, &height);
+    thumb = histogram_imager_reduce_thumbnail(HISTOGRAM_IMAGER(self->map), width, height);
+    counts = histogram_thumbnail_get_counts(thumb, &width, &height, &pixel_scale);
+
+    data = g_new(guint32, width * height);
+    for (i=0; i<width*height; i++) {
+	count.f = counts[i];
+	data[i] = GUINT32_TO_LE(count.i);
+    }
+
+    remote_server_send_binary(self, FYRE_RESPONSE_BINARY, (guchar*) data, width * height * sizeof(guint32),
+			      "preview width=%u height=%u pixel_scale=%.20e iterations=%.20e generation=%u",
+			      width, height, pixel_scale, self->map->iterations, self->generation);
+    g_free(data);
+    histogram_thumbnail_free(thumb);
+}
+
+static void       cmd_subscribe        (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Instead of polling with calc_status and get_histogram_stream, the
+     * client can ask us to push results on our own schedule. Parameters
+     * are the push interval in seconds, the largest histogram push in
+     * bytes, and the number of pushes it's willing to have in flight.
+     */
+    double interval = 0;
+    unsigned long bytes = 0;
+    int credits = 0;
+
+    if (sscanf(parameters, "%lf %lu %d", &interval, &bytes, &credits) != 3 ||
+	interval <= 0 || credits < 0) {
+	remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "Expected interval, bytes, and credits");
+	return;
+    }
+
+    if (self->push_timer)
+	g_source_remove(self->push_timer);
+
+    /* Subscribing again changes the interval, size, and number of credits.
+     * Credits already in flight will still be returned by the client,
+     * so only the change in window size is added to our current count.
+     */
+    if (!self->subscribed) {
+	self->subscribed = TRUE;
+	self->push_window = 0;
+	self->push_credits = 0;
+	self->push_backlog = FALSE;
+	self->pushed_status_iterations = -1;
+	self->pushed_stream_iterations = self->map->iterations;
+    }
+    self->push_credits += credits - self->push_window;
+    self->push_window = credits;
+    self->push_bytes = CLAMP(bytes, MIN_PUSH_BYTES, MAX_PUSH_BYTES);
+    self->push_timer = g_timeout_add(MAX(1, (guint) (interval * 1000)),
+				     remote_server_push_timer, self);
+
+    if (self->server->verbose)
+	printf("[%s:%d] Subscribed, every %.3f seconds, %lu bytes, %d credits\n",
+	       self->gconn->hostname, self->gconn->port,
+	       interval, (unsigned long) self->push_bytes, credits);
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
+}
+
+static void       cmd_unsubscribe      (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    if (self->push_timer) {
+	g_source_remove(self->push_timer);
+	self->push_timer = 0;
+    }
+    self->subscribed = FALSE;
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
+}
+
+static void       cmd_grant            (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* The client has finished merging some pushes, and has room for more */
+    int granted;
+
+    if (!self->subscribed) {
+	remote_server_send_response(self, FYRE_RESPONSE_UNSUPPORTED, "Not subscribed");
+	return;
+    }
+
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
+    granted = MAX(0, atoi(parameters));
+    self->push_credits += granted;
+
+    /* A grant for any push means the client has read every push before
+     * it, so each one retires our oldest push. Only the shared ones free
+     * a slot. Once the client has granted anything from a segment it
+     * must have it open, so the name can go away.
+     */
+    while (granted-- && !g_queue_is_empty(self->pushes_in_flight)) {
+	if (GPOINTER_TO_INT(g_queue_pop_head(self->pushes_in_flight))) {
+	    self->shared_slots_busy = MAX(0, self->shared_slots_busy - 1);
+	    if (self->shared)
+		shared_memory_unlink(self->shared);
+	}
+    }
+
+    remote_server_push_stream(self);
+}
+
+static void       cmd_share_memory     (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Clients on the same machine can take pushes through shared memory.
+     * They turn it back off if they can't open our segments.
+     */
+    if (!shared_memory_supported()) {
+	remote_server_send_response(self, FYRE_RESPONSE_UNSUPPORTED, "Shared memory not available");
+	return;
+    }
+
+    self->shared_enabled = atoi(parameters) != 0;
+    if (!self->shared_enabled && self->shared && !self->shared_slots_busy) {
+	shared_memory_free(self->shared);
+	self->shared = NULL;
+    }
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
+}
+
+static void       cmd_render_submit    (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Queue a whole render: target quality, output format, then the
+     * parameters in the same form as set_params. Everything not given
+     * keeps its default, so the pairs should at least set the size.
+     */
+    RemoteServerRender* render;
+    double quality;
+    char format[16];
+    int consumed = 0;
+
+    if (sscanf(parameters, "%lf %15s %n", &quality, format, &consumed) != 2 || quality <= 0) {
+	remote_server_send_response(self, FYRE_RESPONSE_BAD_VALUE, "Expected quality, format, and parameters");
+	return;
+    }
+
+    if (strcmp(format, "png") && strcmp(format, "histogram")
+#ifdef HAVE_EXR
+	&& strcmp(format, "exr")
+#endif
+	) {
+	remote_server_send_response(self, FYRE_RESPONSE_UNSUPPORTED, "Unsupported output format");
+	return;
+    }
+
+    render = g_new0(RemoteServerRender, 1);
+    render->id = self->server->next_render_id++;
+    render->state = RENDER_QUEUED;
+    render->format = g_strdup(format);
+    render->quality = quality;
+    render->params = g_strdup(parameters + consumed);
+    self->server->renders = g_list_append(self->server->renders, render);
+
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "render=%u", render->id);
+    remote_server_start_render(self->server);
+}
+
+static void       cmd_render_status    (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* With a render ID, describe that render. Otherwise list the
+     * state of every render we know about.
+     */
+    RemoteServerRender* render;
+    GString* list;
+    GList* l;
+
+    if (*parameters) {
+	if (!(render = remote_server_find_render(self, parameters)))
+	    return;
+	remote_server_send_response(self, FYRE_RESPONSE_OK,
+				    "render=%u state=%s iterations=%.20e quality=%f size=%lu",
+				    render->id, render_state_names[render->state],
+				    render->iterations, render->current_quality,
+				    (unsigned long) render->result_size);
+	return;
+    }
+
+    list = g_string_new("renders=");
+    for (l=self->server->renders; l; l=l->next) {
+	render = (RemoteServerRender*) l->data;
+	g_string_append_printf(list, "%s%u:%s", l == self->server->renders ? "" : ",",
+			       render->id, render_state_names[render->state]);
+    }
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "%s", list->str);
+    g_string_free(list, TRUE);
+}
+
+static void       cmd_render_fetch     (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    RemoteServerRender* render = remote_server_find_render(self, parameters);
+    if (!render)
+	return;
+
+    if (render->state == RENDER_FAILED) {
+	remote_server_send_response(self, FYRE_RESPONSE_FALSE, "%s", render->error);
+	return;
+    }
+    if (render->state != RENDER_DONE) {
+	remote_server_send_response(self, FYRE_RESPONSE_UNSUPPORTED, "Render not finished");
+	return;
+    }
+
+    remote_server_send_binary(self, FYRE_RESPONSE_BINARY, render->result, render->result_size,
+			      "render=%u format=%s", render->id, render->format);
+}
+
+static void       cmd_render_cancel    (RemoteServerConn*  self,
+					const char*        command,
+					const char*        parameters)
+{
+    /* Stop a render if it's running, and forget about it either way */
+    RemoteServerRender* render = remote_server_find_render(self, parameters);
+    if (!render)
+	return;
+
+    self->server->renders = g_list_remove(self->server->renders, render);
+    remote_server_render_free(render);
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "ok");
+    remote_server_start_render(self->server);
+}
+
+static void       cmd_set_stream_format (RemoteServerConn*  self,
+					 const char*        command,
+					 const char*        parameters)
+{
+    /* Clients that know about stream formats ask for the one they'd
+     * like. Everyone else keeps getting the original run-length format.
+     */
+    HistogramStreamFormat format;
+
+    if (!histogram_stream_format_from_name(parameters, &format)) {
+	remote_server_send_response(self, FYRE_RESPONSE_UNSUPPORTED, "Unsupported stream format");
+	return;
+    }
+
+    self->stream_format = format;
+    if (self->server->verbose)
+	printf("[%s:%d] Stream format set to '%s'\n", self->gconn->hostname, self->gconn->port, parameters);
+    remote_server_send_response(self, FYRE_RESPONSE_OK, "Stream format set to '%s'", parameters);
+}
+
 static void       cmd_is_gui_available (RemoteServerConn*  self,
 					const char*        command,
 					const char*        parameters)
@@ -512,14 +2115,31 @@ static void       gui_init_simple     (RemoteServerConn*     self)
 static void       remote_server_init_commands (RemoteServer*  self)
 {
     remote_server_add_command(self, "set_param",            cmd_set_param);
+    remote_server_add_command(self, "set_params",           cmd_set_params);
     remote_server_add_command(self, "set_gui_style",        cmd_set_gui_style);
     remote_server_add_command(self, "set_render_time",      cmd_set_render_time);
+    remote_server_add_command(self, "set_seed",             cmd_set_seed);
+    remote_server_add_command(self, "set_region",           cmd_set_region);
     remote_server_add_command(self, "is_gui_available",     cmd_is_gui_available);
     remote_server_add_command(self, "calc_start",           cmd_calc_start);
     remote_server_add_command(self, "calc_stop",            cmd_calc_stop);
     remote_server_add_command(self, "calc_step",            cmd_calc_step);
     remote_server_add_command(self, "calc_status",          cmd_calc_status);
     remote_server_add_command(self, "get_histogram_stream", cmd_get_histogram_stream);
+    remote_server_add_command(self, "get_image",            cmd_get_image);
+    remote_server_add_command(self, "set_share",            cmd_set_share);
+    remote_server_add_command(self, "get_share",            cmd_get_share);
+    remote_server_add_command(self, "get_stats",            cmd_get_stats);
+    remote_server_add_command(self, "get_preview",          cmd_get_preview);
+    remote_server_add_command(self, "set_stream_format",    cmd_set_stream_format);
+    remote_server_add_command(self, "subscribe",            cmd_subscribe);
+    remote_server_add_command(self, "unsubscribe",          cmd_unsubscribe);
+    remote_server_add_command(self, "grant",                cmd_grant);
+    remote_server_add_command(self, "share_memory",         cmd_share_memory);
+    remote_server_add_command(self, "render_submit",        cmd_render_submit);
+    remote_server_add_command(self, "render_status",        cmd_render_status);
+    remote_server_add_command(self, "render_fetch",         cmd_render_fetch);
+    remote_server_add_command(self, "render_cancel",        cmd_render_cancel);
 
     remote_server_add_gui(self, "none",    gui_init_none);
     remote_server_add_gui(self, "simple",  gui_init_simple);
@@ -40,9 +40,15 @@ G_BEGIN_DECLS
 /******************************************************************* Public Methods */
 /************************************************************************************/
 
-void              remote_server_main_loop     (int        port_number,
-					       gboolean   have_gtk,
-					       gboolean   verbose);
+/* If sub_nodes is non-NULL, it's a comma-separated list of host[:port]
+ * specifiers. Each connection then gets its own cluster of those nodes,
+ * which calculate alongside us and have their results merged into ours
+ * before they're sent upstream. This lets servers form an aggregation tree.
+ */
+void              remote_server_main_loop     (int           port_number,
+					       gboolean      have_gtk,
+					       gboolean      verbose,
+					       const gchar*  sub_nodes);
 
 
 /************************************************************************************/
@@ -61,6 +67,11 @@ void              remote_server_main_loop     (int        port_number,
 					  * the response message. Binary data follows
 					  * after the message's newline.
 					  */
+#define FYRE_RESPONSE_PUSH_PROGRESS 261  /* Like PROGRESS, but sent unsolicited to subscribers */
+#define FYRE_RESPONSE_PUSH_SHARED   262  /* Histogram data pushed through a shared memory
+					  * segment, named in the response message.
+					  */
+#define FYRE_RESPONSE_PUSH_BINARY   381  /* Like BINARY, but sent unsolicited to subscribers */
 #define FYRE_RESPONSE_UNRECOGNIZED  500  /* Command not recognized */
 #define FYRE_RESPONSE_BAD_VALUE     501  /* Inappropriate parameter value */
 #define FYRE_RESPONSE_UNSUPPORTED   502  /* Command was recognized, but is not currently supported */
@@ -0,0 +1,192 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * render-stats.c - Performance counters for a render, in several formats
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include "render-stats.h"
+
+#ifdef HAVE_GNET
+#include "cluster-model.h"
+#endif
+
+typedef struct {
+    const gchar*  name;
+    const gchar*  label;
+    double        value;
+} RenderStatsItem;
+
+static int        render_stats_items          (const RenderStats*  self,
+					       RenderStatsItem*    items);
+
+#define MAX_ITEMS  32
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+double     render_stats_clock             ()
+{
+    GTimeVal now;
+    g_get_current_time(&now);
+    return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+void       render_stats_collect           (RenderStats*      self,
+					   IterativeMap*     map)
+{
+    HistogramImager* imager = HISTOGRAM_IMAGER(map);
+
+    memset(self, 0, sizeof(RenderStats));
+    self->iterations = map->iterations;
+    self->elapsed_seconds = histogram_imager_get_elapsed_time(imager);
+    self->points_plotted = imager->total_points_plotted;
+    self->calc_seconds = imager->calc_seconds;
+    self->colorize_seconds = imager->colorize_seconds;
+    self->colorize_count = imager->colorize_count;
+    self->merge_seconds = imager->merge_seconds;
+    self->export_seconds = imager->export_seconds;
+    render_stats_add_memory(self, imager);
+
+#ifdef HAVE_GNET
+    {
+	ClusterModel* cluster = cluster_model_get(map, FALSE);
+	GtkTreeIter iter;
+	RemoteClient* client;
+
+	if (cluster) {
+	    if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(cluster), &iter)) {
+		do {
+		    gtk_tree_model_get(GTK_TREE_MODEL(cluster), &iter,
+				       CLUSTER_MODEL_CLIENT, &client,
+				       -1);
+		    if (client) {
+			/* Merges done on the main thread are already in
+			 * the map's counter. Only the merger's are new.
+			 */
+			self->cluster_nodes++;
+			self->bytes_streamed += client->total_bytes;
+			self->worker_merge_seconds += client->total_worker_merge_seconds;
+			self->stale_drops += client->stale_drops;
+			g_object_unref(client);
+		    }
+		} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(cluster), &iter));
+	    }
+	    g_object_unref(cluster);
+	}
+    }
+#endif
+}
+
+void       render_stats_add_memory        (RenderStats*      self,
+					   HistogramImager*  imager)
+{
+    if (imager->histogram)
+	self->histogram_bytes += histogram_imager_get_region_buckets(imager) * sizeof(imager->histogram[0]);
+    if (imager->image)
+	self->image_bytes += gdk_pixbuf_get_rowstride(imager->image) * gdk_pixbuf_get_height(imager->image);
+}
+
+gchar*     render_stats_to_pairs          (const RenderStats* self)
+{
+    RenderStatsItem items[MAX_ITEMS];
+    GString* str = g_string_new(NULL);
+    int i, n = render_stats_items(self, items);
+
+    for (i=0; i<n; i++)
+	g_string_append_printf(str, "%s%s=%.10g", i ? " " : "", items[i].name, items[i].value);
+    return g_string_free(str, FALSE);
+}
+
+gchar*     render_stats_to_json           (const RenderStats* self)
+{
+    RenderStatsItem items[MAX_ITEMS];
+    GString* str = g_string_new("{");
+    int i, n = render_stats_items(self, items);
+
+    for (i=0; i<n; i++)
+	g_string_append_printf(str, "%s\n  \"%s\": %.10g", i ? "," : "", items[i].name, items[i].value);
+    g_string_append(str, "\n}\n");
+    return g_string_free(str, FALSE);
+}
+
+gchar*     render_stats_to_text           (const RenderStats* self)
+{
+    RenderStatsItem items[MAX_ITEMS];
+    GString* str = g_string_new(NULL);
+    int i, n = render_stats_items(self, items);
+
+    for (i=0; i<n; i++)
+	g_string_append_printf(str, "%s%-26s %.4g", i ? "\n" : "", items[i].label, items[i].value);
+    return g_string_free(str, FALSE);
+}
+
+
+/************************************************************************************/
+/************************************************************************* Helpers **/
+/************************************************************************************/
+
+static int        render_stats_items          (const RenderStats*  self,
+					       RenderStatsItem*    items)
+{
+    /* Every output format lists the same statistics, in this order.
+     * Rates with nothing to divide by come out as zero. Other seconds
+     * are what's left of the main thread's time, so worker merge time
+     * isn't taken out of them.
+     */
+    double other = self->elapsed_seconds - self->calc_seconds - self->colorize_seconds
+	- self->merge_seconds - self->export_seconds;
+    int n = 0;
+
+#define ITEM(n_, l_, v_)  do { items[n].name = (n_); items[n].label = (l_); items[n].value = (v_); n++; } while (0)
+#define RATE(a, b)        ((b) > 0 ? (a) / (b) : 0)
+
+    ITEM("iterations",        "Iterations",                 self->iterations);
+    ITEM("elapsed",           "Elapsed seconds",            self->elapsed_seconds);
+    ITEM("iterations_per_sec", "Iterations/sec",            RATE(self->iterations, self->elapsed_seconds));
+    ITEM("calc_rate",         "Iterations/calc second",     RATE(self->iterations, self->calc_seconds));
+    ITEM("hit_rate",          "In-bounds hit rate",         RATE(self->points_plotted, self->iterations));
+    ITEM("calc_seconds",      "Calculation seconds",        self->calc_seconds);
+    ITEM("colorize_seconds",  "Colorize seconds",           self->colorize_seconds);
+    ITEM("colorize_count",    "Images colorized",           self->colorize_count);
+    ITEM("colorize_ms",       "Milliseconds per colorize",  RATE(self->colorize_seconds * 1000, self->colorize_count));
+    ITEM("merge_seconds",     "Merge seconds",              self->merge_seconds);
+    ITEM("export_seconds",    "Export seconds",             self->export_seconds);
+    ITEM("worker_merge_seconds", "Worker merge seconds",    self->worker_merge_seconds);
+    ITEM("other_seconds",     "Other seconds",              MAX(other, 0));
+    ITEM("bytes_streamed",    "Bytes streamed",             self->bytes_streamed);
+    ITEM("stream_bytes_per_sec", "Stream bytes/sec",        RATE(self->bytes_streamed, self->elapsed_seconds));
+    ITEM("histogram_bytes",   "Histogram memory",           self->histogram_bytes);
+    ITEM("image_bytes",       "Image memory",               self->image_bytes);
+    ITEM("cluster_nodes",     "Cluster nodes",              self->cluster_nodes);
+    ITEM("stale_drops",       "Stale results dropped",      self->stale_drops);
+
+#undef ITEM
+#undef RATE
+
+    g_assert(n <= MAX_ITEMS);
+    return n;
+}
+
+/* The End */
@@ -0,0 +1,91 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * render-stats.h - Performance counters for a render, in several formats
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __RENDER_STATS_H__
+#define __RENDER_STATS_H__
+
+#include <glib.h>
+#include "iterative-map.h"
+
+G_BEGIN_DECLS
+
+/* A snapshot of a render's performance counters. The counters themselves
+ * live in the HistogramImager, cost one clock read per calculation step,
+ * merge, export, or image update, and start over whenever the histogram
+ * is cleared. Cluster nodes' totals are kept from when they connected.
+ */
+typedef struct {
+    double   iterations;
+    double   elapsed_seconds;     /* Since the histogram was last cleared */
+    double   points_plotted;      /* Iterations that landed inside the image */
+
+    /* Time spent in each phase */
+    double   calc_seconds;
+    double   colorize_seconds;
+    double   colorize_count;
+    double   merge_seconds;
+    double   export_seconds;
+
+    /* Cluster data decoded on the merger's thread, alongside everything
+     * above rather than as part of the elapsed time.
+     */
+    double   worker_merge_seconds;
+
+    /* Histogram data received from cluster nodes, or sent by a server */
+    double   bytes_streamed;
+    double   histogram_bytes;
+    double   image_bytes;
+
+    double   cluster_nodes;
+    double   stale_drops;
+} RenderStats;
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+/* Wall clock time in seconds, for timing phases of a render */
+double     render_stats_clock             ();
+
+/* Fill in stats from a map, and from its cluster nodes if it has any */
+void       render_stats_collect           (RenderStats*      self,
+					   IterativeMap*     map);
+
+/* Count the memory used by another imager working on the same render */
+void       render_stats_add_memory        (RenderStats*      self,
+					   HistogramImager*  imager);
+
+/* The same statistics, with rates worked out, as space-separated
+ * name=value pairs for the remote protocol, as a JSON object, or as
+ * one line per statistic for people.
+ */
+gchar*     render_stats_to_pairs          (const RenderStats* self);
+gchar*     render_stats_to_json           (const RenderStats* self);
+gchar*     render_stats_to_text           (const RenderStats* self);
+
+G_END_DECLS
+
+#endif /* __RENDER_STATS_H__ */
+
+/* The End */
@@ -24,13 +24,50 @@
 
 #include "screensaver.h"
 #include "histogram-view.h"
+#include "image-fu.h"
+#include "thread-util.h"
 #include "de-jong.h"
 
+/* Frames are refined on a pool of worker threads. Only a few histograms
+ * are kept live at once, in 'slots'. A frame that gets pushed out of the
+ * working set keeps a compressed copy of its histogram so refinement can
+ * pick up where it left off, and once a frame reaches TARGET_QUALITY its
+ * histogram is dropped entirely, leaving only the 8-bit image.
+ */
+#define TARGET_QUALITY     1.0
+#define PREVIEW_TIME       0.02   /* Calculation time for a frame's first rendering */
+#define REFINE_TIME        0.25   /* Calculation time for each later refinement */
+#define LOOKAHEAD_FRAMES   20     /* How strongly upcoming frames are favoured */
+#define STREAM_CHUNK_SIZE  (256 * 1024)
+
+typedef struct {
+    int frame;
+    ScreenSaverSlot *slot;
+
+    /* Work to do, set up by the main thread */
+    gboolean load;
+    GSList *stream;
+    gdouble refine_time;
+    gboolean release;
+
+    /* Results, filled in by the worker */
+    GdkPixbuf *image;
+    gdouble quality;
+} ScreenSaverJob;
+
 static void screensaver_class_init(ScreenSaverClass *klass);
 static void screensaver_init(ScreenSaver *self);
 static void screensaver_dispose(GObject *gobject);
 
-static int screensaver_idle_handler(gpointer user_data);
+static int  screensaver_idle_handler(gpointer user_data);
+static void screensaver_worker(gpointer data, gpointer user_data);
+static void screensaver_collect_results(ScreenSaver *self);
+static void screensaver_schedule(ScreenSaver *self);
+static void screensaver_step_frame(ScreenSaver *self, int *frame, int *direction);
+
+static GSList* stream_export(HistogramImager *imager);
+static void    stream_merge(HistogramImager *imager, GSList *stream);
+static void    stream_free(GSList *stream);
 
 
 /************************************************************************************/
@@ -73,20 +110,38 @@ static void screensaver_dispose(GObject *gobject) {
 
     screensaver_stop(self);
 
-    if (self->frame_renders) {
+    if (self->workers) {
+	/* Let any outstanding jobs finish, then collect their results so
+	 * everything they hold gets freed along with the frames below.
+	 */
+	g_thread_pool_free(self->workers, FALSE, TRUE);
+	self->workers = NULL;
+	screensaver_collect_results(self);
+	g_async_queue_unref(self->results);
+	self->results = NULL;
+    }
+
+    if (self->slots) {
 	int i;
-	for (i=0; i<self->num_frames; i++)
-	    g_object_unref(self->frame_renders[i]);
-	g_free(self->frame_renders);
-	self->frame_renders = NULL;
+	for (i=0; i<self->num_slots; i++) {
+	    g_object_unref(self->slots[i].map);
+	    g_object_unref(self->slots[i].params.a);
+	    g_object_unref(self->slots[i].params.b);
+	}
+	g_free(self->slots);
+	self->slots = NULL;
     }
 
-    if (self->frame_parameters) {
+    if (self->frames) {
 	int i;
-	for (i=0; i<self->num_frames; i++)
-	    g_object_unref(self->frame_parameters[i].a);
-	g_free(self->frame_parameters);
-	self->frame_parameters = NULL;
+	for (i=0; i<self->num_frames; i++) {
+	    g_free(self->frames[i].params);
+	    if (self->frames[i].image)
+		gdk_pixbuf_unref(self->frames[i].image);
+	    stream_free(self->frames[i].stream);
+	}
+	g_free(self->frames);
+	self->frames = NULL;
     }
 
     if (self->view) {
@@ -108,34 +163,49 @@ ScreenSaver* screensaver_new(IterativeMap *map, Animation *animation) {
     ScreenSaver *self = SCREENSAVER(g_object_new(screensaver_get_type(), NULL));
     int i;
     AnimationIter iter;
+    ParameterHolder *frame_params;
     gchar* common_parameters;
 
     self->animation = ANIMATION(g_object_ref(animation));
     self->map = ITERATIVE_MAP(g_object_ref(map));
     self->view = g_object_ref(histogram_view_new(HISTOGRAM_IMAGER(self->map)));
 
-    /* Allocate and interpolate all frames */
+    /* Store the parameters for every frame, but no histograms yet */
     self->framerate = 10;
-    self->num_frames = animation_get_length(self->animation) * self->framerate;
-    self->frame_renders = g_new0(IterativeMap*, self->num_frames);
-    self->frame_parameters = g_new0(ParameterHolderPair, self->num_frames);
+    self->num_frames = MAX(1, animation_get_length(self->animation) * self->framerate);
+    self->frames = g_new0(ScreenSaverFrame, self->num_frames);
     self->current_frame = 0;
-    common_parameters = parameter_holder_save_string(PARAMETER_HOLDER(map));
 
+    frame_params = PARAMETER_HOLDER(de_jong_new());
     animation_iter_seek(animation, &iter, 0);
     for (i=0; i<self->num_frames; i++) {
-	self->frame_renders[i] = ITERATIVE_MAP(de_jong_new());
-	parameter_holder_load_string(PARAMETER_HOLDER(self->frame_renders[i]), common_parameters);
-
-	self->frame_parameters[i].a = PARAMETER_HOLDER(de_jong_new());
-	animation_iter_load(animation, &iter, self->frame_parameters[i].a);
+	animation_iter_load(animation, &iter, frame_params);
+	self->frames[i].params = parameter_holder_save_string(frame_params);
+	self->frames[i].slot = -1;
 	animation_iter_seek_relative(animation, &iter, 1/self->framerate);
     }
-    for (i=0; i<self->num_frames-1; i++)
-	self->frame_parameters[i].b = self->frame_parameters[i+1].a;
-    self->frame_parameters[self->num_frames-1].b = self->frame_parameters[self->num_frames-1].a;
+    g_object_unref(frame_params);
+
+    /* The live working set. Each worker needs one slot to refine in, and
+     * the extras let frames near the playback position stay live between
+     * refinements rather than being recompressed every time.
+     */
+    self->num_workers = thread_util_num_processors();
+    self->num_slots = MIN(self->num_frames, self->num_workers * 2 + 2);
+    self->slots = g_new0(ScreenSaverSlot, self->num_slots);
+    common_parameters = parameter_holder_save_string(PARAMETER_HOLDER(map));
 
+    for (i=0; i<self->num_slots; i++) {
+	self->slots[i].map = ITERATIVE_MAP(de_jong_new());
+	parameter_holder_load_string(PARAMETER_HOLDER(self->slots[i].map), common_parameters);
+	self->slots[i].params.a = PARAMETER_HOLDER(de_jong_new());
+	self->slots[i].params.b = PARAMETER_HOLDER(de_jong_new());
+	self->slots[i].frame = -1;
+    }
     g_free(common_parameters);
+
+    self->results = g_async_queue_new();
+    self->workers = g_thread_pool_new(screensaver_worker, self, self->num_workers, FALSE, NULL);
     self->direction = 1;
 
     screensaver_start(self);
@@ -150,7 +220,7 @@ ScreenSaver* screensaver_new(IterativeMap *map, Animation *animation) {
 void          screensaver_start    (ScreenSaver *self)
 {
     if (!self->idler)
-	self->idler = g_idle_add(screensaver_idle_handler, self);
+	self->idler = g_timeout_add((guint) (1000 / self->framerate), screensaver_idle_handler, self);
 }
 
 void          screensaver_stop     (ScreenSaver *self)
@@ -163,29 +233,236 @@ void          screensaver_stop     (ScreenSaver *self)
 
 static int screensaver_idle_handler(gpointer user_data) {
     ScreenSaver *self = SCREENSAVER(user_data);
+    ScreenSaverFrame *frame;
+
+    screensaver_collect_results(self);
+
+    /* Playback runs at a fixed frame rate, independent of how quickly
+     * frames are being refined. If the next frame hasn't been rendered
+     * at all yet we wait for it, but it will be first in line.
+     */
+    frame = &self->frames[self->current_frame];
+    if (frame->image && GTK_WIDGET_DRAWABLE(self->view)) {
+	histogram_view_show_pixbuf(HISTOGRAM_VIEW(self->view), frame->image);
+	screensaver_step_frame(self, &self->current_frame, &self->direction);
+    }
+
+    screensaver_schedule(self);
+    return 1;
+}
+
+static void screensaver_step_frame(ScreenSaver *self, int *frame, int *direction) {
+    /* Advance one frame, bouncing back and forth across the animation */
+    *frame += *direction;
+    if (*frame >= self->num_frames) {
+	*frame = MAX(0, self->num_frames-2);
+	*direction = -1;
+    }
+    if (*frame < 0) {
+	*frame = MIN(1, self->num_frames-1);
+	*direction = 1;
+    }
+}
+
+static void screensaver_collect_results(ScreenSaver *self) {
+    ScreenSaverJob *job;
+    ScreenSaverFrame *frame;
+
+    while ((job = g_async_queue_try_pop(self->results))) {
+	frame = &self->frames[job->frame];
+	frame->busy = FALSE;
+	self->jobs_in_flight--;
+
+	if (job->image) {
+	    if (frame->image)
+		gdk_pixbuf_unref(frame->image);
+	    frame->image = job->image;
+	    frame->quality = job->quality;
+	}
+	if (job->release) {
+	    job->slot->frame = -1;
+	    frame->slot = -1;
+	    frame->stream = job->stream;
+	}
+	g_free(job);
+    }
+}
 
-    iterative_map_calculate_motion(ITERATIVE_MAP(self->frame_renders[self->current_frame]), 100000,
-				   TRUE, PARAMETER_INTERPOLATOR(parameter_holder_interpolate_linear),
-				   &self->frame_parameters[self->current_frame]);
+static void screensaver_schedule(ScreenSaver *self) {
+    /* Keep every worker busy, choosing frames by how soon they'll be shown
+     * and how far they are from being finished. Frames that haven't been
+     * rendered at all come first, so playback can start right away.
+     */
+    while (self->jobs_in_flight < self->num_workers) {
+	ScreenSaverJob *job;
+	ScreenSaverFrame *frame;
+	ScreenSaverSlot *slot = NULL;
+	int position = self->current_frame;
+	int direction = self->direction;
+	int best = -1;
+	double score, best_score = G_MAXDOUBLE;
+	int i;
 
-    if (GTK_WIDGET_DRAWABLE(self->view)) {
+	for (i=0; i<self->num_frames*2; i++) {
+	    frame = &self->frames[position];
+	    if (!frame->busy && frame->quality < TARGET_QUALITY) {
+		score = (double) i / LOOKAHEAD_FRAMES;
+		if (frame->image)
+		    score += frame->quality / TARGET_QUALITY;
+		else
+		    score -= 1;
+		if (score < best_score) {
+		    best_score = score;
+		    best = position;
+		}
+	    }
+	    screensaver_step_frame(self, &position, &direction);
+	}
+	if (best < 0)
+	    return;
+	frame = &self->frames[best];
 
-	histogram_view_set_imager(HISTOGRAM_VIEW(self->view),
-				  HISTOGRAM_IMAGER(self->frame_renders[self->current_frame]));
-	histogram_view_update(HISTOGRAM_VIEW(self->view));
+	job = g_new0(ScreenSaverJob, 1);
 
-	self->current_frame += self->direction;
-	if (self->current_frame >= self->num_frames) {
-	    self->current_frame = self->num_frames-2;
-	    self->direction = -1;
+	if (frame->slot >= 0) {
+	    /* Already live, just refine it */
+	    slot = &self->slots[frame->slot];
+	    job->frame = best;
+	    job->refine_time = frame->image ? REFINE_TIME : PREVIEW_TIME;
 	}
-	if (self->current_frame < 0) {
-	    self->current_frame = 1;
-	    self->direction = 1;
+	else {
+	    /* Look for a free slot, or failing that the least recently
+	     * used one that isn't busy.
+	     */
+	    ScreenSaverSlot *lru = NULL;
+
+	    for (i=0; i<self->num_slots; i++) {
+		if (self->slots[i].frame < 0) {
+		    slot = &self->slots[i];
+		    break;
+		}
+		if (!self->frames[self->slots[i].frame].busy &&
+		    (!lru || self->slots[i].last_used < lru->last_used))
+		    lru = &self->slots[i];
+	    }
+
+	    if (slot) {
+		/* Move the frame into this slot, resuming from its compressed histogram */
+		slot->frame = best;
+		frame->slot = slot - self->slots;
+		parameter_holder_load_string(slot->params.a, frame->params);
+		parameter_holder_load_string(slot->params.b,
+					     self->frames[MIN(best+1, self->num_frames-1)].params);
+		job->frame = best;
+		job->load = TRUE;
+		job->stream = frame->stream;
+		frame->stream = NULL;
+		job->refine_time = frame->image ? REFINE_TIME : PREVIEW_TIME;
+	    }
+	    else if (lru) {
+		/* Nothing free. Spend this worker compressing the least
+		 * recently used frame out of the working set, and try the
+		 * frame we actually wanted on the next tick.
+		 */
+		slot = lru;
+		job->frame = slot->frame;
+		job->release = TRUE;
+	    }
+	    else {
+		g_free(job);
+		return;
+	    }
 	}
 
+	slot->last_used = ++self->tick;
+	job->slot = slot;
+	self->frames[job->frame].busy = TRUE;
+	self->jobs_in_flight++;
+	g_thread_pool_push(self->workers, job, NULL);
     }
-    return 1;
+}
+
+static void screensaver_worker(gpointer data, gpointer user_data) {
+    /* Runs on a worker thread. The slot and its frame are marked busy, so
+     * nothing else touches them until this job shows up in the results queue.
+     */
+    ScreenSaverJob *job = (ScreenSaverJob*) data;
+    ScreenSaver *self = SCREENSAVER(user_data);
+    IterativeMap *map = job->slot->map;
+    HistogramImager *imager = HISTOGRAM_IMAGER(map);
+
+    if (job->load) {
+	histogram_imager_clear(imager);
+	map->iterations = 0;
+	stream_merge(imager, job->stream);
+	stream_free(job->stream);
+	job->stream = NULL;
+    }
+
+    if (job->refine_time > 0) {
+	iterative_map_calculate_motion_timed(map, job->refine_time, TRUE,
+					     PARAMETER_INTERPOLATOR(parameter_holder_interpolate_linear),
+					     &job->slot->params);
+	job->quality = histogram_imager_compute_quality(imager);
+
+	histogram_imager_update_image(imager);
+	job->image = gdk_pixbuf_copy(imager->image);
+	if (imager->fgalpha < 0xFFFF || imager->bgalpha < 0xFFFF)
+	    image_add_checkerboard(job->image);
+
+	/* A finished frame doesn't need its histogram any more */
+	if (job->quality >= TARGET_QUALITY) {
+	    job->release = TRUE;
+	    histogram_imager_clear(imager);
+	}
+    }
+
+    if (job->release)
+	job->stream = stream_export(imager);
+
+    g_async_queue_push(self->results, job);
+}
+
+
+/************************************************************************************/
+/*************************************************************** Compressed Streams */
+/************************************************************************************/
+
+static GSList* stream_export(HistogramImager *imager) {
+    /* Export and clear the whole histogram, as a list of GByteArray chunks.
+     * Each chunk starts again at the beginning of the histogram, so they
+     * must be merged back separately.
+     */
+    GSList *stream = NULL;
+    GByteArray *chunk;
+    guchar *buffer = g_malloc(STREAM_CHUNK_SIZE);
+    gsize size;
+
+    while ((size = histogram_imager_export_stream(imager, buffer, STREAM_CHUNK_SIZE))) {
+	chunk = g_byte_array_new();
+	g_byte_array_append(chunk, buffer, size);
+	stream = g_slist_prepend(stream, chunk);
+    }
+
+    g_free(buffer);
+    return g_slist_reverse(stream);
+}
+
+static void stream_merge(HistogramImager *imager, GSList *stream) {
+    GByteArray *chunk;
+
+    for (; stream; stream = stream->next) {
+	chunk = (GByteArray*) stream->data;
+	histogram_imager_merge_stream(imager, chunk->data, chunk->len);
+    }
+}
+
+static void stream_free(GSList *stream) {
+    GSList *i;
+
+    for (i=stream; i; i=i->next)
+	g_byte_array_free((GByteArray*) i->data, TRUE);
+    g_slist_free(stream);
 }
 
 /* The End */
@@ -39,6 +39,28 @@ G_BEGIN_DECLS
 typedef struct _ScreenSaver      ScreenSaver;
 typedef struct _ScreenSaverClass ScreenSaverClass;
 
+/* Every frame of the animation is stored compactly: its parameters as a
+ * string, its latest rendering as an 8-bit image, and, if it's still being
+ * refined but isn't in the live working set, its histogram in the
+ * compressed stream format used by histogram_imager_export_stream().
+ */
+typedef struct {
+    gchar *params;
+    GdkPixbuf *image;
+    GSList *stream;
+    gdouble quality;
+    gint slot;
+    gboolean busy;
+} ScreenSaverFrame;
+
+/* A live histogram, shared by whichever frame is currently being refined in it */
+typedef struct {
+    IterativeMap *map;
+    ParameterHolderPair params;
+    gint frame;
+    guint last_used;
+} ScreenSaverSlot;
+
 struct _ScreenSaver {
     GObject object;
 
@@ -46,11 +68,18 @@ struct _ScreenSaver {
     Animation *animation;
 
     gdouble framerate;
-    IterativeMap **frame_renders;
-    ParameterHolderPair *frame_parameters;
+    ScreenSaverFrame *frames;
     int num_frames, current_frame;
     int direction;
 
+    ScreenSaverSlot *slots;
+    int num_slots;
+    guint tick;
+
+    GThreadPool *workers;
+    GAsyncQueue *results;
+    int num_workers, jobs_in_flight;
+
     GtkWidget *view;
 
     guint idler;
@@ -0,0 +1,152 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * shared-memory.c - Named shared memory segments, for passing histograms
+ *                   between processes on the same machine
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include "shared-memory.h"
+
+#ifdef HAVE_SHM
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+gboolean       shared_memory_supported  ()
+{
+#ifdef HAVE_SHM
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+#ifdef HAVE_SHM
+
+static SharedMemory* shared_memory_map  (gchar*         name,
+					 int            fd,
+					 gsize          size)
+{
+    /* Wrap a mapping of the open segment. The descriptor isn't
+     * needed once it's mapped, so it's always closed here.
+     */
+    SharedMemory* self;
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+	g_free(name);
+	return NULL;
+    }
+
+    self = g_new0(SharedMemory, 1);
+    self->name = name;
+    self->data = data;
+    self->size = size;
+    return self;
+}
+
+SharedMemory*  shared_memory_create     (gsize          size)
+{
+    static guint serial = 0;
+    SharedMemory* self;
+    gchar* name;
+    int fd;
+
+    /* Unique within this process, and the pid makes it unique system-wide */
+    name = g_strdup_printf("/fyre-%d-%u", (int) getpid(), serial++);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+	g_free(name);
+	return NULL;
+    }
+    if (ftruncate(fd, size) < 0) {
+	close(fd);
+	shm_unlink(name);
+	g_free(name);
+	return NULL;
+    }
+
+    self = shared_memory_map(name, fd, size);
+    if (self)
+	self->is_linked = TRUE;
+    else
+	shm_unlink(name);
+    return self;
+}
+
+SharedMemory*  shared_memory_open       (const gchar*   name)
+{
+    struct stat st;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+	return NULL;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+	close(fd);
+	return NULL;
+    }
+    return shared_memory_map(g_strdup(name), fd, st.st_size);
+}
+
+void           shared_memory_unlink     (SharedMemory*  self)
+{
+    if (self->is_linked) {
+	shm_unlink(self->name);
+	self->is_linked = FALSE;
+    }
+}
+
+void           shared_memory_free       (SharedMemory*  self)
+{
+    shared_memory_unlink(self);
+    munmap(self->data, self->size);
+    g_free(self->name);
+    g_free(self);
+}
+
+#else /* !HAVE_SHM */
+
+SharedMemory*  shared_memory_create     (gsize          size)
+{
+    return NULL;
+}
+
+SharedMemory*  shared_memory_open       (const gchar*   name)
+{
+    return NULL;
+}
+
+void           shared_memory_unlink     (SharedMemory*  self)
+{
+}
+
+void           shared_memory_free       (SharedMemory*  self)
+{
+}
+
+#endif /* HAVE_SHM */
+
+/* The End */
@@ -0,0 +1,62 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * shared-memory.h - Named shared memory segments, for passing histograms
+ *                   between processes on the same machine
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __SHARED_MEMORY_H__
+#define __SHARED_MEMORY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+    gchar*    name;
+    guchar*   data;
+    gsize     size;
+    gboolean  is_linked;
+} SharedMemory;
+
+/* Returns FALSE if this build can't share memory between processes,
+ * in which case shared_memory_create() and shared_memory_open()
+ * always fail.
+ */
+gboolean       shared_memory_supported  ();
+
+/* Create a new segment with a unique name, readable and writable only
+ * by the current user. The name stays visible to other processes until
+ * shared_memory_unlink() or shared_memory_free(), so it should be
+ * unlinked as soon as everyone who needs it has it open.
+ */
+SharedMemory*  shared_memory_create     (gsize          size);
+
+/* Map an existing segment by name, at whatever size it was created with */
+SharedMemory*  shared_memory_open       (const gchar*   name);
+
+void           shared_memory_unlink     (SharedMemory*  self);
+void           shared_memory_free       (SharedMemory*  self);
+
+G_END_DECLS
+
+#endif /* __SHARED_MEMORY_H__ */
+
+/* The End */
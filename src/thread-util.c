@@ -0,0 +1,71 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * thread-util.c - Small threading utilities shared by other modules
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include "platform.h"
+#include "thread-util.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+void thread_util_init() {
+    if (!g_thread_supported())
+	g_thread_init(NULL);
+}
+
+int thread_util_num_processors() {
+    static int num_processors = 0;
+
+    if (!num_processors) {
+#if defined(WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	num_processors = info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	num_processors = MAX(num_processors, 1);
+    }
+    return num_processors;
+}
+
+guint64 thread_util_physical_memory() {
+    guint64 bytes = 0;
+
+#if defined(WIN32)
+    MEMORYSTATUS status;
+    GlobalMemoryStatus(&status);
+    bytes = status.dwTotalPhys;
+#elif defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0)
+	bytes = ((guint64) pages) * page_size;
+#endif
+    return bytes;
+}
+
+/* The End */
@@ -0,0 +1,46 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * thread-util.h - Small threading utilities shared by other modules
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __THREAD_UTIL_H__
+#define __THREAD_UTIL_H__
+
+#include <glib.h>
+
+/* Initialize GLib's thread system. This must be called before any
+ * other GLib function, and before math_init().
+ */
+void thread_util_init();
+
+/* Return the number of processors available, for sizing worker pools.
+ * Always returns at least 1.
+ */
+int thread_util_num_processors();
+
+/* Return the machine's physical memory in bytes, for sizing caches and
+ * buffers. Returns 0 if it can't be determined.
+ */
+guint64 thread_util_physical_memory();
+
+#endif /* __THREAD_UTIL_H__ */
+
+/* The End */
@@ -0,0 +1,143 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * trace.c - Optional timeline recording in Chrome's trace event format
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <errno.h>
+#include "trace.h"
+
+/* Everything below is protected by this lock, except that trace_file is
+ * checked without it first. It's only set and cleared while the main
+ * thread is the only one tracing.
+ */
+G_LOCK_DEFINE_STATIC(trace);
+
+static FILE*       trace_file = NULL;
+static GTimer*     trace_timer = NULL;
+static GHashTable* trace_threads = NULL;
+static int         trace_next_thread = 1;
+static gboolean    trace_first_event;
+
+static void       trace_event                 (const gchar*  name,
+					       char          phase);
+static int        trace_thread_id             ();
+
+
+/************************************************************************************/
+/******************************************************************* Public Methods */
+/************************************************************************************/
+
+gboolean   trace_open              (const gchar*  filename,
+				    GError**      error)
+{
+    FILE* f = fopen(filename, "w");
+
+    if (!f) {
+	g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+		    "Can't open trace file '%s'", filename);
+	return FALSE;
+    }
+
+    /* Each event is a line, so a trace survives being cut off */
+    setvbuf(f, NULL, _IOLBF, BUFSIZ);
+    fputs("[", f);
+
+    G_LOCK(trace);
+    trace_threads = g_hash_table_new(g_direct_hash, g_direct_equal);
+    trace_next_thread = 1;
+    trace_first_event = TRUE;
+    trace_timer = g_timer_new();
+    trace_file = f;
+
+    /* The opening thread is always thread 1 */
+    trace_thread_id();
+    G_UNLOCK(trace);
+    return TRUE;
+}
+
+void       trace_close             ()
+{
+    G_LOCK(trace);
+    if (trace_file) {
+	fputs("\n]\n", trace_file);
+	fclose(trace_file);
+	trace_file = NULL;
+	g_timer_destroy(trace_timer);
+	g_hash_table_destroy(trace_threads);
+    }
+    G_UNLOCK(trace);
+}
+
+void       trace_begin             (const gchar*  name)
+{
+    if (trace_file)
+	trace_event(name, 'B');
+}
+
+void       trace_end               (const gchar*  name)
+{
+    if (trace_file)
+	trace_event(name, 'E');
+}
+
+
+/************************************************************************************/
+/************************************************************************* Helpers **/
+/************************************************************************************/
+
+static void       trace_event                 (const gchar*  name,
+					       char          phase)
+{
+    int tid;
+
+    G_LOCK(trace);
+    if (trace_file) {
+	tid = trace_thread_id();
+	fprintf(trace_file, "%s\n{\"name\":\"%s\",\"cat\":\"fyre\",\"ph\":\"%c\",\"ts\":%.1f,\"pid\":1,\"tid\":%d}",
+		trace_first_event ? "" : ",", name, phase,
+		g_timer_elapsed(trace_timer, NULL) * 1000000.0, tid);
+	trace_first_event = FALSE;
+    }
+    G_UNLOCK(trace);
+}
+
+static int        trace_thread_id             ()
+{
+    /* Threads get small IDs in the order we first see them, and a name
+     * event so viewers can label them. Call with the lock held.
+     */
+    GThread* thread = g_thread_self();
+    int tid = GPOINTER_TO_INT(g_hash_table_lookup(trace_threads, thread));
+
+    if (!tid) {
+	tid = trace_next_thread++;
+	g_hash_table_insert(trace_threads, thread, GINT_TO_POINTER(tid));
+	fprintf(trace_file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+		"\"args\":{\"name\":\"%s %d\"}}",
+		trace_first_event ? "" : ",", tid, tid == 1 ? "main" : "thread", tid);
+	trace_first_event = FALSE;
+    }
+    return tid;
+}
+
+/* The End */
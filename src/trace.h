@@ -0,0 +1,52 @@
+/* -*- mode: c; c-basic-offset: 4; -*-
+ *
+ * trace.h - Optional timeline recording in Chrome's trace event format
+ *
+ * Fyre - rendering and interactive exploration of chaotic functions
+ * Copyright (C) 2004-2007 David Trowbridge and Micah Dowty
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* When a trace file is open, the phases of a render record when they
+ * begin and end, and on which thread, as a JSON array of trace events.
+ * The file can be loaded into chrome://tracing or any viewer that reads
+ * the same format. Events are written as they happen, so a trace from a
+ * process that never calls trace_close() is still readable.
+ *
+ * Phase names must be static strings. Every trace_begin() needs a
+ * matching trace_end() on the same thread, and spans on one thread must
+ * nest. With no trace file open, both return right away.
+ */
+gboolean   trace_open              (const gchar*  filename,
+				    GError**      error);
+void       trace_close             ();
+
+void       trace_begin             (const gchar*  name);
+void       trace_end               (const gchar*  name);
+
+G_END_DECLS
+
+#endif /* __TRACE_H__ */
+
+/* The End */
@@ -95,6 +95,16 @@ static inline int var_int_read(const unsigned char *p, unsigned int *i)
     }
 }
 
+/* Nonzero if the 8 bytes at 'p' are all single-byte var-ints whose values
+ * have every bit of 'bits' set, so a run of small values can be decoded
+ * eight at a time. There are no branches, so compilers can vectorize it.
+ */
+static inline int var_int_short8(const unsigned char *p, unsigned char bits)
+{
+    bits |= 0x80;
+    return ((p[0] & p[1] & p[2] & p[3] & p[4] & p[5] & p[6] & p[7]) & bits) == bits;
+}
+
 #endif /* __VAR_INT_H__ */
 
 /* The End */